@@ -9,13 +9,33 @@
     what you will.
 */
 
+#define _GNU_SOURCE 1 /* for sched_getaffinity */
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <stdalign.h>
 #include <iso646.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
+#include "trial_primes.h" /* generated by gen-trial-primes */
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 /*
     Useful stuff
 */
@@ -26,6 +46,10 @@
 #define END_PTR_LIST 0
   /* put at end of variable-length C arrays of pointers; any new elements must
     be added before this. */
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+  /* turns the expansion of macro «x» into a string literal, e.g. to quote
+    compile-time limits in docstrings. */
 
 /* informational types to indicate that a pointer is “borrowing” its
   reference and doesn’t need to be disposed: */
@@ -34,200 +58,14764 @@ typedef char
 typedef PyObject
     br_PyObject;
 
+#ifndef Py_BEGIN_CRITICAL_SECTION
+/* before 3.13 there are no free-threaded builds, so the GIL already does
+  everything these would do: */
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
+  /* Note that a critical section is a block: leaving it other than by
+    falling out the bottom will leave the object locked. So each one
+    encloses a whole do-once construct, never the other way round.
+    Also, on a free-threaded build, the lock is let go for as long as
+    the GIL would have been, so anything mutable that is used across
+    Py_BEGIN_ALLOW_THREADS needs protecting by some other means. */
+
+static PyObject * sequence_fast
+  (
+    PyObject * obj,
+    const char * msg
+  )
+  /* like PySequence_Fast, except that, on a free-threaded build, a list
+    is copied into a tuple first, since without the GIL another thread
+    could change the list while its items are being looked at. */
+  {
+    PyObject * result;
+#ifdef Py_GIL_DISABLED
+    if (PyList_Check(obj))
+        result = PyList_AsTuple(obj); /* takes its own critical section on obj */
+    else
+#endif
+        result = PySequence_Fast(obj, msg);
+    return
+        result;
+  } /*sequence_fast*/
+
 /*
     Types
+
+    The module uses multi-phase initialization, so each interpreter that
+    imports it gets a module object of its own, with its own instances of
+    all the types, kept in the module state along with anything else that
+    holds Python objects. Everything else the module keeps (the thread
+    pool, the caches, the smallest-prime-factor table) is plain C data
+    shared by the whole process, with its own locking, so interpreters
+    with their own GILs can all use it at once. For the same reason,
+    the module can declare that it does not need the GIL at all on
+    free-threaded builds: what per-object state there is that the GIL
+    used to protect (the iterators, the async channel) is guarded with
+    critical sections instead.
 */
 
-static PyTypeObject ExceptMe_type = /* really just a dummy */
-    {
-        PyVarObject_HEAD_INIT(NULL, 0)
-        .tp_name = "ExceptMe",
-        .tp_basicsize = /*sizeof(something)*/ 0,
-        .tp_flags = Py_TPFLAGS_DEFAULT,
-        .tp_doc = "sentinel used to trigger exception in makedict",
-    };
+struct async_channel; /* forward */
+
+struct module_state
+  {
+    PyTypeObject * ExceptMe_type;
+    PyTypeObject * Factorization_type;
+    PyTypeObject * PrimeIterator_type;
+    PyTypeObject * FactorRangeIterator_type;
+    PyTypeObject * FactorIterator_type;
+    PyTypeObject * CacheInfo_type;
+  /* for factorize_async: */
+    struct async_channel * async; /* NULL until first used */
+    PyObject * async_loop; /* event loop async->efd is registered with */
+    PyObject * async_callback; /* async_ready as a Python callable */
+  };
+
+static PyModuleDef discipline_module; /* forward */
+
+static inline struct module_state * get_module_state
+  (
+    PyObject * modu
+  )
+  {
+    return
+        PyModule_GetState(modu);
+  } /*get_module_state*/
+
+static struct module_state * type_module_state
+  (
+    PyTypeObject * type /* one of the types in the module state */
+  )
+  /* returns the state of the module that type belongs to. */
+  {
+    return
+        get_module_state(PyType_GetModuleByDef(type, &discipline_module));
+  } /*type_module_state*/
+
+static PyType_Slot ExceptMe_slots[] =
+  {
+    {Py_tp_doc, (void *)"sentinel used to trigger exception in makedict"},
+    END_STRUCT_LIST
+  };
+
+static PyType_Spec ExceptMe_spec = /* really just a dummy */
+  {
+    .name = "discipline.ExceptMe",
+    .basicsize = /*sizeof(something)*/ 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, /* only used as itself */
+    .slots = ExceptMe_slots,
+  };
 
 /*
-    Methods
+    Modular arithmetic
+
+    Multiplication modulo an odd n is done in Montgomery form, where a
+    residue a is represented by a·R mod n, with R = 2**64 for moduli that
+    fit in 64 bits, 2**128 for bigger ones. The double-length product
+    of two such representations can be brought back into the same form
+    with a couple of multiplications and a subtraction (REDC), without
+    any division: a 128-bit “%” compiles into a call to __umodti3, which
+    costs several times as much. Converting into and out of Montgomery
+    form costs one multiplication each, which is soon paid back by the
+    exponentiations in Miller-Rabin and the iterations of rho.
+
+    Even moduli cannot be handled this way; they only come from
+    Python-level calls, and go through plain division-based routines.
+*/
+
+typedef unsigned __int128
+    uint128_t;
+
+static inline unsigned int ctz_u128
+  (
+    uint128_t n /* must be nonzero */
+  )
+  {
+    return
+        (uint64_t)n != 0 ?
+            __builtin_ctzll((uint64_t)n)
+        :
+            64 + __builtin_ctzll((uint64_t)(n >> 64));
+  } /*ctz_u128*/
+
+static inline unsigned int clz_u128
+  (
+    uint128_t n /* must be nonzero */
+  )
+  {
+    return
+        n >> 64 != 0 ?
+            __builtin_clzll((uint64_t)(n >> 64))
+        :
+            64 + __builtin_clzll((uint64_t)n);
+  } /*clz_u128*/
+
+static inline uint128_t addmod_u128
+  (
+    uint128_t a,
+    uint128_t b,
+    uint128_t n
+  )
+  /* a + b mod n, for a, b < n, even if the sum overflows. */
+  {
+    const uint128_t sum = a + b;
+    return
+        sum < a or sum >= n ? sum - n : sum;
+  } /*addmod_u128*/
+
+static inline uint128_t submod_u128
+  (
+    uint128_t a,
+    uint128_t b,
+    uint128_t n
+  )
+  /* a - b mod n, for a, b < n. */
+  {
+    return
+        a >= b ? a - b : a - b + n;
+  } /*submod_u128*/
+
+static inline uint128_t halfmod_u128
+  (
+    uint128_t a,
+    uint128_t n
+  )
+  /* a / 2 mod n, for a < n, n odd. */
+  {
+    return
+        a % 2 == 0 ? a >> 1 : (a >> 1) + (n >> 1) + 1;
+  } /*halfmod_u128*/
+
+static uint128_t invmod_u128
+  (
+    uint128_t a,
+    uint128_t n
+  )
+  /* returns the inverse of a modulo n (n > 1), or zero if a has none.
+    Extended Euclid: the coefficients of a alternate in sign, and never
+    exceed n in magnitude, so only their magnitudes are kept, and the
+    sign of the final one is given by the nr of steps. */
+  {
+    uint128_t r0 = n, r1 = a % n, t0 = 0, t1 = 1;
+    bool t0_negative = false, t1_negative = false;
+    for (;;)
+      {
+        if (r1 == 0)
+            break;
+        const uint128_t q = r0 / r1;
+        const uint128_t r = r0 - q * r1;
+        const uint128_t t = t0 + q * t1;
+        r0 = r1;
+        r1 = r;
+        t0 = t1;
+        t1 = t;
+        t0_negative = t1_negative;
+        t1_negative = not t1_negative;
+      } /*for*/
+    return
+        r0 != 1 ?
+            0
+        : t0_negative ?
+            n - t0
+        :
+            t0;
+  } /*invmod_u128*/
+
+struct mont64
+  /* precomputed values for arithmetic modulo odd n < 2**64 in Montgomery form */
+  {
+    uint64_t n;
+    uint64_t ninv; /* n**-1 mod 2**64 */
+    uint64_t one; /* R mod n, being 1 in Montgomery form */
+    uint64_t r2; /* R**2 mod n, for converting into Montgomery form */
+  };
+
+static void mont64_init
+  (
+    struct mont64 * m,
+    uint64_t n /* must be odd */
+  )
+  {
+    uint64_t inv = n; /* correct to 3 bits, since n * n ≡ 1 mod 8 for odd n */
+    for (unsigned int i = 0;;)
+      {
+        if (i == 5)
+            break;
+        inv *= 2 - n * inv; /* each Newton step doubles the nr of correct bits */
+        ++i;
+      } /*for*/
+    m->n = n;
+    m->ninv = inv;
+    m->one = -n % n;
+    m->r2 = (uint64_t)((uint128_t)m->one * m->one % n);
+  } /*mont64_init*/
+
+static inline uint64_t mont64_reduce
+  (
+    const struct mont64 * m,
+    uint128_t t /* must be less than n·R */
+  )
+  /* REDC: returns t / R mod n. Subtracting q·n, where q is chosen to
+    make the low halves equal, leaves just the difference of the high
+    halves. */
+  {
+    const uint64_t q = (uint64_t)t * m->ninv;
+    const uint64_t qn_hi = (uint64_t)((uint128_t)q * m->n >> 64);
+    const uint64_t t_hi = (uint64_t)(t >> 64);
+    return
+        t_hi >= qn_hi ? t_hi - qn_hi : t_hi - qn_hi + m->n;
+  } /*mont64_reduce*/
+
+static inline uint64_t mont64_mul
+  (
+    const struct mont64 * m,
+    uint64_t a,
+    uint64_t b
+  )
+  {
+    return
+        mont64_reduce(m, (uint128_t)a * b);
+  } /*mont64_mul*/
+
+static inline uint64_t mont64_add
+  (
+    const struct mont64 * m,
+    uint64_t a,
+    uint64_t b
+  )
+  {
+    const uint64_t sum = a + b;
+    return
+        sum < a or sum >= m->n ? sum - m->n : sum;
+  } /*mont64_add*/
+
+static inline uint64_t mont64_to
+  (
+    const struct mont64 * m,
+    uint64_t a /* must be less than n */
+  )
+  {
+    return
+        mont64_mul(m, a, m->r2);
+  } /*mont64_to*/
+
+static inline uint64_t mont64_from
+  (
+    const struct mont64 * m,
+    uint64_t a
+  )
+  {
+    return
+        mont64_reduce(m, a);
+  } /*mont64_from*/
+
+static uint64_t mont64_pow
+  (
+    const struct mont64 * m,
+    uint64_t base, /* in Montgomery form */
+    uint128_t exponent
+  )
+  /* returns base ** exponent, in Montgomery form. */
+  {
+    uint64_t result = m->one;
+    for (;;)
+      {
+        if (exponent == 0)
+            break;
+        if (exponent & 1)
+            result = mont64_mul(m, result, base);
+        base = mont64_mul(m, base, base);
+        exponent >>= 1;
+      } /*for*/
+    return
+        result;
+  } /*mont64_pow*/
+
+static bool mont64_inverse_many
+  (
+    const struct mont64 * m,
+    uint64_t * values, /* in Montgomery form */
+    uint64_t * scratch, /* room for count elements */
+    size_t count
+  )
+  /* replaces each of the values with its inverse, in Montgomery form,
+    by Montgomery’s trick: only the product of all of them is actually
+    inverted, after which each inverse costs just 3 multiplications.
+    Returns false, leaving values unchanged, if any of them has no
+    inverse. */
+  {
+    bool ok = true;
+    if (count != 0)
+      {
+        scratch[0] = values[0];
+        for (size_t i = 1;;)
+          {
+            if (i == count)
+                break;
+            scratch[i] = mont64_mul(m, scratch[i - 1], values[i]);
+            ++i;
+          } /*for*/
+        uint64_t inv = invmod_u128(mont64_from(m, scratch[count - 1]), m->n);
+        ok = inv != 0;
+        if (ok)
+          {
+            inv = mont64_to(m, inv);
+            for (size_t i = count - 1;;)
+              {
+                if (i == 0)
+                    break;
+                const uint64_t this_inv = mont64_mul(m, inv, scratch[i - 1]);
+                inv = mont64_mul(m, inv, values[i]);
+                values[i] = this_inv;
+                --i;
+              } /*for*/
+            values[0] = inv;
+          } /*if*/
+      } /*if*/
+    return
+        ok;
+  } /*mont64_inverse_many*/
+
+struct mont128
+  /* precomputed values for arithmetic modulo odd n < 2**128 in Montgomery form */
+  {
+    uint128_t n;
+    uint128_t ninv; /* n**-1 mod 2**128 */
+    uint128_t one; /* R mod n, being 1 in Montgomery form */
+    uint128_t r2; /* R**2 mod n, for converting into Montgomery form */
+  };
+
+static inline void mul_u128
+  (
+    uint128_t a,
+    uint128_t b,
+    uint128_t * hi,
+    uint128_t * lo
+  )
+  /* full 256-bit product of a and b, from four 64×64-bit ones. */
+  {
+    const uint128_t
+        a0 = (uint64_t)a,
+        a1 = a >> 64,
+        b0 = (uint64_t)b,
+        b1 = b >> 64;
+    const uint128_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    const uint128_t mid = (p00 >> 64) + (uint64_t)p01 + (uint64_t)p10;
+    *lo = mid << 64 | (uint64_t)p00;
+    *hi = p11 + (p01 >> 64) + (p10 >> 64) + (mid >> 64);
+  } /*mul_u128*/
+
+static void mont128_init
+  (
+    struct mont128 * m,
+    uint128_t n /* must be odd */
+  )
+  {
+    uint128_t inv = n; /* correct to 3 bits, as for mont64_init */
+    for (unsigned int i = 0;;)
+      {
+        if (i == 6)
+            break;
+        inv *= 2 - n * inv;
+        ++i;
+      } /*for*/
+    m->n = n;
+    m->ninv = inv;
+    m->one = -n % n;
+  /* no 256-bit division to compute R**2 mod n with, so double R mod n
+    another 128 times instead */
+    uint128_t r2 = m->one;
+    for (unsigned int i = 0;;)
+      {
+        if (i == 128)
+            break;
+        r2 = addmod_u128(r2, r2, n);
+        ++i;
+      } /*for*/
+    m->r2 = r2;
+  } /*mont128_init*/
+
+static inline uint128_t mont128_reduce
+  (
+    const struct mont128 * m,
+    uint128_t t_hi,
+    uint128_t t_lo /* t must be less than n·R */
+  )
+  /* REDC, as for mont64_reduce. */
+  {
+    uint128_t qn_hi, qn_lo;
+    mul_u128(t_lo * m->ninv, m->n, &qn_hi, &qn_lo);
+    return
+        t_hi >= qn_hi ? t_hi - qn_hi : t_hi - qn_hi + m->n;
+  } /*mont128_reduce*/
+
+static inline uint128_t mont128_mul
+  (
+    const struct mont128 * m,
+    uint128_t a,
+    uint128_t b
+  )
+  {
+    uint128_t hi, lo;
+    mul_u128(a, b, &hi, &lo);
+    return
+        mont128_reduce(m, hi, lo);
+  } /*mont128_mul*/
+
+static inline uint128_t mont128_to
+  (
+    const struct mont128 * m,
+    uint128_t a /* must be less than n */
+  )
+  {
+    return
+        mont128_mul(m, a, m->r2);
+  } /*mont128_to*/
+
+static inline uint128_t mont128_from
+  (
+    const struct mont128 * m,
+    uint128_t a
+  )
+  {
+    return
+        mont128_reduce(m, 0, a);
+  } /*mont128_from*/
+
+static uint128_t mont128_pow
+  (
+    const struct mont128 * m,
+    uint128_t base, /* in Montgomery form */
+    uint128_t exponent
+  )
+  /* returns base ** exponent, in Montgomery form. */
+  {
+    uint128_t result = m->one;
+    for (;;)
+      {
+        if (exponent == 0)
+            break;
+        if (exponent & 1)
+            result = mont128_mul(m, result, base);
+        base = mont128_mul(m, base, base);
+        exponent >>= 1;
+      } /*for*/
+    return
+        result;
+  } /*mont128_pow*/
+
+static bool mont128_inverse_many
+  (
+    const struct mont128 * m,
+    uint128_t * values, /* in Montgomery form */
+    uint128_t * scratch, /* room for count elements */
+    size_t count
+  )
+  /* same as mont64_inverse_many, only with 128-bit moduli. */
+  {
+    bool ok = true;
+    if (count != 0)
+      {
+        scratch[0] = values[0];
+        for (size_t i = 1;;)
+          {
+            if (i == count)
+                break;
+            scratch[i] = mont128_mul(m, scratch[i - 1], values[i]);
+            ++i;
+          } /*for*/
+        uint128_t inv = invmod_u128(mont128_from(m, scratch[count - 1]), m->n);
+        ok = inv != 0;
+        if (ok)
+          {
+            inv = mont128_to(m, inv);
+            for (size_t i = count - 1;;)
+              {
+                if (i == 0)
+                    break;
+                const uint128_t this_inv = mont128_mul(m, inv, scratch[i - 1]);
+                inv = mont128_mul(m, inv, values[i]);
+                values[i] = this_inv;
+                --i;
+              } /*for*/
+            values[0] = inv;
+          } /*if*/
+      } /*if*/
+    return
+        ok;
+  } /*mont128_inverse_many*/
+
+static uint128_t mulmod_u128
+  (
+    uint128_t a,
+    uint128_t b,
+    uint128_t n
+  )
+  /* a * b mod n, for a, b < n, without using Montgomery form: by plain
+    division if the product is known to fit in 128 bits, otherwise by
+    shifting and adding. Only for the even moduli that Montgomery form
+    cannot cope with. */
+  {
+    uint128_t result;
+    if (n >> 64 == 0)
+        result = a * b % n;
+    else
+      {
+        result = 0;
+        for (unsigned int i = 128;;)
+          {
+            if (i == 0)
+                break;
+            --i;
+            result = addmod_u128(result, result, n);
+            if (b >> i & 1)
+                result = addmod_u128(result, a, n);
+          } /*for*/
+      } /*if*/
+    return
+        result;
+  } /*mulmod_u128*/
+
+static uint128_t powmod_u128
+  (
+    uint128_t base, /* must be less than n */
+    uint128_t exponent,
+    uint128_t n /* must be nonzero */
+  )
+  /* returns base ** exponent mod n, using Montgomery form where possible. */
+  {
+    uint128_t result;
+    if (n == 1)
+        result = 0;
+    else if (n % 2 != 0 and n >> 64 == 0)
+      {
+        struct mont64 m;
+        mont64_init(&m, n);
+        result = mont64_from(&m, mont64_pow(&m, mont64_to(&m, base), exponent));
+      }
+    else if (n % 2 != 0)
+      {
+        struct mont128 m;
+        mont128_init(&m, n);
+        result = mont128_from(&m, mont128_pow(&m, mont128_to(&m, base), exponent));
+      }
+    else
+      {
+        result = 1;
+        for (;;)
+          {
+            if (exponent == 0)
+                break;
+            if (exponent & 1)
+                result = mulmod_u128(result, base, n);
+            base = mulmod_u128(base, base, n);
+            exponent >>= 1;
+          } /*for*/
+      } /*if*/
+    return
+        result;
+  } /*powmod_u128*/
+
+static bool inverse_many_u128
+  (
+    uint128_t * values, /* each must be less than n */
+    uint128_t * scratch, /* room for count elements */
+    size_t count,
+    uint128_t n /* must be nonzero */
+  )
+  /* replaces each of the values with its inverse modulo n, by batch
+    inversion in Montgomery form where possible. Returns false if any of
+    them has no inverse, in which case the contents of values are
+    undefined. */
+  {
+    bool ok = true;
+    if (n == 1)
+        memset(values, 0, count * sizeof(uint128_t)); /* everything is 0, including its inverse */
+    else if (n % 2 != 0 and n >> 64 == 0)
+      {
+      /* scratch has room for both the values and the scratch area
+        of mont64_inverse_many */
+        struct mont64 m;
+        uint64_t * const values64 = (uint64_t *)scratch;
+        mont64_init(&m, n);
+        for (size_t i = 0;;)
+          {
+            if (i == count)
+                break;
+            values64[i] = mont64_to(&m, values[i]);
+            ++i;
+          } /*for*/
+        ok = mont64_inverse_many(&m, values64, values64 + count, count);
+        for (size_t i = 0;;)
+          {
+            if (i == count)
+                break;
+            values[i] = mont64_from(&m, values64[i]);
+            ++i;
+          } /*for*/
+      }
+    else if (n % 2 != 0)
+      {
+        struct mont128 m;
+        mont128_init(&m, n);
+        for (size_t i = 0;;)
+          {
+            if (i == count)
+                break;
+            values[i] = mont128_to(&m, values[i]);
+            ++i;
+          } /*for*/
+        ok = mont128_inverse_many(&m, values, scratch, count);
+        for (size_t i = 0;;)
+          {
+            if (i == count)
+                break;
+            values[i] = mont128_from(&m, values[i]);
+            ++i;
+          } /*for*/
+      }
+    else
+      {
+        for (size_t i = 0;;)
+          {
+            if (i == count)
+                break;
+            values[i] = invmod_u128(values[i], n);
+            if (values[i] == 0)
+              {
+                ok = false;
+                break;
+              } /*if*/
+            ++i;
+          } /*for*/
+      } /*if*/
+    return
+        ok;
+  } /*inverse_many_u128*/
+
+/*
+    Factorization engine
+
+    Pure C, no Python API calls: small factors are found by trial division
+    by the primes up to TRIAL_LIMIT, stopping at the square root of the
+    cofactor. Divisibility is tested without any division instructions,
+    by multiplying by the precomputed inverse of each prime (see
+    gen-trial-primes), which also gives the exact quotient. Any
+    cofactor left over is tested for primality with Miller-Rabin, and
+    composite cofactors are split with Brent’s variant of Pollard’s rho,
+    both doing their arithmetic in Montgomery form.
 */
 
-static PyObject * discipline_makedict
+#define MAX_FACTORS 15
+  /* product of first 16 primes exceeds 2**64, so no uint64 can have more
+    distinct prime factors than this */
+
+struct factor_entry
+  {
+    uint64_t prime;
+    unsigned int power;
+  };
+
+struct factorization
+  {
+    unsigned int nr_factors;
+    struct factor_entry factors[MAX_FACTORS]; /* kept in ascending order of prime */
+  };
+
+static void factorization_add
+  (
+    struct factorization * f,
+    uint64_t prime,
+    unsigned int power
+  )
+  /* merges prime ** power into f, keeping the entries sorted. */
+  {
+    unsigned int i = f->nr_factors;
+    for (;;)
+      {
+        if (i == 0 or f->factors[i - 1].prime < prime)
+            break;
+        if (f->factors[i - 1].prime == prime)
+          {
+            f->factors[i - 1].power += power;
+            power = 0; /* merged */
+            break;
+          } /*if*/
+        --i;
+      } /*for*/
+    if (power != 0)
+      {
+        memmove(f->factors + i + 1, f->factors + i, (f->nr_factors - i) * sizeof(struct factor_entry));
+        f->factors[i].prime = prime;
+        f->factors[i].power = power;
+        ++f->nr_factors;
+      } /*if*/
+  } /*factorization_add*/
+
+static uint64_t gcd_u64
+  (
+    uint64_t a,
+    uint64_t b
+  )
+  /* binary gcd. */
+  {
+    uint64_t result;
+    if (a == 0)
+        result = b;
+    else if (b == 0)
+        result = a;
+    else
+      {
+        const int shift = __builtin_ctzll(a | b);
+        a >>= __builtin_ctzll(a);
+        for (;;)
+          {
+            b >>= __builtin_ctzll(b);
+            if (a > b)
+              {
+                const uint64_t t = a;
+                a = b;
+                b = t;
+              } /*if*/
+            b -= a;
+            if (b == 0)
+                break;
+          } /*for*/
+        result = a << shift;
+      } /*if*/
+    return
+        result;
+  } /*gcd_u64*/
+
+static bool is_prime_u64
+  (
+    uint64_t n
+  )
+  /* deterministic Miller-Rabin, valid over the entire 64-bit range. */
+  {
+    static const uint64_t bases[] =
+      /* the 7-base set found by Jim Sinclair, sufficient for all n < 2**64 */
+        {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+    static const uint8_t small_primes[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    bool result = true;
+    do /*once*/
+      {
+        if (n < 2)
+          {
+            result = false;
+            break;
+          } /*if*/
+        for (unsigned int i = 0;;)
+          {
+            if (i == sizeof small_primes / sizeof small_primes[0])
+                break;
+            if (n % small_primes[i] == 0)
+              {
+                result = n == small_primes[i];
+                break;
+              } /*if*/
+            ++i;
+          } /*for*/
+        if (n < 37 * 37 or not result)
+            break;
+        struct mont64 m;
+        mont64_init(&m, n);
+        const uint64_t minus_one = n - m.one; /* in Montgomery form */
+        const unsigned int s = __builtin_ctzll(n - 1);
+        const uint64_t d = (n - 1) >> s;
+        for (unsigned int i = 0;;)
+          {
+            if (i == sizeof bases / sizeof bases[0])
+                break;
+            const uint64_t a = bases[i] % n;
+            if (a != 0)
+              {
+                uint64_t x = mont64_pow(&m, mont64_to(&m, a), d);
+                if (x != m.one and x != minus_one)
+                  {
+                    for (unsigned int r = 1;;)
+                      {
+                        if (r == s)
+                          {
+                            result = false; /* witness found */
+                            break;
+                          } /*if*/
+                        x = mont64_mul(&m, x, x);
+                        if (x == minus_one)
+                            break;
+                        ++r;
+                      } /*for*/
+                    if (not result)
+                        break;
+                  } /*if*/
+              } /*if*/
+            ++i;
+          } /*for*/
+      }
+    while (false);
+    return
+        result;
+  } /*is_prime_u64*/
+
+static int jacobi_u128
+  (
+    uint128_t a,
+    uint128_t n /* must be odd */
+  )
+  /* returns the Jacobi symbol (a/n). */
+  {
+    int result = 1;
+    a %= n;
+    for (;;)
+      {
+        if (a == 0)
+            break;
+        for (;;)
+          {
+            if (a % 2 != 0)
+                break;
+            a >>= 1;
+            if (n % 8 == 3 or n % 8 == 5)
+                result = -result;
+          } /*for*/
+        const uint128_t t = a;
+        a = n;
+        n = t;
+        if (a % 4 == 3 and n % 4 == 3)
+            result = -result;
+        a %= n;
+      } /*for*/
+    return
+        n == 1 ? result : 0;
+  } /*jacobi_u128*/
+
+static bool is_square_u128
+  (
+    uint128_t n /* must be nonzero */
+  )
+  {
+    uint128_t x = (uint128_t)1 << (129 - clz_u128(n)) / 2; /* no less than the square root */
+    for (;;)
+      {
+      /* Newton iteration, decreasing monotonically to the integer square root */
+        const uint128_t y = (x + n / x) / 2;
+        if (y >= x)
+            break;
+        x = y;
+      } /*for*/
+    return
+        x * x == n;
+  } /*is_square_u128*/
+
+static inline uint128_t signed_mod_u128
+  (
+    int64_t a,
+    uint128_t n /* must exceed the magnitude of a */
+  )
+  /* a mod n, for small a of either sign. */
+  {
+    return
+        a >= 0 ? (uint128_t)a : n - (uint128_t)-a;
+  } /*signed_mod_u128*/
+
+static bool strong_lucas_u128
+  (
+    const struct mont128 * m /* m->n must be at least 2**64 */
+  )
+  /* strong Lucas probable-prime test, with parameters chosen by
+    Selfridge’s method A: the first D in 5, -7, 9, -11 ... with Jacobi
+    symbol (D/n) = -1, P = 1, Q = (1 - D) / 4. */
+  {
+    const uint128_t n = m->n;
+    bool result = false;
+    do /*once*/
+      {
+        if (is_square_u128(n))
+            break; /* no suitable D exists */
+        int64_t D = 5;
+        int j;
+        for (;;)
+          {
+            j = jacobi_u128(signed_mod_u128(D, n), n);
+            if (j != 1)
+                break;
+            D = D > 0 ? -(D + 2) : -D + 2;
+          } /*for*/
+        if (j == 0)
+            break; /* D shares a factor with n, which is much bigger */
+        const uint128_t
+            mD = mont128_to(m, signed_mod_u128(D, n)),
+            mQ = mont128_to(m, signed_mod_u128((1 - D) / 4, n));
+        const uint128_t n1 = n + 1; /* can’t overflow, since 2**128 - 1 is divisible by 3 */
+        const unsigned int s = ctz_u128(n1);
+        const uint128_t d = n1 >> s;
+      /* compute U[d], V[d] and Q**d by working down from the top bit of
+        d, doubling the index at each step and adding 1 if the bit is set */
+        uint128_t U = m->one, V = m->one, Qk = mQ;
+        for (unsigned int i = 127 - clz_u128(d);;)
+          {
+            if (i == 0)
+                break;
+            --i;
+            U = mont128_mul(m, U, V);
+            V = submod_u128(mont128_mul(m, V, V), addmod_u128(Qk, Qk, n), n);
+            Qk = mont128_mul(m, Qk, Qk);
+            if (d >> i & 1)
+              {
+                const uint128_t U1 = halfmod_u128(addmod_u128(U, V, n), n);
+                V = halfmod_u128(addmod_u128(mont128_mul(m, mD, U), V, n), n);
+                U = U1;
+                Qk = mont128_mul(m, Qk, mQ);
+              } /*if*/
+          } /*for*/
+        result = U == 0 or V == 0;
+        for (unsigned int r = 1;;)
+          {
+            if (result or r == s)
+                break;
+            V = submod_u128(mont128_mul(m, V, V), addmod_u128(Qk, Qk, n), n);
+            Qk = mont128_mul(m, Qk, Qk);
+            result = V == 0;
+            ++r;
+          } /*for*/
+      }
+    while (false);
+    return
+        result;
+  } /*strong_lucas_u128*/
+
+#define ODD_PRIMORIAL_53 16294579238595022365U
+  /* product of the odd primes up to 53, the most that fits in 64 bits */
+
+static bool is_prime_u128
+  (
+    uint128_t n
+  )
+  /* beyond 64 bits, this is the Baillie-PSW test: a strong probable-prime
+    test to base 2, followed by a strong Lucas test. No composite is known
+    to pass both. */
+  {
+    bool result = false;
+    do /*once*/
+      {
+        if (n >> 64 == 0)
+          {
+            result = is_prime_u64(n);
+            break;
+          } /*if*/
+        if (n % 2 == 0 or gcd_u64(n % ODD_PRIMORIAL_53, ODD_PRIMORIAL_53) != 1)
+            break;
+        struct mont128 m;
+        mont128_init(&m, n);
+        const uint128_t minus_one = n - m.one; /* in Montgomery form */
+        const unsigned int s = ctz_u128(n - 1);
+        uint128_t x = mont128_pow(&m, mont128_to(&m, 2), (n - 1) >> s);
+        bool probable = x == m.one or x == minus_one;
+        for (unsigned int r = 1;;)
+          {
+            if (probable or r == s)
+                break;
+            x = mont128_mul(&m, x, x);
+            probable = x == minus_one;
+            ++r;
+          } /*for*/
+        if (not probable)
+            break;
+        result = strong_lucas_u128(&m);
+      }
+    while (false);
+    return
+        result;
+  } /*is_prime_u128*/
+
+static inline uint64_t rho_step
+  (
+    const struct mont64 * m,
+    uint64_t x,
+    uint64_t c
+  )
+  {
+    return
+        mont64_add(m, mont64_mul(m, x, x), c);
+  } /*rho_step*/
+
+static uint64_t rho_brent
+  (
+    uint64_t n,
+    uint64_t c
+  )
+  /* tries to find a nontrivial factor of odd composite n using the
+    iteration x ← x² + c. Returns n on failure, in which case the caller
+    should retry with a different c. The iteration is done entirely in
+    Montgomery form, which just amounts to a different choice of c; and
+    the gcd of a Montgomery-form product with n is the same as that of
+    the product itself, since R has no factors in common with n. */
+  {
+    const uint64_t m = 128; /* nr of differences to accumulate per gcd */
+    struct mont64 mont;
+    uint64_t x = 0, y = 2, ys = 2, q = 1, g = 1;
+    mont64_init(&mont, n);
+    for (uint64_t r = 1;;)
+      {
+        x = y;
+        for (uint64_t i = 0;;)
+          {
+            if (i == r)
+                break;
+            y = rho_step(&mont, y, c);
+            ++i;
+          } /*for*/
+        for (uint64_t k = 0;;)
+          {
+            if (k >= r or g != 1)
+                break;
+            ys = y;
+            const uint64_t limit = m < r - k ? m : r - k;
+            for (uint64_t i = 0;;)
+              {
+                if (i == limit)
+                    break;
+                y = rho_step(&mont, y, c);
+                q = mont64_mul(&mont, q, x > y ? x - y : y - x);
+                ++i;
+              } /*for*/
+            g = gcd_u64(q, n);
+            k += m;
+          } /*for*/
+        if (g != 1)
+            break;
+        r *= 2;
+      } /*for*/
+    if (g == n)
+      {
+      /* overshot: some difference in the last batch shared a factor, so
+        back up and redo the batch one step at a time */
+        for (;;)
+          {
+            ys = rho_step(&mont, ys, c);
+            g = gcd_u64(x > ys ? x - ys : ys - x, n);
+            if (g != 1)
+                break;
+          } /*for*/
+      } /*if*/
+    return
+        g;
+  } /*rho_brent*/
+
+static void factorize_cofactor
+  (
+    struct factorization * f,
+    uint64_t n
+  )
+  /* completes the factorization of n, which has no factors up to TRIAL_LIMIT. */
+  {
+    if (n > 1)
+      {
+        if (is_prime_u64(n))
+            factorization_add(f, n, 1);
+        else
+          {
+            uint64_t d;
+            for (uint64_t c = 1;;)
+              {
+                d = rho_brent(n, c);
+                if (d != n)
+                    break;
+                ++c;
+              } /*for*/
+            factorize_cofactor(f, d);
+            factorize_cofactor(f, n / d);
+          } /*if*/
+      } /*if*/
+  } /*factorize_cofactor*/
+
+static void trial_divide
+  (
+    struct factorization * f,
+    uint64_t * n,
+    const struct trial_prime * t
+  )
+  /* removes all powers of t->prime from *n, recording them in f. */
+  {
+    uint64_t quotient = *n * t->inverse;
+    if (quotient <= t->bound)
+      {
+        unsigned int power = 0;
+        for (;;)
+          {
+            *n = quotient;
+            ++power;
+            quotient = *n * t->inverse;
+            if (quotient > t->bound)
+                break;
+          } /*for*/
+        factorization_add(f, t->prime, power);
+      } /*if*/
+  } /*trial_divide*/
+
+/*
+    Prime sieve
+
+    A segmented sieve of Eratosthenes, working on a bitmap with one byte
+    for every 30 integers: only the 8 residues modulo 30 which are
+    coprime to 2, 3 and 5 can be prime (apart from those three), so bit
+    j of byte i stands for 30·i + wheel_residues[j]. A segment of
+    SIEVE_SEGMENT_BYTES stays in L1 cache while all the base primes (from
+    7 up to the square root of the end of the range) strike out their
+    multiples in it.
+
+    Only multiples p·q with q also coprime to 30 need striking out, and
+    stepping q around the wheel means the byte index of the multiple
+    advances by (p div 30)·wheel_gaps[j] plus a small adjustment that,
+    like the bit to clear, depends only on p mod 30 and the position j of
+    q in the wheel. So each base prime just keeps the byte index of its
+    next multiple and its wheel position from one segment to the next.
+
+    The base primes up to √last are themselves found by sieving up to
+    √last with the base primes up to ⁴√last, and so on. For a range much
+    narrower than √last, that would be far more work than the range
+    itself, so each candidate is given a primality test instead.
+
+    A prime iterator may be asked for a huge range and then only be run
+    for a few values, so rather than finding all its base primes up
+    front, its sieve draws them one at a time from a feeder sieve, only
+    as far as √(end of current segment). Nor does it go beyond
+    SIEVE_GROW_LIMIT: past the square of that, a segment is only sieved
+    with the base primes it has, and whatever is left gets a primality
+    test, which is far less work than striking out hundreds of millions
+    of base primes in every segment.
+
+    The multiples of 7, 11 and 13, which are the most work to strike out,
+    repeat every SIEVE_PATTERN_BYTES, so rather than being struck out in
+    every segment, they are copied in from a precomputed pattern.
+*/
+
+#define SIEVE_SEGMENT_BYTES 32768 /* covering 983040 integers */
+#define SIEVE_PATTERN_BYTES 1001 /* 7 × 11 × 13 */
+#define SIEVE_TEST_RATIO 256
+  /* ranges narrower than √last divided by this are done by primality
+    testing each candidate rather than sieving */
+#define SIEVE_GROW_LIMIT ((uint64_t)1 << 25)
+  /* prime iterators do not grow base primes beyond this */
+
+static const uint8_t wheel_residues[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+static const uint8_t wheel_gaps[8] = {6, 4, 2, 4, 2, 4, 6, 2};
+  /* to next residue, wrapping round to 31 */
+static const int8_t wheel_index[30] =
+  /* position in wheel_residues of each residue, -1 if not coprime to 30 */
+    {
+        -1, 0, -1, -1, -1, -1, -1, 1, -1, -1,
+        -1, 2, -1, 3, -1, -1, -1, 4, -1, 5,
+        -1, -1, -1, 6, -1, -1, -1, -1, -1, 7,
+    };
+static const uint8_t wheel_masks[8][8] =
+  /* [index of p mod 30][position of q in wheel]: clears the bit for p·q */
+    {
+        {0xfe, 0xfd, 0xfb, 0xf7, 0xef, 0xdf, 0xbf, 0x7f}, /* 1 */
+        {0xfd, 0xdf, 0xef, 0xfe, 0x7f, 0xf7, 0xfb, 0xbf}, /* 7 */
+        {0xfb, 0xef, 0xfe, 0xbf, 0xfd, 0x7f, 0xf7, 0xdf}, /* 11 */
+        {0xf7, 0xfe, 0xbf, 0xdf, 0xfb, 0xfd, 0x7f, 0xef}, /* 13 */
+        {0xef, 0x7f, 0xfd, 0xfb, 0xdf, 0xbf, 0xfe, 0xf7}, /* 17 */
+        {0xdf, 0xf7, 0x7f, 0xfd, 0xbf, 0xfe, 0xef, 0xfb}, /* 19 */
+        {0xbf, 0xfb, 0xf7, 0x7f, 0xfe, 0xef, 0xdf, 0xfd}, /* 23 */
+        {0x7f, 0xbf, 0xdf, 0xef, 0xf7, 0xfb, 0xfd, 0xfe}, /* 29 */
+    };
+static const uint8_t wheel_adjust[8][8] =
+  /* [index of p mod 30][position of q in wheel]: byte index of p·q advances
+    by (p div 30)·wheel_gaps[j] plus this when q moves on to the next residue */
+    {
+        {0, 0, 0, 0, 0, 0, 0, 1}, /* 1 */
+        {1, 1, 1, 0, 1, 1, 1, 1}, /* 7 */
+        {2, 2, 0, 2, 0, 2, 2, 1}, /* 11 */
+        {3, 1, 1, 2, 1, 1, 3, 1}, /* 13 */
+        {3, 3, 1, 2, 1, 3, 3, 1}, /* 17 */
+        {4, 2, 2, 2, 2, 2, 4, 1}, /* 19 */
+        {5, 3, 1, 4, 1, 3, 5, 1}, /* 23 */
+        {6, 4, 2, 4, 2, 4, 6, 1}, /* 29 */
+    };
+static const uint8_t wheel_primes[3] = {2, 3, 5}; /* not represented in the bitmap */
+
+static uint64_t isqrt_u64
+  (
+    uint64_t n /* must be less than 2**64 - 1 */
+  )
+  /* returns the integer square root of n, by Newton iteration. */
+  {
+    uint64_t x = n, y = (n + 1) / 2;
+    for (;;)
+      {
+        if (y >= x)
+            break;
+        x = y;
+        y = (x + n / x) / 2;
+      } /*for*/
+    return
+        x;
+  } /*isqrt_u64*/
+
+static inline uint64_t sieve_root
+  (
+    uint64_t last
+  )
+  /* the largest base prime that could be needed for sieving up to last. */
+  {
+    return
+        isqrt_u64(last == UINT64_MAX ? last - 1 : last);
+  } /*sieve_root*/
+
+static inline bool sieve_test_each
+  (
+    uint64_t lo,
+    uint64_t last
+  )
+  /* is the range [lo, last] narrow enough to be better done by primality
+    tests than by sieving? */
+  {
+    return
+        (last - lo) < sieve_root(last) / SIEVE_TEST_RATIO;
+  } /*sieve_test_each*/
+
+static size_t prime_count_bound
+  (
+    uint64_t x /* must be at least 2 */
+  )
+  /* an upper bound on the nr of primes up to x, from Rosser and Schoenfeld. */
+  {
+    return
+        (size_t)(1.25506 * x / log(x)) + 1;
+  } /*prime_count_bound*/
+
+struct sieve
+  /* state for sieving a range segment by segment. */
+  {
+    uint64_t lo, last; /* range of integers wanted, inclusive */
+    const uint32_t * base_primes; /* from 7 up to √last, ascending; not owned */
+    size_t nr_base_primes;
+    bool test_each; /* just do primality tests instead of using the base primes */
+    struct sieve * feeder;
+      /* if not NULL, supplies more base primes as segments need them, which
+        are added to grown */
+    uint32_t * grown; /* if not NULL, is base_primes, and owned */
+    size_t room; /* allocated length of grown, next and wheel_pos */
+    uint64_t exact_to;
+      /* base primes are all there for sieving up to this, beyond which
+        whatever is left in a segment needs a primality test */
+    size_t nr_presieved; /* nr of base primes struck out in pattern */
+    size_t nr_active; /* nr of base primes so far whose squares have been reached */
+    uint64_t * next; /* for each base prime, byte index of its next multiple */
+    uint8_t * wheel_pos; /* for each base prime, wheel position of cofactor of that multiple */
+    uint64_t segment; /* byte index of start of current segment */
+    size_t segment_len; /* nr of bytes in current segment */
+    size_t pos; /* index of next word of bits to scan */
+    uint64_t word; /* remaining unscanned bits of word before that */
+    unsigned int nr_small; /* nr of wheel_primes dealt with */
+    uint64_t bits[SIEVE_SEGMENT_BYTES / 8]; /* bitmap for current segment */
+    uint8_t pattern[SIEVE_PATTERN_BYTES];
+      /* bitmap starting from 0, repeating thereafter, with just the first
+        nr_presieved base primes struck out */
+  };
+
+static void sieve_dispose
+  (
+    struct sieve * s
+  )
+  /* noop if s is NULL. */
+  {
+    if (s != NULL)
+      {
+        sieve_dispose(s->feeder);
+        free(s->grown);
+        free(s->next);
+        free(s->wheel_pos);
+        free(s);
+      } /*if*/
+  } /*sieve_dispose*/
+
+static inline uint64_t sieve_bits_word
+  (
+    const uint64_t * bits,
+    size_t i
+  )
+  /* the ith word of a sieve bitmap, with byte i·8 + k in bits 8·k to 8·k + 7. */
+  {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return
+        __builtin_bswap64(bits[i]);
+#else
+    return
+        bits[i];
+#endif
+  } /*sieve_bits_word*/
+
+static void sieve_start
+  (
+    struct sieve * s,
+    size_t i
+  )
+  /* works out the first multiple of the ith base prime to strike out, at
+    or beyond both its square and the current segment. */
+  {
+    const uint64_t p = s->base_primes[i];
+    const uint64_t from = 30 * s->segment;
+    uint64_t q = from / p;
+    if (q * p < from)
+        ++q;
+    if (q < p)
+        q = p;
+    unsigned int j = 0;
+    for (;;)
+      {
+        if (wheel_residues[j] >= q % 30) /* q % 30 ≤ 29, so bound to happen */
+            break;
+        ++j;
+      } /*for*/
+    s->next[i] = p * (q / 30) + p / 30 * wheel_residues[j] + p % 30 * wheel_residues[j] / 30;
+    s->wheel_pos[i] = j;
+  } /*sieve_start*/
+
+static uint64_t sieve_next_prime
+  (
+    struct sieve * s
+  );
+
+static bool sieve_grow
+  (
+    struct sieve * s
+  )
+  /* adds the next base prime from the feeder, if any, returning false if
+    there are no more to be had. */
+  {
+    bool grown = false;
+    do /*once*/
+      {
+        if (s->feeder == NULL)
+            break;
+        if (s->nr_base_primes == s->room)
+          {
+            const size_t room = 2 * s->room;
+            uint32_t * const primes = realloc(s->grown, room * sizeof(uint32_t));
+            if (primes != NULL)
+              {
+                s->grown = primes;
+                s->base_primes = primes;
+              } /*if*/
+            uint64_t * const next = realloc(s->next, room * sizeof(uint64_t));
+            if (next != NULL)
+                s->next = next;
+            uint8_t * const wheel_pos = realloc(s->wheel_pos, room);
+            if (wheel_pos != NULL)
+                s->wheel_pos = wheel_pos;
+            if (primes == NULL or next == NULL or wheel_pos == NULL)
+              {
+              /* make do with what I have, and primality-test the rest */
+                sieve_dispose(s->feeder);
+                s->feeder = NULL;
+                break;
+              } /*if*/
+            s->room = room;
+          } /*if*/
+        const uint64_t p = sieve_next_prime(s->feeder);
+        if (p == 0)
+          {
+            if (sieve_root(s->last) <= s->feeder->last)
+                s->exact_to = UINT64_MAX;
+            else
+                s->exact_to = s->feeder->last * s->feeder->last;
+            sieve_dispose(s->feeder);
+            s->feeder = NULL;
+            break;
+          } /*if*/
+        s->grown[s->nr_base_primes++] = p;
+        s->exact_to = p * p;
+        grown = true;
+      }
+    while (false);
+    return
+        grown;
+  } /*sieve_grow*/
+
+static void sieve_fill
+  (
+    struct sieve * s
+  )
+  /* sieves the segment starting at byte s->segment, leaving bits set only
+    for the primes from s->lo to s->last. */
+  {
+    uint8_t * const bytes = (uint8_t *)s->bits;
+    const uint64_t last_byte = s->last / 30;
+    const size_t len =
+        last_byte - s->segment >= SIEVE_SEGMENT_BYTES ?
+            SIEVE_SEGMENT_BYTES
+        :
+            last_byte - s->segment + 1;
+    const uint64_t segment_end = s->segment + len;
+    s->segment_len = len;
+    for (size_t i = 0;;)
+      {
+        if (i == len)
+            break;
+        const size_t offset = (s->segment + i) % SIEVE_PATTERN_BYTES;
+        const size_t piece =
+            SIEVE_PATTERN_BYTES - offset < len - i ? SIEVE_PATTERN_BYTES - offset : len - i;
+        memcpy(bytes + i, s->pattern + offset, piece);
+        i += piece;
+      } /*for*/
+    memset(bytes + len, 0, (len + 7) / 8 * 8 - len); /* pad out last word */
+    if (s->test_each)
+      {
+        for (size_t i = 0;;)
+          {
+            if (i == len)
+                break;
+            for (unsigned int j = 0;;)
+              {
+                if (j == 8)
+                    break;
+                const uint64_t n = 30 * (s->segment + i) + wheel_residues[j];
+                if (n >= s->lo and n <= s->last and not is_prime_u64(n))
+                    bytes[i] &= ~(1 << j);
+                ++j;
+              } /*for*/
+            ++i;
+          } /*for*/
+      }
+    else
+      {
+        for (;;)
+          {
+            if (s->nr_active == s->nr_base_primes and not sieve_grow(s))
+                break;
+            const uint64_t p = s->base_primes[s->nr_active];
+            if (p * p / 30 >= segment_end)
+                break;
+            sieve_start(s, s->nr_active);
+            ++s->nr_active;
+          } /*for*/
+        for (size_t i = s->nr_presieved;;)
+          {
+            if (i == s->nr_active)
+                break;
+            if (s->next[i] < segment_end)
+              {
+                const uint32_t p = s->base_primes[i];
+                const uint8_t * const masks = wheel_masks[wheel_index[p % 30]];
+                const uint8_t * const adjust = wheel_adjust[wheel_index[p % 30]];
+                const size_t step = p / 30;
+                size_t pos = s->next[i] - s->segment;
+                unsigned int j = s->wheel_pos[i];
+                for (;;)
+                  {
+                  /* a whole turn of the wheel advances by exactly p bytes */
+                    if (pos + p > len)
+                        break;
+                    for (unsigned int k = 0;;)
+                      {
+                        if (k == 8)
+                            break;
+                        bytes[pos] &= masks[j];
+                        pos += step * wheel_gaps[j] + adjust[j];
+                        j = (j + 1) % 8;
+                        ++k;
+                      } /*for*/
+                  } /*for*/
+                for (;;)
+                  {
+                    if (pos >= len)
+                        break;
+                    bytes[pos] &= masks[j];
+                    pos += step * wheel_gaps[j] + adjust[j];
+                    j = (j + 1) % 8;
+                  } /*for*/
+                s->next[i] = s->segment + pos;
+                s->wheel_pos[i] = j;
+              } /*if*/
+            ++i;
+          } /*for*/
+      } /*if*/
+    if (s->segment == 0)
+      /* 1 is not prime, but 7, 11 and 13 are */
+        bytes[0] = (bytes[0] | (s->nr_presieved != 0 ? 0x0e : 0)) & ~1;
+    if (s->segment == s->lo / 30)
+      {
+        for (unsigned int j = 0;;)
+          {
+            if (j == 8 or wheel_residues[j] >= s->lo % 30)
+                break;
+            bytes[0] &= ~(1 << j);
+            ++j;
+          } /*for*/
+      } /*if*/
+    if (segment_end - 1 == last_byte)
+      {
+        for (unsigned int j = 0;;)
+          {
+            if (j == 8)
+                break;
+            if (wheel_residues[j] > s->last % 30)
+                bytes[len - 1] &= ~(1 << j);
+            ++j;
+          } /*for*/
+      } /*if*/
+    if (s->exact_to / 30 < segment_end)
+      /* not sieved with all the base primes needed */
+      {
+        for (size_t i = 0;;)
+          {
+            if (i == (len + 7) / 8)
+                break;
+            uint64_t word = sieve_bits_word(s->bits, i);
+            for (;;)
+              {
+                if (word == 0)
+                    break;
+                const unsigned int k = __builtin_ctzll(word);
+                word &= word - 1;
+                const uint64_t n = 30 * (s->segment + 8 * i + k / 8) + wheel_residues[k % 8];
+                if (n > s->exact_to and not is_prime_u64(n))
+                    bytes[8 * i + k / 8] &= ~(1 << k % 8);
+              } /*for*/
+            ++i;
+          } /*for*/
+      } /*if*/
+    s->pos = 0;
+    s->word = 0;
+  } /*sieve_fill*/
+
+static void sieve_reset
+  (
+    struct sieve * s,
+    uint64_t lo,
+    uint64_t last /* must be at least lo */
+  )
+  /* sets s to start again on the range [lo, last], which must not need
+    any more base primes than before, and sieves its first segment. */
+  {
+    s->lo = lo;
+    s->last = last;
+    s->nr_active = s->nr_presieved;
+    s->segment = lo / 30;
+    s->nr_small = 0;
+    sieve_fill(s);
+  } /*sieve_reset*/
+
+static struct sieve * sieve_new
+  (
+    const uint32_t * base_primes, /* as found by sieve_base_primes */
+    size_t nr_base_primes,
+    bool test_each,
+    struct sieve * feeder,
+      /* if not NULL, base_primes is ignored, and they are drawn from this
+        instead as needed; ownership passes to the new sieve */
+    uint64_t lo,
+    uint64_t last /* must be at least lo */
+  )
+  /* returns a new sieve for the range [lo, last], with its first segment
+    done, or NULL if out of memory. */
+  {
+    struct sieve * result = NULL;
+    struct sieve * s = NULL;
+    do /*once*/
+      {
+        s = malloc(sizeof(struct sieve));
+        if (s == NULL)
+            break;
+        s->feeder = feeder;
+        feeder = NULL; /* s has it now */
+        s->grown = NULL;
+        s->exact_to = UINT64_MAX;
+        s->last = last;
+        if (s->feeder != NULL)
+          {
+            s->room = 64;
+            s->grown = malloc(s->room * sizeof(uint32_t));
+            s->base_primes = s->grown;
+            s->nr_base_primes = 0;
+            s->exact_to = 0;
+          }
+        else
+          {
+            s->base_primes = base_primes;
+            s->nr_base_primes = test_each ? 0 : nr_base_primes;
+            s->room = s->nr_base_primes + 1; /* avoid malloc(0) */
+          } /*if*/
+        s->test_each = test_each;
+        s->next = malloc(s->room * sizeof(uint64_t));
+        s->wheel_pos = malloc(s->room);
+        if (s->next == NULL or s->wheel_pos == NULL or s->feeder != NULL and s->grown == NULL)
+            break;
+        for (;;)
+          {
+          /* get enough for the pattern */
+            if (s->nr_base_primes >= 3 or not sieve_grow(s))
+                break;
+          } /*for*/
+        s->nr_presieved = s->nr_base_primes >= 3 ? 3 : 0; /* 7, 11 and 13 */
+        memset(s->pattern, 0xff, SIEVE_PATTERN_BYTES);
+        for (size_t i = 0;;)
+          {
+            if (i == s->nr_presieved)
+                break;
+            const uint32_t p = s->base_primes[i];
+            const uint8_t * const masks = wheel_masks[wheel_index[p]];
+            const uint8_t * const adjust = wheel_adjust[wheel_index[p]];
+            for (size_t pos = 0, j = 0;;) /* p·1 is in byte 0 */
+              {
+                if (pos >= SIEVE_PATTERN_BYTES)
+                    break;
+                s->pattern[pos] &= masks[j];
+                pos += adjust[j]; /* p div 30 = 0 */
+                j = (j + 1) % 8;
+              } /*for*/
+            ++i;
+          } /*for*/
+        sieve_reset(s, lo, last);
+      /* all done */
+        result = s;
+        s = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    sieve_dispose(feeder);
+    sieve_dispose(s);
+    return
+        result;
+  } /*sieve_new*/
+
+static inline bool sieve_advance
+  (
+    struct sieve * s
+  )
+  /* moves on to and sieves the next segment, returning false if there
+    are no more. */
+  {
+    const bool more = s->segment + s->segment_len <= s->last / 30;
+    if (more)
+      {
+        s->segment += s->segment_len;
+        sieve_fill(s);
+      } /*if*/
+    return
+        more;
+  } /*sieve_advance*/
+
+static size_t sieve_bits_count
+  (
+    const uint64_t * bits,
+    size_t nr_bytes
+  )
+  /* the nr of primes marked in a sieve bitmap. */
+  {
+    size_t count = 0;
+    for (size_t i = 0;;)
+      {
+        if (i == (nr_bytes + 7) / 8)
+            break;
+        count += __builtin_popcountll(bits[i]);
+        ++i;
+      } /*for*/
+    return
+        count;
+  } /*sieve_bits_count*/
+
+static size_t sieve_bits_extract
+  (
+    const uint64_t * bits,
+    size_t nr_bytes,
+    uint64_t segment, /* byte index corresponding to start of bits */
+    uint64_t * out,
+    size_t max_out
+  )
+  /* puts up to max_out of the primes marked in a sieve bitmap into out,
+    returning the nr written. */
+  {
+    size_t count = 0;
+    for (size_t i = 0;;)
+      {
+        if (i == (nr_bytes + 7) / 8 or count == max_out)
+            break;
+        uint64_t word = sieve_bits_word(bits, i);
+        for (;;)
+          {
+            if (word == 0 or count == max_out)
+                break;
+            const unsigned int k = __builtin_ctzll(word);
+            word &= word - 1;
+            out[count++] = 30 * (segment + 8 * i + k / 8) + wheel_residues[k % 8];
+          } /*for*/
+        ++i;
+      } /*for*/
+    return
+        count;
+  } /*sieve_bits_extract*/
+
+static uint64_t sieve_next_prime
+  (
+    struct sieve * s
+  )
+  /* returns the next prime in the range, including any of 2, 3 and 5,
+    sieving more segments as needed, or 0 if there are no more. */
+  {
+    uint64_t result = 0;
+    for (;;)
+      {
+        if (s->nr_small < 3)
+          {
+            const uint64_t p = wheel_primes[s->nr_small++];
+            if (p >= s->lo and p <= s->last)
+              {
+                result = p;
+                break;
+              } /*if*/
+            continue;
+          } /*if*/
+        if (s->word != 0)
+          {
+            const unsigned int k = __builtin_ctzll(s->word);
+            s->word &= s->word - 1;
+            result = 30 * (s->segment + 8 * (s->pos - 1) + k / 8) + wheel_residues[k % 8];
+            break;
+          } /*if*/
+        if (s->pos == (s->segment_len + 7) / 8)
+          {
+            if (not sieve_advance(s))
+                break;
+          } /*if*/
+        s->word = sieve_bits_word(s->bits, s->pos);
+        ++s->pos;
+      } /*for*/
+    return
+        result;
+  } /*sieve_next_prime*/
+
+static bool sieve_base_primes
+  (
+    uint64_t last,
+    uint32_t ** primes, /* set to newly-allocated array, or NULL if none needed */
+    size_t * nr_primes
+  )
+  /* finds the primes from 7 up to √last, needed for sieving up to last.
+    Returns false if out of memory. */
+  {
+    bool ok = false;
+    uint32_t * smaller = NULL;
+    uint32_t * found = NULL;
+    struct sieve * s = NULL;
+    size_t nr_smaller;
+    *primes = NULL;
+    *nr_primes = 0;
+    do /*once*/
+      {
+        const uint64_t root = sieve_root(last);
+        if (root < 7)
+          {
+            ok = true;
+            break;
+          } /*if*/
+        if (not sieve_base_primes(root, &smaller, &nr_smaller))
+            break;
+        found = malloc(prime_count_bound(root) * sizeof(uint32_t));
+        s = sieve_new(smaller, nr_smaller, false, NULL, 7, root);
+        if (found == NULL or s == NULL)
+            break;
+        size_t count = 0;
+        for (;;)
+          {
+            const uint64_t p = sieve_next_prime(s);
+            if (p == 0)
+                break;
+            found[count++] = p;
+          } /*for*/
+      /* all done */
+        *primes = found;
+        *nr_primes = count;
+        found = NULL; /* so I don’t dispose of it yet */
+        ok = true;
+      }
+    while (false);
+    sieve_dispose(s);
+    free(smaller);
+    free(found);
+    return
+        ok;
+  } /*sieve_base_primes*/
+
+struct prime_iter
+  /* generates successive primes in a given range, by sieving. */
+  {
+    uint32_t * base_primes; /* for the feeder */
+    struct sieve * sieve;
+  };
+
+static void prime_iter_dispose
+  (
+    struct prime_iter * it
+  )
+  {
+    sieve_dispose(it->sieve);
+    it->sieve = NULL;
+    free(it->base_primes);
+    it->base_primes = NULL;
+  } /*prime_iter_dispose*/
+
+static bool prime_iter_init
+  (
+    struct prime_iter * it,
+    uint64_t start,
+    uint64_t limit /* must be at least start */
+  )
+  /* sets up to generate primes from start to limit inclusive. Returns
+    false if out of memory; in any case, the caller must dispose of it
+    with prime_iter_dispose. */
+  {
+    const bool test_each = sieve_test_each(start, limit);
+    it->base_primes = NULL;
+    it->sieve = NULL;
+    if (test_each)
+        it->sieve = sieve_new(NULL, 0, true, NULL, start, limit);
+    else
+      {
+        const uint64_t root = sieve_root(limit);
+        const uint64_t feed_last = root < SIEVE_GROW_LIMIT ? root : SIEVE_GROW_LIMIT;
+        size_t nr_base_primes = 0;
+        struct sieve * feeder = NULL;
+        do /*once*/
+          {
+            if (not sieve_base_primes(feed_last, &it->base_primes, &nr_base_primes))
+                break;
+            if (feed_last >= 7) /* else no base primes needed */
+              {
+                feeder = sieve_new(it->base_primes, nr_base_primes, false, NULL, 7, feed_last);
+                if (feeder == NULL)
+                    break;
+              } /*if*/
+            it->sieve = sieve_new(NULL, 0, false, feeder, start, limit);
+          }
+        while (false);
+      } /*if*/
+    return
+        it->sieve != NULL;
+  } /*prime_iter_init*/
+
+static inline uint64_t prime_iter_next
+  (
+    struct prime_iter * it
+  )
+  /* returns the next prime, or 0 if there are no more. */
+  {
+    return
+        sieve_next_prime(it->sieve);
+  } /*prime_iter_next*/
+
+/*
+    Smallest-prime-factor table
+
+    For small n, factorization is just a matter of looking up the smallest
+    prime factor of n, dividing it out and repeating with the quotient.
+    The table only covers odd numbers, and since the smallest prime factor
+    of a composite below 2**32 is less than 2**16, each entry fits in a
+    uint16; primes are marked with zero. Alongside it is a bitmap with
+    one bit per odd number, set for primes.
+
+    The table is built on first use, rather than at module load. Or it can
+    be saved to a file, and the file memory-mapped read-only on first use
+    instead, so that all processes using the same file share one copy of
+    it in the page cache. A table built in memory has exactly the same
+    layout as the file, header and all, which is how it gets saved.
+
+    The table is reference-counted, so changing it while some batch is
+    still running without the GIL does not pull it out from under that
+    batch. Interpreters with their own GILs share the one table, so the
+    current settings are protected by a lock of their own.
+
+    Factorize calls are too quick to be taking that lock every time, so
+    once the table is loaded, taking a reference to it just picks up the
+    pointer to it with an atomic load, announcing the fact in a hazard
+    slot belonging to the current thread (Michael’s hazard pointers)
+    until the refcount has been incremented. A table that is replaced is
+    put on a retired list, and only gives up the reference held by
+    spf_state once no hazard slot points to it. Slots are reused once
+    their threads have gone. Single factorize calls don’t even touch the
+    refcount, which would bounce between CPUs: they just keep the table
+    in their hazard slot for as long as they need it.
+*/
+
+#define SPF_DEFAULT_LIMIT ((uint64_t)1 << 24)
+#define SPF_MAX_LIMIT ((uint64_t)1 << 32)
+#define SPF_BLOCK 32768 /* nr of table entries built at a time */
+
+#define SPF_FILE_MAGIC "DSCPSPF\n"
+#define SPF_FILE_VERSION 1
+#define SPF_BYTE_ORDER_MARK 0x01020304
+  /* so a file written on a machine of the opposite endianness is rejected */
+
+struct spf_file_header
+  {
+    char magic[8]; /* SPF_FILE_MAGIC */
+    uint32_t version; /* SPF_FILE_VERSION */
+    uint32_t byte_order; /* SPF_BYTE_ORDER_MARK */
+    uint64_t limit; /* table covers all n < limit */
+    uint64_t bitmap_offset; /* from start of file */
+    uint64_t spf_offset; /* from start of file */
+    uint64_t total_size; /* of file */
+  };
+
+struct spf_table
+  {
+    atomic_uint refcount;
+    struct spf_table * next_retired; /* on spf_state.retired list */
+    uint64_t limit; /* table covers all n < limit */
+    const uint8_t * primes; /* bit i % 8 of byte i / 8 is set if n = 2 * i + 1 is prime */
+    const uint16_t * spf; /* entry i is for n = 2 * i + 1 */
+    void * storage; /* header, bitmap and spf array */
+    size_t storage_size;
+    bool mapped; /* storage is mapped from a file rather than allocated */
+    double load_time; /* seconds to build or map */
+  };
+
+struct spf_hazard
+  /* where a thread announces the table it is using without a reference */
+  {
+    _Atomic(struct spf_table *) table;
+    atomic_bool taken; /* by some thread */
+    struct spf_hazard * next; /* on spf_state.hazards list */
+  };
+
+static struct
+  {
+    pthread_mutex_t lock; /* protects all the rest, except as noted */
+    uint64_t limit; /* for next table to be built, 0 to disable */
+    char * filename; /* to map table from, if any */
+    char * file_error; /* why filename could not be used, if it couldn’t */
+    _Atomic(struct spf_table *) table;
+      /* current table, if loaded; only changed under the lock, but may be
+        read without it */
+    _Atomic uint64_t wanted_below;
+      /* a table is to be loaded for values below this; only changed under
+        the lock, but may be read without it */
+    bool loading; /* a thread is loading the table without holding the lock */
+    pthread_cond_t loaded; /* signalled when it has finished */
+    unsigned long generation; /* bumped on every change of limit or filename */
+    struct spf_hazard * hazards; /* all slots ever allocated, never freed */
+    struct spf_table * retired; /* no longer current, but maybe still in use */
+    atomic_bool any_retired; /* may be read without the lock */
+  } spf_state =
+    {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .limit = SPF_DEFAULT_LIMIT,
+        .filename = NULL,
+        .file_error = NULL,
+        .table = NULL,
+        .wanted_below = SPF_DEFAULT_LIMIT,
+        .loading = false,
+        .loaded = PTHREAD_COND_INITIALIZER,
+        .generation = 0,
+        .hazards = NULL,
+        .retired = NULL,
+        .any_retired = false,
+    };
+static _Thread_local struct spf_hazard * spf_my_hazard;
+static pthread_key_t spf_hazard_key; /* for giving back slot on thread exit */
+static bool spf_hazard_key_ok;
+static pthread_once_t spf_hazard_once = PTHREAD_ONCE_INIT;
+
+static double timestamp(void)
+  /* seconds since some arbitrary epoch, for measuring elapsed times. */
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return
+        now.tv_sec + now.tv_nsec / 1e9;
+  } /*timestamp*/
+
+static void close_fd
+  (
+    int fd
+  )
+  /* like close(2), but a noop if fd is -1, as any disposal routine should be. */
+  {
+    if (fd >= 0)
+        close(fd);
+  } /*close_fd*/
+
+static void spf_table_layout
+  (
+    uint64_t limit,
+    struct spf_file_header * header
+  )
+  /* fills in header with the layout of a table covering all n < limit. */
+  {
+    const uint64_t nr_entries = (limit + 1) / 2;
+    memset(header, 0, sizeof(struct spf_file_header));
+    memcpy(header->magic, SPF_FILE_MAGIC, sizeof header->magic);
+    header->version = SPF_FILE_VERSION;
+    header->byte_order = SPF_BYTE_ORDER_MARK;
+    header->limit = limit;
+    header->bitmap_offset = sizeof(struct spf_file_header);
+    header->spf_offset = header->bitmap_offset + (nr_entries + 63) / 64 * 8;
+      /* keep spf array 8-byte aligned */
+    header->total_size = header->spf_offset + nr_entries * sizeof(uint16_t);
+  } /*spf_table_layout*/
+
+static void spf_table_dispose
+  (
+    struct spf_table * table
+  )
+  /* noop if table is NULL. */
+  {
+    if (table != NULL)
+      {
+        if (table->mapped)
+            munmap(table->storage, table->storage_size);
+        else
+            free(table->storage);
+        free(table);
+      } /*if*/
+  } /*spf_table_dispose*/
+
+static struct spf_table * spf_table_build
+  (
+    uint64_t limit
+  )
+  /* returns a new table covering all n < limit, or NULL if there is not
+    enough memory. */
+  {
+    struct spf_table * result = NULL;
+    struct spf_table * table = NULL;
+    uint32_t * base_primes = NULL;
+    size_t nr_base_primes;
+    do /*once*/
+      {
+        const double start = timestamp();
+        table = calloc(1, sizeof(struct spf_table));
+        if (table == NULL)
+            break;
+        struct spf_file_header header;
+        spf_table_layout(limit, &header);
+        table->storage = calloc(header.total_size, 1);
+        if (table->storage == NULL)
+            break;
+        table->storage_size = header.total_size;
+        memcpy(table->storage, &header, sizeof header);
+        uint8_t * const primes = (uint8_t *)table->storage + header.bitmap_offset;
+        uint16_t * const spf = (uint16_t *)((uint8_t *)table->storage + header.spf_offset);
+        if (not sieve_base_primes(limit - 1, &base_primes, &nr_base_primes))
+            break;
+        const uint64_t nr_entries = (limit + 1) / 2;
+        for (uint64_t block = 0;;)
+          {
+          /* mark a cache-sized block at a time with the odd multiples of
+            each odd prime up to √limit, in ascending order, so each entry
+            is marked by the smallest one first */
+            if (block == nr_entries)
+                break;
+            const uint64_t block_end =
+                nr_entries - block > SPF_BLOCK ? block + SPF_BLOCK : nr_entries;
+            for (size_t k = 0;;)
+              {
+                if (k == nr_base_primes + 2)
+                    break;
+                const uint64_t p = k < 2 ? wheel_primes[k + 1] : base_primes[k - 2];
+                uint64_t m = p * p;
+                if (m / 2 >= block_end)
+                    break;
+                if (m / 2 < block)
+                  {
+                  /* first odd multiple within block */
+                    m = (2 * block + 1 + p - 1) / p * p;
+                    if (m % 2 == 0)
+                        m += p;
+                  } /*if*/
+                for (uint64_t i = m / 2;;)
+                  {
+                    if (i >= block_end)
+                        break;
+                    if (spf[i] == 0)
+                        spf[i] = p;
+                    i += p;
+                  } /*for*/
+                ++k;
+              } /*for*/
+            block = block_end;
+          } /*for*/
+        for (uint64_t i = 1;;) /* skipping n = 1, which is not prime */
+          {
+            if (i >= (limit + 1) / 2)
+                break;
+            if (spf[i] == 0)
+                primes[i / 8] |= 1 << i % 8;
+            ++i;
+          } /*for*/
+        table->limit = limit;
+        table->primes = primes;
+        table->spf = spf;
+        table->mapped = false;
+        atomic_init(&table->refcount, 1);
+        table->load_time = timestamp() - start;
+      /* all done */
+        result = table;
+        table = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    free(base_primes);
+    spf_table_dispose(table);
+    return
+        result;
+  } /*spf_table_build*/
+
+static struct spf_table * spf_table_map
+  (
+    const char * filename,
+    const char ** error /* set to reason on failure */
+  )
+  /* returns a table mapped read-only from the specified file, or NULL if
+    it cannot be used. */
+  {
+    struct spf_table * result = NULL;
+    struct spf_table * table = NULL;
+    int fd = -1;
+    *error = NULL;
+    do /*once*/
+      {
+        const double start = timestamp();
+        table = calloc(1, sizeof(struct spf_table));
+        if (table == NULL)
+          {
+            *error = "out of memory";
+            break;
+          } /*if*/
+        fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+          {
+            *error = strerror(errno);
+            break;
+          } /*if*/
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+          {
+            *error = strerror(errno);
+            break;
+          } /*if*/
+        if ((size_t)info.st_size < sizeof(struct spf_file_header))
+          {
+            *error = "file too short";
+            break;
+          } /*if*/
+        void * const storage = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (storage == MAP_FAILED)
+          {
+            *error = strerror(errno);
+            break;
+          } /*if*/
+        table->storage = storage;
+        table->storage_size = info.st_size;
+        table->mapped = true;
+        const struct spf_file_header * const header = storage;
+        if (memcmp(header->magic, SPF_FILE_MAGIC, sizeof header->magic) != 0)
+          {
+            *error = "not a smallest-prime-factor table file";
+            break;
+          } /*if*/
+        if (header->version != SPF_FILE_VERSION)
+          {
+            *error = "unsupported table file version";
+            break;
+          } /*if*/
+        if (header->byte_order != SPF_BYTE_ORDER_MARK)
+          {
+            *error = "table file has wrong byte order";
+            break;
+          } /*if*/
+          {
+            struct spf_file_header expect;
+            if (header->limit <= SPF_MAX_LIMIT)
+                spf_table_layout(header->limit, &expect);
+            if
+              (
+                    header->limit > SPF_MAX_LIMIT
+                or
+                    header->bitmap_offset != expect.bitmap_offset
+                or
+                    header->spf_offset != expect.spf_offset
+                or
+                    header->total_size != expect.total_size
+                or
+                    header->total_size != (uint64_t)info.st_size
+              )
+              {
+                *error = "table file header is inconsistent";
+                break;
+              } /*if*/
+          }
+        table->limit = header->limit;
+        table->primes = (const uint8_t *)storage + header->bitmap_offset;
+        table->spf = (const uint16_t *)((const uint8_t *)storage + header->spf_offset);
+        atomic_init(&table->refcount, 1);
+        table->load_time = timestamp() - start;
+      /* all done */
+        result = table;
+        table = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    close_fd(fd); /* mapping stays valid */
+    spf_table_dispose(table);
+    return
+        result;
+  } /*spf_table_map*/
+
+static void spf_table_release
+  (
+    struct spf_table * table
+  )
+  /* drops a reference to table, disposing of it when no longer in use.
+    Noop if table is NULL. */
+  {
+    if (table != NULL and atomic_fetch_sub(&table->refcount, 1) == 1)
+        spf_table_dispose(table);
+  } /*spf_table_release*/
+
+static struct spf_table * spf_table_load
+  (
+    uint64_t limit,
+    const char * filename, /* or NULL */
+    char ** file_error /* set to why filename could not be used, if it couldn’t */
+  )
+  /* returns a new table, preferring to map it from filename if specified,
+    otherwise building it in memory to cover limit. Returns NULL if there is
+    no memory, or limit is 0. Touches no shared state, so it can be called
+    without holding spf_state.lock or the GIL. */
+  {
+    struct spf_table * result = NULL;
+    *file_error = NULL;
+    if (filename != NULL)
+      {
+        const char * error;
+        result = spf_table_map(filename, &error);
+        if (result == NULL)
+            *file_error = strdup(error);
+      } /*if*/
+    if (result == NULL and limit != 0)
+        result = spf_table_build(limit);
+    return
+        result;
+  } /*spf_table_load*/
+
+static void spf_hazard_free
+  (
+    void * arg
+  )
+  /* gives back the slot of a thread that is exiting. */
+  {
+    struct spf_hazard * const slot = arg;
+    atomic_store(&slot->table, NULL);
+    atomic_store(&slot->taken, false);
+  } /*spf_hazard_free*/
+
+static void spf_hazard_init(void)
+  {
+    spf_hazard_key_ok = pthread_key_create(&spf_hazard_key, spf_hazard_free) == 0;
+  } /*spf_hazard_init*/
+
+static struct spf_hazard * spf_hazard_get(void)
+  /* returns the hazard slot for the current thread, claiming a free one
+    or allocating a new one the first time. Returns NULL only if out of
+    memory. */
+  {
+    struct spf_hazard * slot = spf_my_hazard;
+    if (slot == NULL)
+      {
+        pthread_once(&spf_hazard_once, spf_hazard_init);
+        pthread_mutex_lock(&spf_state.lock);
+        for (slot = spf_state.hazards;;)
+          {
+            if (slot == NULL or not atomic_load(&slot->taken))
+                break;
+            slot = slot->next;
+          } /*for*/
+        if (slot == NULL)
+          {
+            slot = malloc(sizeof(struct spf_hazard));
+            if (slot != NULL)
+              {
+                atomic_init(&slot->table, NULL);
+                slot->next = spf_state.hazards;
+                spf_state.hazards = slot;
+              } /*if*/
+          } /*if*/
+        if (slot != NULL)
+          {
+            atomic_store(&slot->taken, true);
+            spf_my_hazard = slot;
+            if (spf_hazard_key_ok)
+                pthread_setspecific(spf_hazard_key, slot);
+          } /*if*/
+        pthread_mutex_unlock(&spf_state.lock);
+      } /*if*/
+    return
+        slot;
+  } /*spf_hazard_get*/
+
+static struct spf_table * spf_hazard_protect
+  (
+    struct spf_hazard * slot
+  )
+  /* loads the current table, if any, into slot, so it will not be
+    disposed of until slot is cleared again, and returns it. */
+  {
+    struct spf_table * table = atomic_load(&spf_state.table);
+    for (;;)
+      {
+        if (table == NULL)
+            break;
+        atomic_store(&slot->table, table);
+      /* make sure it was not retired before the slot was seen */
+        struct spf_table * const again = atomic_load(&spf_state.table);
+        if (again == table)
+            break;
+        table = again;
+      } /*for*/
+    return
+        table;
+  } /*spf_hazard_protect*/
+
+static void spf_table_retire
+  (
+    struct spf_table * table /* or NULL */
+  )
+  /* puts a table that has just been replaced as the current one onto
+    the retired list. Must be called with spf_state.lock held; the caller
+    should call spf_reclaim once it has let go of the lock. */
+  {
+    if (table != NULL)
+      {
+        table->next_retired = spf_state.retired;
+        spf_state.retired = table;
+        atomic_store(&spf_state.any_retired, true);
+      } /*if*/
+  } /*spf_table_retire*/
+
+static void spf_reclaim(void)
+  /* drops the reference from spf_state to each retired table that no
+    hazard slot points to any more. Must not be called with
+    spf_state.lock held. */
+  {
+    struct spf_table * done = NULL;
+    pthread_mutex_lock(&spf_state.lock);
+    for (struct spf_table ** prev = &spf_state.retired;;)
+      {
+        struct spf_table * const table = *prev;
+        if (table == NULL)
+            break;
+        bool in_use = false;
+        for (struct spf_hazard * slot = spf_state.hazards;;)
+          {
+            if (slot == NULL)
+                break;
+            if (atomic_load(&slot->table) == table)
+              {
+                in_use = true;
+                break;
+              } /*if*/
+            slot = slot->next;
+          } /*for*/
+        if (in_use)
+            prev = &table->next_retired;
+        else
+          {
+            *prev = table->next_retired;
+            table->next_retired = done;
+            done = table;
+          } /*if*/
+      } /*for*/
+    atomic_store(&spf_state.any_retired, spf_state.retired != NULL);
+    pthread_mutex_unlock(&spf_state.lock);
+    for (;;)
+      {
+      /* outside the lock, since unmapping or freeing a big table takes a while */
+        if (done == NULL)
+            break;
+        struct spf_table * const table = done;
+        done = table->next_retired;
+        spf_table_release(table);
+      } /*for*/
+  } /*spf_reclaim*/
+
+static struct spf_table * spf_table_acquire
+  (
+    uint64_t min_value
+  )
+  /* returns a new reference to the current table if it would be of any use
+    for factorizing min_value, loading it if necessary; otherwise NULL.
+    Running out of memory is not an error; factorization just carries on
+    without the table. Must be called with the GIL held. Once the table is
+    loaded, this just protects it with a hazard slot while taking the
+    reference, without the lock. Building a table near SPF_MAX_LIMIT can
+    take seconds, so it is done with neither the GIL nor spf_state.lock
+    held, and only then published under the lock; other threads wanting
+    the table meanwhile wait for that one load rather than starting their
+    own. The lock is only ever taken while holding the GIL (or after
+    letting it go for good), never the other way round. */
+  {
+    struct spf_table * result = NULL;
+    bool done = false;
+    struct spf_hazard * const slot = spf_hazard_get();
+    if (slot != NULL)
+      {
+        struct spf_table * const table = spf_hazard_protect(slot);
+        if (table != NULL and min_value < table->limit)
+          {
+            atomic_fetch_add(&table->refcount, 1);
+            result = table;
+          } /*if*/
+        atomic_store(&slot->table, NULL);
+        done = table != NULL or min_value >= atomic_load(&spf_state.wanted_below);
+      } /*if*/
+    if (not done)
+      {
+      /* slow path, without a slot or if the table still needs loading */
+        pthread_mutex_lock(&spf_state.lock);
+        for (;;)
+          {
+            if
+              (
+                    atomic_load(&spf_state.table) != NULL
+                or
+                    min_value >= spf_state.limit and spf_state.filename == NULL
+              )
+                break;
+            if (spf_state.loading)
+              {
+              /* wait for the other thread, without holding on to the GIL */
+                Py_BEGIN_ALLOW_THREADS
+                pthread_cond_wait(&spf_state.loaded, &spf_state.lock);
+                pthread_mutex_unlock(&spf_state.lock);
+                Py_END_ALLOW_THREADS
+                pthread_mutex_lock(&spf_state.lock);
+                continue;
+              } /*if*/
+            const unsigned long generation = spf_state.generation;
+            const uint64_t limit = spf_state.limit;
+            char * const filename =
+                spf_state.filename != NULL and spf_state.file_error == NULL ?
+                    strdup(spf_state.filename)
+                :
+                    NULL;
+            char * file_error;
+            struct spf_table * table;
+            spf_state.loading = true;
+            pthread_mutex_unlock(&spf_state.lock);
+            Py_BEGIN_ALLOW_THREADS
+            table = spf_table_load(limit, filename, &file_error);
+            Py_END_ALLOW_THREADS
+            free(filename);
+            pthread_mutex_lock(&spf_state.lock);
+            spf_state.loading = false;
+            pthread_cond_broadcast(&spf_state.loaded);
+            if (spf_state.generation == generation)
+              {
+              /* settings unchanged meanwhile, so it’s the one to use */
+                atomic_store(&spf_state.table, table);
+                if (file_error != NULL)
+                  {
+                  /* remember why, and don’t try the file again */
+                    free(spf_state.file_error);
+                    spf_state.file_error = file_error;
+                  } /*if*/
+                break; /* even if out of memory, don’t keep trying */
+              } /*if*/
+          /* built for settings that have since changed: throw it away
+            (outside the lock) and try again with the new ones */
+            free(file_error);
+            pthread_mutex_unlock(&spf_state.lock);
+            spf_table_release(table);
+            pthread_mutex_lock(&spf_state.lock);
+          } /*for*/
+        struct spf_table * const table = atomic_load(&spf_state.table);
+        if (table != NULL and min_value < table->limit)
+          {
+            result = table;
+            atomic_fetch_add(&result->refcount, 1);
+          } /*if*/
+        pthread_mutex_unlock(&spf_state.lock);
+      } /*if*/
+    return
+        result;
+  } /*spf_table_acquire*/
+
+static struct spf_table * spf_table_borrow
+  (
+    uint64_t min_value
+  )
+  /* like spf_table_acquire, but without taking a reference, just
+    protecting the table with this thread’s hazard slot, which is far
+    cheaper. The caller must finish with it, by calling spf_table_unborrow,
+    before doing anything else that might use the slot, such as calling
+    back into Python. */
+  {
+    struct spf_table * result = NULL;
+    struct spf_hazard * const slot = spf_hazard_get();
+    if (slot != NULL)
+      {
+        for (unsigned int tries = 0;;)
+          {
+            struct spf_table * const table = spf_hazard_protect(slot);
+            if (table != NULL)
+              {
+                if (min_value < table->limit)
+                    result = table;
+                break;
+              } /*if*/
+            if (min_value >= atomic_load(&spf_state.wanted_below) or tries == 1)
+                break;
+          /* get it loaded, then protect it as usual */
+            spf_table_release(spf_table_acquire(min_value));
+            ++tries;
+          } /*for*/
+        if (result == NULL)
+            atomic_store(&slot->table, NULL);
+      } /*if*/
+    return
+        result;
+  } /*spf_table_borrow*/
+
+static void spf_table_unborrow
+  (
+    struct spf_table * table /* as returned from spf_table_borrow, may be NULL */
+  )
+  {
+    if (table != NULL)
+      {
+        atomic_store(&spf_my_hazard->table, NULL);
+        if (atomic_load_explicit(&spf_state.any_retired, memory_order_relaxed))
+            spf_reclaim();
+      } /*if*/
+  } /*spf_table_unborrow*/
+
+static void spf_after_fork(void)
+  /* in the child after fork(), no other thread can still be loading the
+    table, holding the lock, or using a hazard slot. */
+  {
+    pthread_mutex_init(&spf_state.lock, NULL);
+    pthread_cond_init(&spf_state.loaded, NULL);
+    spf_state.loading = false;
+    for (struct spf_hazard * slot = spf_state.hazards;;)
+      {
+        if (slot == NULL)
+            break;
+        if (slot != spf_my_hazard)
+          {
+            atomic_store(&slot->table, NULL);
+            atomic_store(&slot->taken, false);
+          } /*if*/
+        slot = slot->next;
+      } /*for*/
+  } /*spf_after_fork*/
+
+static void trial_scalar
+  (
+    uint64_t * cofactors,
+    struct factorization * fs,
+    size_t count
+  )
+  /* divides all powers of the trial primes out of each of the count odd
+    numbers in cofactors, recording them in the corresponding entries of fs. */
+  {
+    for (size_t i = 0;;)
+      {
+        if (i == count)
+            break;
+        for (const struct trial_prime * t = trial_primes;;)
+          {
+          /* search stops at the square root of the shrinking cofactor */
+            if (t == trial_primes + NR_TRIAL_PRIMES or t->prime * t->prime > cofactors[i])
+                break;
+            trial_divide(&fs[i], &cofactors[i], t);
+            ++t;
+          } /*for*/
+        ++i;
+      } /*for*/
+  } /*trial_scalar*/
+
+static void factorize_remainder
+  (
+    struct factorization * f,
+    uint64_t n
+  )
+  /* completes the factorization of what is left of n after trial division. */
+  {
+    if (n > 1)
+      {
+        if (n < (uint64_t)TRIAL_LIMIT * TRIAL_LIMIT)
+          /* no factor up to its square root, so must be prime */
+            factorization_add(f, n, 1);
+        else
+            factorize_cofactor(f, n);
+      } /*if*/
+  } /*factorize_remainder*/
+
+static uint64_t remove_twos
+  (
+    struct factorization * f,
+    uint64_t n
+  )
+  /* starts off f with the power of 2 in n, which must be nonzero, and
+    returns the odd part of n. */
+  {
+    f->nr_factors = 0;
+    if (n % 2 == 0)
+      {
+        const unsigned int power = __builtin_ctzll(n);
+        n >>= power;
+        factorization_add(f, 2, power);
+      } /*if*/
+    return
+        n;
+  } /*remove_twos*/
+
+static inline bool spf_table_is_prime
+  (
+    const struct spf_table * table,
+    uint64_t n /* must be odd and less than table->limit */
+  )
+  /* does the bitmap in table say n is prime? */
+  {
+    return
+        (table->primes[n / 16] & 1 << n / 2 % 8) != 0;
+  } /*spf_table_is_prime*/
+
+static void factorize_by_table
+  (
+    struct factorization * f,
+    uint64_t n,
+    const struct spf_table * table
+  )
+  /* fills in f with the prime factors of n, which must be at least 2 and
+    less than table->limit. */
+  {
+    n = remove_twos(f, n);
+    for (;;)
+      {
+        if (n == 1)
+            break;
+        uint64_t factor;
+        if (spf_table_is_prime(table, n))
+          /* bitmap is much smaller than spf array, so more likely to be in cache */
+            factor = n;
+        else
+          {
+            factor = table->spf[n / 2];
+            if (factor * factor > n or factor % 2 == 0 or not spf_table_is_prime(table, factor))
+                factor = 0; /* can’t be the smallest prime factor */
+          } /*if*/
+        if (factor < 3 or n % factor != 0)
+          {
+          /* table is corrupt (it might have come from a file), so carry on
+            without it rather than dividing by zero, going round forever or
+            passing off a composite as prime */
+            trial_scalar(&n, f, 1);
+            factorize_remainder(f, n);
+            break;
+          } /*if*/
+        unsigned int power = 1;
+        n /= factor;
+        while (n % factor == 0)
+          {
+            ++power;
+            n /= factor;
+          } /*while*/
+        factorization_add(f, factor, power);
+      } /*for*/
+  } /*factorize_by_table*/
+
+static void factorize_u64
+  (
+    struct factorization * f,
+    uint64_t n,
+    const struct spf_table * table /* optional */
+  )
+  /* fills in f with the prime factors of n, which must be at least 2. */
+  {
+    if (table != NULL and n < table->limit)
+        factorize_by_table(f, n, table);
+    else
+      {
+        n = remove_twos(f, n);
+        trial_scalar(&n, f, 1);
+        factorize_remainder(f, n);
+      } /*if*/
+  } /*factorize_u64*/
+
+/*
+    Factorization cache
+
+    Optional, off by default: remembers the factorizations of recently
+    seen values, so that a stream of requests where the same values
+    keep recurring need not redo the work. Values done by table lookup
+    don’t go through it, there being nothing to save. The factors are
+    kept in a compact form, not as Python objects, so the cache can be
+    shared by batch worker threads running without the GIL.
+
+    Eviction is by the CLOCK approximation to LRU: each entry has a bit
+    that is set whenever it is looked up, and when room is needed, a
+    hand sweeps round the entries clearing set bits until it comes to
+    one that is already clear, which is the one replaced. To keep
+    threads from contending for a single lock, the cache is divided
+    into shards by value hash, each with its own lock, entries, hand
+    and hash chains.
+*/
+
+#define CACHE_SHARD_BITS 4
+#define CACHE_SHARDS (1 << CACHE_SHARD_BITS)
+#define CACHE_MAX_SIZE ((uint64_t)CACHE_SHARDS << 30)
+  /* keeps entry indices within 32 bits */
+
+struct cache_slot
+  {
+    uint64_t n; /* the value factorized */
+    uint32_t next; /* index + 1 of next slot in same hash chain, 0 if none */
+    uint8_t nr_factors;
+    bool referenced; /* CLOCK bit: looked up since the hand last came by */
+    uint64_t * factors; /* nr_factors primes, followed by nr_factors bytes of powers */
+  };
+
+struct cache_shard
+  {
+    pthread_mutex_t lock;
+    size_t capacity; /* max nr of slots */
+    size_t nr_slots; /* nr in use, all at start of slots */
+    size_t nr_allocated; /* room in slots */
+    struct cache_slot * slots;
+    unsigned int bucket_bits;
+    uint32_t * buckets; /* index + 1 of first slot in each hash chain, 0 if none */
+    size_t hand; /* CLOCK hand */
+    uint64_t hits, misses;
+  };
+
+static struct
+  {
+    atomic_size_t maxsize; /* 0 if disabled */
+    pthread_mutex_t reset_lock; /* serializes cache_reset calls */
+    struct cache_shard shards[CACHE_SHARDS];
+  } factor_cache;
+
+static inline uint64_t cache_hash
+  (
+    uint64_t n
+  )
+  /* top CACHE_SHARD_BITS bits choose the shard, the following ones the
+    hash chain within it. */
+  {
+    return
+        n * 0x9e3779b97f4a7c15;
+  } /*cache_hash*/
+
+static inline uint32_t * cache_bucket
+  (
+    struct cache_shard * shard,
+    uint64_t hash
+  )
+  {
+    return
+        shard->buckets + (hash << CACHE_SHARD_BITS >> (64 - shard->bucket_bits));
+  } /*cache_bucket*/
+
+static void cache_init(void)
+  /* one-time setup, done by process_init at first module load. */
+  {
+    atomic_init(&factor_cache.maxsize, 0);
+    pthread_mutex_init(&factor_cache.reset_lock, NULL);
+    for (unsigned int i = 0;;)
+      {
+        if (i == CACHE_SHARDS)
+            break;
+        struct cache_shard * const shard = &factor_cache.shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->capacity = 0;
+        shard->nr_slots = 0;
+        shard->nr_allocated = 0;
+        shard->slots = NULL;
+        shard->bucket_bits = 0;
+        shard->buckets = NULL;
+        shard->hand = 0;
+        shard->hits = 0;
+        shard->misses = 0;
+        ++i;
+      } /*for*/
+  } /*cache_init*/
+
+static void cache_shard_empty
+  (
+    struct cache_shard * shard
+  )
+  /* frees all the entries in shard, which must be locked. */
+  {
+    for (size_t i = 0;;)
+      {
+        if (i == shard->nr_slots)
+            break;
+        free(shard->slots[i].factors);
+        ++i;
+      } /*for*/
+    free(shard->slots);
+    free(shard->buckets);
+    shard->nr_slots = 0;
+    shard->nr_allocated = 0;
+    shard->slots = NULL;
+    shard->bucket_bits = 0;
+    shard->buckets = NULL;
+    shard->hand = 0;
+  } /*cache_shard_empty*/
+
+#define CACHE_SAME_SIZE SIZE_MAX /* for cache_reset */
+
+static void cache_reset
+  (
+    size_t maxsize, /* 0 to disable, CACHE_SAME_SIZE to keep current */
+    bool keep_stats
+  )
+  /* empties the cache and sets its new maximum size. The current size
+    is only looked at under reset_lock, so a clear cannot undo a resize
+    that gets in ahead of it. */
+  {
+    pthread_mutex_lock(&factor_cache.reset_lock);
+    if (maxsize == CACHE_SAME_SIZE)
+        maxsize = atomic_load(&factor_cache.maxsize);
+    atomic_store(&factor_cache.maxsize, maxsize);
+    for (unsigned int i = 0;;)
+      {
+        if (i == CACHE_SHARDS)
+            break;
+        struct cache_shard * const shard = &factor_cache.shards[i];
+        pthread_mutex_lock(&shard->lock);
+        cache_shard_empty(shard);
+        shard->capacity = maxsize / CACHE_SHARDS + (i < maxsize % CACHE_SHARDS);
+        if (not keep_stats)
+          {
+            shard->hits = 0;
+            shard->misses = 0;
+          } /*if*/
+        pthread_mutex_unlock(&shard->lock);
+        ++i;
+      } /*for*/
+    pthread_mutex_unlock(&factor_cache.reset_lock);
+  } /*cache_reset*/
+
+static bool cache_get
+  (
+    uint64_t n,
+    struct factorization * f
+  )
+  /* fills in f and returns true if n is in the cache, else returns false. */
+  {
+    bool found = false;
+    if (atomic_load_explicit(&factor_cache.maxsize, memory_order_relaxed) != 0)
+      {
+        const uint64_t hash = cache_hash(n);
+        struct cache_shard * const shard = &factor_cache.shards[hash >> (64 - CACHE_SHARD_BITS)];
+        pthread_mutex_lock(&shard->lock);
+        if (shard->buckets != NULL)
+          {
+            for (uint32_t i = *cache_bucket(shard, hash);;)
+              {
+                if (i == 0)
+                    break;
+                struct cache_slot * const slot = &shard->slots[i - 1];
+                if (slot->n == n)
+                  {
+                    const uint8_t * const powers = (const uint8_t *)(slot->factors + slot->nr_factors);
+                    f->nr_factors = slot->nr_factors;
+                    for (unsigned int j = 0;;)
+                      {
+                        if (j == slot->nr_factors)
+                            break;
+                        f->factors[j].prime = slot->factors[j];
+                        f->factors[j].power = powers[j];
+                        ++j;
+                      } /*for*/
+                    slot->referenced = true;
+                    found = true;
+                    break;
+                  } /*if*/
+                i = slot->next;
+              } /*for*/
+          } /*if*/
+        if (found)
+            ++shard->hits;
+        else
+            ++shard->misses;
+        pthread_mutex_unlock(&shard->lock);
+      } /*if*/
+    return
+        found;
+  } /*cache_get*/
+
+static bool cache_shard_grow
+  (
+    struct cache_shard * shard
+  )
+  /* makes room for more slots in shard, which must be locked and have
+    nr_slots == nr_allocated < capacity, rebuilding the hash chains to
+    go with them. Returns false if out of memory. */
+  {
+    bool ok = false;
+    do /*once*/
+      {
+        size_t nr_allocated = shard->nr_allocated != 0 ? shard->nr_allocated * 2 : 64;
+        if (nr_allocated > shard->capacity)
+            nr_allocated = shard->capacity;
+        struct cache_slot * const slots = realloc(shard->slots, nr_allocated * sizeof(struct cache_slot));
+        if (slots == NULL)
+            break;
+        shard->slots = slots;
+        shard->nr_allocated = nr_allocated;
+        unsigned int bucket_bits = 1;
+        while ((size_t)1 << bucket_bits < nr_allocated)
+            ++bucket_bits;
+        if (bucket_bits != shard->bucket_bits)
+          {
+            uint32_t * const buckets = calloc((size_t)1 << bucket_bits, sizeof(uint32_t));
+            if (buckets == NULL)
+                break;
+            free(shard->buckets);
+            shard->buckets = buckets;
+            shard->bucket_bits = bucket_bits;
+            for (size_t i = 0;;)
+              {
+                if (i == shard->nr_slots)
+                    break;
+                uint32_t * const bucket = cache_bucket(shard, cache_hash(slots[i].n));
+                slots[i].next = *bucket;
+                *bucket = i + 1;
+                ++i;
+              } /*for*/
+          } /*if*/
+        ok = true;
+      }
+    while (false);
+    return
+        ok;
+  } /*cache_shard_grow*/
+
+static void cache_put
+  (
+    uint64_t n,
+    const struct factorization * f
+  )
+  /* adds the factorization of n to the cache, if it is enabled, evicting
+    some other entry if necessary. Running out of memory is not an error;
+    the entry just doesn’t get added. */
+  {
+    if (atomic_load_explicit(&factor_cache.maxsize, memory_order_relaxed) != 0)
+      {
+        const uint64_t hash = cache_hash(n);
+        struct cache_shard * const shard = &factor_cache.shards[hash >> (64 - CACHE_SHARD_BITS)];
+        pthread_mutex_lock(&shard->lock);
+        do /*once*/
+          {
+            if (shard->capacity == 0)
+                break;
+            bool present = false;
+            if (shard->buckets != NULL)
+              {
+              /* another thread might have got in first */
+                for (uint32_t i = *cache_bucket(shard, hash);;)
+                  {
+                    if (i == 0)
+                        break;
+                    if (shard->slots[i - 1].n == n)
+                      {
+                        present = true;
+                        break;
+                      } /*if*/
+                    i = shard->slots[i - 1].next;
+                  } /*for*/
+              } /*if*/
+            if (present)
+                break;
+            struct cache_slot * slot;
+            if (shard->nr_slots < shard->capacity)
+              {
+                if (shard->nr_slots == shard->nr_allocated and not cache_shard_grow(shard))
+                    break;
+                slot = &shard->slots[shard->nr_slots++];
+                slot->factors = NULL;
+              }
+            else
+              {
+                for (;;)
+                  {
+                    slot = &shard->slots[shard->hand];
+                    shard->hand = (shard->hand + 1) % shard->capacity;
+                    if (not slot->referenced)
+                        break;
+                    slot->referenced = false;
+                  } /*for*/
+              /* unlink victim from its chain */
+                const uint32_t index = slot - shard->slots + 1;
+                uint32_t * link = cache_bucket(shard, cache_hash(slot->n));
+                for (;;)
+                  {
+                    if (*link == index)
+                        break;
+                    link = &shard->slots[*link - 1].next;
+                  } /*for*/
+                *link = slot->next;
+              } /*if*/
+            uint64_t * const factors = realloc(slot->factors, f->nr_factors * (sizeof(uint64_t) + 1));
+            if (factors == NULL)
+              {
+              /* leave slot unusable for now, but still valid */
+                slot->n = 0; /* never looked up */
+                slot->nr_factors = 0;
+                slot->referenced = false;
+                uint32_t * const bucket = cache_bucket(shard, cache_hash(0));
+                slot->next = *bucket;
+                *bucket = slot - shard->slots + 1;
+                break;
+              } /*if*/
+            uint8_t * const powers = (uint8_t *)(factors + f->nr_factors);
+            for (unsigned int j = 0;;)
+              {
+                if (j == f->nr_factors)
+                    break;
+                factors[j] = f->factors[j].prime;
+                powers[j] = f->factors[j].power;
+                ++j;
+              } /*for*/
+            slot->n = n;
+            slot->factors = factors;
+            slot->nr_factors = f->nr_factors;
+            slot->referenced = false;
+            uint32_t * const bucket = cache_bucket(shard, hash);
+            slot->next = *bucket;
+            *bucket = slot - shard->slots + 1;
+          }
+        while (false);
+        pthread_mutex_unlock(&shard->lock);
+      } /*if*/
+  } /*cache_put*/
+
+/*
+    Vectorised trial division
+
+    In batches, the trial-division phase tests several different integers
+    against the same prime at once, one per SIMD lane, using the same
+    multiply-by-inverse divisibility test as the scalar code. Lanes which
+    turn out to be divisible (the rare case) are then dealt with one at a
+    time. Unlike the scalar version, the search only stops early once every
+    lane has got past the square root of its cofactor; carrying on further
+    for some lanes makes no difference to the result, only to the amount
+    of work.
+
+    Which kernel to use is decided at module load, from what the CPU
+    supports; the scalar version works everywhere.
+*/
+
+typedef void (*trial_kernel_t)
+  (
+    uint64_t * cofactors,
+    struct factorization * fs,
+    size_t count
+  );
+  /* common signature of trial_scalar and its vectorised equivalents */
+
+static void trial_divide_lane
+  (
+    struct factorization * f,
+    uint64_t * n,
+    const struct trial_prime * t
+  )
+  /* called when a vector kernel finds that *n is divisible by t->prime. */
+  {
+    unsigned int power = 0;
+    for (;;)
+      {
+        *n *= t->inverse;
+        ++power;
+        if (*n * t->inverse > t->bound)
+            break;
+      } /*for*/
+    factorization_add(f, t->prime, power);
+  } /*trial_divide_lane*/
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) static inline __m256i mullo_u64_avx2
+  (
+    __m256i a,
+    __m256i b
+  )
+  /* low 64 bits of each lane product; AVX2 has no instruction for this,
+    so it is put together from 32 × 32 → 64-bit multiplies. */
+  {
+    const __m256i lo = _mm256_mul_epu32(a, b);
+    const __m256i cross =
+        _mm256_add_epi64
+          (
+            _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+            _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32))
+          );
+    return
+        _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+  } /*mullo_u64_avx2*/
+
+__attribute__((target("avx2"))) static void trial_avx2
+  (
+    uint64_t * cofactors,
+    struct factorization * fs,
+    size_t count
+  )
+  {
+    const size_t nr_lanes = 4;
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+      /* for doing unsigned compares with signed compare instruction */
+    size_t i = 0;
+    for (;;)
+      {
+        if (count - i < nr_lanes)
+            break;
+        __m256i n = _mm256_loadu_si256((const __m256i *)(cofactors + i));
+        for (const struct trial_prime * t = trial_primes;;)
+          {
+            if (t == trial_primes + NR_TRIAL_PRIMES)
+                break;
+            const __m256i below_square =
+                _mm256_cmpgt_epi64
+                  (
+                    _mm256_set1_epi64x(t->prime * t->prime ^ INT64_MIN),
+                    _mm256_xor_si256(n, sign)
+                  );
+            if (_mm256_movemask_pd(_mm256_castsi256_pd(below_square)) == 0xf)
+                break; /* every lane has reached the square root of its cofactor */
+            const __m256i q = mullo_u64_avx2(n, _mm256_set1_epi64x(t->inverse));
+            const __m256i not_divisible =
+                _mm256_cmpgt_epi64
+                  (
+                    _mm256_xor_si256(q, sign),
+                    _mm256_set1_epi64x(t->bound ^ INT64_MIN)
+                  );
+            unsigned int divisible = ~_mm256_movemask_pd(_mm256_castsi256_pd(not_divisible)) & 0xf;
+            if (divisible != 0)
+              {
+                _mm256_storeu_si256((__m256i *)(cofactors + i), n);
+                for (;;)
+                  {
+                    if (divisible == 0)
+                        break;
+                    const unsigned int lane = __builtin_ctz(divisible);
+                    trial_divide_lane(&fs[i + lane], &cofactors[i + lane], t);
+                    divisible &= divisible - 1;
+                  } /*for*/
+                n = _mm256_loadu_si256((const __m256i *)(cofactors + i));
+              } /*if*/
+            ++t;
+          } /*for*/
+        _mm256_storeu_si256((__m256i *)(cofactors + i), n);
+        i += nr_lanes;
+      } /*for*/
+    trial_scalar(cofactors + i, fs + i, count - i);
+  } /*trial_avx2*/
+
+__attribute__((target("avx512f,avx512dq"))) static void trial_avx512
+  (
+    uint64_t * cofactors,
+    struct factorization * fs,
+    size_t count
+  )
+  {
+    const size_t nr_lanes = 8;
+    size_t i = 0;
+    for (;;)
+      {
+        if (count - i < nr_lanes)
+            break;
+        __m512i n = _mm512_loadu_si512(cofactors + i);
+        for (const struct trial_prime * t = trial_primes;;)
+          {
+            if (t == trial_primes + NR_TRIAL_PRIMES)
+                break;
+            if (_mm512_cmplt_epu64_mask(n, _mm512_set1_epi64(t->prime * t->prime)) == 0xff)
+                break; /* every lane has reached the square root of its cofactor */
+            const __m512i q = _mm512_mullo_epi64(n, _mm512_set1_epi64(t->inverse));
+            unsigned int divisible = _mm512_cmple_epu64_mask(q, _mm512_set1_epi64(t->bound));
+            if (divisible != 0)
+              {
+                _mm512_storeu_si512(cofactors + i, n);
+                for (;;)
+                  {
+                    if (divisible == 0)
+                        break;
+                    const unsigned int lane = __builtin_ctz(divisible);
+                    trial_divide_lane(&fs[i + lane], &cofactors[i + lane], t);
+                    divisible &= divisible - 1;
+                  } /*for*/
+                n = _mm512_loadu_si512(cofactors + i);
+              } /*if*/
+            ++t;
+          } /*for*/
+        _mm512_storeu_si512(cofactors + i, n);
+        i += nr_lanes;
+      } /*for*/
+    trial_scalar(cofactors + i, fs + i, count - i);
+  } /*trial_avx512*/
+
+#endif /*__x86_64__*/
+
+struct trial_kernel_entry
+  {
+    const char * name;
+    trial_kernel_t kernel;
+    bool (*supported)(void);
+  };
+
+static bool always_supported(void)
+  {
+    return
+        true;
+  } /*always_supported*/
+
+#if defined(__x86_64__)
+
+static bool avx2_supported(void)
+  {
+    return
+        __builtin_cpu_supports("avx2");
+  } /*avx2_supported*/
+
+static bool avx512_supported(void)
+  {
+    return
+        __builtin_cpu_supports("avx512f") and __builtin_cpu_supports("avx512dq");
+  } /*avx512_supported*/
+
+#endif /*__x86_64__*/
+
+static const struct trial_kernel_entry trial_kernels[] =
+  /* in increasing order of preference */
+  {
+    {"scalar", trial_scalar, always_supported},
+#if defined(__x86_64__)
+    {"avx2", trial_avx2, avx2_supported},
+    {"avx512", trial_avx512, avx512_supported},
+#endif
+    END_STRUCT_LIST
+  };
+
+static _Atomic(const struct trial_kernel_entry *) trial_kernel = &trial_kernels[0];
+  /* best supported one is chosen at module load; atomic because
+    set_trial_kernel() can change it while pool threads are using it,
+    and on a free-threaded build, while other threads are too */
+
+static void choose_trial_kernel(void)
+  {
+    __builtin_cpu_init();
+    for (const struct trial_kernel_entry * e = trial_kernels;;)
+      {
+        if (e->name == NULL)
+            break;
+        if (e->supported())
+            atomic_store(&trial_kernel, e);
+        ++e;
+      } /*for*/
+  } /*choose_trial_kernel*/
+
+enum factorize_status
+  /* outcome of factorizing one value; returned per element by batch calls */
+  {
+    FACTORIZE_OK = 0,
+    FACTORIZE_TOO_SMALL = 1, /* value was zero or one */
+    FACTORIZE_UNLUCKY_FACTOR = 2, /* 5 occurs as a prime factor */
+    FACTORIZE_UNLUCKY_POWER = 3, /* some prime factor occurs exactly 5 times */
+  };
+
+static enum factorize_status factorization_status
+  (
+    const struct factorization * f
+  )
+  /* checks f for unluckiness, looking at the factors in ascending order
+    just as the original trial-division loop encountered them. */
+  {
+    enum factorize_status result = FACTORIZE_OK;
+    for (unsigned int i = 0;;)
+      {
+        if (i == f->nr_factors)
+            break;
+        if (f->factors[i].prime == 5)
+          {
+            result = FACTORIZE_UNLUCKY_FACTOR;
+            break;
+          } /*if*/
+        if (f->factors[i].power == 5)
+          {
+            result = FACTORIZE_UNLUCKY_POWER;
+            break;
+          } /*if*/
+        ++i;
+      } /*for*/
+    return
+        result;
+  } /*factorization_status*/
+
+static enum factorize_status factorize_one
+  (
+    struct factorization * f,
+    uint64_t n,
+    const struct spf_table * table /* optional */
+  )
+  /* factorizes any n, reporting problems as a status code. */
+  {
+    enum factorize_status result;
+    if (n < 2)
+      {
+        f->nr_factors = 0;
+        result = FACTORIZE_TOO_SMALL;
+      }
+    else
+      {
+        const bool cacheable = table == NULL or n >= table->limit;
+        if (not cacheable or not cache_get(n, f))
+          {
+            factorize_u64(f, n, table);
+            if (cacheable)
+                cache_put(n, f);
+          } /*if*/
+        result = factorization_status(f);
+      } /*if*/
+    return
+        result;
+  } /*factorize_one*/
+
+#define BATCH_CHUNK 64
+  /* nr of values factorized together by factorize_chunk, also nr of
+    consecutive values claimed by a batch worker at a time */
+
+static void factorize_chunk
+  (
+    const uint64_t * values,
+    struct factorization * fs,
+    uint8_t * statuses, /* enum factorize_status values */
+    size_t count,
+    const struct spf_table * table /* optional */
+  )
+  /* factorizes a group of values at once, so the trial division can be
+    done by the vectorised kernel. Values small enough to be done by table
+    lookup are done that way instead. */
+  {
+    uint64_t cofactors[BATCH_CHUNK];
+    size_t indices[BATCH_CHUNK]; /* of values going through trial division */
+    struct factorization trial_fs[BATCH_CHUNK];
+    for (size_t start = 0;;)
+      {
+        if (start == count)
+            break;
+        const size_t end = count - start > BATCH_CHUNK ? start + BATCH_CHUNK : count;
+        size_t nr_trial = 0;
+        for (size_t i = start;;)
+          {
+            if (i == end)
+                break;
+            const uint64_t n = values[i];
+            if (n < 2 or table != NULL and n < table->limit)
+                statuses[i] = factorize_one(&fs[i], n, table);
+            else if (cache_get(n, &fs[i]))
+                statuses[i] = factorization_status(&fs[i]);
+            else
+              {
+                cofactors[nr_trial] = remove_twos(&trial_fs[nr_trial], n);
+                indices[nr_trial] = i;
+                ++nr_trial;
+              } /*if*/
+            ++i;
+          } /*for*/
+        atomic_load(&trial_kernel)->kernel(cofactors, trial_fs, nr_trial);
+        for (size_t j = 0;;)
+          {
+            if (j == nr_trial)
+                break;
+            struct factorization * const f = &fs[indices[j]];
+            *f = trial_fs[j];
+            factorize_remainder(f, cofactors[j]);
+            cache_put(values[indices[j]], f);
+            statuses[indices[j]] = factorization_status(f);
+            ++j;
+          } /*for*/
+        start = end;
+      } /*for*/
+  } /*factorize_chunk*/
+
+/*
+    Work limits
+
+    The multiple-precision engine can go on for hours on a hard
+    enough number, all the while without the GIL, so it periodically
+    charges the work it has done against a work_limit. This stops it
+    once a deadline or maximum amount of work has been passed, or a
+    signal handler has raised an exception, whereupon each routine
+    gives up as soon as it can, and whatever is left unfactorized is
+    handed back as such. Work is counted in units of roughly one
+    multiplication modulo the number being factorized. Looking at the
+    clock is only done every WORK_CHECK_INTERVAL units, and reacquiring
+    the GIL to check for signals, which can only be done on the thread
+    that released it, at most every WORK_SIGNAL_INTERVAL seconds.
+*/
+
+#define WORK_CHECK_INTERVAL 4096
+#define WORK_SIGNAL_INTERVAL 0.05
+
+enum work_stop
+  {
+    WORK_GOING = 0, /* not stopped */
+    WORK_TIMED_OUT, /* deadline or max_work passed */
+    WORK_INTERRUPTED, /* exception raised by signal handler */
+  };
+
+struct work_limit
+  {
+    double deadline; /* as per timestamp(), or 0 for none */
+    uint64_t max_work; /* or 0 for none */
+    PyThreadState * tstate; /* thread state saved by owner on releasing the GIL */
+    pthread_t owner; /* only this thread may check for signals */
+    double last_signal_check; /* only accessed by owner */
+    atomic_uint_fast64_t work; /* units done so far */
+    atomic_int stop; /* enum work_stop */
+  };
+
+static void work_limit_init
+  (
+    struct work_limit * limit,
+    double deadline,
+    uint64_t max_work
+  )
+  /* sets up limit for use on the current thread, which must hold the GIL
+    and must release it before the work starts, saving its thread state
+    in limit->tstate. */
+  {
+    limit->deadline = deadline;
+    limit->max_work = max_work;
+    limit->tstate = NULL;
+    limit->owner = pthread_self();
+    limit->last_signal_check = timestamp();
+    atomic_init(&limit->work, 0);
+    atomic_init(&limit->stop, WORK_GOING);
+  } /*work_limit_init*/
+
+static inline bool work_stopped
+  (
+    struct work_limit * limit /* may be NULL for no limit */
+  )
+  /* has work been stopped for any reason. */
+  {
+    return
+        limit != NULL and atomic_load_explicit(&limit->stop, memory_order_relaxed) != WORK_GOING;
+  } /*work_stopped*/
+
+static bool work_charge
+  (
+    struct work_limit * limit, /* may be NULL for no limit */
+    uint64_t units
+  )
+  /* adds units to the work done, and returns true if the caller should
+    give up. */
+  {
+    if (limit != NULL and atomic_load_explicit(&limit->stop, memory_order_relaxed) == WORK_GOING)
+      {
+        const uint64_t before = atomic_fetch_add_explicit(&limit->work, units, memory_order_relaxed);
+        const uint64_t after = before + units;
+        enum work_stop stop = WORK_GOING;
+        if (limit->max_work != 0 and after >= limit->max_work)
+            stop = WORK_TIMED_OUT;
+        else if (before / WORK_CHECK_INTERVAL != after / WORK_CHECK_INTERVAL)
+          {
+            const double now = timestamp();
+            if (limit->deadline != 0 and now >= limit->deadline)
+                stop = WORK_TIMED_OUT;
+            else if
+              (
+                    limit->tstate != NULL
+                and
+                    pthread_equal(pthread_self(), limit->owner)
+                and
+                    now - limit->last_signal_check >= WORK_SIGNAL_INTERVAL
+              )
+              {
+                limit->last_signal_check = now;
+                PyEval_RestoreThread(limit->tstate);
+                if (PyErr_CheckSignals() != 0)
+                    stop = WORK_INTERRUPTED; /* leave exception set for owner to report */
+                limit->tstate = PyEval_SaveThread();
+              } /*if*/
+          } /*if*/
+        if (stop != WORK_GOING)
+          {
+            int expected = WORK_GOING;
+            atomic_compare_exchange_strong(&limit->stop, &expected, stop);
+          } /*if*/
+      } /*if*/
+    return
+        work_stopped(limit);
+  } /*work_charge*/
+
+/*
+    Thread pool
+
+    All the parallel work is done by one pool of native threads, as many
+    as there are CPUs this process may run on, started on first use.
+    Each pool thread has its own Chase–Lev deque of tasks, pushing and
+    popping at the bottom end, while idle threads steal from the top end
+    of each other’s deques; tasks submitted from outside the pool go on a
+    shared queue instead. The deques only come into play for nested
+    parallel work, i.e. tasks submitted by pool tasks themselves (such as
+    the batch GCD over NTTs, or SIQS within a batch): the batch routines
+    do not submit their chunks as separate tasks. Instead run_workers
+    submits copies of a single worker, which all claim chunks from a
+    shared atomic counter (see “Batch execution” below); for a list of
+    chunks planned in advance, that costs one atomic increment per chunk
+    rather than a task allocation and a deque operation, and does the
+    same job of keeping every thread busy to the end. Stealing only
+    moves those worker copies around. run_workers hands out its extra
+    copies of the worker as tasks, then does its own share; any of them
+    that no pool thread has started by the time it has finished, it
+    takes back and runs itself (normally finding nothing left to do), so
+    it never waits on a task that might be stuck behind others, and
+    nested uses from within pool tasks cannot deadlock. The pool is shut
+    down at exit, first telling any long factorizations to give up, and
+    is simply forgotten in the child after a fork(), where its threads no
+    longer exist, so a new one gets started there if needed.
+*/
+
+#define MAX_BATCH_THREADS 256
+#define POOL_DEQUE_SIZE 256 /* must be a power of 2 */
+
+enum
+  {
+    POOL_TASK_QUEUED,
+    POOL_TASK_TAKEN, /* by a pool thread, or by the submitter */
+  };
+
+struct pool_group
+  /* for a submitter to wait for its tasks that pool threads have taken */
+  {
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    unsigned int nr_finished;
+  };
+
+struct pool_task
+  {
+    void * (*func)(void *);
+    void * arg;
+    struct pool_group * group; /* to be notified when finished, or NULL */
+    atomic_int state;
+    atomic_uint refs; /* one for the queue it’s on, one for the submitter if it waits */
+    struct pool_task * next; /* on shared queue */
+  };
+
+struct pool_thread
+  {
+    pthread_t thread;
+    uint64_t rand; /* for choosing whom to steal from */
+    alignas(64) atomic_int_fast64_t top; /* where thieves steal from */
+    alignas(64) atomic_int_fast64_t bottom; /* where owner pushes and pops */
+    _Atomic(struct pool_task *) slots[POOL_DEQUE_SIZE];
+  };
+
+static struct
+  {
+    pthread_mutex_t lock; /* protects everything not atomic */
+    pthread_cond_t wake; /* signalled when there are tasks for sleeping threads */
+    _Atomic(struct pool_task *) queue; /* shared queue, oldest first */
+    struct pool_task * queue_last;
+    atomic_size_t nr_queued; /* tasks in deques or shared queue */
+    atomic_uint nr_sleeping;
+    bool stopping;
+    unsigned int nr_threads; /* nr of deques; 0 until started */
+    struct pool_thread * threads;
+    struct work_limit cancel; /* long tasks give up if this is stopped */
+  } pool =
+    {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .wake = PTHREAD_COND_INITIALIZER,
+        .queue = NULL,
+        .queue_last = NULL,
+        .stopping = false,
+        .nr_threads = 0,
+        .threads = NULL,
+    };
+
+static _Thread_local struct pool_thread * pool_self; /* NULL if not a pool thread */
+
+static unsigned int default_nr_threads(void)
+  /* the nr of CPUs this process may run on, as per os.sched_getaffinity. */
+  {
+    cpu_set_t cpus;
+    const int nr_cpus =
+        sched_getaffinity(0, sizeof cpus, &cpus) == 0 ?
+            CPU_COUNT(&cpus)
+        :
+            sysconf(_SC_NPROCESSORS_ONLN);
+    return
+        nr_cpus < 1 ?
+            1
+        : nr_cpus > MAX_BATCH_THREADS ?
+            MAX_BATCH_THREADS
+        :
+            nr_cpus;
+  } /*default_nr_threads*/
+
+static void pool_task_release
+  (
+    struct pool_task * task
+  )
+  {
+    if (atomic_fetch_sub(&task->refs, 1) == 1)
+        free(task);
+  } /*pool_task_release*/
+
+static bool pool_task_claim
+  (
+    struct pool_task * task
+  )
+  /* tries to take a task for running; false if somebody else already has. */
+  {
+    int expected = POOL_TASK_QUEUED;
+    return
+        atomic_compare_exchange_strong(&task->state, &expected, POOL_TASK_TAKEN);
+  } /*pool_task_claim*/
+
+static bool pool_push
+  (
+    struct pool_thread * self,
+    struct pool_task * task
+  )
+  /* pushes task onto the bottom of self’s deque. Returns false if full. */
+  {
+    const int_fast64_t b = atomic_load_explicit(&self->bottom, memory_order_relaxed);
+    const int_fast64_t t = atomic_load_explicit(&self->top, memory_order_acquire);
+    const bool ok = b - t < POOL_DEQUE_SIZE;
+    if (ok)
+      {
+        atomic_store_explicit(&self->slots[b & POOL_DEQUE_SIZE - 1], task, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        atomic_store_explicit(&self->bottom, b + 1, memory_order_relaxed);
+      } /*if*/
+    return
+        ok;
+  } /*pool_push*/
+
+static struct pool_task * pool_pop
+  (
+    struct pool_thread * self
+  )
+  /* pops the most recently pushed task from self’s deque, or returns NULL
+    if there is none. */
+  {
+    struct pool_task * task = NULL;
+    const int_fast64_t b = atomic_load_explicit(&self->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&self->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int_fast64_t t = atomic_load_explicit(&self->top, memory_order_relaxed);
+    if (t <= b)
+      {
+        task = atomic_load_explicit(&self->slots[b & POOL_DEQUE_SIZE - 1], memory_order_relaxed);
+        if (t == b)
+          {
+          /* last one, so race thieves for it */
+            if
+              (
+                not atomic_compare_exchange_strong_explicit
+                  (
+                    &self->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed
+                  )
+              )
+                task = NULL;
+            atomic_store_explicit(&self->bottom, b + 1, memory_order_relaxed);
+          } /*if*/
+      }
+    else
+        atomic_store_explicit(&self->bottom, b + 1, memory_order_relaxed);
+    return
+        task;
+  } /*pool_pop*/
+
+static struct pool_task * pool_steal
+  (
+    struct pool_thread * victim
+  )
+  /* takes the least recently pushed task from victim’s deque, or returns
+    NULL if there is none, or if another thief got there first. */
+  {
+    struct pool_task * task = NULL;
+    int_fast64_t t = atomic_load_explicit(&victim->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    const int_fast64_t b = atomic_load_explicit(&victim->bottom, memory_order_acquire);
+    if (t < b)
+      {
+        task = atomic_load_explicit(&victim->slots[t & POOL_DEQUE_SIZE - 1], memory_order_relaxed);
+        if
+          (
+            not atomic_compare_exchange_strong_explicit
+              (
+                &victim->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed
+              )
+          )
+            task = NULL;
+      } /*if*/
+    return
+        task;
+  } /*pool_steal*/
+
+static struct pool_task * pool_find_task
+  (
+    struct pool_thread * self
+  )
+  /* looks for a task to run: first in self’s own deque, then in the shared
+    queue, then in the other threads’ deques, starting from a random one. */
+  {
+    struct pool_task * task = pool_pop(self);
+    if
+      (
+            task == NULL
+        and
+          /* quick look without the lock, to avoid taking it when there’s
+            nothing there */
+            atomic_load_explicit(&pool.queue, memory_order_relaxed) != NULL
+      )
+      {
+        pthread_mutex_lock(&pool.lock);
+        task = atomic_load_explicit(&pool.queue, memory_order_relaxed);
+        if (task != NULL)
+          {
+            atomic_store_explicit(&pool.queue, task->next, memory_order_relaxed);
+            if (task->next == NULL)
+                pool.queue_last = NULL;
+          } /*if*/
+        pthread_mutex_unlock(&pool.lock);
+      } /*if*/
+    if (task == NULL)
+      {
+        self->rand = self->rand * 6364136223846793005 + 1442695040888963407;
+        const unsigned int first = (self->rand >> 32) % pool.nr_threads;
+        for (unsigned int i = 0;;)
+          {
+            if (task != NULL or i == pool.nr_threads)
+                break;
+            struct pool_thread * const victim = &pool.threads[(first + i) % pool.nr_threads];
+            if (victim != self)
+                task = pool_steal(victim);
+            ++i;
+          } /*for*/
+      } /*if*/
+    if (task != NULL)
+        atomic_fetch_sub(&pool.nr_queued, 1);
+    return
+        task;
+  } /*pool_find_task*/
+
+static void * pool_thread_run
+  (
+    void * arg
+  )
+  {
+    struct pool_thread * const self = arg;
+    pool_self = self;
+    for (;;)
+      {
+        struct pool_task * const task = pool_find_task(self);
+        if (task != NULL)
+          {
+            if (pool_task_claim(task))
+              {
+                task->func(task->arg);
+                if (task->group != NULL)
+                  {
+                    struct pool_group * const group = task->group;
+                    pthread_mutex_lock(&group->lock);
+                    ++group->nr_finished;
+                    pthread_cond_signal(&group->finished);
+                    pthread_mutex_unlock(&group->lock);
+                  } /*if*/
+              } /*if*/
+            pool_task_release(task);
+            continue;
+          } /*if*/
+        if (atomic_load(&pool.nr_queued) != 0)
+          {
+          /* in the middle of being pushed, or some other thief beat me to it */
+            sched_yield();
+            continue;
+          } /*if*/
+        pthread_mutex_lock(&pool.lock);
+        const bool stopping = pool.stopping;
+        if (not stopping)
+          {
+            atomic_fetch_add(&pool.nr_sleeping, 1);
+            for (;;)
+              {
+                if (pool.stopping or atomic_load(&pool.nr_queued) != 0)
+                    break;
+                pthread_cond_wait(&pool.wake, &pool.lock);
+              } /*for*/
+            atomic_fetch_sub(&pool.nr_sleeping, 1);
+          } /*if*/
+        pthread_mutex_unlock(&pool.lock);
+        if (stopping)
+            break;
+      } /*for*/
+    return
+        NULL;
+  } /*pool_thread_run*/
+
+static bool pool_start(void)
+  /* makes sure the pool threads are running, returning false if none
+    could be started. */
+  {
+    pthread_mutex_lock(&pool.lock);
+    if (pool.threads == NULL and not pool.stopping)
+      {
+        const unsigned int nr_threads = default_nr_threads();
+        struct pool_thread * const threads = aligned_alloc(64, nr_threads * sizeof(struct pool_thread));
+        if (threads != NULL)
+          {
+            for (unsigned int i = 0;;)
+              {
+                if (i == nr_threads)
+                    break;
+                threads[i].rand = i + 1;
+                atomic_init(&threads[i].top, 0);
+                atomic_init(&threads[i].bottom, 0);
+                ++i;
+              } /*for*/
+            pool.threads = threads;
+            pool.nr_threads = nr_threads;
+            work_limit_init(&pool.cancel, 0, 0);
+            unsigned int nr_started = 0;
+            for (unsigned int i = 0;;)
+              {
+                if (i == nr_threads)
+                    break;
+                if (pthread_create(&threads[i].thread, NULL, pool_thread_run, &threads[i]) == 0)
+                    ++nr_started;
+                else
+                    threads[i].thread = pthread_self(); /* marks it as not running */
+                ++i;
+              } /*for*/
+            if (nr_started == 0)
+              {
+                free(threads);
+                pool.threads = NULL;
+                pool.nr_threads = 0;
+              } /*if*/
+          } /*if*/
+      } /*if*/
+    const bool ok = pool.threads != NULL;
+    pthread_mutex_unlock(&pool.lock);
+    return
+        ok;
+  } /*pool_start*/
+
+static void pool_submit
+  (
+    struct pool_task * task
+  )
+  /* queues task for running by a pool thread, which must have been started. */
+  {
+    atomic_fetch_add(&pool.nr_queued, 1);
+    if (pool_self == NULL or not pool_push(pool_self, task))
+      {
+        task->next = NULL;
+        pthread_mutex_lock(&pool.lock);
+        if (pool.queue_last != NULL)
+            pool.queue_last->next = task;
+        else
+            atomic_store_explicit(&pool.queue, task, memory_order_relaxed);
+        pool.queue_last = task;
+        pthread_mutex_unlock(&pool.lock);
+      } /*if*/
+    if (atomic_load(&pool.nr_sleeping) != 0)
+      {
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_signal(&pool.wake);
+        pthread_mutex_unlock(&pool.lock);
+      } /*if*/
+  } /*pool_submit*/
+
+static struct pool_task * pool_task_new
+  (
+    void * (*func)(void *),
+    void * arg,
+    struct pool_group * group /* if not NULL, the submitter keeps a reference */
+  )
+  /* submits a new task, returning it, or NULL if out of memory. */
+  {
+    struct pool_task * const task = malloc(sizeof(struct pool_task));
+    if (task != NULL)
+      {
+        task->func = func;
+        task->arg = arg;
+        task->group = group;
+        atomic_init(&task->state, POOL_TASK_QUEUED);
+        atomic_init(&task->refs, group != NULL ? 2 : 1);
+        task->next = NULL;
+        pool_submit(task);
+      } /*if*/
+    return
+        task;
+  } /*pool_task_new*/
+
+#define POOL_SHUTDOWN_WAIT 1 /* seconds to wait for pool threads to stop */
+
+static void pool_shutdown(void)
+  /* stops all the pool threads, for Py_AtExit. Any still busy after
+    POOL_SHUTDOWN_WAIT seconds, e.g. helping a daemon thread with a long
+    factorization, are left to be killed at process exit. */
+  {
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = true;
+    pthread_cond_broadcast(&pool.wake);
+    struct pool_thread * const threads = pool.threads;
+    const unsigned int nr_threads = pool.nr_threads;
+    if (threads != NULL)
+        atomic_store(&pool.cancel.stop, WORK_TIMED_OUT);
+    pthread_mutex_unlock(&pool.lock);
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += POOL_SHUTDOWN_WAIT;
+    for (unsigned int i = 0;;)
+      {
+        if (threads == NULL or i == nr_threads)
+            break;
+        if
+          (
+                not pthread_equal(threads[i].thread, pthread_self())
+            and
+                pthread_timedjoin_np(threads[i].thread, NULL, &deadline) != 0
+          )
+            break;
+        ++i;
+      } /*for*/
+  } /*pool_shutdown*/
+
+static void pool_after_fork(void)
+  /* forgets about the pool in the child after fork(), since its threads
+    did not come along. */
+  {
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    atomic_store(&pool.queue, NULL);
+    pool.queue_last = NULL;
+    atomic_store(&pool.nr_queued, 0);
+    atomic_store(&pool.nr_sleeping, 0);
+    pool.threads = NULL; /* can’t safely free it, so let it leak */
+    pool.nr_threads = 0;
+  } /*pool_after_fork*/
+
+static void run_workers
+  (
+    void * (*worker)(void *),
+    void * job,
+    unsigned int nr_threads
+  )
+  /* runs worker(job) on up to nr_threads threads including the caller, and
+    waits for them all to finish. Each copy is expected to share out the
+    work in job among them, e.g. by claiming chunks from a counter. */
+  {
+    struct pool_task * tasks[MAX_BATCH_THREADS];
+    unsigned int nr_tasks = 0;
+    struct pool_group group = {.nr_finished = 0};
+    pthread_mutex_init(&group.lock, NULL);
+    pthread_cond_init(&group.finished, NULL);
+    if (nr_threads > 1 and pool_start())
+      {
+        for (;;)
+          {
+            if (nr_tasks + 1 >= nr_threads)
+                break;
+            tasks[nr_tasks] = pool_task_new(worker, job, &group);
+            if (tasks[nr_tasks] == NULL)
+                break; /* just make do with what I have */
+            ++nr_tasks;
+          } /*for*/
+      } /*if*/
+    worker(job);
+    unsigned int nr_taken = 0; /* nr of tasks being run by pool threads */
+    for (unsigned int i = 0;;)
+      {
+        if (i == nr_tasks)
+            break;
+        if (pool_task_claim(tasks[i]))
+            worker(job); /* nobody else got round to it */
+        else
+            ++nr_taken;
+        pool_task_release(tasks[i]);
+        ++i;
+      } /*for*/
+    pthread_mutex_lock(&group.lock);
+    for (;;)
+      {
+        if (group.nr_finished == nr_taken)
+            break;
+        pthread_cond_wait(&group.finished, &group.lock);
+      } /*for*/
+    pthread_mutex_unlock(&group.lock);
+    pthread_cond_destroy(&group.finished);
+    pthread_mutex_destroy(&group.lock);
+  } /*run_workers*/
+
+static unsigned int threads_for
+  (
+    size_t nr_values,
+    size_t chunk_size,
+    unsigned int nr_threads
+  )
+  /* no point starting threads that will find nothing to do. */
+  {
+    const size_t nr_chunks = (nr_values + chunk_size - 1) / chunk_size;
+    return
+        nr_threads > nr_chunks ? nr_chunks : nr_threads;
+  } /*threads_for*/
+
+/*
+    Batch execution
+
+    A batch of values is factorized by the pool threads, all running
+    without the GIL and claiming chunks of the batch from a shared counter
+    until it is used up. The calling thread takes part as well, so a batch
+    still gets done even if no pool threads could be started. The time
+    to factorize a value goes up steeply with its size, so the chunks are
+    not all the same length: they are planned beforehand by guided
+    self-scheduling on an estimated cost per value, each chunk getting a
+    fixed share of whatever cost is still left after the ones before it.
+    So the chunks get smaller towards the end of the batch, and a few hard
+    values there do not leave most of the threads idle while the last
+    chunks are finished.
+*/
+
+#define BATCH_MAX_CHUNK (16 * BATCH_CHUNK) /* most values in a batch chunk */
+#define CHUNK_MIN_COST BATCH_CHUNK /* least cost worth claiming at once */
+#define CHUNK_MAX_COST (32 * BATCH_CHUNK)
+
+struct chunk_plan
+  /* how a batch is divided into chunks */
+  {
+    size_t nr_values;
+    size_t nr_chunks;
+    size_t chunk_size; /* if all chunks are the same size */
+    size_t * bounds; /* otherwise chunk i is [bounds[i], bounds[i + 1]) */
+  };
+
+static inline unsigned int value_cost
+  (
+    uint64_t n
+  )
+  /* rough relative cost of factorizing n: doubles with every 8 bits
+    beyond 24, as measured. */
+  {
+    const unsigned int bits = n != 0 ? 64 - __builtin_clzll(n) : 0;
+    return
+        1u << (bits > 24 ? (bits - 24) / 8 : 0);
+  } /*value_cost*/
+
+static void chunk_plan_init
+  (
+    struct chunk_plan * plan,
+    const uint64_t * values,
+    size_t nr_values,
+    size_t max_chunk, /* most values in a chunk */
+    unsigned int nr_threads
+  )
+  /* plans the chunks for factorizing values on nr_threads threads. If
+    there is no memory for that, they are just all made max_chunk long.
+    Caller must dispose of plan with chunk_plan_dispose. */
+  {
+    plan->nr_values = nr_values;
+    plan->chunk_size = max_chunk;
+    plan->nr_chunks = (nr_values + max_chunk - 1) / max_chunk;
+    plan->bounds = NULL;
+    if (nr_threads > 1 and plan->nr_chunks > 1)
+      {
+        uint64_t remaining = 0;
+        for (size_t i = 0;;)
+          {
+            if (i == nr_values)
+                break;
+            remaining += value_cost(values[i]);
+            ++i;
+          } /*for*/
+        plan->bounds = malloc((nr_values + 1) * sizeof(size_t));
+      /* all chunks have at least one value, so that’s always enough */
+        if (plan->bounds != NULL)
+          {
+            plan->nr_chunks = 0;
+            plan->bounds[0] = 0;
+            for (size_t start = 0;;)
+              {
+                if (start == nr_values)
+                    break;
+                uint64_t budget = remaining / (2 * nr_threads);
+                if (budget < CHUNK_MIN_COST)
+                    budget = CHUNK_MIN_COST;
+                else if (budget > CHUNK_MAX_COST)
+                    budget = CHUNK_MAX_COST;
+                uint64_t cost = 0;
+                size_t end = start;
+                for (;;)
+                  {
+                    if (end == nr_values or end - start == max_chunk or cost >= budget)
+                        break;
+                    cost += value_cost(values[end]);
+                    ++end;
+                  } /*for*/
+                remaining -= cost;
+                plan->bounds[++plan->nr_chunks] = end;
+                start = end;
+              } /*for*/
+          } /*if*/
+      } /*if*/
+  } /*chunk_plan_init*/
+
+static void chunk_plan_dispose
+  (
+    struct chunk_plan * plan
+  )
+  {
+    free(plan->bounds);
+    plan->bounds = NULL;
+  } /*chunk_plan_dispose*/
+
+static inline size_t chunk_plan_start
+  (
+    const struct chunk_plan * plan,
+    size_t chunk /* may be nr_chunks, giving the end of the last one */
+  )
+  /* index of first value in the chunk. */
+  {
+    return
+        plan->bounds != NULL ?
+            plan->bounds[chunk]
+        : chunk < plan->nr_chunks ?
+            chunk * plan->chunk_size
+        :
+            plan->nr_values;
+  } /*chunk_plan_start*/
+
+struct batch_job
+  {
+    const uint64_t * values;
+    struct factorization * results;
+    uint8_t * statuses; /* enum factorize_status values */
+    const struct chunk_plan * plan;
+    const struct spf_table * table; /* optional */
+    atomic_size_t next_chunk; /* index of next unclaimed chunk */
+  };
+
+static void * batch_worker
+  (
+    void * arg
+  )
+  {
+    struct batch_job * const job = arg;
+    for (;;)
+      {
+        const size_t chunk = atomic_fetch_add(&job->next_chunk, 1);
+        if (chunk >= job->plan->nr_chunks)
+            break;
+        const size_t start = chunk_plan_start(job->plan, chunk);
+        const size_t end = chunk_plan_start(job->plan, chunk + 1);
+        factorize_chunk
+          (
+            job->values + start,
+            job->results + start,
+            job->statuses + start,
+            end - start,
+            job->table
+          );
+      } /*for*/
+    return
+        NULL;
+  } /*batch_worker*/
+
+static void run_batch
+  (
+    const uint64_t * values,
+    struct factorization * results,
+    uint8_t * statuses,
+    size_t nr_values,
+    const struct spf_table * table, /* optional */
+    unsigned int nr_threads
+  )
+  /* factorizes values[0 .. nr_values - 1] into results and statuses, using up
+    to nr_threads threads including the caller. Must be called without the GIL. */
+  {
+    struct chunk_plan plan;
+    chunk_plan_init(&plan, values, nr_values, BATCH_MAX_CHUNK, nr_threads);
+    struct batch_job job =
+        {
+            .values = values,
+            .results = results,
+            .statuses = statuses,
+            .plan = &plan,
+            .table = table,
+        };
+    atomic_init(&job.next_chunk, 0);
+    run_workers(batch_worker, &job, threads_for(plan.nr_chunks, 1, nr_threads));
+    chunk_plan_dispose(&plan);
+  } /*run_batch*/
+
+/*
+    Packed (CSR) batch output
+
+    Instead of building Python objects, the factors of all the values are
+    written into flat caller-supplied arrays: the factors of values[i] are
+    primes[offsets[i] .. offsets[i + 1] - 1], with the corresponding powers
+    in exponents. Each worker factorizes a chunk into local storage, then
+    waits for the chunk before it to publish where it ends, so the output
+    goes straight into its final place in a single pass.
+*/
+
+#define CSR_CHUNK 256
+
+struct csr_job
+  {
+    const uint64_t * values;
+    size_t nr_values;
+    uint64_t * offsets; /* nr_values + 1 entries, NULL to just count factors */
+    uint64_t * primes;
+    uint8_t * exponents;
+    size_t max_factors; /* room in primes and exponents */
+    uint8_t * statuses; /* optional */
+    const struct spf_table * table; /* optional */
+    const struct chunk_plan * plan;
+    atomic_size_t next_chunk; /* index of next unclaimed chunk */
+    atomic_uint_fast64_t * chunk_ends;
+      /* for each chunk, 1 + offset of end of its factors, 0 if not yet known */
+    atomic_uint_fast64_t nr_factors; /* total, when just counting */
+    atomic_size_t first_failure; /* index of first unsuccessful value, if any */
+  };
+
+static void csr_note_failure
+  (
+    struct csr_job * job,
+    size_t index
+  )
+  {
+    size_t prev = atomic_load(&job->first_failure);
+    for (;;)
+      {
+        if (prev <= index)
+            break;
+        if (atomic_compare_exchange_weak(&job->first_failure, &prev, index))
+            break;
+      } /*for*/
+  } /*csr_note_failure*/
+
+static void * csr_worker
+  (
+    void * arg
+  )
+  {
+    struct csr_job * const job = arg;
+    struct factorization scratch[CSR_CHUNK];
+    uint8_t scratch_statuses[CSR_CHUNK];
+    for (;;)
+      {
+        const size_t chunk = atomic_fetch_add(&job->next_chunk, 1);
+        if (chunk >= job->plan->nr_chunks)
+            break;
+        const size_t start = chunk_plan_start(job->plan, chunk);
+        const size_t end = chunk_plan_start(job->plan, chunk + 1);
+        factorize_chunk(job->values + start, scratch, scratch_statuses, end - start, job->table);
+        uint64_t count = 0;
+        for (size_t i = start;;)
+          {
+            if (i == end)
+                break;
+            struct factorization * const f = &scratch[i - start];
+            const enum factorize_status status = scratch_statuses[i - start];
+            if (status != FACTORIZE_OK)
+              {
+                f->nr_factors = 0;
+                csr_note_failure(job, i);
+              } /*if*/
+            if (job->statuses != NULL)
+                job->statuses[i] = status;
+            count += f->nr_factors;
+            ++i;
+          } /*for*/
+        if (job->offsets != NULL)
+          {
+            uint64_t pos = 0;
+            if (chunk != 0)
+              {
+                for (;;)
+                  {
+                    const uint64_t prev_end =
+                        atomic_load_explicit(&job->chunk_ends[chunk - 1], memory_order_acquire);
+                    if (prev_end != 0)
+                      {
+                        pos = prev_end - 1;
+                        break;
+                      } /*if*/
+                    sched_yield();
+                  } /*for*/
+              }
+            else
+                job->offsets[0] = 0;
+            atomic_store_explicit(&job->chunk_ends[chunk], pos + count + 1, memory_order_release);
+            const bool fits = pos + count <= job->max_factors;
+            for (size_t i = start;;)
+              {
+                if (i == end)
+                    break;
+                const struct factorization * const f = &scratch[i - start];
+                if (fits)
+                  {
+                    for (unsigned int j = 0;;)
+                      {
+                        if (j == f->nr_factors)
+                            break;
+                        job->primes[pos + j] = f->factors[j].prime;
+                        job->exponents[pos + j] = f->factors[j].power;
+                        ++j;
+                      } /*for*/
+                  } /*if*/
+                pos += f->nr_factors;
+                job->offsets[i + 1] = pos;
+                ++i;
+              } /*for*/
+          }
+        else
+            atomic_fetch_add(&job->nr_factors, count);
+      } /*for*/
+    return
+        NULL;
+  } /*csr_worker*/
+
+/*
+    Parallel prime sieving
+
+    The range is divided into chunks of SIEVE_CHUNK_SEGMENTS segments,
+    which the workers claim in turn. Each worker sieves its chunk into
+    local storage and counts the primes in it, then, like the CSR output
+    above, waits for the chunk before it to publish where its primes end
+    before publishing its own end and copying its primes into place.
+    Each worker has its own copy of the sieve state, which has to be set
+    up afresh for each chunk, so chunks are made big enough for that not
+    to matter.
+*/
+
+#define SIEVE_CHUNK_SEGMENTS 16
+
+struct prime_job
+  {
+    uint32_t * base_primes;
+    size_t nr_base_primes;
+    bool test_each;
+    uint64_t lo, last; /* range wanted, inclusive */
+    uint64_t * out;
+    size_t max_out; /* room in out */
+    uint64_t nr_chunks;
+    atomic_uint_fast64_t next_chunk; /* index of next unclaimed chunk */
+    atomic_uint_fast64_t nr_done; /* nr of chunks whose primes have been placed */
+    atomic_size_t nr_out; /* nr of primes placed so far */
+    atomic_bool failed; /* out of memory */
+  };
+
+static void * prime_worker
+  (
+    void * arg
+  )
+  {
+    struct prime_job * const job = arg;
+    const size_t chunk_bytes = SIEVE_CHUNK_SEGMENTS * SIEVE_SEGMENT_BYTES;
+    struct sieve * s = NULL;
+    uint64_t * bits = NULL;
+    do /*once*/
+      {
+        s = sieve_new(job->base_primes, job->nr_base_primes, job->test_each, NULL, job->lo, job->lo);
+        bits = malloc(chunk_bytes);
+        if (s == NULL or bits == NULL)
+          {
+            atomic_store(&job->failed, true);
+            break;
+          } /*if*/
+        for (;;)
+          {
+            if (atomic_load(&job->failed) or atomic_load(&job->nr_out) == job->max_out)
+                break;
+            const uint64_t chunk = atomic_fetch_add(&job->next_chunk, 1);
+            if (chunk >= job->nr_chunks)
+                break;
+          /* from here on, the chunk must be published, even if empty */
+            const uint64_t first_byte = job->lo / 30 + chunk * chunk_bytes;
+            const uint64_t chunk_lo = chunk == 0 ? job->lo : 30 * first_byte;
+            const uint64_t chunk_last =
+                job->last / 30 - first_byte < chunk_bytes ?
+                    job->last
+                :
+                    30 * (first_byte + chunk_bytes) - 1;
+            size_t nr_bytes = 0;
+            size_t count = 0;
+            if (atomic_load(&job->nr_out) < job->max_out)
+              {
+                sieve_reset(s, chunk_lo, chunk_last);
+                for (;;)
+                  {
+                    memcpy
+                      (
+                        (uint8_t *)bits + nr_bytes,
+                        s->bits,
+                        (s->segment_len + 7) / 8 * 8
+                      );
+                    nr_bytes += s->segment_len;
+                    count += sieve_bits_count(s->bits, s->segment_len);
+                    if (not sieve_advance(s))
+                        break;
+                  } /*for*/
+              } /*if*/
+            for (;;)
+              {
+                if (atomic_load_explicit(&job->nr_done, memory_order_acquire) == chunk)
+                    break;
+                sched_yield();
+              } /*for*/
+            const size_t pos = atomic_load(&job->nr_out);
+            if (count > job->max_out - pos)
+                count = job->max_out - pos;
+            atomic_store(&job->nr_out, pos + count);
+            atomic_store_explicit(&job->nr_done, chunk + 1, memory_order_release);
+            sieve_bits_extract(bits, nr_bytes, first_byte, job->out + pos, count);
+          } /*for*/
+      }
+    while (false);
+    sieve_dispose(s);
+    free(bits);
+    return
+        NULL;
+  } /*prime_worker*/
+
+static bool run_primes
+  (
+    uint64_t lo,
+    uint64_t last, /* must be at least lo */
+    uint64_t * out,
+    size_t max_out,
+    unsigned int nr_threads,
+    size_t * nr_out /* set to nr of primes put in out */
+  )
+  /* puts the primes from lo to last inclusive into out, in ascending order,
+    stopping early if it fills up. Must be called without the GIL. Returns
+    false if out of memory. */
+  {
+    struct prime_job job =
+        {
+            .lo = lo,
+            .last = last,
+            .out = out,
+            .max_out = max_out,
+            .base_primes = NULL,
+            .nr_base_primes = 0,
+            .test_each = sieve_test_each(lo, last),
+        };
+    size_t count = 0;
+    for (unsigned int i = 0;;)
+      {
+        if (i == 3 or count == max_out)
+            break;
+        if (wheel_primes[i] >= lo and wheel_primes[i] <= last)
+            out[count++] = wheel_primes[i];
+        ++i;
+      } /*for*/
+    atomic_init(&job.failed, false);
+    if
+      (
+            count < max_out
+        and
+            not job.test_each
+        and
+            not sieve_base_primes(last, &job.base_primes, &job.nr_base_primes)
+      )
+        atomic_store(&job.failed, true);
+    if (count < max_out and not atomic_load(&job.failed))
+      {
+        const uint64_t chunk_bytes = SIEVE_CHUNK_SEGMENTS * SIEVE_SEGMENT_BYTES;
+        job.nr_chunks = (last / 30 - lo / 30) / chunk_bytes + 1;
+        atomic_init(&job.next_chunk, 0);
+        atomic_init(&job.nr_done, 0);
+        atomic_init(&job.nr_out, count);
+        run_workers(prime_worker, &job, threads_for(job.nr_chunks, 1, nr_threads));
+        count = atomic_load(&job.nr_out);
+      } /*if*/
+    free(job.base_primes);
+    *nr_out = count;
+    return
+        not atomic_load(&job.failed);
+  } /*run_primes*/
+
+/*
+    Sieve factorization
+
+    Factorizes every integer in a window [lo, last], a segment of
+    FACTOR_RANGE_SEGMENT consecutive values at a time. Each prime p up
+    to √last divides exactly every pth value, so rather than trying
+    every prime on every value, each prime is only divided into its own
+    multiples, by multiplying by its inverse, as in trial division. What
+    is left of each value is then either 1 or a single prime. The factors
+    are recorded in the order they are found, that is, prime by prime,
+    then a counting sort by value gathers them into the same packed form
+    as factorize_csr produces, with each value’s factors still in
+    ascending order.
+
+    Near 2**64, sieving with all the primes up to 2**32 would cost more
+    in finding each one’s first multiple in every segment than in the
+    sieving itself, so only primes up to FACTOR_RANGE_MAX_PRIME are used,
+    and any cofactor left over that is too big to be prime is finished
+    off with rho. A window too narrow to be worth sieving at all just has
+    each value factorized separately.
+*/
+
+#define FACTOR_RANGE_SEGMENT 32768 /* nr of values factorized together */
+#define FACTOR_RANGE_MAX_PRIME ((uint64_t)1 << 20) /* biggest sieved with */
+#define FACTOR_RANGE_TEST_RATIO 64
+  /* windows narrower than the biggest prime needed divided by this have
+    each value factorized separately */
+
+struct range_primes
+  /* the primes to sieve a window with */
+  {
+    struct trial_prime * primes; /* odd primes in ascending order */
+    size_t nr_primes;
+    bool complete; /* includes all the primes up to √last */
+    bool test_each; /* window is not worth sieving */
+  };
+
+struct range_entry
+  /* a factor of one value in a segment */
+  {
+    uint64_t prime;
+    uint32_t index; /* of value within segment */
+    uint32_t power;
+  };
+
+struct range_segment
+  /* the factorizations of a run of consecutive values */
+  {
+    uint64_t start; /* first value */
+    size_t nr_values;
+    uint64_t * primes; /* prime factors of each value in turn */
+    uint8_t * powers; /* corresponding powers */
+    size_t max_factors; /* room in primes and powers */
+    struct range_entry * entries; /* factors in the order they were found */
+    size_t nr_entries, max_entries;
+    uint32_t offsets[FACTOR_RANGE_SEGMENT + 1];
+      /* factors of start + i are at [offsets[i], offsets[i + 1]) in primes and powers */
+    uint8_t statuses[FACTOR_RANGE_SEGMENT]; /* enum factorize_status values */
+    uint64_t rem[FACTOR_RANGE_SEGMENT]; /* part of each value not yet factorized */
+  };
+
+static void trial_prime_init
+  (
+    struct trial_prime * t,
+    uint64_t p /* odd */
+  )
+  /* fills in t for trial division by p, as gen-trial-primes does for the
+    built-in ones. */
+  {
+    uint64_t inverse = p; /* correct to 3 bits, since p * p ≡ 1 (mod 8) */
+    for (unsigned int j = 0;;)
+      {
+        if (j == 5)
+            break;
+        inverse *= 2 - p * inverse; /* Newton iteration doubles the bits */
+        ++j;
+      } /*for*/
+    t->prime = p;
+    t->inverse = inverse;
+    t->bound = UINT64_MAX / p;
+  } /*trial_prime_init*/
+
+static void range_primes_dispose
+  (
+    struct range_primes * rp
+  )
+  {
+    free(rp->primes);
+    rp->primes = NULL;
+  } /*range_primes_dispose*/
+
+static bool range_primes_init
+  (
+    struct range_primes * rp,
+    uint64_t lo,
+    uint64_t last /* must be at least lo */
+  )
+  /* finds the primes needed to sieve [lo, last]. Returns false if out of
+    memory; in any case, the caller must dispose of it with
+    range_primes_dispose. */
+  {
+    bool ok = false;
+    uint32_t * base_primes = NULL;
+    size_t nr_base_primes;
+    const uint64_t root = sieve_root(last);
+    rp->primes = NULL;
+    rp->nr_primes = 0;
+    rp->complete = root <= FACTOR_RANGE_MAX_PRIME;
+    rp->test_each =
+        last - lo < (rp->complete ? root : FACTOR_RANGE_MAX_PRIME) / FACTOR_RANGE_TEST_RATIO;
+    do /*once*/
+      {
+        if (rp->test_each)
+          {
+            ok = true;
+            break;
+          } /*if*/
+        if
+          (
+            not sieve_base_primes
+              (
+                rp->complete ? last : FACTOR_RANGE_MAX_PRIME * FACTOR_RANGE_MAX_PRIME,
+                &base_primes,
+                &nr_base_primes
+              )
+          )
+            break;
+        rp->primes = malloc((nr_base_primes + 2) * sizeof(struct trial_prime));
+        if (rp->primes == NULL)
+            break;
+        for (size_t i = 0;;)
+          {
+            if (i == nr_base_primes + 2)
+                break;
+            const uint64_t p = i < 2 ? wheel_primes[i + 1] : base_primes[i - 2];
+            if (p > root)
+                break; /* only possible with 3 or 5 */
+            trial_prime_init(&rp->primes[i], p);
+            ++rp->nr_primes;
+            ++i;
+          } /*for*/
+        ok = true;
+      }
+    while (false);
+    free(base_primes);
+    return
+        ok;
+  } /*range_primes_init*/
+
+static void range_segment_dispose
+  (
+    struct range_segment * seg
+  )
+  /* noop if seg is NULL. */
+  {
+    if (seg != NULL)
+      {
+        free(seg->primes);
+        free(seg->powers);
+        free(seg->entries);
+        free(seg);
+      } /*if*/
+  } /*range_segment_dispose*/
+
+static struct range_segment * range_segment_new(void)
+  /* returns a new, empty segment, or NULL if out of memory. */
+  {
+    struct range_segment * result = NULL;
+    struct range_segment * seg = NULL;
+    do /*once*/
+      {
+        seg = malloc(sizeof(struct range_segment));
+        if (seg == NULL)
+            break;
+        seg->nr_values = 0;
+        seg->max_entries = seg->max_factors = 4 * FACTOR_RANGE_SEGMENT;
+          /* about right for values up to 2**64 */
+        seg->entries = malloc(seg->max_entries * sizeof(struct range_entry));
+        seg->primes = malloc(seg->max_factors * sizeof(uint64_t));
+        seg->powers = malloc(seg->max_factors);
+        if (seg->entries == NULL or seg->primes == NULL or seg->powers == NULL)
+            break;
+      /* all done */
+        result = seg;
+        seg = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    range_segment_dispose(seg);
+    return
+        result;
+  } /*range_segment_new*/
+
+static inline bool range_segment_add
+  (
+    struct range_segment * seg,
+    uint64_t prime,
+    uint32_t index,
+    uint32_t power
+  )
+  /* records a factor of the value at index, growing the entries as
+    necessary. Returns false if out of memory. */
+  {
+    bool ok = true;
+    if (seg->nr_entries == seg->max_entries)
+      {
+        struct range_entry * const entries =
+            realloc(seg->entries, 2 * seg->max_entries * sizeof(struct range_entry));
+        if (entries != NULL)
+          {
+            seg->entries = entries;
+            seg->max_entries *= 2;
+          }
+        else
+            ok = false;
+      } /*if*/
+    if (ok)
+      {
+        struct range_entry * const e = &seg->entries[seg->nr_entries++];
+        e->prime = prime;
+        e->index = index;
+        e->power = power;
+      } /*if*/
+    return
+        ok;
+  } /*range_segment_add*/
+
+static inline void range_segment_get
+  (
+    const struct range_segment * seg,
+    size_t i,
+    struct factorization * f
+  )
+  /* unpacks the factors of the ith value in seg. */
+  {
+    f->nr_factors = 0;
+    for (uint32_t j = seg->offsets[i];;)
+      {
+        if (j == seg->offsets[i + 1])
+            break;
+        f->factors[f->nr_factors].prime = seg->primes[j];
+        f->factors[f->nr_factors].power = seg->powers[j];
+        ++f->nr_factors;
+        ++j;
+      } /*for*/
+  } /*range_segment_get*/
+
+static bool range_segment_fill
+  (
+    struct range_segment * seg,
+    const struct range_primes * rp,
+    uint64_t start,
+    size_t nr_values /* at most FACTOR_RANGE_SEGMENT, start + nr_values - 1 must not overflow */
+  )
+  /* factorizes the values from start to start + nr_values - 1 into seg.
+    Returns false if out of memory. */
+  {
+    bool ok = false;
+    bool nomem = false;
+    seg->start = start;
+    seg->nr_values = nr_values;
+    seg->nr_entries = 0;
+    do /*once*/
+      {
+        if (rp->test_each)
+          {
+            for (size_t i = 0;;)
+              {
+                if (i == nr_values)
+                    break;
+                struct factorization f = {.nr_factors = 0};
+                if (start + i >= 2)
+                    factorize_u64(&f, start + i, NULL);
+                for (unsigned int j = 0;;)
+                  {
+                    if (j == f.nr_factors)
+                        break;
+                    if (not range_segment_add(seg, f.factors[j].prime, i, f.factors[j].power))
+                      {
+                        nomem = true;
+                        break;
+                      } /*if*/
+                    ++j;
+                  } /*for*/
+                if (nomem)
+                    break;
+                ++i;
+              } /*for*/
+            if (nomem)
+                break;
+          }
+        else
+          {
+          /* powers of 2 */
+            for (size_t i = 0;;)
+              {
+                if (i == nr_values)
+                    break;
+                const uint64_t n = start + i;
+                const unsigned int twos = n != 0 ? __builtin_ctzll(n) : 0;
+                seg->rem[i] = n >> twos;
+                if (twos != 0 and not range_segment_add(seg, 2, i, twos))
+                  {
+                    nomem = true;
+                    break;
+                  } /*if*/
+                ++i;
+              } /*for*/
+            if (nomem)
+                break;
+          /* odd primes, each dividing just its own multiples */
+            for (size_t k = 0;;)
+              {
+                if (k == rp->nr_primes)
+                    break;
+                const struct trial_prime * const t = &rp->primes[k];
+                const uint64_t r = start % t->prime;
+                size_t i = r != 0 ? t->prime - r : start != 0 ? 0 : t->prime; /* skipping 0 */
+                for (;;)
+                  {
+                    if (i >= nr_values)
+                        break;
+                    uint64_t n = seg->rem[i] * t->inverse; /* exact */
+                    uint32_t power = 1;
+                    for (;;)
+                      {
+                        const uint64_t quotient = n * t->inverse;
+                        if (quotient > t->bound)
+                            break;
+                        n = quotient;
+                        ++power;
+                      } /*for*/
+                    seg->rem[i] = n;
+                    if (not range_segment_add(seg, t->prime, i, power))
+                      {
+                        nomem = true;
+                        break;
+                      } /*if*/
+                    i += t->prime;
+                  } /*for*/
+                if (nomem)
+                    break;
+                ++k;
+              } /*for*/
+            if (nomem)
+                break;
+          /* whatever is left over */
+            const uint64_t max_prime = rp->nr_primes != 0 ? rp->primes[rp->nr_primes - 1].prime : 1;
+            for (size_t i = 0;;)
+              {
+                if (i == nr_values)
+                    break;
+                const uint64_t n = seg->rem[i];
+                if (n > 1)
+                  {
+                    struct factorization f = {.nr_factors = 0};
+                    if (rp->complete or n <= max_prime * max_prime)
+                        factorization_add(&f, n, 1); /* can only be prime */
+                    else
+                        factorize_cofactor(&f, n);
+                    for (unsigned int j = 0;;)
+                      {
+                        if (j == f.nr_factors)
+                            break;
+                        if (not range_segment_add(seg, f.factors[j].prime, i, f.factors[j].power))
+                          {
+                            nomem = true;
+                            break;
+                          } /*if*/
+                        ++j;
+                      } /*for*/
+                    if (nomem)
+                        break;
+                  } /*if*/
+                ++i;
+              } /*for*/
+            if (nomem)
+                break;
+          } /*if*/
+      /* gather factors by value */
+        if (seg->nr_entries > seg->max_factors)
+          {
+            uint64_t * const primes = realloc(seg->primes, seg->nr_entries * sizeof(uint64_t));
+            if (primes != NULL)
+                seg->primes = primes;
+            uint8_t * const powers = realloc(seg->powers, seg->nr_entries);
+            if (powers != NULL)
+                seg->powers = powers;
+            if (primes == NULL or powers == NULL)
+                break;
+            seg->max_factors = seg->nr_entries;
+          } /*if*/
+        memset(seg->offsets, 0, (nr_values + 1) * sizeof(uint32_t));
+        for (size_t j = 0;;)
+          {
+            if (j == seg->nr_entries)
+                break;
+            ++seg->offsets[seg->entries[j].index + 1];
+            ++j;
+          } /*for*/
+        for (size_t i = 0;;)
+          {
+            if (i == nr_values)
+                break;
+            seg->offsets[i + 1] += seg->offsets[i];
+            ++i;
+          } /*for*/
+        for (size_t j = 0;;)
+          {
+          /* offsets[i] is used as the next free slot for value i, which leaves it
+            equal to the original offsets[i + 1] at the end */
+            if (j == seg->nr_entries)
+                break;
+            const struct range_entry * const e = &seg->entries[j];
+            const uint32_t slot = seg->offsets[e->index]++;
+            seg->primes[slot] = e->prime;
+            seg->powers[slot] = e->power;
+            ++j;
+          } /*for*/
+        memmove(seg->offsets + 1, seg->offsets, nr_values * sizeof(uint32_t));
+        seg->offsets[0] = 0;
+        for (size_t i = 0;;)
+          {
+            if (i == nr_values)
+                break;
+            if (start + i < 2)
+                seg->statuses[i] = FACTORIZE_TOO_SMALL;
+            else
+              {
+                struct factorization f;
+                range_segment_get(seg, i, &f);
+                seg->statuses[i] = factorization_status(&f);
+              } /*if*/
+            ++i;
+          } /*for*/
+        ok = true;
+      }
+    while (false);
+    return
+        ok;
+  } /*range_segment_fill*/
+
+struct range_job
+  /* factorizing a window into packed arrays, shared between threads each
+    claiming one segment at a time, and placing its results in order in
+    the same way as for parallel prime sieving */
+  {
+    const struct range_primes * rp;
+    uint64_t lo, last;
+    uint64_t * offsets; /* max_values + 1 entries */
+    uint64_t * primes;
+    uint8_t * exponents;
+    uint8_t * statuses; /* optional */
+    size_t max_values; /* room in offsets, less 1, and in statuses */
+    size_t max_factors; /* room in primes and exponents */
+    uint64_t nr_segments;
+    atomic_uint_fast64_t next_segment; /* index of next unclaimed segment */
+    atomic_uint_fast64_t nr_done; /* nr of segments whose results have been placed */
+    size_t nr_values_out, nr_factors_out; /* only touched in turn, as per nr_done */
+    atomic_bool full; /* no room for any more values */
+    atomic_bool failed; /* out of memory */
+    atomic_size_t first_failure; /* index of first unsuccessful value, if any */
+  };
+
+static void * range_worker
+  (
+    void * arg
+  )
+  {
+    struct range_job * const job = arg;
+    struct range_segment * seg = range_segment_new();
+    if (seg == NULL)
+        atomic_store(&job->failed, true);
+    for (;;)
+      {
+        if (seg == NULL or atomic_load(&job->failed) or atomic_load(&job->full))
+            break;
+        const uint64_t segment = atomic_fetch_add(&job->next_segment, 1);
+        if (segment >= job->nr_segments)
+            break;
+      /* from here on, the segment must be placed, even if not filled */
+        const uint64_t start = job->lo + segment * FACTOR_RANGE_SEGMENT;
+        const size_t nr_values =
+            job->last - start < FACTOR_RANGE_SEGMENT ? job->last - start + 1 : FACTOR_RANGE_SEGMENT;
+        bool filled = false;
+        if (not atomic_load(&job->full) and not atomic_load(&job->failed))
+          {
+            filled = range_segment_fill(seg, job->rp, start, nr_values);
+            if (not filled)
+                atomic_store(&job->failed, true);
+          } /*if*/
+        for (;;)
+          {
+            if (atomic_load_explicit(&job->nr_done, memory_order_acquire) == segment)
+                break;
+            sched_yield();
+          } /*for*/
+      /* work out how many whole values fit */
+        const size_t values_pos = job->nr_values_out;
+        const size_t factors_pos = job->nr_factors_out;
+        size_t nr_placed = 0;
+        size_t nr_factors = 0;
+        for (;;)
+          {
+            if (not filled or atomic_load(&job->full) or nr_placed == nr_values)
+                break;
+            const size_t count =
+                seg->statuses[nr_placed] == FACTORIZE_OK ?
+                    seg->offsets[nr_placed + 1] - seg->offsets[nr_placed]
+                :
+                    0;
+            if
+              (
+                    values_pos + nr_placed == job->max_values
+                or
+                    factors_pos + nr_factors + count > job->max_factors
+              )
+              {
+                atomic_store(&job->full, true);
+                break;
+              } /*if*/
+            nr_factors += count;
+            ++nr_placed;
+          } /*for*/
+        job->nr_values_out = values_pos + nr_placed;
+        job->nr_factors_out = factors_pos + nr_factors;
+        atomic_store_explicit(&job->nr_done, segment + 1, memory_order_release);
+      /* and put them there */
+        uint64_t pos = factors_pos;
+        for (size_t i = 0;;)
+          {
+            if (i == nr_placed)
+                break;
+            const uint8_t status = seg->statuses[i];
+            if (status == FACTORIZE_OK)
+              {
+                const uint32_t from = seg->offsets[i], to = seg->offsets[i + 1];
+                memcpy(job->primes + pos, seg->primes + from, (to - from) * sizeof(uint64_t));
+                memcpy(job->exponents + pos, seg->powers + from, to - from);
+                pos += to - from;
+              }
+            else
+              {
+                size_t prev = atomic_load(&job->first_failure);
+                for (;;)
+                  {
+                    if (prev <= values_pos + i)
+                        break;
+                    if (atomic_compare_exchange_weak(&job->first_failure, &prev, values_pos + i))
+                        break;
+                  } /*for*/
+              } /*if*/
+            if (job->statuses != NULL)
+                job->statuses[values_pos + i] = status;
+            job->offsets[values_pos + i + 1] = pos;
+            ++i;
+          } /*for*/
+      } /*for*/
+    range_segment_dispose(seg);
+    return
+        NULL;
+  } /*range_worker*/
+
+static bool run_factorize_range
+  (
+    struct range_job * job, /* all but the atomics and output counts filled in */
+    unsigned int nr_threads
+  )
+  /* factorizes as many values as will fit from the window into the
+    arrays, leaving the nrs of values and factors placed in
+    job->nr_values_out and job->nr_factors_out. Must be called without
+    the GIL. Returns false if out of memory. */
+  {
+    job->nr_segments = (job->last - job->lo) / FACTOR_RANGE_SEGMENT + 1;
+    job->nr_values_out = 0;
+    job->nr_factors_out = 0;
+    job->offsets[0] = 0;
+    atomic_init(&job->next_segment, 0);
+    atomic_init(&job->nr_done, 0);
+    atomic_init(&job->full, job->max_values == 0);
+    atomic_init(&job->failed, false);
+    atomic_init(&job->first_failure, SIZE_MAX);
+    run_workers(range_worker, job, threads_for(job->nr_segments, 1, nr_threads));
+    return
+        not atomic_load(&job->failed);
+  } /*run_factorize_range*/
+
+/*
+    Arithmetic function tables
+
+    Multiplicative and additive functions over a window, computed from
+    the factorizations that the window sieve produces. Unlike the
+    factorizations themselves, these are returned for every value, 5s
+    and all. Each segment of the window ends up in a fixed place in the
+    output, so the threads can each claim a segment at a time and put
+    its results straight there, without having to wait for each other.
+*/
+
+enum arith_function
+  {
+    ARITH_TOTIENT, /* uint64, Euler’s φ */
+    ARITH_MOBIUS, /* int8, Möbius μ */
+    ARITH_OMEGA, /* uint8, nr of distinct prime factors ω */
+    ARITH_BIGOMEGA, /* uint8, nr of prime factors with multiplicity Ω */
+    ARITH_SIGMA, /* uint64, sum of divisors σ */
+  };
+
+static size_t arith_segment
+  (
+    enum arith_function func,
+    const struct range_segment * seg,
+    void * out /* entry for value seg->start */
+  )
+  /* computes func for each value in seg into out, returning the index of
+    the first value for which the result doesn’t fit, or SIZE_MAX if
+    none. Zero, having no sensible value for any of these, gets 0. */
+  {
+    size_t overflow = SIZE_MAX;
+    for (size_t i = 0;;)
+      {
+        if (i == seg->nr_values)
+            break;
+        const uint64_t n = seg->start + i;
+        const uint32_t from = seg->offsets[i], to = seg->offsets[i + 1];
+        switch (func)
+          {
+        case ARITH_TOTIENT:
+          {
+            uint64_t result = n;
+            for (uint32_t j = from;;)
+              {
+                if (j == to)
+                    break;
+                result = result / seg->primes[j] * (seg->primes[j] - 1);
+                ++j;
+              } /*for*/
+            ((uint64_t *)out)[i] = result;
+          }
+        break;
+        case ARITH_MOBIUS:
+          {
+            int8_t result = n != 0 ? 1 : 0;
+            for (uint32_t j = from;;)
+              {
+                if (j == to)
+                    break;
+                if (seg->powers[j] > 1)
+                  {
+                    result = 0;
+                    break;
+                  } /*if*/
+                result = -result;
+                ++j;
+              } /*for*/
+            ((int8_t *)out)[i] = result;
+          }
+        break;
+        case ARITH_OMEGA:
+            ((uint8_t *)out)[i] = to - from;
+        break;
+        case ARITH_BIGOMEGA:
+          {
+            uint8_t result = 0;
+            for (uint32_t j = from;;)
+              {
+                if (j == to)
+                    break;
+                result += seg->powers[j];
+                ++j;
+              } /*for*/
+            ((uint8_t *)out)[i] = result;
+          }
+        break;
+        case ARITH_SIGMA:
+          {
+          /* product of 1 + p + … + p**e over prime powers p**e; each of these
+            is less than 2 * n, so fits in 128 bits along with anything less
+            than 2**64 it is multiplied by */
+            uint128_t result = n != 0 ? 1 : 0;
+            for (uint32_t j = from;;)
+              {
+                if (j == to or result > UINT64_MAX)
+                    break;
+                const uint64_t p = seg->primes[j];
+                uint64_t power = 1;
+                uint128_t sum = 1;
+                for (unsigned int k = 0;;)
+                  {
+                    if (k == seg->powers[j])
+                        break;
+                    power *= p;
+                    sum += power;
+                    ++k;
+                  } /*for*/
+                result = sum <= UINT64_MAX ? result * sum : (uint128_t)UINT64_MAX + 1;
+                ++j;
+              } /*for*/
+            if (result > UINT64_MAX and overflow == SIZE_MAX)
+                overflow = i;
+            ((uint64_t *)out)[i] = result;
+          }
+        break;
+          } /*switch*/
+        ++i;
+      } /*for*/
+    return
+        overflow;
+  } /*arith_segment*/
+
+struct arith_job
+  /* computing an arithmetic function over a window, shared between
+    threads each claiming one segment at a time */
+  {
+    enum arith_function func;
+    size_t itemsize; /* of out */
+    const struct range_primes * rp;
+    uint64_t lo, last;
+    void * out;
+    uint64_t nr_segments;
+    atomic_uint_fast64_t next_segment; /* index of next unclaimed segment */
+    atomic_bool failed; /* out of memory */
+    atomic_size_t first_overflow; /* index of first value whose result didn’t fit, if any */
+  };
+
+static void * arith_worker
+  (
+    void * arg
+  )
+  {
+    struct arith_job * const job = arg;
+    struct range_segment * seg = range_segment_new();
+    if (seg == NULL)
+        atomic_store(&job->failed, true);
+    for (;;)
+      {
+        if (seg == NULL or atomic_load(&job->failed))
+            break;
+        const uint64_t segment = atomic_fetch_add(&job->next_segment, 1);
+        if (segment >= job->nr_segments)
+            break;
+        const uint64_t start = job->lo + segment * FACTOR_RANGE_SEGMENT;
+        const size_t nr_values =
+            job->last - start < FACTOR_RANGE_SEGMENT ? job->last - start + 1 : FACTOR_RANGE_SEGMENT;
+        if (not range_segment_fill(seg, job->rp, start, nr_values))
+          {
+            atomic_store(&job->failed, true);
+            break;
+          } /*if*/
+        const size_t overflow = arith_segment
+          (
+            job->func,
+            seg,
+            (uint8_t *)job->out + segment * FACTOR_RANGE_SEGMENT * job->itemsize
+          );
+        if (overflow != SIZE_MAX)
+          {
+            const size_t index = segment * FACTOR_RANGE_SEGMENT + overflow;
+            size_t prev = atomic_load(&job->first_overflow);
+            for (;;)
+              {
+                if (prev <= index)
+                    break;
+                if (atomic_compare_exchange_weak(&job->first_overflow, &prev, index))
+                    break;
+              } /*for*/
+          } /*if*/
+      } /*for*/
+    range_segment_dispose(seg);
+    return
+        NULL;
+  } /*arith_worker*/
+
+static bool run_arith_range
+  (
+    struct arith_job * job, /* all but the atomics filled in */
+    unsigned int nr_threads
+  )
+  /* computes job->func for each value from job->lo to job->last inclusive
+    into job->out. Must be called without the GIL. Returns false if out
+    of memory. */
+  {
+    job->nr_segments = (job->last - job->lo) / FACTOR_RANGE_SEGMENT + 1;
+    atomic_init(&job->next_segment, 0);
+    atomic_init(&job->failed, false);
+    atomic_init(&job->first_overflow, SIZE_MAX);
+    run_workers(arith_worker, job, threads_for(job->nr_segments, 1, nr_threads));
+    return
+        not atomic_load(&job->failed);
+  } /*run_arith_range*/
+
+/*
+    Multiple-precision factorization
+
+    Integers of 2**64 or more are held as little-endian arrays of 64-bit
+    limbs, with an explicit length, normalized to have no high-order zero
+    limbs. After the powers of 2 and the primes up to TRIAL_LIMIT have
+    been divided out, any composite cofactor is attacked first with
+    Brent’s rho for a limited nr of iterations, which finds any smallish
+    factors quickly, then with Lenstra’s elliptic curve method (ECM),
+    whose running time depends on the size of the factor found rather
+    than of the number being factorized. Cofactors up to SIQS_MAX_BITS
+    are handed over to the quadratic sieve instead, after at most a
+    few ECM curves. Before any of that, a cofactor is checked for being
+    a perfect power, since none of these methods can tell the prime
+    apart from its powers, and each factor found is divided out as many
+    times as it will go.
+
+    Each ECM curve is run through stage 1, which finds a factor p if the
+    order of the curve modulo p has no prime-power factors above a bound
+    B1, and if that fails, through stage 2, which allows for one further
+    prime factor up to B2. The bounds go up as more curves are tried
+    without success. Curves are in Montgomery form, with points
+    represented by their projective X and Z coordinates only, chosen by
+    Suyama’s parametrization, which ensures the group order is divisible
+    by 12 while avoiding any need for inversions modulo n.
+
+    Primality of cofactors beyond 64 bits is decided by the Baillie-PSW
+    test. All of this is pure C, so it can run without the GIL. Factors
+    which fit in 64 bits are finished off by the single-precision code.
+*/
+
+static size_t mp_normalize
+  (
+    const uint64_t * a,
+    size_t len
+  )
+  /* returns len less any high-order zero limbs. */
+  {
+    for (;;)
+      {
+        if (len == 0 or a[len - 1] != 0)
+            break;
+        --len;
+      } /*for*/
+    return
+        len;
+  } /*mp_normalize*/
+
+static int mp_cmp
+  (
+    const uint64_t * a,
+    size_t alen,
+    const uint64_t * b,
+    size_t blen
+  )
+  /* compares normalized a and b, returning -1, 0 or +1. */
+  {
+    int result = alen < blen ? -1 : alen > blen ? 1 : 0;
+    if (result == 0)
+      {
+        for (size_t i = alen;;)
+          {
+            if (i == 0)
+                break;
+            --i;
+            if (a[i] != b[i])
+              {
+                result = a[i] < b[i] ? -1 : 1;
+                break;
+              } /*if*/
+          } /*for*/
+      } /*if*/
+    return
+        result;
+  } /*mp_cmp*/
+
+static uint64_t mp_add_n
+  (
+    uint64_t * r,
+    const uint64_t * a,
+    const uint64_t * b,
+    size_t k
+  )
+  /* r = a + b, all of k limbs; returns the carry out. */
+  {
+    uint64_t carry = 0;
+    for (size_t i = 0;;)
+      {
+        if (i == k)
+            break;
+        const uint128_t sum = (uint128_t)a[i] + b[i] + carry;
+        r[i] = (uint64_t)sum;
+        carry = (uint64_t)(sum >> 64);
+        ++i;
+      } /*for*/
+    return
+        carry;
+  } /*mp_add_n*/
+
+static uint64_t mp_sub_n
+  (
+    uint64_t * r,
+    const uint64_t * a,
+    const uint64_t * b,
+    size_t k
+  )
+  /* r = a - b, all of k limbs; returns the borrow out. */
+  {
+    uint64_t borrow = 0;
+    for (size_t i = 0;;)
+      {
+        if (i == k)
+            break;
+        const uint64_t ai = a[i], bi = b[i];
+        r[i] = ai - bi - borrow;
+        borrow = ai < bi or ai - bi < borrow;
+        ++i;
+      } /*for*/
+    return
+        borrow;
+  } /*mp_sub_n*/
+
+static size_t mp_sub
+  (
+    uint64_t * a,
+    size_t alen,
+    const uint64_t * b,
+    size_t blen
+  )
+  /* a -= b, where a ≥ b; returns the normalized length of the result. */
+  {
+    uint64_t borrow = mp_sub_n(a, a, b, blen);
+    for (size_t i = blen;;)
+      {
+        if (borrow == 0 or i == alen)
+            break;
+        borrow = a[i] == 0;
+        --a[i];
+        ++i;
+      } /*for*/
+    return
+        mp_normalize(a, alen);
+  } /*mp_sub*/
+
+static uint64_t mp_divrem_1
+  (
+    uint64_t * q, /* may be NULL, or the same as a */
+    const uint64_t * a,
+    size_t len,
+    uint64_t d
+  )
+  /* divides a by d, putting the quotient in q if wanted, and returns the remainder. */
+  {
+    uint64_t rem = 0;
+    for (size_t i = len;;)
+      {
+        if (i == 0)
+            break;
+        --i;
+        const uint128_t cur = (uint128_t)rem << 64 | a[i];
+        if (q != NULL)
+            q[i] = (uint64_t)(cur / d);
+        rem = (uint64_t)(cur % d);
+      } /*for*/
+    return
+        rem;
+  } /*mp_divrem_1*/
+
+static unsigned int mp_ctz
+  (
+    const uint64_t * a,
+    size_t len /* a must be nonzero */
+  )
+  {
+    size_t i = 0;
+    for (;;)
+      {
+        if (a[i] != 0)
+            break;
+        ++i;
+      } /*for*/
+    return
+        i * 64 + __builtin_ctzll(a[i]);
+  } /*mp_ctz*/
+
+static size_t mp_shr
+  (
+    uint64_t * a,
+    size_t len,
+    unsigned int shift
+  )
+  /* shifts a right in place by shift bits, returning the normalized length. */
+  {
+    const size_t limbs = shift / 64;
+    const unsigned int bits = shift % 64;
+    size_t i = 0;
+    for (;;)
+      {
+        if (i + limbs >= len)
+            break;
+        a[i] = a[i + limbs] >> bits;
+        if (bits != 0 and i + limbs + 1 < len)
+            a[i] |= a[i + limbs + 1] << (64 - bits);
+        ++i;
+      } /*for*/
+    for (;;)
+      {
+        if (i >= len)
+            break;
+        a[i] = 0;
+        ++i;
+      } /*for*/
+    return
+        mp_normalize(a, len);
+  } /*mp_shr*/
+
+static void mp_divexact
+  (
+    uint64_t * q, /* room for alen - dlen + 1 limbs */
+    uint64_t * a, /* destroyed */
+    size_t alen,
+    const uint64_t * d, /* must be odd */
+    size_t dlen
+  )
+  /* q = a / d, where d is known to divide a exactly. Done from the low
+    end (Jebelean), multiplying by the inverse of d modulo 2**64 to
+    get each quotient limb, so no division instructions are needed. */
+  {
+    uint64_t dinv = d[0];
+    for (unsigned int i = 0;;)
+      {
+        if (i == 5)
+            break;
+        dinv *= 2 - d[0] * dinv; /* as for mont64_init */
+        ++i;
+      } /*for*/
+    for (size_t i = 0;;)
+      {
+        if (i + dlen > alen)
+            break;
+        const uint64_t qi = a[i] * dinv;
+        q[i] = qi;
+        uint64_t borrow = 0;
+        for (size_t j = 0;;)
+          {
+            if (j == dlen)
+                break;
+            const uint128_t p = (uint128_t)qi * d[j] + borrow;
+            const uint64_t t = a[i + j];
+            a[i + j] = t - (uint64_t)p;
+            borrow = (uint64_t)(p >> 64) + (t < (uint64_t)p);
+            ++j;
+          } /*for*/
+        for (size_t j = i + dlen;;)
+          {
+            if (borrow == 0 or j == alen)
+                break;
+            const uint64_t t = a[j];
+            a[j] = t - borrow;
+            borrow = t < borrow;
+            ++j;
+          } /*for*/
+        ++i;
+      } /*for*/
+  } /*mp_divexact*/
+
+static size_t mp_gcd
+  (
+    uint64_t * g, /* room for blen limbs */
+    uint64_t * a, /* destroyed */
+    size_t alen,
+    uint64_t * b, /* must be odd; destroyed */
+    size_t blen
+  )
+  /* binary gcd, putting the result in g and returning its length. */
+  {
+    alen = mp_normalize(a, alen);
+    blen = mp_normalize(b, blen);
+    if (alen != 0)
+      {
+        alen = mp_shr(a, alen, mp_ctz(a, alen));
+        for (;;)
+          {
+          /* both odd at this point */
+            if (alen == 1 and blen == 1)
+              {
+                b[0] = gcd_u64(a[0], b[0]);
+                break;
+              } /*if*/
+            const int cmp = mp_cmp(a, alen, b, blen);
+            if (cmp == 0)
+                break;
+            if (cmp > 0)
+              {
+                uint64_t * const t = a;
+                const size_t tlen = alen;
+                a = b;
+                alen = blen;
+                b = t;
+                blen = tlen;
+              } /*if*/
+            blen = mp_sub(b, blen, a, alen);
+            blen = mp_shr(b, blen, mp_ctz(b, blen));
+          } /*for*/
+      } /*if*/
+    memmove(g, b, blen * sizeof(uint64_t));
+    return
+        blen;
+  } /*mp_gcd*/
+
+#define MP_NR_TEMPS 24 /* nr of k-limb temporaries in an mp_mont workspace */
+
+struct mp_mont
+  /* precomputed values for arithmetic modulo odd multiple-precision n in
+    Montgomery form, with R = 2**(64·k), together with some workspace. */
+  {
+    size_t k; /* nr of limbs in n */
+    uint64_t ninv; /* -n**-1 mod 2**64 */
+    uint64_t * n; /* this and the following are k limbs each */
+    uint64_t * one; /* R mod n, being 1 in Montgomery form */
+    uint64_t * r2; /* R**2 mod n, for converting into Montgomery form */
+    uint64_t * unit; /* plain 1, for converting out of Montgomery form */
+    uint64_t * temps; /* MP_NR_TEMPS temporaries for callers */
+    uint64_t * t; /* k + 2 limbs of scratch for mp_mont_mul */
+  };
+
+static inline uint64_t * mp_temp
+  (
+    const struct mp_mont * m,
+    unsigned int i
+  )
+  {
+    return
+        m->temps + i * m->k;
+  } /*mp_temp*/
+
+static inline int mp_cmp_n
+  (
+    const uint64_t * a,
+    const uint64_t * b,
+    size_t k
+  )
+  /* compares a and b, both of k limbs, not necessarily normalized. */
+  {
+    int result = 0;
+    for (size_t i = k;;)
+      {
+        if (i == 0)
+            break;
+        --i;
+        if (a[i] != b[i])
+          {
+            result = a[i] < b[i] ? -1 : 1;
+            break;
+          } /*if*/
+      } /*for*/
+    return
+        result;
+  } /*mp_cmp_n*/
+
+static inline bool mp_is_zero
+  (
+    const uint64_t * a,
+    size_t k
+  )
+  {
+    return
+        mp_normalize(a, k) == 0;
+  } /*mp_is_zero*/
+
+static inline void mp_addmod
+  (
+    const struct mp_mont * m,
+    uint64_t * r,
+    const uint64_t * a,
+    const uint64_t * b
+  )
+  {
+    if (mp_add_n(r, a, b, m->k) != 0 or mp_cmp_n(r, m->n, m->k) >= 0)
+        mp_sub_n(r, r, m->n, m->k);
+  } /*mp_addmod*/
+
+static inline void mp_submod
+  (
+    const struct mp_mont * m,
+    uint64_t * r,
+    const uint64_t * a,
+    const uint64_t * b
+  )
+  {
+    if (mp_sub_n(r, a, b, m->k) != 0)
+        mp_add_n(r, r, m->n, m->k);
+  } /*mp_submod*/
+
+static inline void mp_halfmod
+  (
+    const struct mp_mont * m,
+    uint64_t * a
+  )
+  /* a = a / 2 mod n, in place. */
+  {
+    uint64_t carry = 0;
+    if (a[0] % 2 != 0)
+        carry = mp_add_n(a, a, m->n, m->k);
+    for (size_t i = 0;;)
+      {
+        if (i == m->k)
+            break;
+        a[i] = a[i] >> 1 | (i + 1 < m->k ? a[i + 1] << 63 : carry << 63);
+        ++i;
+      } /*for*/
+  } /*mp_halfmod*/
+
+static void mp_mont_mul
+  (
+    const struct mp_mont * m,
+    uint64_t * r, /* may be the same as a or b */
+    const uint64_t * a,
+    const uint64_t * b
+  )
+  /* r = a·b / R mod n, by coarsely integrated operand scanning (CIOS):
+    one row of the product is added in at a time, then reduced by one
+    limb, so the intermediate result never exceeds k + 2 limbs. */
+  {
+    const size_t k = m->k;
+    uint64_t * const t = m->t;
+    memset(t, 0, (k + 2) * sizeof(uint64_t));
+    for (size_t i = 0;;)
+      {
+        if (i == k)
+            break;
+        uint64_t carry = 0;
+        uint128_t p;
+        for (size_t j = 0;;)
+          {
+            if (j == k)
+                break;
+            p = (uint128_t)a[j] * b[i] + t[j] + carry;
+            t[j] = (uint64_t)p;
+            carry = (uint64_t)(p >> 64);
+            ++j;
+          } /*for*/
+        p = (uint128_t)t[k] + carry;
+        t[k] = (uint64_t)p;
+        t[k + 1] = (uint64_t)(p >> 64);
+        const uint64_t q = t[0] * m->ninv;
+        p = (uint128_t)q * m->n[0] + t[0];
+        carry = (uint64_t)(p >> 64);
+        for (size_t j = 1;;)
+          {
+            if (j == k)
+                break;
+            p = (uint128_t)q * m->n[j] + t[j] + carry;
+            t[j - 1] = (uint64_t)p;
+            carry = (uint64_t)(p >> 64);
+            ++j;
+          } /*for*/
+        p = (uint128_t)t[k] + carry;
+        t[k - 1] = (uint64_t)p;
+        t[k] = t[k + 1] + (uint64_t)(p >> 64);
+        ++i;
+      } /*for*/
+    if (t[k] != 0 or mp_cmp_n(t, m->n, k) >= 0)
+        mp_sub_n(r, t, m->n, k);
+    else
+        memcpy(r, t, k * sizeof(uint64_t));
+  } /*mp_mont_mul*/
+
+static void mp_mont_dispose
+  (
+    struct mp_mont * m
+  )
+  {
+    free(m->n); /* start of the single allocation */
+    m->n = NULL;
+  } /*mp_mont_dispose*/
+
+static bool mp_mont_init
+  (
+    struct mp_mont * m,
+    const uint64_t * n, /* must be odd and normalized, at least 2 limbs */
+    size_t k
+  )
+  /* returns false if out of memory. Otherwise the caller must later
+    dispose of m with mp_mont_dispose. */
+  {
+    uint64_t * const block = malloc(((4 + MP_NR_TEMPS) * k + k + 2) * sizeof(uint64_t));
+    if (block != NULL)
+      {
+        m->k = k;
+        m->n = block;
+        m->one = block + k;
+        m->r2 = block + 2 * k;
+        m->unit = block + 3 * k;
+        m->temps = block + 4 * k;
+        m->t = m->temps + MP_NR_TEMPS * k;
+        memcpy(m->n, n, k * sizeof(uint64_t));
+        uint64_t inv = n[0];
+        for (unsigned int i = 0;;)
+          {
+            if (i == 5)
+                break;
+            inv *= 2 - n[0] * inv; /* as for mont64_init */
+            ++i;
+          } /*for*/
+        m->ninv = -inv;
+        memset(m->unit, 0, k * sizeof(uint64_t));
+        m->unit[0] = 1;
+      /* no multiple-precision division, so compute R mod n and R**2 mod n
+        by repeated doubling of 1 */
+        memcpy(m->one, m->unit, k * sizeof(uint64_t));
+        for (size_t i = 0;;)
+          {
+            if (i == 64 * k)
+                break;
+            mp_addmod(m, m->one, m->one, m->one);
+            ++i;
+          } /*for*/
+        memcpy(m->r2, m->one, k * sizeof(uint64_t));
+        for (size_t i = 0;;)
+          {
+            if (i == 64 * k)
+                break;
+            mp_addmod(m, m->r2, m->r2, m->r2);
+            ++i;
+          } /*for*/
+      } /*if*/
+    return
+        block != NULL;
+  } /*mp_mont_init*/
+
+static inline void mp_mont_set
+  (
+    const struct mp_mont * m,
+    uint64_t * r,
+    uint64_t value /* must be less than n */
+  )
+  /* sets r to value, in Montgomery form. */
+  {
+    memset(r, 0, m->k * sizeof(uint64_t));
+    r[0] = value;
+    mp_mont_mul(m, r, r, m->r2);
+  } /*mp_mont_set*/
+
+static void mp_mont_pow
+  (
+    const struct mp_mont * m,
+    uint64_t * r, /* must not be the same as base */
+    const uint64_t * base, /* in Montgomery form */
+    const uint64_t * exponent,
+    size_t elen
+  )
+  /* r = base ** exponent, in Montgomery form, by left-to-right binary
+    exponentiation. */
+  {
+    memcpy(r, m->one, m->k * sizeof(uint64_t));
+    for (size_t i = elen * 64;;)
+      {
+        if (i == 0)
+            break;
+        --i;
+        mp_mont_mul(m, r, r, r);
+        if (exponent[i / 64] >> i % 64 & 1)
+            mp_mont_mul(m, r, r, base);
+      } /*for*/
+  } /*mp_mont_pow*/
+
+static size_t mp_mont_gcd
+  (
+    const struct mp_mont * m,
+    uint64_t * g, /* room for k limbs */
+    const uint64_t * a,
+    uint64_t * scratch /* room for 2·k limbs */
+  )
+  /* puts gcd(a, n) in g and returns its length. Since R and n are
+    coprime, a may equally be in Montgomery form or not. */
+  {
+    memcpy(scratch, a, m->k * sizeof(uint64_t));
+    memcpy(scratch + m->k, m->n, m->k * sizeof(uint64_t));
+    return
+        mp_gcd(g, scratch, m->k, scratch + m->k, m->k);
+  } /*mp_mont_gcd*/
+
+static inline bool mp_is_proper_factor
+  (
+    const struct mp_mont * m,
+    const uint64_t * g,
+    size_t glen
+  )
+  /* is g, as returned from mp_mont_gcd, neither 1 nor n? */
+  {
+    return
+        not (glen == 1 and g[0] == 1) and mp_cmp(g, glen, m->n, m->k) != 0;
+  } /*mp_is_proper_factor*/
+
+static int jacobi_mp
+  (
+    int64_t a, /* must be odd, with magnitude more than 1 */
+    const uint64_t * n, /* must be odd */
+    size_t len
+  )
+  /* returns the Jacobi symbol (a/n), by way of quadratic reciprocity
+    to reduce it to (n mod |a| / |a|). */
+  {
+    const uint64_t abs_a = a < 0 ? -a : a;
+    int result = jacobi_u128(mp_divrem_1(NULL, n, len, abs_a), abs_a);
+    if (a < 0 and n[0] % 4 == 3)
+        result = -result; /* (-1/n) */
+    if (abs_a % 4 == 3 and n[0] % 4 == 3)
+        result = -result;
+    return
+        result;
+  } /*jacobi_mp*/
+
+static bool is_square_mp
+  (
+    const struct mp_mont * m
+  )
+  /* is m->n a perfect square? Bit-by-bit square root, using shifts and
+    subtractions only; not fast, but only needed in rare cases. Leaves
+    the integer square root in temporary 1; uses temporaries 0-2. */
+  {
+    const size_t k = m->k;
+    uint64_t * const rem = mp_temp(m, 0);
+    uint64_t * const root = mp_temp(m, 1);
+    uint64_t * const trial = mp_temp(m, 2);
+    memcpy(rem, m->n, k * sizeof(uint64_t));
+    memset(root, 0, k * sizeof(uint64_t));
+    unsigned int bit = ((k - 1) * 64 + 63 - __builtin_clzll(m->n[k - 1])) & ~1U;
+      /* highest even bit position not above the top bit of n */
+    for (;;)
+      {
+      /* root has no bits set below position bit + 2 at this point */
+        memcpy(trial, root, k * sizeof(uint64_t));
+        trial[bit / 64] |= (uint64_t)1 << bit % 64;
+        const bool fits = mp_cmp_n(rem, trial, k) >= 0;
+        if (fits)
+            mp_sub_n(rem, rem, trial, k);
+        mp_shr(root, k, 1);
+        if (fits)
+            root[bit / 64] |= (uint64_t)1 << bit % 64;
+        if (bit == 0)
+            break;
+        bit -= 2;
+      } /*for*/
+    return
+        mp_is_zero(rem, k);
+  } /*is_square_mp*/
+
+static void mp_mont_set_signed
+  (
+    const struct mp_mont * m,
+    uint64_t * r,
+    int64_t value /* magnitude must be less than n */
+  )
+  /* sets r to value mod n, in Montgomery form. */
+  {
+    mp_mont_set(m, r, value < 0 ? -value : value);
+    if (value < 0 and not mp_is_zero(r, m->k))
+        mp_sub_n(r, m->n, r, m->k);
+  } /*mp_mont_set_signed*/
+
+static bool is_prime_mp
+  (
+    const struct mp_mont * m /* m->n must be at least 2**128 */
+  )
+  /* Baillie-PSW test of m->n, as for is_prime_u128. Uses temporaries 0-10. */
+  {
+    const size_t k = m->k;
+    bool result = false;
+    do /*once*/
+      {
+        if (gcd_u64(mp_divrem_1(NULL, m->n, k, ODD_PRIMORIAL_53), ODD_PRIMORIAL_53) != 1)
+            break;
+          {
+          /* strong probable-prime test to base 2 */
+            uint64_t * const e = mp_temp(m, 3);
+            uint64_t * const x = mp_temp(m, 4);
+            uint64_t * const two = mp_temp(m, 5);
+            uint64_t * const minus_one = mp_temp(m, 6);
+            memcpy(e, m->n, k * sizeof(uint64_t));
+            e[0] -= 1; /* n is odd, so no borrow */
+            const unsigned int s = mp_ctz(e, k);
+            const size_t elen = mp_shr(e, k, s);
+            mp_mont_set(m, two, 2);
+            mp_mont_pow(m, x, two, e, elen);
+            mp_sub_n(minus_one, m->n, m->one, k);
+            bool probable = mp_cmp_n(x, m->one, k) == 0 or mp_cmp_n(x, minus_one, k) == 0;
+            for (unsigned int r = 1;;)
+              {
+                if (probable or r == s)
+                    break;
+                mp_mont_mul(m, x, x, x);
+                probable = mp_cmp_n(x, minus_one, k) == 0;
+                ++r;
+              } /*for*/
+            if (not probable)
+                break;
+          }
+      /* strong Lucas test, with parameters chosen as for strong_lucas_u128 */
+        int64_t D = 5;
+        int j;
+        for (;;)
+          {
+            j = jacobi_mp(D, m->n, k);
+            if (j != 1)
+                break;
+            if (D == 61 and is_square_mp(m))
+                break; /* no suitable D exists; only worth checking if a few tries fail */
+            D = D > 0 ? -(D + 2) : -D + 2;
+          } /*for*/
+        if (j != -1)
+            break;
+        uint64_t * const U = mp_temp(m, 3);
+        uint64_t * const V = mp_temp(m, 4);
+        uint64_t * const Qk = mp_temp(m, 5);
+        uint64_t * const mD = mp_temp(m, 6);
+        uint64_t * const mQ = mp_temp(m, 7);
+        uint64_t * const d = mp_temp(m, 8);
+        uint64_t * const t1 = mp_temp(m, 9);
+        uint64_t * const t2 = mp_temp(m, 10);
+        mp_mont_set_signed(m, mD, D);
+        mp_mont_set_signed(m, mQ, (1 - D) / 4);
+        memset(t1, 0, k * sizeof(uint64_t));
+        t1[0] = 1;
+        if (mp_add_n(d, m->n, t1, k) != 0)
+            break; /* n = R - 1, divisible by 3 */
+        const unsigned int s = mp_ctz(d, k);
+        const size_t dlen = mp_shr(d, k, s);
+        memcpy(U, m->one, k * sizeof(uint64_t));
+        memcpy(V, m->one, k * sizeof(uint64_t));
+        memcpy(Qk, mQ, k * sizeof(uint64_t));
+        for (size_t i = dlen * 64 - 1 - __builtin_clzll(d[dlen - 1]);;)
+          {
+            if (i == 0)
+                break;
+            --i;
+            mp_mont_mul(m, U, U, V);
+            mp_mont_mul(m, t1, V, V);
+            mp_addmod(m, t2, Qk, Qk);
+            mp_submod(m, V, t1, t2);
+            mp_mont_mul(m, Qk, Qk, Qk);
+            if (d[i / 64] >> i % 64 & 1)
+              {
+                mp_addmod(m, t1, U, V);
+                mp_halfmod(m, t1);
+                mp_mont_mul(m, t2, mD, U);
+                mp_addmod(m, V, t2, V);
+                mp_halfmod(m, V);
+                memcpy(U, t1, k * sizeof(uint64_t));
+                mp_mont_mul(m, Qk, Qk, mQ);
+              } /*if*/
+          } /*for*/
+        result = mp_is_zero(U, k) or mp_is_zero(V, k);
+        for (unsigned int r = 1;;)
+          {
+            if (result or r == s)
+                break;
+            mp_mont_mul(m, t1, V, V);
+            mp_addmod(m, t2, Qk, Qk);
+            mp_submod(m, V, t1, t2);
+            mp_mont_mul(m, Qk, Qk, Qk);
+            result = mp_is_zero(V, k);
+            ++r;
+          } /*for*/
+      }
+    while (false);
+    return
+        result;
+  } /*is_prime_mp*/
+
+#define RHO_MP_LIMIT 65536
+  /* roughly how many rho iterations to try before moving on to ECM */
+#define RHO_MP_SIQS_LIMIT 4096
+  /* less is worth trying when SIQS will come next */
+
+static bool rho_mp
+  (
+    const struct mp_mont * m,
+    uint64_t * g, /* room for k limbs */
+    size_t * glen,
+    uint64_t limit,
+    struct work_limit * work
+  )
+  /* tries Brent’s rho on m->n, as for rho_brent, but giving up after
+    about limit iterations, or when work is stopped. Returns true, with
+    the factor in g, if one was found. Uses temporaries 0-7. */
+  {
+    const size_t k = m->k;
+    const unsigned int batch = 128; /* nr of differences to accumulate per gcd */
+    uint64_t * const scratch = mp_temp(m, 0); /* and 1 */
+    uint64_t * const x = mp_temp(m, 2);
+    uint64_t * const y = mp_temp(m, 3);
+    uint64_t * const ys = mp_temp(m, 4);
+    uint64_t * const q = mp_temp(m, 5);
+    uint64_t * const diff = mp_temp(m, 6);
+    uint64_t * const c = mp_temp(m, 7);
+    mp_mont_set(m, c, 1);
+    mp_mont_set(m, y, 2);
+    memcpy(ys, y, k * sizeof(uint64_t));
+    memcpy(q, m->one, k * sizeof(uint64_t));
+    g[0] = 1;
+    *glen = 1;
+    for (uint64_t r = 1;;)
+      {
+        memcpy(x, y, k * sizeof(uint64_t));
+        for (uint64_t i = 0;;)
+          {
+            if (i == r)
+                break;
+            mp_mont_mul(m, y, y, y);
+            mp_addmod(m, y, y, c);
+            ++i;
+          } /*for*/
+        if (work_charge(work, r))
+            break;
+        for (uint64_t j = 0;;)
+          {
+            if (j >= r or not (*glen == 1 and g[0] == 1) or work_charge(work, 2 * batch))
+                break;
+            memcpy(ys, y, k * sizeof(uint64_t));
+            const uint64_t limit = batch < r - j ? batch : r - j;
+            for (uint64_t i = 0;;)
+              {
+                if (i == limit)
+                    break;
+                mp_mont_mul(m, y, y, y);
+                mp_addmod(m, y, y, c);
+                mp_submod(m, diff, x, y);
+                mp_mont_mul(m, q, q, diff);
+                ++i;
+              } /*for*/
+            *glen = mp_mont_gcd(m, g, q, scratch);
+            j += batch;
+          } /*for*/
+        if (not (*glen == 1 and g[0] == 1) or r >= limit or work_stopped(work))
+            break;
+        r *= 2;
+      } /*for*/
+    if (mp_cmp(g, *glen, m->n, k) == 0)
+      {
+      /* overshot, so redo the last batch one step at a time */
+        for (;;)
+          {
+            mp_mont_mul(m, ys, ys, ys);
+            mp_addmod(m, ys, ys, c);
+            mp_submod(m, diff, x, ys);
+            *glen = mp_mont_gcd(m, g, diff, scratch);
+            if (not (*glen == 1 and g[0] == 1))
+                break;
+          } /*for*/
+      } /*if*/
+    return
+        mp_is_proper_factor(m, g, *glen);
+  } /*rho_mp*/
+
+static void ec_double
+  (
+    const struct mp_mont * m,
+    uint64_t * X2, /* may be the same as X */
+    uint64_t * Z2, /* may be the same as Z */
+    const uint64_t * X,
+    const uint64_t * Z,
+    const uint64_t * a24, /* A + 2C */
+    const uint64_t * c24 /* 4C */
+  )
+  /* doubles point (X : Z) on the Montgomery curve with projective
+    parameter (A : C). Uses temporaries 2-4. */
+  {
+    uint64_t * const sum2 = mp_temp(m, 2);
+    uint64_t * const diff2 = mp_temp(m, 3);
+    uint64_t * const xz4 = mp_temp(m, 4);
+    mp_addmod(m, sum2, X, Z);
+    mp_mont_mul(m, sum2, sum2, sum2); /* (X + Z)² */
+    mp_submod(m, diff2, X, Z);
+    mp_mont_mul(m, diff2, diff2, diff2); /* (X - Z)² */
+    mp_submod(m, xz4, sum2, diff2); /* 4XZ */
+    mp_mont_mul(m, diff2, diff2, c24);
+    mp_mont_mul(m, X2, sum2, diff2);
+    mp_mont_mul(m, sum2, xz4, a24);
+    mp_addmod(m, sum2, sum2, diff2);
+    mp_mont_mul(m, Z2, xz4, sum2);
+  } /*ec_double*/
+
+static void ec_add
+  (
+    const struct mp_mont * m,
+    uint64_t * X3, /* may be the same as any of the inputs */
+    uint64_t * Z3,
+    const uint64_t * XP,
+    const uint64_t * ZP,
+    const uint64_t * XQ,
+    const uint64_t * ZQ,
+    const uint64_t * Xd, /* P - Q */
+    const uint64_t * Zd
+  )
+  /* differential addition: computes P + Q given P, Q and P - Q. Uses
+    temporaries 2-5. */
+  {
+    uint64_t * const u = mp_temp(m, 2);
+    uint64_t * const v = mp_temp(m, 3);
+    uint64_t * const t = mp_temp(m, 4);
+    uint64_t * const w = mp_temp(m, 5);
+    mp_submod(m, u, XP, ZP);
+    mp_addmod(m, t, XQ, ZQ);
+    mp_mont_mul(m, u, u, t);
+    mp_addmod(m, v, XP, ZP);
+    mp_submod(m, t, XQ, ZQ);
+    mp_mont_mul(m, v, v, t);
+    mp_addmod(m, t, u, v);
+    mp_mont_mul(m, t, t, t);
+    mp_submod(m, w, u, v);
+    mp_mont_mul(m, w, w, w);
+    mp_mont_mul(m, t, t, Zd);
+    mp_mont_mul(m, w, w, Xd);
+    memcpy(X3, t, m->k * sizeof(uint64_t));
+    memcpy(Z3, w, m->k * sizeof(uint64_t));
+  } /*ec_add*/
+
+static void ec_mul
+  (
+    const struct mp_mont * m,
+    uint64_t * X, /* point is replaced with its multiple */
+    uint64_t * Z,
+    uint64_t s, /* must be nonzero */
+    const uint64_t * a24,
+    const uint64_t * c24
+  )
+  /* multiplies point (X : Z) by s, with the Montgomery ladder. Uses
+    temporaries 2-11. */
+  {
+    const size_t size = m->k * sizeof(uint64_t);
+    uint64_t * const px = mp_temp(m, 6);
+    uint64_t * const pz = mp_temp(m, 7);
+    uint64_t * const x0 = mp_temp(m, 8);
+    uint64_t * const z0 = mp_temp(m, 9);
+    uint64_t * const x1 = mp_temp(m, 10);
+    uint64_t * const z1 = mp_temp(m, 11);
+    if (s > 1)
+      {
+        memcpy(px, X, size);
+        memcpy(pz, Z, size);
+        memcpy(x0, X, size);
+        memcpy(z0, Z, size);
+        ec_double(m, x1, z1, X, Z, a24, c24);
+      /* invariant: (x1 : z1) - (x0 : z0) = P */
+        for (unsigned int i = 63 - __builtin_clzll(s);;)
+          {
+            if (i == 0)
+                break;
+            --i;
+            if (s >> i & 1)
+              {
+                ec_add(m, x0, z0, x0, z0, x1, z1, px, pz);
+                ec_double(m, x1, z1, x1, z1, a24, c24);
+              }
+            else
+              {
+                ec_add(m, x1, z1, x0, z0, x1, z1, px, pz);
+                ec_double(m, x0, z0, x0, z0, a24, c24);
+              } /*if*/
+          } /*for*/
+        memcpy(X, x0, size);
+        memcpy(Z, z0, size);
+      } /*if*/
+  } /*ec_mul*/
+
+#define ECM_D 2310
+  /* giant-step size for stage 2, being 2·3·5·7·11, so only a
+    small proportion of the baby steps need be stored */
+#define ECM_NR_BABY_STEPS 240
+  /* nr of odd j < ECM_D / 2 coprime to ECM_D */
+
+struct ecm_workspace
+  /* storage for stage 2, allocated once and reused for every curve */
+  {
+    uint64_t * baby; /* X, Z for each stored baby step */
+    uint64_t last_k[ECM_NR_BABY_STEPS]; /* for pairing up primes kD ± j */
+    int16_t baby_index[ECM_D / 2]; /* index into baby of each j, or -1 */
+  };
+
+static bool ecm_curve
+  (
+    const struct mp_mont * m,
+    struct ecm_workspace * ws,
+    uint64_t sigma, /* at least 6, less than 2**32 */
+    uint64_t b1,
+    uint64_t b2,
+    uint64_t * g, /* room for k limbs */
+    size_t * glen,
+    bool * found,
+    struct work_limit * work
+  )
+  /* tries one elliptic curve, as determined by sigma, with the given
+    bounds. Sets *found to true, with the factor in g, if one was found,
+    which won’t happen if work is stopped partway. Returns false if out
+    of memory. */
+  {
+    const size_t k = m->k;
+    const size_t size = k * sizeof(uint64_t);
+    uint64_t * const scratch = mp_temp(m, 0); /* and 1 */
+    uint64_t * const a24 = mp_temp(m, 12);
+    uint64_t * const c24 = mp_temp(m, 13);
+    uint64_t * const X = mp_temp(m, 14);
+    uint64_t * const Z = mp_temp(m, 15);
+    uint64_t * const acc = mp_temp(m, 16);
+    uint64_t * const t1 = mp_temp(m, 17);
+    bool ok = false;
+    struct prime_iter primes = {.base_primes = NULL, .sieve = NULL};
+    *found = false;
+    do /*once*/
+      {
+          {
+          /* Suyama’s parametrization: with u = σ² - 5 and v = 4σ, the
+            starting point is (u³ : v³), on the curve with
+            (A + 2C : 4C) = ((v - u)³(3u + v) : 16u³v) */
+            uint64_t * const u = mp_temp(m, 18);
+            uint64_t * const v = mp_temp(m, 19);
+            uint64_t * const t2 = mp_temp(m, 20);
+            mp_mont_set(m, u, sigma * sigma - 5);
+            mp_mont_set(m, v, 4 * sigma);
+            mp_mont_mul(m, t1, u, u);
+            mp_mont_mul(m, X, t1, u);
+            mp_mont_mul(m, t1, v, v);
+            mp_mont_mul(m, Z, t1, v);
+            mp_submod(m, t1, v, u);
+            mp_mont_mul(m, t2, t1, t1);
+            mp_mont_mul(m, t1, t2, t1);
+            mp_addmod(m, t2, u, u);
+            mp_addmod(m, t2, t2, u);
+            mp_addmod(m, t2, t2, v);
+            mp_mont_mul(m, a24, t1, t2);
+            mp_mont_mul(m, c24, X, v);
+            for (unsigned int i = 0;;)
+              {
+                if (i == 4)
+                    break;
+                mp_addmod(m, c24, c24, c24);
+                ++i;
+              } /*for*/
+          }
+      /* stage 1: multiply by every prime power up to b1, several
+        primes at a time */
+        for (uint64_t p = 2;;)
+          {
+            if (p > b1)
+                break;
+            ec_double(m, X, Z, X, Z, a24, c24);
+            p *= 2;
+          } /*for*/
+        if (not prime_iter_init(&primes, 3, b1))
+            break;
+        uint64_t s = 1;
+        for (;;)
+          {
+            const uint64_t p = prime_iter_next(&primes);
+            if (p == 0)
+                break;
+            uint64_t q = p;
+            for (;;)
+              {
+                if (q > b1 / p)
+                    break;
+                q *= p;
+              } /*for*/
+            if (s > UINT64_MAX / q)
+              {
+                ec_mul(m, X, Z, s, a24, c24);
+                s = 1;
+                if (work_charge(work, 64 * 11)) /* ladder step is 5M + 4S + some adds */
+                    break;
+              } /*if*/
+            s *= q;
+          } /*for*/
+        if (work_stopped(work))
+          {
+            ok = true;
+            break;
+          } /*if*/
+        ec_mul(m, X, Z, s, a24, c24);
+        prime_iter_dispose(&primes);
+        *glen = mp_mont_gcd(m, g, Z, scratch);
+        if (not (*glen == 1 and g[0] == 1))
+          {
+            *found = mp_is_proper_factor(m, g, *glen);
+            ok = true;
+            break; /* found a factor, or this curve is no good */
+          } /*if*/
+      /* stage 2: for each prime q = kD ± j in (b1, b2], with the
+        point Q from stage 1, (kD)Q and (j)Q have the same x-coordinate
+        modulo the factor p if qQ is the identity modulo p, so accumulate
+        the product of the differences X(kD)Z(j) - X(j)Z(kD) */
+          {
+          /* baby steps: odd multiples jQ, j < D/2, worked out in sequence
+            by adding 2Q each time */
+            uint64_t * prev_x = mp_temp(m, 18), * prev_z = mp_temp(m, 19);
+            uint64_t * cur_x = mp_temp(m, 20), * cur_z = mp_temp(m, 21);
+            uint64_t * const two_x = mp_temp(m, 22), * const two_z = mp_temp(m, 23);
+            memcpy(prev_x, X, size); /* -Q, which has the same x-coordinate as Q */
+            memcpy(prev_z, Z, size);
+            memcpy(cur_x, X, size);
+            memcpy(cur_z, Z, size);
+            ec_double(m, two_x, two_z, X, Z, a24, c24);
+            for (unsigned int j = 1;;)
+              {
+                if (j >= ECM_D / 2)
+                    break;
+                if (ws->baby_index[j] >= 0)
+                  {
+                    memcpy(ws->baby + 2 * k * ws->baby_index[j], cur_x, size);
+                    memcpy(ws->baby + 2 * k * ws->baby_index[j] + k, cur_z, size);
+                  } /*if*/
+                ec_add(m, prev_x, prev_z, cur_x, cur_z, two_x, two_z, prev_x, prev_z);
+                uint64_t * t = prev_x;
+                prev_x = cur_x;
+                cur_x = t;
+                t = prev_z;
+                prev_z = cur_z;
+                cur_z = t;
+                j += 2;
+              } /*for*/
+          }
+          {
+          /* giant steps: successive multiples (kD)Q */
+            uint64_t * kx = mp_temp(m, 18), * kz = mp_temp(m, 19);
+            uint64_t * k1x = mp_temp(m, 20), * k1z = mp_temp(m, 21);
+            uint64_t * const dx = mp_temp(m, 22), * const dz = mp_temp(m, 23);
+            uint64_t * const t2 = mp_temp(m, 2);
+            uint64_t * const t3 = mp_temp(m, 3);
+            uint64_t cur_k = 0;
+            memset(ws->last_k, 0, sizeof ws->last_k);
+            memcpy(acc, m->one, size);
+            memcpy(dx, X, size);
+            memcpy(dz, Z, size);
+            ec_mul(m, dx, dz, ECM_D, a24, c24);
+            if (not prime_iter_init(&primes, b1 + 1 + b1 % 2, b2))
+                break;
+            for (;;)
+              {
+                const uint64_t q = prime_iter_next(&primes);
+                if (q == 0)
+                    break;
+                const uint64_t qk = (q + ECM_D / 2) / ECM_D;
+                if (cur_k == 0)
+                  {
+                    memcpy(kx, X, size);
+                    memcpy(kz, Z, size);
+                    ec_mul(m, kx, kz, qk * ECM_D, a24, c24);
+                    memcpy(k1x, X, size);
+                    memcpy(k1z, Z, size);
+                    ec_mul(m, k1x, k1z, (qk + 1) * ECM_D, a24, c24);
+                    cur_k = qk;
+                  } /*if*/
+                for (;;)
+                  {
+                    if (cur_k == qk)
+                        break;
+                  /* ((k + 2)D)Q = ((k + 1)D)Q + DQ, with difference (kD)Q */
+                    ec_add(m, kx, kz, k1x, k1z, dx, dz, kx, kz);
+                    uint64_t * t = kx;
+                    kx = k1x;
+                    k1x = t;
+                    t = kz;
+                    kz = k1z;
+                    k1z = t;
+                    ++cur_k;
+                  } /*for*/
+                const unsigned int j = q > qk * ECM_D ? q - qk * ECM_D : qk * ECM_D - q;
+                const int index = ws->baby_index[j];
+                if (ws->last_k[index] != qk)
+                  {
+                  /* not already done as the other member of the pair kD ± j */
+                    ws->last_k[index] = qk;
+                    const uint64_t * const baby = ws->baby + 2 * k * index;
+                    mp_mont_mul(m, t2, kx, baby + k);
+                    mp_mont_mul(m, t3, baby, kz);
+                    mp_submod(m, t2, t2, t3);
+                    mp_mont_mul(m, acc, acc, t2);
+                  } /*if*/
+                if (work_charge(work, 4))
+                    break;
+              } /*for*/
+            prime_iter_dispose(&primes);
+          }
+        if (work_stopped(work))
+          {
+            ok = true;
+            break;
+          } /*if*/
+        *glen = mp_mont_gcd(m, g, acc, scratch);
+        *found = mp_is_proper_factor(m, g, *glen);
+        ok = true;
+      }
+    while (false);
+    prime_iter_dispose(&primes);
+    return
+        ok;
+  } /*ecm_curve*/
+
+static const struct
+  {
+    uint32_t b1;
+    uint32_t nr_curves;
+  } ecm_schedule[] =
+  /* stage 1 bounds and expected nr of curves needed to find factors of
+    15, 20, 25 ... digits; once all these have been tried, the last
+    entry is repeated indefinitely */
+    {
+        {2000, 25},
+        {11000, 90},
+        {50000, 300},
+        {250000, 700},
+        {1000000, 1800},
+        {3000000, 5100},
+        {11000000, 10600},
+    };
+#define ECM_B2_FACTOR 100 /* ratio of stage 2 bound to stage 1 bound */
+
+/*
+    Self-initialising quadratic sieve
+
+    ECM takes time depending on the size of the factor it finds, so it
+    is at its worst on products of two primes of similar size. For these,
+    from SIQS_MIN_BITS up, the quadratic sieve takes over, once rho and
+    perhaps a few ECM curves have had a chance to find any smaller
+    factors.
+
+    The sieve looks for values of x for which
+
+        Q(x) = ((A·x + B)**2 - k·n) / A = A·x**2 + 2·B·x + C
+
+    factorizes completely over a factor base, consisting of those primes
+    p modulo which k·n is a square; k is a small multiplier chosen to
+    make the factor base rich in small primes. One leftover “large prime”
+    above the factor base is allowed, and partial relations with the
+    same large prime are paired up. Each relation gives a congruence
+    (A·x + B)**2 ≡ A·Q(x) (mod n); once there are more relations than
+    primes in the factor base, Gaussian elimination modulo 2 finds
+    subsets whose products are squares on both sides, and each of these
+    has an even chance of splitting n by a gcd.
+
+    A is a product of s factor-base primes, chosen to make it about
+    √(2·k·n) / M, where the sieve interval is -M ≤ x < M. Each A gives
+    2**(s - 1) polynomials, whose values of B differ in the signs of s
+    precomputed terms; going from one to the next in Gray-code order
+    changes one sign, which only needs an addition modulo each prime to
+    update the roots. Each thread works on its own values of A.
+
+    The interval is sieved in blocks small enough to stay in L1 cache.
+    A prime bigger than a block hits it at most once for each root, so
+    rather than going through all such primes for every block, they are
+    sieved in a single pass over the whole interval, which drops each hit
+    into a bucket for the block it falls in.
+
+    Before elimination, relations containing a prime found in no other
+    relation are repeatedly removed, since they cannot be part of any
+    square. This usually shrinks the matrix a good deal, and what is
+    left is solved by dense elimination on bit vectors.
+*/
+
+#define SIQS_MIN_BITS 64 /* smallest composite worth using SIQS on */
+#define SIQS_MAX_BITS 220 /* beyond this, dense elimination gets too big */
+#define SIQS_ECM_BITS 160 /* from this size up, try the first ECM level before SIQS */
+#define SIQS_BLOCK 32768 /* bytes in a sieve block */
+#define SIQS_LIMBS 8 /* width of two’s-complement arithmetic on polynomial values */
+#define SIQS_SMALL_PRIME 40 /* factor-base primes below this are not sieved with */
+#define SIQS_EXTRA_RELATIONS 64 /* nr of relations to collect beyond the factor-base size */
+#define SIQS_THREAD_RELATIONS 256 /* start one thread for each this many relations needed */
+#define SIQS_MAX_A_FACTORS 16
+#define SIQS_MAX_RELATION_FACTORS 256
+  /* |Q(x)| < 2**160 within SIQS_MAX_BITS, so this leaves room for the
+    factors of A and the sign */
+
+static const struct
+  {
+    uint16_t bits; /* size of n */
+    uint16_t nr_blocks; /* length of sieve interval, in blocks */
+    uint32_t nr_primes; /* size of factor base */
+    uint32_t large_multiplier; /* large-prime bound, relative to largest factor-base prime */
+  } siqs_params[] =
+  /* parameters for various sizes of n; the factor-base size is
+    interpolated between entries */
+    {
+        {64, 1, 100, 30},
+        {100, 2, 150, 30},
+        {128, 2, 400, 40},
+        {160, 2, 1000, 40},
+        {183, 2, 2200, 50},
+        {200, 2, 4200, 60},
+        {220, 4, 8000, 80},
+    };
+
+static uint64_t mp_mul_1
+  (
+    uint64_t * r, /* may be the same as a */
+    const uint64_t * a,
+    size_t len,
+    uint64_t b
+  )
+  /* r = a·b, all of len limbs; returns the carry out. */
+  {
+    uint64_t carry = 0;
+    for (size_t i = 0;;)
+      {
+        if (i == len)
+            break;
+        const uint128_t p = (uint128_t)a[i] * b + carry;
+        r[i] = (uint64_t)p;
+        carry = (uint64_t)(p >> 64);
+        ++i;
+      } /*for*/
+    return
+        carry;
+  } /*mp_mul_1*/
+
+static void mp_mul
+  (
+    uint64_t * r, /* room for alen + blen limbs; not the same as a or b */
+    const uint64_t * a,
+    size_t alen,
+    const uint64_t * b,
+    size_t blen
+  )
+  /* r = a·b, by schoolbook multiplication. */
+  {
+    memset(r, 0, (alen + blen) * sizeof(uint64_t));
+    for (size_t i = 0;;)
+      {
+        if (i == blen)
+            break;
+        uint64_t carry = 0;
+        for (size_t j = 0;;)
+          {
+            if (j == alen)
+                break;
+            const uint128_t p = (uint128_t)a[j] * b[i] + r[i + j] + carry;
+            r[i + j] = (uint64_t)p;
+            carry = (uint64_t)(p >> 64);
+            ++j;
+          } /*for*/
+        r[i + alen] = carry;
+        ++i;
+      } /*for*/
+  } /*mp_mul*/
+
+static inline bool siqs_is_negative
+  (
+    const uint64_t * a /* SIQS_LIMBS limbs */
+  )
+  {
+    return
+        a[SIQS_LIMBS - 1] >> 63 != 0;
+  } /*siqs_is_negative*/
+
+static void siqs_negate
+  (
+    uint64_t * a /* SIQS_LIMBS limbs */
+  )
+  /* a = -a, in two’s complement. */
+  {
+    uint64_t carry = 1;
+    for (size_t i = 0;;)
+      {
+        if (i == SIQS_LIMBS)
+            break;
+        a[i] = ~a[i] + carry;
+        carry = carry != 0 and a[i] == 0;
+        ++i;
+      } /*for*/
+  } /*siqs_negate*/
+
+static void siqs_mul_si
+  (
+    uint64_t * r, /* may be the same as a */
+    const uint64_t * a,
+    int64_t x
+  )
+  /* r = a·x, in two’s complement of SIQS_LIMBS limbs. */
+  {
+    mp_mul_1(r, a, SIQS_LIMBS, x < 0 ? -(uint64_t)x : (uint64_t)x);
+    if (x < 0)
+        siqs_negate(r);
+  } /*siqs_mul_si*/
+
+static uint32_t powmod_u32
+  (
+    uint64_t base,
+    uint32_t exponent,
+    uint32_t p
+  )
+  {
+    uint64_t result = 1;
+    base %= p;
+    for (;;)
+      {
+        if (exponent == 0)
+            break;
+        if (exponent % 2 != 0)
+            result = result * base % p;
+        base = base * base % p;
+        exponent /= 2;
+      } /*for*/
+    return
+        result;
+  } /*powmod_u32*/
+
+static uint32_t sqrtmod_u32
+  (
+    uint32_t a, /* must be a nonzero square modulo p */
+    uint32_t p /* must be an odd prime */
+  )
+  /* returns a square root of a modulo p, by Tonelli-Shanks. */
+  {
+    uint32_t q = p - 1;
+    unsigned int s = 0;
+    for (;;)
+      {
+        if (q % 2 != 0)
+            break;
+        q /= 2;
+        ++s;
+      } /*for*/
+    uint32_t z = 2;
+    for (;;)
+      {
+        if (jacobi_u128(z, p) == -1)
+            break;
+        ++z;
+      } /*for*/
+    uint64_t c = powmod_u32(z, q, p);
+    uint64_t x = powmod_u32(a, (q + 1) / 2, p);
+    uint64_t t = powmod_u32(a, q, p);
+    for (;;)
+      {
+        if (t == 1)
+            break;
+      /* find least i such that t**(2**i) = 1 */
+        unsigned int i = 0;
+        for (uint64_t tt = t;;)
+          {
+            if (tt == 1)
+                break;
+            tt = tt * tt % p;
+            ++i;
+          } /*for*/
+        uint64_t b = c;
+        for (unsigned int j = i + 1;;)
+          {
+            if (j == s)
+                break;
+            b = b * b % p;
+            ++j;
+          } /*for*/
+        x = x * b % p;
+        c = b * b % p;
+        t = t * c % p;
+        s = i;
+      } /*for*/
+    return
+        x;
+  } /*sqrtmod_u32*/
+
+static uint32_t invmod_u32
+  (
+    uint32_t a, /* must be coprime to p */
+    uint32_t p
+  )
+  /* returns the inverse of a modulo p, by the extended Euclidean algorithm. */
+  {
+    uint32_t r0 = p, r1 = a % p;
+    int64_t x0 = 0, x1 = 1; /* ri ≡ xi·a (mod p) */
+    for (;;)
+      {
+        if (r1 == 0)
+            break;
+        const uint32_t q = r0 / r1;
+        const uint32_t r2 = r0 - q * r1;
+        const int64_t x2 = x0 - (int64_t)q * x1;
+        r0 = r1;
+        r1 = r2;
+        x0 = x1;
+        x1 = x2;
+      } /*for*/
+    return
+        x0 < 0 ? x0 + p : x0;
+  } /*invmod_u32*/
+
+static inline uint64_t siqs_mix
+  (
+    uint64_t x
+  )
+  /* scrambles the bits of x (the splitmix64 finalizer). */
+  {
+    x = (x ^ x >> 30) * 0xbf58476d1ce4e5b9U;
+    x = (x ^ x >> 27) * 0x94d049bb133111ebU;
+    return
+        x ^ x >> 31;
+  } /*siqs_mix*/
+
+static uint64_t siqs_random
+  (
+    uint64_t * state /* must be nonzero */
+  )
+  /* returns the next number from an xorshift64* generator. */
+  {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return
+        x * 0x2545f4914f6cdd1dU;
+  } /*siqs_random*/
+
+struct siqs_hash
+  /* set of nonzero 64-bit keys, by open addressing */
+  {
+    size_t nr_keys, size; /* size is zero or a power of 2 */
+    uint64_t * keys; /* zero for empty slots */
+  };
+
+static size_t siqs_hash_slot
+  (
+    const uint64_t * keys,
+    size_t size,
+    uint64_t key
+  )
+  /* returns the slot holding key, or the empty slot where it would go. */
+  {
+    size_t i = siqs_mix(key) & size - 1;
+    for (;;)
+      {
+        if (keys[i] == 0 or keys[i] == key)
+            break;
+        i = i + 1 & size - 1;
+      } /*for*/
+    return
+        i;
+  } /*siqs_hash_slot*/
+
+static int siqs_hash_insert
+  (
+    struct siqs_hash * h,
+    uint64_t key /* must be nonzero */
+  )
+  /* adds key to h, returning 1 if it was not already there, 0 if it
+    was, or -1 if out of memory. */
+  {
+    int result = -1;
+    do /*once*/
+      {
+        if (2 * (h->nr_keys + 1) > h->size)
+          {
+            const size_t new_size = h->size == 0 ? 1024 : 2 * h->size;
+            uint64_t * const new_keys = calloc(new_size, sizeof(uint64_t));
+            if (new_keys == NULL)
+                break;
+            for (size_t i = 0;;)
+              {
+                if (i == h->size)
+                    break;
+                if (h->keys[i] != 0)
+                    new_keys[siqs_hash_slot(new_keys, new_size, h->keys[i])] = h->keys[i];
+                ++i;
+              } /*for*/
+            free(h->keys);
+            h->keys = new_keys;
+            h->size = new_size;
+          } /*if*/
+        const size_t i = siqs_hash_slot(h->keys, h->size, key);
+        result = h->keys[i] == 0;
+        if (result != 0)
+          {
+            h->keys[i] = key;
+            ++h->nr_keys;
+          } /*if*/
+      }
+    while (false);
+    return
+        result;
+  } /*siqs_hash_insert*/
+
+struct siqs_relation
+  {
+    uint64_t large;
+      /* in a partial relation, the large prime left over; in a full one
+        made by pairing two partials, their common large prime, whose
+        square is an extra factor; otherwise 1 */
+    size_t factors; /* start of factor-base indices in the factors array */
+    uint32_t nr_factors;
+  };
+
+struct siqs_relations
+  /* relations y**2 ≡ large × product of factor-base entries (mod n) */
+  {
+    size_t k; /* limbs in each y */
+    size_t nr, allocated;
+    struct siqs_relation * rels;
+    uint64_t * y; /* k limbs per relation, reduced modulo n */
+    uint32_t * factors; /* factor-base indices, repeated according to multiplicity */
+    size_t nr_factors, factors_allocated;
+  };
+
+static void siqs_relations_dispose
+  (
+    struct siqs_relations * r
+  )
+  {
+    free(r->rels);
+    r->rels = NULL;
+    free(r->y);
+    r->y = NULL;
+    free(r->factors);
+    r->factors = NULL;
+    r->nr = r->allocated = r->nr_factors = r->factors_allocated = 0;
+  } /*siqs_relations_dispose*/
+
+static bool siqs_relations_add
+  (
+    struct siqs_relations * r,
+    const uint64_t * y,
+    const uint32_t * factors1,
+    uint32_t nr_factors1,
+    const uint32_t * factors2, /* may be NULL if nr_factors2 is zero */
+    uint32_t nr_factors2,
+    uint64_t large
+  )
+  /* appends a relation whose factors are the concatenation of factors1
+    and factors2. Returns false if out of memory. */
+  {
+    bool ok = false;
+    const size_t nr_factors = nr_factors1 + nr_factors2;
+    do /*once*/
+      {
+        if (r->nr == r->allocated)
+          {
+            const size_t new_allocated = r->allocated == 0 ? 256 : 2 * r->allocated;
+            struct siqs_relation * const new_rels =
+                realloc(r->rels, new_allocated * sizeof(struct siqs_relation));
+            if (new_rels == NULL)
+                break;
+            r->rels = new_rels;
+            uint64_t * const new_y = realloc(r->y, new_allocated * r->k * sizeof(uint64_t));
+            if (new_y == NULL)
+                break;
+            r->y = new_y;
+            r->allocated = new_allocated;
+          } /*if*/
+        if (r->nr_factors + nr_factors > r->factors_allocated)
+          {
+            size_t new_allocated = r->factors_allocated == 0 ? 4096 : 2 * r->factors_allocated;
+            if (new_allocated < r->nr_factors + nr_factors)
+                new_allocated = r->nr_factors + nr_factors;
+            uint32_t * const new_factors = realloc(r->factors, new_allocated * sizeof(uint32_t));
+            if (new_factors == NULL)
+                break;
+            r->factors = new_factors;
+            r->factors_allocated = new_allocated;
+          } /*if*/
+        struct siqs_relation * const rel = &r->rels[r->nr];
+        rel->large = large;
+        rel->factors = r->nr_factors;
+        rel->nr_factors = nr_factors;
+        memcpy(r->y + r->nr * r->k, y, r->k * sizeof(uint64_t));
+        memcpy(r->factors + r->nr_factors, factors1, nr_factors1 * sizeof(uint32_t));
+        if (nr_factors2 != 0)
+            memcpy(r->factors + r->nr_factors + nr_factors1, factors2, nr_factors2 * sizeof(uint32_t));
+        r->nr_factors += nr_factors;
+        ++r->nr;
+        ok = true;
+      }
+    while (false);
+    return
+        ok;
+  } /*siqs_relations_add*/
+
+struct siqs_job
+  {
+  /* set up beforehand, and only read by the workers: */
+    const uint64_t * n;
+    size_t k; /* nr of limbs in n */
+    uint64_t kn[SIQS_LIMBS]; /* n times the multiplier */
+    uint32_t nr_primes; /* size of factor base; entry 0 stands for -1, entry 1 for 2 */
+    uint32_t * primes;
+    uint32_t * roots; /* square root of kn modulo each prime */
+    uint8_t * logs; /* rounded log2 of each prime */
+    uint32_t first_sieved; /* index of first prime big enough to sieve with */
+    uint32_t first_large; /* index of first prime sieved via buckets */
+    uint32_t nr_blocks; /* length of sieve interval, in blocks */
+    uint32_t half_width; /* M */
+    uint8_t sieve_init; /* initial sieve value: positions whose sums reach 128 are candidates */
+    uint64_t large_bound; /* partial relations have large primes below this */
+    unsigned int nr_a_factors; /* s */
+    uint32_t a_lo, a_hi; /* range of factor-base indices to choose factors of A from */
+    double log_a; /* ideal log2 of A */
+    size_t needed; /* nr of full relations to collect */
+  /* shared between workers, protected by lock: */
+    pthread_mutex_t lock;
+    struct siqs_relations full, partial;
+    struct siqs_hash large_primes; /* distinct large primes of partial relations */
+    struct siqs_hash used_a; /* choices of A already taken */
+    size_t nr_cycles; /* nr of partial relations whose large prime was already seen */
+    unsigned int nr_workers; /* for seeding their random-number generators */
+    bool failed; /* out of memory */
+    struct work_limit * work; /* may be NULL */
+    atomic_bool done;
+  };
+
+struct siqs_poly
+  /* a worker’s state for sieving its current polynomial */
+  {
+    uint64_t rand; /* random-number generator state */
+    uint32_t a_index[SIQS_MAX_A_FACTORS]; /* factor-base indices of factors of A, ascending */
+    uint64_t a[SIQS_LIMBS], b[SIQS_LIMBS], c[SIQS_LIMBS]; /* b and c in two’s complement */
+    uint64_t terms[SIQS_MAX_A_FACTORS][SIQS_LIMBS]; /* B is the sum of ± each of these */
+    bool negated[SIQS_MAX_A_FACTORS]; /* sign currently applied to each term */
+    uint32_t * root1, * root2;
+      /* sieve positions mod p of the roots of Q(x) modulo each prime,
+        UINT32_MAX for those that are not sieved with */
+    uint32_t * next1, * next2; /* where each medium-sized prime next hits the sieve */
+    uint32_t * deltas; /* 2·terms[j]/A modulo each prime, for each j */
+    uint8_t * sieve; /* SIQS_BLOCK bytes */
+    uint32_t * buckets; /* for each block, hits of large primes as index << 16 | offset */
+    uint32_t * bucket_fill; /* nr of entries in each bucket */
+    size_t bucket_size; /* room in each bucket */
+    uint32_t factors[SIQS_MAX_RELATION_FACTORS]; /* for the relation being found */
+  };
+
+static unsigned int siqs_choose_multiplier
+  (
+    const uint64_t * n,
+    size_t len
+  )
+  /* chooses the multiplier k by the Knuth-Schroeppel function, which
+    estimates how much the small primes in the factor base for k·n
+    will contribute to the average sieve value. */
+  {
+    static const uint8_t candidates[] =
+        {
+            1, 3, 5, 7, 11, 13, 15, 17, 19, 21, 23, 29, 31, 33, 35, 37,
+            39, 41, 43, 47, 51, 53, 55, 57, 59, 61, 65, 67, 69, 71, 73,
+        };
+    uint32_t residues[NR_TRIAL_PRIMES];
+    for (unsigned int i = 0;;)
+      {
+        if (i == NR_TRIAL_PRIMES)
+            break;
+        residues[i] = mp_divrem_1(NULL, n, len, trial_primes[i].prime);
+        ++i;
+      } /*for*/
+    unsigned int result = 1;
+    double best = -HUGE_VAL;
+    for (unsigned int i = 0;;)
+      {
+        if (i == sizeof candidates / sizeof candidates[0])
+            break;
+        const unsigned int k = candidates[i];
+        double score = -0.5 * log(k);
+        switch (n[0] * k % 8)
+          {
+        case 1:
+            score += 2 * log(2);
+        break;
+        case 5:
+            score += log(2);
+        break;
+        default: /* 3 or 7 */
+            score += 0.5 * log(2);
+        break;
+          } /*switch*/
+        for (unsigned int j = 0;;)
+          {
+            if (j == NR_TRIAL_PRIMES)
+                break;
+            const uint32_t p = trial_primes[j].prime;
+            const uint32_t r = (uint64_t)residues[j] * k % p;
+            if (r == 0)
+                score += log(p) / p;
+            else if (jacobi_u128(r, p) == 1)
+                score += 2 * log(p) / (p - 1);
+            ++j;
+          } /*for*/
+        if (score > best)
+          {
+            best = score;
+            result = k;
+          } /*if*/
+        ++i;
+      } /*for*/
+    return
+        result;
+  } /*siqs_choose_multiplier*/
+
+static bool siqs_new_a
+  (
+    struct siqs_job * job,
+    struct siqs_poly * w
+  )
+  /* chooses a new value of A not used before, and sets up the first
+    polynomial for it. Returns false if out of memory. */
+  {
+    const unsigned int s = job->nr_a_factors;
+    const uint32_t nr_primes = job->nr_primes;
+    bool ok = true;
+    for (unsigned int tries = 0;;)
+      {
+        ++tries;
+      /* all but the last factor at random from the window … */
+        unsigned int nr_chosen = 0;
+        double log_product = 0;
+        for (;;)
+          {
+            if (nr_chosen + 1 == s)
+                break;
+            const uint32_t i = job->a_lo + siqs_random(&w->rand) % (job->a_hi - job->a_lo);
+            bool taken = job->roots[i] == 0; /* prime divides multiplier */
+            for (unsigned int j = 0;;)
+              {
+                if (taken or j == nr_chosen)
+                    break;
+                taken = w->a_index[j] == i;
+                ++j;
+              } /*for*/
+            if (not taken)
+              {
+                w->a_index[nr_chosen++] = i;
+                log_product += log2(job->primes[i]);
+              } /*if*/
+          } /*for*/
+      /* … and the last to bring A as close as possible to the ideal size */
+        const double want = exp2(job->log_a - log_product);
+        uint32_t last = 2;
+        for (uint32_t lo = 2, hi = nr_primes;;)
+          {
+          /* binary search for first prime not below want */
+            if (lo == hi)
+              {
+                last = lo;
+                break;
+              } /*if*/
+            const uint32_t mid = lo + (hi - lo) / 2;
+            if (job->primes[mid] < want)
+                lo = mid + 1;
+            else
+                hi = mid;
+          } /*for*/
+        if (last == nr_primes or last > 2 and want / job->primes[last - 1] < job->primes[last] / want)
+            --last;
+        for (;;)
+          {
+            bool taken = job->roots[last] == 0;
+            for (unsigned int j = 0;;)
+              {
+                if (taken or j == nr_chosen)
+                    break;
+                taken = w->a_index[j] == last;
+                ++j;
+              } /*for*/
+            if (not taken or last + 1 == nr_primes)
+                break;
+            ++last;
+          } /*for*/
+        w->a_index[nr_chosen++] = last;
+        log_product += log2(job->primes[last]);
+        if (fabs(log_product - job->log_a) > 1 and tries < 100)
+            continue;
+      /* sort the indices, to make a key identifying this choice */
+        uint64_t key = 0;
+        bool repeated = false;
+        for (unsigned int i = 1;;)
+          {
+            if (i == s)
+                break;
+            const uint32_t this_index = w->a_index[i];
+            unsigned int j = i;
+            for (;;)
+              {
+                if (j == 0 or w->a_index[j - 1] <= this_index)
+                    break;
+                w->a_index[j] = w->a_index[j - 1];
+                --j;
+              } /*for*/
+            w->a_index[j] = this_index;
+            ++i;
+          } /*for*/
+        for (unsigned int i = 0;;)
+          {
+            if (i == s)
+                break;
+            repeated = repeated or i > 0 and w->a_index[i] == w->a_index[i - 1];
+            key = siqs_mix(key + w->a_index[i]);
+            ++i;
+          } /*for*/
+        if (repeated)
+            continue; /* last factor came out the same as another one */
+        pthread_mutex_lock(&job->lock);
+        const int inserted = siqs_hash_insert(&job->used_a, key | 1);
+        pthread_mutex_unlock(&job->lock);
+        if (inserted < 0)
+          {
+            ok = false;
+            break;
+          } /*if*/
+        if (inserted != 0 or tries >= 1000)
+            break;
+      } /*for*/
+    if (ok)
+      {
+      /* A, and the terms whose signed sum is B */
+        memset(w->a, 0, sizeof w->a);
+        w->a[0] = 1;
+        for (unsigned int j = 0;;)
+          {
+            if (j == s)
+                break;
+            mp_mul_1(w->a, w->a, SIQS_LIMBS, job->primes[w->a_index[j]]);
+            ++j;
+          } /*for*/
+        const size_t alen = mp_normalize(w->a, SIQS_LIMBS);
+        memset(w->b, 0, sizeof w->b);
+        for (unsigned int j = 0;;)
+          {
+            if (j == s)
+                break;
+            const uint32_t q = job->primes[w->a_index[j]];
+            uint64_t a_over_q[SIQS_LIMBS];
+            mp_divrem_1(a_over_q, w->a, SIQS_LIMBS, q);
+            uint64_t gamma =
+                    (uint64_t)job->roots[w->a_index[j]]
+                *
+                    invmod_u32(mp_divrem_1(NULL, a_over_q, alen, q), q)
+                %
+                    q;
+            if (gamma > q / 2)
+                gamma = q - gamma;
+            mp_mul_1(w->terms[j], a_over_q, SIQS_LIMBS, gamma);
+            mp_add_n(w->b, w->b, w->terms[j], SIQS_LIMBS);
+            w->negated[j] = false;
+            ++j;
+          } /*for*/
+        const size_t blen = mp_normalize(w->b, SIQS_LIMBS);
+      /* roots of the first polynomial, and the adjustments for the others */
+        w->root1[1] = w->root2[1] = UINT32_MAX; /* don’t sieve with 2 */
+        unsigned int next_a = 0;
+        for (uint32_t i = 2;;)
+          {
+            if (i == nr_primes)
+                break;
+            if (next_a < s and w->a_index[next_a] == i)
+              {
+                w->root1[i] = w->root2[i] = UINT32_MAX;
+                ++next_a;
+              }
+            else
+              {
+                const uint32_t p = job->primes[i];
+                const uint64_t a_inverse = invmod_u32(mp_divrem_1(NULL, w->a, alen, p), p);
+                const uint64_t b_mod = mp_divrem_1(NULL, w->b, blen, p);
+                const uint64_t t = job->roots[i];
+                w->root1[i] = ((t + p - b_mod) % p * a_inverse + job->half_width) % p;
+                w->root2[i] = ((2 * p - t - b_mod) % p * a_inverse + job->half_width) % p;
+                for (unsigned int j = 0;;)
+                  {
+                    if (j == s)
+                        break;
+                    w->deltas[j * nr_primes + i] =
+                        2 * mp_divrem_1(NULL, w->terms[j], alen, p) * a_inverse % p;
+                    ++j;
+                  } /*for*/
+              } /*if*/
+            ++i;
+          } /*for*/
+      } /*if*/
+    return
+        ok;
+  } /*siqs_new_a*/
+
+static void siqs_next_b
+  (
+    const struct siqs_job * job,
+    struct siqs_poly * w,
+    uint32_t i /* 1 ≤ i < 2**(s - 1) */
+  )
+  /* moves on to the ith polynomial for the current A, by changing the
+    sign of one term of B. */
+  {
+    const unsigned int v = __builtin_ctz(i);
+    const bool was_negated = w->negated[v];
+    uint64_t twice[SIQS_LIMBS];
+    mp_add_n(twice, w->terms[v], w->terms[v], SIQS_LIMBS);
+    if (was_negated)
+        mp_add_n(w->b, w->b, twice, SIQS_LIMBS);
+    else
+        mp_sub_n(w->b, w->b, twice, SIQS_LIMBS);
+    w->negated[v] = not was_negated;
+  /* roots move by ±2·terms[v]/A */
+    const uint32_t * const delta = w->deltas + v * job->nr_primes;
+    for (uint32_t j = 2;;)
+      {
+        if (j == job->nr_primes)
+            break;
+        if (w->root1[j] != UINT32_MAX)
+          {
+            const uint32_t p = job->primes[j], d = delta[j];
+            uint32_t r1 = w->root1[j], r2 = w->root2[j];
+            if (was_negated)
+              {
+                r1 = r1 >= d ? r1 - d : r1 + (p - d);
+                r2 = r2 >= d ? r2 - d : r2 + (p - d);
+              }
+            else
+              {
+                r1 = r1 >= p - d ? r1 - (p - d) : r1 + d;
+                r2 = r2 >= p - d ? r2 - (p - d) : r2 + d;
+              } /*if*/
+            w->root1[j] = r1;
+            w->root2[j] = r2;
+          } /*if*/
+        ++j;
+      } /*for*/
+  } /*siqs_next_b*/
+
+static void siqs_compute_c
+  (
+    const struct siqs_job * job,
+    struct siqs_poly * w
+  )
+  /* C = (B**2 - k·n) / A, which is always negative. */
+  {
+    uint64_t b[SIQS_LIMBS], square[2 * SIQS_LIMBS];
+    memcpy(b, w->b, sizeof b);
+    if (siqs_is_negative(b))
+        siqs_negate(b);
+    const size_t blen = mp_normalize(b, SIQS_LIMBS);
+    memset(square, 0, sizeof square);
+    mp_mul(square, b, blen, b, blen);
+    mp_sub_n(square, job->kn, square, SIQS_LIMBS);
+    memset(w->c, 0, sizeof w->c);
+    mp_divexact(w->c, square, SIQS_LIMBS, w->a, mp_normalize(w->a, SIQS_LIMBS));
+    siqs_negate(w->c);
+  } /*siqs_compute_c*/
+
+static uint32_t siqs_divide_out
+  (
+    uint64_t * v,
+    size_t * len,
+    uint32_t p,
+    uint32_t index, /* of p in the factor base */
+    uint32_t * factors,
+    uint32_t nr_factors
+  )
+  /* divides all powers of p out of v, appending index to factors for
+    each one, and returns the new nr of factors. */
+  {
+    uint64_t q[SIQS_LIMBS];
+    for (;;)
+      {
+        if (mp_divrem_1(q, v, *len, p) != 0)
+            break;
+        memcpy(v, q, *len * sizeof(uint64_t));
+        *len = mp_normalize(v, *len);
+        factors[nr_factors++] = index;
+      } /*for*/
+    return
+        nr_factors;
+  } /*siqs_divide_out*/
+
+static void siqs_add_relation
+  (
+    struct siqs_job * job,
+    const uint64_t * y,
+    const uint32_t * factors,
+    uint32_t nr_factors,
+    uint64_t large
+  )
+  /* saves a newly found full or partial relation, noting when there
+    are enough. */
+  {
+    pthread_mutex_lock(&job->lock);
+    if (not atomic_load(&job->done))
+      {
+        bool ok;
+        if (large == 1)
+            ok = siqs_relations_add(&job->full, y, factors, nr_factors, NULL, 0, 1);
+        else
+          {
+            const int inserted = siqs_hash_insert(&job->large_primes, large);
+            ok =
+                    inserted >= 0
+                and
+                    siqs_relations_add(&job->partial, y, factors, nr_factors, NULL, 0, large);
+            if (inserted == 0)
+                ++job->nr_cycles;
+          } /*if*/
+        if (not ok)
+            job->failed = true;
+        if (not ok or job->full.nr + job->nr_cycles >= job->needed)
+            atomic_store(&job->done, true);
+      } /*if*/
+    pthread_mutex_unlock(&job->lock);
+  } /*siqs_add_relation*/
+
+static void siqs_check
+  (
+    struct siqs_job * job,
+    struct siqs_poly * w,
+    uint32_t block,
+    uint32_t offset
+  )
+  /* tries to factorize Q(x) over the factor base at a sieve position
+    that looks promising, and saves the relation if it succeeds. */
+  {
+    const uint32_t pos = block * SIQS_BLOCK + offset;
+    const int64_t x = (int64_t)pos - job->half_width;
+    uint64_t y[SIQS_LIMBS], v[SIQS_LIMBS];
+    siqs_mul_si(y, w->a, x);
+    mp_add_n(y, y, w->b, SIQS_LIMBS); /* A·x + B */
+    mp_add_n(v, y, w->b, SIQS_LIMBS);
+    siqs_mul_si(v, v, x);
+    mp_add_n(v, v, w->c, SIQS_LIMBS); /* (A·x + 2·B)·x + C */
+    uint32_t nr_factors = 0;
+    if (siqs_is_negative(v))
+      {
+        w->factors[nr_factors++] = 0;
+        siqs_negate(v);
+      } /*if*/
+    size_t len = mp_normalize(v, SIQS_LIMBS);
+    if (len != 0)
+      {
+        const unsigned int twos = mp_ctz(v, len);
+        len = mp_shr(v, len, twos);
+        for (unsigned int i = 0;;)
+          {
+            if (i == twos)
+                break;
+            w->factors[nr_factors++] = 1;
+            ++i;
+          } /*for*/
+        for (uint32_t i = 2;;)
+          {
+            if (i == job->first_large)
+                break;
+            if (w->root1[i] != UINT32_MAX)
+              {
+                const uint32_t p = job->primes[i], r = pos % p;
+                if (r == w->root1[i] or r == w->root2[i])
+                    nr_factors = siqs_divide_out(v, &len, p, i, w->factors, nr_factors);
+              } /*if*/
+            ++i;
+          } /*for*/
+        for (unsigned int j = 0;;)
+          {
+            if (j == job->nr_a_factors)
+                break;
+            const uint32_t i = w->a_index[j];
+            w->factors[nr_factors++] = i; /* from A */
+            nr_factors = siqs_divide_out(v, &len, job->primes[i], i, w->factors, nr_factors);
+            ++j;
+          } /*for*/
+        const uint32_t * const bucket = w->buckets + block * w->bucket_size;
+        for (uint32_t j = 0;;)
+          {
+            if (j == w->bucket_fill[block])
+                break;
+            if ((bucket[j] & 0xffff) == offset)
+              {
+                const uint32_t i = bucket[j] >> 16;
+                nr_factors = siqs_divide_out(v, &len, job->primes[i], i, w->factors, nr_factors);
+              } /*if*/
+            ++j;
+          } /*for*/
+      /* anything left over is a prime, being less than the square of the
+        largest factor-base prime */
+        if (len == 1 and v[0] < job->large_bound)
+          {
+            if (siqs_is_negative(y))
+                siqs_negate(y);
+            siqs_add_relation(job, y, w->factors, nr_factors, v[0]);
+          } /*if*/
+      } /*if*/
+  } /*siqs_check*/
+
+static void siqs_sieve
+  (
+    struct siqs_job * job,
+    struct siqs_poly * w
+  )
+  /* sieves over the interval for the current polynomial, checking
+    each promising-looking position. */
+  {
+    const uint32_t interval = job->nr_blocks * SIQS_BLOCK;
+  /* distribute hits of the large primes among the buckets */
+    memset(w->bucket_fill, 0, job->nr_blocks * sizeof(uint32_t));
+    for (uint32_t i = job->first_large;;)
+      {
+        if (i == job->nr_primes)
+            break;
+        if (w->root1[i] != UINT32_MAX)
+          {
+            const uint32_t p = job->primes[i];
+            for (unsigned int r = 0;;)
+              {
+                if (r == 2 or r == 1 and w->root2[i] == w->root1[i])
+                    break;
+                for (uint32_t j = r == 0 ? w->root1[i] : w->root2[i];;)
+                  {
+                    if (j >= interval)
+                        break;
+                    const uint32_t block = j / SIQS_BLOCK;
+                    w->buckets[block * w->bucket_size + w->bucket_fill[block]++] =
+                        i << 16 | j % SIQS_BLOCK;
+                    j += p;
+                  } /*for*/
+                ++r;
+              } /*for*/
+          } /*if*/
+        ++i;
+      } /*for*/
+    memcpy(w->next1, w->root1, job->first_large * sizeof(uint32_t));
+    memcpy(w->next2, w->root2, job->first_large * sizeof(uint32_t));
+    for (uint32_t block = 0;;)
+      {
+        if (block == job->nr_blocks or atomic_load(&job->done))
+            break;
+        uint8_t * const sieve = w->sieve;
+        memset(sieve, job->sieve_init, SIQS_BLOCK);
+        for (uint32_t i = job->first_sieved;;)
+          {
+            if (i == job->first_large)
+                break;
+            if (w->root1[i] != UINT32_MAX)
+              {
+                const uint32_t p = job->primes[i];
+                const uint8_t logp = job->logs[i];
+                uint32_t j = w->next1[i];
+                for (;;)
+                  {
+                    if (j >= SIQS_BLOCK)
+                        break;
+                    sieve[j] += logp;
+                    j += p;
+                  } /*for*/
+                w->next1[i] = j - SIQS_BLOCK;
+                if (w->root2[i] != w->root1[i])
+                  {
+                    j = w->next2[i];
+                    for (;;)
+                      {
+                        if (j >= SIQS_BLOCK)
+                            break;
+                        sieve[j] += logp;
+                        j += p;
+                      } /*for*/
+                    w->next2[i] = j - SIQS_BLOCK;
+                  } /*if*/
+              } /*if*/
+            ++i;
+          } /*for*/
+        const uint32_t * const bucket = w->buckets + block * w->bucket_size;
+        for (uint32_t j = 0;;)
+          {
+            if (j == w->bucket_fill[block])
+                break;
+            sieve[bucket[j] & 0xffff] += job->logs[bucket[j] >> 16];
+            ++j;
+          } /*for*/
+        for (uint32_t offset = 0;;)
+          {
+            if (offset == SIQS_BLOCK)
+                break;
+            uint64_t word;
+            memcpy(&word, sieve + offset, sizeof word);
+            if ((word & 0x8080808080808080U) != 0)
+              {
+                for (uint32_t j = offset;;)
+                  {
+                    if (j == offset + sizeof word)
+                        break;
+                    if (sieve[j] >= 128)
+                        siqs_check(job, w, block, j);
+                    ++j;
+                  } /*for*/
+              } /*if*/
+            offset += sizeof word;
+          } /*for*/
+        ++block;
+      } /*for*/
+  } /*siqs_sieve*/
+
+static void * siqs_worker
+  (
+    void * arg
+  )
+  /* collects relations from one value of A after another, until there
+    are enough. */
+  {
+    struct siqs_job * const job = arg;
+    const uint32_t nr_primes = job->nr_primes;
+    struct siqs_poly * w = NULL;
+    bool ok = false;
+    do /*once*/
+      {
+        w = malloc(sizeof(struct siqs_poly));
+        if (w == NULL)
+            break;
+        w->root1 = malloc((4 + job->nr_a_factors) * nr_primes * sizeof(uint32_t));
+        w->sieve = malloc(SIQS_BLOCK);
+        w->bucket_size = 2 * (nr_primes - job->first_large) + 1;
+        w->buckets = malloc(job->nr_blocks * w->bucket_size * sizeof(uint32_t));
+        w->bucket_fill = malloc(job->nr_blocks * sizeof(uint32_t));
+        if (w->root1 == NULL or w->sieve == NULL or w->buckets == NULL or w->bucket_fill == NULL)
+            break;
+        w->root2 = w->root1 + nr_primes;
+        w->next1 = w->root1 + 2 * nr_primes;
+        w->next2 = w->root1 + 3 * nr_primes;
+        w->deltas = w->root1 + 4 * nr_primes;
+        pthread_mutex_lock(&job->lock);
+        const unsigned int seed = ++job->nr_workers;
+        pthread_mutex_unlock(&job->lock);
+        w->rand = siqs_mix(job->n[0] + seed) | 1;
+        ok = true;
+        for (;;)
+          {
+            if (atomic_load(&job->done))
+                break;
+            ok = siqs_new_a(job, w);
+            if (not ok)
+                break;
+            for (uint32_t i = 0;;)
+              {
+                if (i != 0)
+                    siqs_next_b(job, w, i);
+                siqs_compute_c(job, w);
+                siqs_sieve(job, w);
+                if (work_charge(job->work, job->nr_blocks * (SIQS_BLOCK / 32)))
+                    atomic_store(&job->done, true); /* a block takes about as long as 1000 multiplications */
+                ++i;
+                if (i == (uint32_t)1 << job->nr_a_factors - 1 or atomic_load(&job->done))
+                    break;
+              } /*for*/
+          } /*for*/
+      }
+    while (false);
+    if (not ok)
+      {
+        pthread_mutex_lock(&job->lock);
+        job->failed = true;
+        atomic_store(&job->done, true);
+        pthread_mutex_unlock(&job->lock);
+      } /*if*/
+    if (w != NULL)
+      {
+        free(w->root1);
+        free(w->sieve);
+        free(w->buckets);
+        free(w->bucket_fill);
+        free(w);
+      } /*if*/
+    return
+        NULL;
+  } /*siqs_worker*/
+
+struct siqs_pairing
+  {
+    uint64_t large;
+    size_t index;
+  };
+
+static int siqs_compare_pairings
+  (
+    const void * a,
+    const void * b
+  )
+  /* for sorting partial relations by large prime. */
+  {
+    const struct siqs_pairing * const pa = a;
+    const struct siqs_pairing * const pb = b;
+    return
+        pa->large < pb->large ? -1 : pa->large > pb->large ? 1 : 0;
+  } /*siqs_compare_pairings*/
+
+static bool siqs_combine_partials
+  (
+    const struct mp_mont * m,
+    struct siqs_job * job
+  )
+  /* pairs each partial relation with the first one having the same
+    large prime, adding the products to the full relations. Returns
+    false if out of memory. */
+  {
+    const struct siqs_relations * const partial = &job->partial;
+    bool ok = false;
+    struct siqs_pairing * order = NULL;
+    do /*once*/
+      {
+        order = malloc((partial->nr + 1) * sizeof(struct siqs_pairing));
+        if (order == NULL)
+            break;
+        for (size_t i = 0;;)
+          {
+            if (i == partial->nr)
+                break;
+            order[i].large = partial->rels[i].large;
+            order[i].index = i;
+            ++i;
+          } /*for*/
+        qsort(order, partial->nr, sizeof(struct siqs_pairing), siqs_compare_pairings);
+        uint64_t * const y = mp_temp(m, 0);
+        ok = true;
+        for (size_t i = 0, first = 0;;)
+          {
+            if (i == partial->nr)
+                break;
+            if (order[i].large != order[first].large)
+                first = i;
+            else if (i != first)
+              {
+                const struct siqs_relation * const rel1 = &partial->rels[order[first].index];
+                const struct siqs_relation * const rel2 = &partial->rels[order[i].index];
+                mp_mont_mul(m, y, partial->y + order[first].index * m->k, partial->y + order[i].index * m->k);
+                mp_mont_mul(m, y, y, m->r2); /* undo the division by R */
+                ok = siqs_relations_add
+                  (
+                    &job->full,
+                    y,
+                    partial->factors + rel1->factors,
+                    rel1->nr_factors,
+                    partial->factors + rel2->factors,
+                    rel2->nr_factors,
+                    order[i].large
+                  );
+                if (not ok)
+                    break;
+              } /*if*/
+            ++i;
+          } /*for*/
+      }
+    while (false);
+    free(order);
+    return
+        ok;
+  } /*siqs_combine_partials*/
+
+static void siqs_try_dependency
+  (
+    const struct mp_mont * m,
+    const struct siqs_job * job,
+    const uint64_t * chosen, /* bit set of matrix rows */
+    const size_t * rows, /* full-relation index of each matrix row */
+    size_t nr_rows,
+    uint32_t * exponents, /* scratch, one for each factor-base entry */
+    uint64_t * g,
+    size_t * glen,
+    bool * found
+  )
+  /* multiplies together the chosen relations, giving x**2 ≡ y**2 (mod n),
+    and sees if gcd(x ± y, n) is a proper factor. Uses temporaries 0-4. */
+  {
+    const struct siqs_relations * const rels = &job->full;
+    const size_t k = m->k;
+    uint64_t * const x = mp_temp(m, 0);
+    uint64_t * const y = mp_temp(m, 1);
+    uint64_t * const t = mp_temp(m, 2);
+    uint64_t * const scratch = mp_temp(m, 3); /* and 4 */
+    memset(exponents, 0, job->nr_primes * sizeof(uint32_t));
+    memcpy(x, m->one, k * sizeof(uint64_t));
+    memcpy(y, m->one, k * sizeof(uint64_t));
+    for (size_t r = 0;;)
+      {
+        if (r == nr_rows)
+            break;
+        if (chosen[r / 64] >> r % 64 & 1)
+          {
+            const struct siqs_relation * const rel = &rels->rels[rows[r]];
+            mp_mont_mul(m, t, rels->y + rows[r] * k, m->r2);
+            mp_mont_mul(m, x, x, t);
+            if (rel->large != 1)
+              {
+                mp_mont_set(m, t, rel->large);
+                mp_mont_mul(m, y, y, t);
+              } /*if*/
+            for (uint32_t j = 0;;)
+              {
+                if (j == rel->nr_factors)
+                    break;
+                ++exponents[rels->factors[rel->factors + j]];
+                ++j;
+              } /*for*/
+          } /*if*/
+        ++r;
+      } /*for*/
+    for (uint32_t i = 1;;)
+      {
+        if (i == job->nr_primes)
+            break;
+        if (exponents[i] != 0)
+          {
+            mp_mont_set(m, t, job->primes[i]);
+            for (uint32_t e = exponents[i] / 2;;)
+              {
+                if (e == 0)
+                    break;
+                mp_mont_mul(m, y, y, t);
+                --e;
+              } /*for*/
+          } /*if*/
+        ++i;
+      } /*for*/
+    for (unsigned int sign = 0;;)
+      {
+        if (sign == 2)
+            break;
+        if (sign == 0)
+            mp_submod(m, t, x, y);
+        else
+            mp_addmod(m, t, x, y);
+        *glen = mp_mont_gcd(m, g, t, scratch);
+        if (mp_is_proper_factor(m, g, *glen))
+          {
+            *found = true;
+            break;
+          } /*if*/
+        ++sign;
+      } /*for*/
+  } /*siqs_try_dependency*/
+
+static bool siqs_solve
+  (
+    const struct mp_mont * m,
+    const struct siqs_job * job,
+    uint64_t * g,
+    size_t * glen,
+    bool * found
+  )
+  /* finds subsets of the full relations whose products are squares,
+    and tries each in turn for a factor of n. Returns false only if
+    out of memory. */
+  {
+    const struct siqs_relations * const rels = &job->full;
+    const uint32_t nr_primes = job->nr_primes;
+    bool ok = false;
+    size_t * odd_start = NULL; /* where each relation’s odd-power primes start in odd */
+    uint32_t * odd = NULL;
+    uint32_t * weight = NULL; /* nr of live relations with an odd power of each prime */
+    uint8_t * parity = NULL;
+    uint32_t * column = NULL; /* matrix column for each prime */
+    bool * live = NULL;
+    size_t * rows = NULL; /* relation for each matrix row */
+    uint64_t * matrix = NULL;
+    uint32_t * exponents = NULL;
+    do /*once*/
+      {
+        odd_start = malloc((rels->nr + 1) * sizeof(size_t));
+        odd = malloc((rels->nr_factors + 1) * sizeof(uint32_t));
+        weight = calloc(nr_primes, sizeof(uint32_t));
+        parity = calloc(nr_primes, 1);
+        column = malloc(nr_primes * sizeof(uint32_t));
+        live = malloc(rels->nr + 1);
+        rows = malloc((rels->nr + 1) * sizeof(size_t));
+        exponents = malloc(nr_primes * sizeof(uint32_t));
+        if
+          (
+                odd_start == NULL
+            or
+                odd == NULL
+            or
+                weight == NULL
+            or
+                parity == NULL
+            or
+                column == NULL
+            or
+                live == NULL
+            or
+                rows == NULL
+            or
+                exponents == NULL
+          )
+            break;
+      /* which primes occur to odd powers in each relation */
+        size_t nr_odd = 0;
+        for (size_t i = 0;;)
+          {
+            if (i == rels->nr)
+                break;
+            const struct siqs_relation * const rel = &rels->rels[i];
+            const uint32_t * const factors = rels->factors + rel->factors;
+            odd_start[i] = nr_odd;
+            for (uint32_t j = 0;;)
+              {
+                if (j == rel->nr_factors)
+                    break;
+                parity[factors[j]] ^= 1;
+                ++j;
+              } /*for*/
+            for (uint32_t j = 0;;)
+              {
+                if (j == rel->nr_factors)
+                    break;
+                if (parity[factors[j]] != 0)
+                  {
+                    parity[factors[j]] = 0;
+                    odd[nr_odd++] = factors[j];
+                    ++weight[factors[j]];
+                  } /*if*/
+                ++j;
+              } /*for*/
+            live[i] = true;
+            ++i;
+          } /*for*/
+        odd_start[rels->nr] = nr_odd;
+      /* repeatedly weed out relations with a prime occurring nowhere else */
+        for (;;)
+          {
+            bool changed = false;
+            for (size_t i = 0;;)
+              {
+                if (i == rels->nr)
+                    break;
+                if (live[i])
+                  {
+                    bool singleton = false;
+                    for (size_t j = odd_start[i];;)
+                      {
+                        if (singleton or j == odd_start[i + 1])
+                            break;
+                        singleton = weight[odd[j]] == 1;
+                        ++j;
+                      } /*for*/
+                    if (singleton)
+                      {
+                        for (size_t j = odd_start[i];;)
+                          {
+                            if (j == odd_start[i + 1])
+                                break;
+                            --weight[odd[j]];
+                            ++j;
+                          } /*for*/
+                        live[i] = false;
+                        changed = true;
+                      } /*if*/
+                  } /*if*/
+                ++i;
+              } /*for*/
+            if (not changed)
+                break;
+          } /*for*/
+        size_t nr_columns = 0, nr_rows = 0;
+        for (uint32_t i = 0;;)
+          {
+            if (i == nr_primes)
+                break;
+            column[i] = weight[i] != 0 ? nr_columns++ : UINT32_MAX;
+            ++i;
+          } /*for*/
+        for (size_t i = 0;;)
+          {
+            if (i == rels->nr or nr_rows == nr_columns + SIQS_EXTRA_RELATIONS)
+                break;
+            if (live[i])
+                rows[nr_rows++] = i;
+            ++i;
+          } /*for*/
+      /* each matrix row has a bit for each prime, followed by a bit for
+        each row, to keep track of which relations have been added into it */
+        const size_t column_words = (nr_columns + 63) / 64;
+        const size_t row_words = column_words + (nr_rows + 63) / 64;
+        matrix = calloc(nr_rows * row_words + 1, sizeof(uint64_t));
+        if (matrix == NULL)
+            break;
+        for (size_t r = 0;;)
+          {
+            if (r == nr_rows)
+                break;
+            uint64_t * const row = matrix + r * row_words;
+            for (size_t j = odd_start[rows[r]];;)
+              {
+                if (j == odd_start[rows[r] + 1])
+                    break;
+                const uint32_t c = column[odd[j]];
+                row[c / 64] |= (uint64_t)1 << c % 64;
+                ++j;
+              } /*for*/
+            row[column_words + r / 64] |= (uint64_t)1 << r % 64;
+            live[r] = false; /* now means “used as pivot” */
+            ++r;
+          } /*for*/
+        bool * const pivot = live;
+        for (size_t c = 0;;)
+          {
+            if (c == nr_columns)
+                break;
+            const size_t word = c / 64;
+            const uint64_t bit = (uint64_t)1 << c % 64;
+            size_t p = 0;
+            for (;;)
+              {
+                if (p == nr_rows or not pivot[p] and (matrix[p * row_words + word] & bit) != 0)
+                    break;
+                ++p;
+              } /*for*/
+            if (p != nr_rows)
+              {
+                pivot[p] = true;
+                const uint64_t * const prow = matrix + p * row_words;
+                for (size_t r = 0;;)
+                  {
+                    if (r == nr_rows)
+                        break;
+                    uint64_t * const row = matrix + r * row_words;
+                    if (not pivot[r] and (row[word] & bit) != 0)
+                      {
+                      /* pivot row has nothing in earlier columns */
+                        for (size_t j = word;;)
+                          {
+                            if (j == row_words)
+                                break;
+                            row[j] ^= prow[j];
+                            ++j;
+                          } /*for*/
+                      } /*if*/
+                    ++r;
+                  } /*for*/
+              } /*if*/
+            ++c;
+          } /*for*/
+      /* rows never used as pivots have been reduced to zero */
+        for (size_t r = 0;;)
+          {
+            if (r == nr_rows or *found)
+                break;
+            if (not pivot[r])
+                siqs_try_dependency
+                  (
+                    m,
+                    job,
+                    matrix + r * row_words + column_words,
+                    rows,
+                    nr_rows,
+                    exponents,
+                    g,
+                    glen,
+                    found
+                  );
+            ++r;
+          } /*for*/
+        ok = true;
+      }
+    while (false);
+    free(odd_start);
+    free(odd);
+    free(weight);
+    free(parity);
+    free(column);
+    free(live);
+    free(rows);
+    free(matrix);
+    free(exponents);
+    return
+        ok;
+  } /*siqs_solve*/
+
+static bool siqs_factor
+  (
+    const struct mp_mont * m, /* m->n must be composite, with no factors up to TRIAL_LIMIT */
+    uint64_t * g, /* room for k limbs */
+    size_t * glen,
+    bool * found,
+    struct work_limit * work
+  )
+  /* tries to find a nontrivial factor of m->n with the quadratic sieve,
+    putting it in g and setting *found. This can fail if n is a prime
+    power, or if work is stopped. Returns false only if out of memory. */
+  {
+    const uint64_t * const n = m->n;
+    const size_t k = m->k;
+    bool ok = false;
+    struct prime_iter it = {.base_primes = NULL, .sieve = NULL};
+    struct siqs_job job =
+        {
+            .n = n,
+            .k = k,
+            .primes = NULL,
+            .roots = NULL,
+            .logs = NULL,
+            .full = {.k = k},
+            .partial = {.k = k},
+            .large_primes = {.nr_keys = 0, .size = 0, .keys = NULL},
+            .used_a = {.nr_keys = 0, .size = 0, .keys = NULL},
+            .nr_cycles = 0,
+            .nr_workers = 0,
+            .failed = false,
+            .work = work,
+        };
+    bool locked = false; /* whether job.lock needs destroying */
+    *found = false;
+    do /*once*/
+      {
+        const unsigned int bits = 64 * k - __builtin_clzll(n[k - 1]);
+        unsigned int level = 0;
+        for (;;)
+          {
+            if
+              (
+                    level + 1 == sizeof siqs_params / sizeof siqs_params[0]
+                or
+                    siqs_params[level + 1].bits > bits
+              )
+                break;
+            ++level;
+          } /*for*/
+        uint32_t nr_primes = siqs_params[level].nr_primes;
+        if (bits > siqs_params[level].bits and level + 1 < sizeof siqs_params / sizeof siqs_params[0])
+            nr_primes +=
+                    (siqs_params[level + 1].nr_primes - siqs_params[level].nr_primes)
+                *
+                    (bits - siqs_params[level].bits)
+                /
+                    (siqs_params[level + 1].bits - siqs_params[level].bits);
+        const unsigned int multiplier = siqs_choose_multiplier(n, k);
+        memset(job.kn, 0, sizeof job.kn);
+        job.kn[k] = mp_mul_1(job.kn, n, k, multiplier);
+        job.primes = malloc(nr_primes * sizeof(uint32_t));
+        job.roots = malloc(nr_primes * sizeof(uint32_t));
+        job.logs = malloc(nr_primes);
+        if (job.primes == NULL or job.roots == NULL or job.logs == NULL)
+            break;
+        if (not prime_iter_init(&it, 3, 64 * nr_primes))
+            break;
+          /* more than enough: at least half of these primes should qualify */
+      /* factor base: -1, 2, then the odd primes modulo which k·n is a square */
+        job.primes[0] = 1;
+        job.roots[0] = 0;
+        job.logs[0] = 0;
+        job.primes[1] = 2;
+        job.roots[1] = 1;
+        job.logs[1] = 1;
+        job.nr_primes = 2;
+        for (;;)
+          {
+            if (job.nr_primes == nr_primes)
+                break;
+            const uint32_t p = prime_iter_next(&it);
+            if (p == 0)
+                break;
+            const uint32_t r = mp_divrem_1(NULL, job.kn, k + 1, p);
+            if (r == 0 and multiplier % p != 0)
+              {
+              /* p divides n: unlikely after rho, but not impossible */
+                g[0] = p;
+                *glen = 1;
+                *found = true;
+                break;
+              } /*if*/
+            if (r == 0 or jacobi_u128(r, p) == 1)
+              {
+                job.primes[job.nr_primes] = p;
+                job.roots[job.nr_primes] = r == 0 ? 0 : sqrtmod_u32(r, p);
+                job.logs[job.nr_primes] = lround(log2(p));
+                ++job.nr_primes;
+              } /*if*/
+          } /*for*/
+        if (*found)
+          {
+            ok = true;
+            break;
+          } /*if*/
+        if (job.nr_primes < nr_primes)
+            break;
+        job.first_sieved = 2;
+        for (;;)
+          {
+            if (job.first_sieved == nr_primes or job.primes[job.first_sieved] >= SIQS_SMALL_PRIME)
+                break;
+            ++job.first_sieved;
+          } /*for*/
+        job.first_large = job.first_sieved;
+        for (;;)
+          {
+            if (job.first_large == nr_primes or job.primes[job.first_large] >= SIQS_BLOCK)
+                break;
+            ++job.first_large;
+          } /*for*/
+      /* sizes of things */
+        job.nr_blocks = siqs_params[level].nr_blocks;
+        job.half_width = job.nr_blocks * SIQS_BLOCK / 2;
+        const size_t knlen = mp_normalize(job.kn, k + 1);
+        const double log_kn =
+                64 * (knlen - 1)
+            +
+                log2(job.kn[knlen - 1] + (knlen > 1 ? job.kn[knlen - 2] / 0x1p64 : 0));
+        const double log_m = log2(job.half_width);
+        job.large_bound = (uint64_t)job.primes[nr_primes - 1] * siqs_params[level].large_multiplier;
+        const double threshold = log_m + log_kn / 2 - 0.5 - log2(job.large_bound) - 14;
+          /* |Q(x)| is at most about M·√(k·n / 2), of which all but the
+            large prime should come from the factor base; the slack allows
+            for values below the maximum, and for the primes too small to
+            sieve with */
+        job.sieve_init = threshold >= 128 ? 0 : 128 - (unsigned int)lround(threshold);
+        job.log_a = (log_kn + 1) / 2 - log_m;
+      /* factors of A should be a few thousand, but can’t be too far up
+        a small factor base */
+        const double log_q = fmin(11, log2(job.primes[nr_primes / 2]));
+        long s = lround(job.log_a / log_q);
+        if (s < 2)
+            s = 2;
+        else if (s > SIQS_MAX_A_FACTORS)
+            s = SIQS_MAX_A_FACTORS;
+        job.nr_a_factors = s;
+        const double q = exp2(job.log_a / s);
+      /* choose factors from primes within a factor of 2 of the ideal
+        size, or if that is too few, from whatever is nearest */
+        job.a_lo = 2;
+        for (;;)
+          {
+            if (job.a_lo + 1 == nr_primes or job.primes[job.a_lo] >= q / 2)
+                break;
+            ++job.a_lo;
+          } /*for*/
+        job.a_hi = job.a_lo;
+        for (;;)
+          {
+            if (job.a_hi == nr_primes or job.primes[job.a_hi] > 2 * q)
+                break;
+            ++job.a_hi;
+          } /*for*/
+        for (;;)
+          {
+            if (job.a_hi - job.a_lo >= 4 * s or job.a_lo == 2 and job.a_hi == nr_primes)
+                break;
+            if (job.a_lo > 2)
+                --job.a_lo;
+            if (job.a_hi < nr_primes)
+                ++job.a_hi;
+          } /*for*/
+        job.needed = nr_primes + SIQS_EXTRA_RELATIONS;
+      /* collect relations */
+        if (pthread_mutex_init(&job.lock, NULL) != 0)
+            break;
+        locked = true;
+        atomic_init(&job.done, false);
+        run_workers
+          (
+            siqs_worker,
+            &job,
+            threads_for(job.needed, SIQS_THREAD_RELATIONS, default_nr_threads())
+          );
+        if (job.failed)
+            break;
+        if (work_stopped(work))
+          {
+            ok = true;
+            break;
+          } /*if*/
+      /* and make use of them */
+        if (not siqs_combine_partials(m, &job))
+            break;
+        ok = siqs_solve(m, &job, g, glen, found);
+      }
+    while (false);
+    if (locked)
+        pthread_mutex_destroy(&job.lock);
+    prime_iter_dispose(&it);
+    free(job.primes);
+    free(job.roots);
+    free(job.logs);
+    siqs_relations_dispose(&job.full);
+    siqs_relations_dispose(&job.partial);
+    free(job.large_primes.keys);
+    free(job.used_a.keys);
+    return
+        ok;
+  } /*siqs_factor*/
+
+static bool mp_find_factor
+  (
+    const struct mp_mont * m, /* m->n must be composite */
+    uint64_t * g, /* room for k limbs */
+    size_t * glen,
+    struct work_limit * work /* may be NULL */
+  )
+  /* finds a nontrivial factor of m->n, first with rho, then with ECM,
+    switching to SIQS partway through the ECM schedule if n is in the
+    right size range, putting it in g. If work is stopped first, sets
+    *glen to 0 instead. Returns false only if out of memory. */
+  {
+    bool ok = true;
+    bool found = false;
+    struct ecm_workspace * ws = NULL;
+    do /*once*/
+      {
+        const unsigned int bits = 64 * m->k - __builtin_clzll(m->n[m->k - 1]);
+        bool try_siqs = bits >= SIQS_MIN_BITS and bits <= SIQS_MAX_BITS;
+        found = rho_mp(m, g, glen, try_siqs ? RHO_MP_SIQS_LIMIT : RHO_MP_LIMIT, work);
+        if (found or work_stopped(work))
+            break;
+        const unsigned int siqs_level = bits < SIQS_ECM_BITS ? 0 : 1;
+          /* nr of ECM levels to try first, looking for factors that are
+            small enough for ECM to find faster */
+        ws = malloc(sizeof(struct ecm_workspace));
+        if (ws != NULL)
+            ws->baby = malloc(ECM_NR_BABY_STEPS * 2 * m->k * sizeof(uint64_t));
+        if (ws == NULL or ws->baby == NULL)
+          {
+            ok = false;
+            break;
+          } /*if*/
+        int nr_baby_steps = 0;
+        for (unsigned int j = 0;;)
+          {
+            if (j == ECM_D / 2)
+                break;
+            ws->baby_index[j] = j % 2 != 0 and gcd_u64(j, ECM_D) == 1 ? nr_baby_steps++ : -1;
+            ++j;
+          } /*for*/
+        uint64_t sigma = 6;
+        for (unsigned int level = 0;;)
+          {
+            if (try_siqs and level == siqs_level)
+              {
+                ok = siqs_factor(m, g, glen, &found, work);
+                if (not ok or found or work_stopped(work))
+                    break;
+                try_siqs = false; /* no luck, carry on with ECM */
+              } /*if*/
+            for (uint32_t curve = 0;;)
+              {
+                if (curve == ecm_schedule[level].nr_curves)
+                    break;
+                const uint64_t b1 = ecm_schedule[level].b1;
+                ok = ecm_curve(m, ws, sigma, b1, b1 * ECM_B2_FACTOR, g, glen, &found, work);
+                if (not ok or found or work_stopped(work))
+                    break;
+                ++sigma;
+                ++curve;
+              } /*for*/
+            if (not ok or found or work_stopped(work))
+                break;
+            if (level + 1 < sizeof ecm_schedule / sizeof ecm_schedule[0])
+                ++level;
+          } /*for*/
+      }
+    while (false);
+    if (ws != NULL)
+      {
+        free(ws->baby);
+        free(ws);
+      } /*if*/
+    if (not found)
+        *glen = 0;
+    return
+        ok;
+  } /*mp_find_factor*/
+
+struct mp_factor
+  {
+    uint64_t * limbs;
+    size_t len;
+    unsigned int power;
+  };
+
+struct mp_factorization
+  {
+    size_t nr_factors, allocated;
+    struct mp_factor * factors; /* kept in ascending order of prime */
+  };
+#define MP_FACTORIZATION_INIT {.nr_factors = 0, .allocated = 0, .factors = NULL}
+
+static void mp_factorization_dispose
+  (
+    struct mp_factorization * f
+  )
+  {
+    for (size_t i = 0;;)
+      {
+        if (i == f->nr_factors)
+            break;
+        free(f->factors[i].limbs);
+        ++i;
+      } /*for*/
+    free(f->factors);
+    f->factors = NULL;
+    f->nr_factors = f->allocated = 0;
+  } /*mp_factorization_dispose*/
+
+static bool mp_factorization_add
+  (
+    struct mp_factorization * f,
+    const uint64_t * prime,
+    size_t len,
+    unsigned int power
+  )
+  /* merges prime ** power into f, keeping the entries sorted. Returns
+    false if out of memory. */
+  {
+    bool ok = true;
+    size_t i = f->nr_factors;
+    int cmp = -1;
+    for (;;)
+      {
+        if (i == 0)
+            break;
+        cmp = mp_cmp(f->factors[i - 1].limbs, f->factors[i - 1].len, prime, len);
+        if (cmp <= 0)
+            break;
+        --i;
+      } /*for*/
+    if (i != 0 and cmp == 0)
+        f->factors[i - 1].power += power;
+    else
+      {
+        do /*once*/
+          {
+            if (f->nr_factors == f->allocated)
+              {
+                const size_t new_allocated = f->allocated == 0 ? 8 : 2 * f->allocated;
+                struct mp_factor * const new_factors =
+                    realloc(f->factors, new_allocated * sizeof(struct mp_factor));
+                if (new_factors == NULL)
+                  {
+                    ok = false;
+                    break;
+                  } /*if*/
+                f->factors = new_factors;
+                f->allocated = new_allocated;
+              } /*if*/
+            uint64_t * const limbs = malloc(len * sizeof(uint64_t));
+            if (limbs == NULL)
+              {
+                ok = false;
+                break;
+              } /*if*/
+            memcpy(limbs, prime, len * sizeof(uint64_t));
+            memmove(f->factors + i + 1, f->factors + i, (f->nr_factors - i) * sizeof(struct mp_factor));
+            f->factors[i].limbs = limbs;
+            f->factors[i].len = len;
+            f->factors[i].power = power;
+            ++f->nr_factors;
+          }
+        while (false);
+      } /*if*/
+    return
+        ok;
+  } /*mp_factorization_add*/
+
+static bool mp_factorization_add_all
+  (
+    struct mp_factorization * f,
+    const struct factorization * g,
+    unsigned int power /* g is raised to this */
+  )
+  /* merges a single-precision factorization into f. */
+  {
+    bool ok = true;
+    for (unsigned int i = 0;;)
+      {
+        if (i == g->nr_factors)
+            break;
+        ok = mp_factorization_add(f, &g->factors[i].prime, 1, g->factors[i].power * power);
+        if (not ok)
+            break;
+        ++i;
+      } /*for*/
+    return
+        ok;
+  } /*mp_factorization_add_all*/
+
+#define MP_POWER_RESIDUE_TESTS 6
+  /* nr of primes modulo which n must be a kth power residue before its
+    kth root is worked out */
+
+static bool mp_kth_root
+  (
+    uint64_t * r, /* room for len limbs */
+    size_t * rlen,
+    const uint64_t * n,
+    size_t len, /* n must be normalized */
+    unsigned int k, /* at least 2 */
+    uint64_t * scratch /* room for 4·len + 2 limbs */
+  )
+  /* puts the integer kth root of n in r, returning true if its kth power
+    is exactly n. Done a bit at a time from the top, raising each trial
+    root to the kth power by repeated multiplication; not fast, but only
+    needed for n that already look like kth powers. */
+  {
+    uint64_t * const a = scratch;
+    uint64_t * const b = scratch + 2 * len + 1;
+    const unsigned int bits = 64 * len - __builtin_clzll(n[len - 1]);
+    int cmp = 1;
+    memset(r, 0, len * sizeof(uint64_t));
+    for (unsigned int bit = (bits + k - 1) / k;;)
+      {
+        if (bit == 0)
+            break;
+        --bit;
+        r[bit / 64] |= (uint64_t)1 << bit % 64;
+        const size_t len_r = mp_normalize(r, len);
+      /* a = r ** k, unless it is bound to exceed n */
+        memcpy(a, r, len_r * sizeof(uint64_t));
+        size_t len_a = len_r;
+        for (unsigned int i = 1;;)
+          {
+            if (i == k or len_a > len)
+                break;
+            mp_mul(b, a, len_a, r, len_r);
+            len_a = mp_normalize(b, len_a + len_r);
+            memcpy(a, b, len_a * sizeof(uint64_t));
+            ++i;
+          } /*for*/
+        cmp = mp_cmp(a, len_a, n, len);
+        if (cmp > 0)
+            r[bit / 64] &= ~((uint64_t)1 << bit % 64);
+        if (cmp == 0)
+            break;
+      } /*for*/
+    *rlen = mp_normalize(r, len);
+    return
+        cmp == 0;
+  } /*mp_kth_root*/
+
+static unsigned int mp_perfect_power
+  (
+    uint64_t * r, /* room for len limbs */
+    size_t * rlen,
+    const uint64_t * n,
+    size_t len, /* n must be normalized, with no factors up to TRIAL_LIMIT */
+    uint64_t * scratch /* room for 4·len + 2 limbs */
+  )
+  /* if n is a perfect kth power for some prime k, puts its kth root in r
+    and returns k; otherwise returns 0. Since the root must exceed
+    TRIAL_LIMIT, k can only be up to log(n) / log(TRIAL_LIMIT); each
+    candidate k is first checked by seeing if n is a kth power residue
+    modulo a few primes ℓ ≡ 1 (mod k), which only about one in k of
+    other n will be for each ℓ. */
+  {
+    const unsigned int bits = 64 * len - __builtin_clzll(n[len - 1]);
+    unsigned int result = 0;
+    for (unsigned int k = 2;;)
+      {
+        if (k * (63 - __builtin_clzll(TRIAL_LIMIT)) >= bits)
+            break;
+        bool candidate = true;
+        for (uint32_t ell = 2 * k + 1, nr_tested = 0;;)
+          {
+            if (not candidate or nr_tested == MP_POWER_RESIDUE_TESTS)
+                break;
+            if (is_prime_u64(ell))
+              {
+                const uint32_t residue = mp_divrem_1(NULL, n, len, ell);
+                candidate = residue == 0 or powmod_u32(residue, (ell - 1) / k, ell) == 1;
+                ++nr_tested;
+              } /*if*/
+            ell += 2 * k;
+          } /*for*/
+        if (candidate and mp_kth_root(r, rlen, n, len, k, scratch))
+          {
+            result = k;
+            break;
+          } /*if*/
+        for (;;)
+          {
+          /* on to next prime */
+            ++k;
+            if (is_prime_u64(k))
+                break;
+          } /*for*/
+      } /*for*/
+    return
+        result;
+  } /*mp_perfect_power*/
+
+static bool factorize_mp_cofactor
+  (
+    struct mp_factorization * f,
+    struct mp_factorization * rest, /* may be NULL if work is */
+    const uint64_t * n,
+    size_t len,
+    unsigned int power, /* n is raised to this */
+    struct work_limit * work
+  )
+  /* completes the factorization of n ** power, where n has no factors up
+    to TRIAL_LIMIT, as far as work allows: parts left unfactorized are put
+    into rest. Returns false if out of memory. */
+  {
+    bool ok = true;
+    struct mp_mont m = {.n = NULL};
+    uint64_t * space = NULL;
+    do /*once*/
+      {
+        if (len == 1)
+          {
+            struct factorization g = {.nr_factors = 0};
+            factorize_cofactor(&g, n[0]);
+            ok = mp_factorization_add_all(f, &g, power);
+            break;
+          } /*if*/
+        if (len == 2 and is_prime_u128((uint128_t)n[1] << 64 | n[0]))
+          {
+            ok = mp_factorization_add(f, n, len, power);
+            break;
+          } /*if*/
+        ok = mp_mont_init(&m, n, len);
+        if (not ok)
+            break;
+        if (len > 2 and is_prime_mp(&m))
+          {
+            ok = mp_factorization_add(f, n, len, power);
+            break;
+          } /*if*/
+        if (work_stopped(work))
+          {
+            ok = mp_factorization_add(rest, n, len, power);
+            break;
+          } /*if*/
+        space = malloc((7 * len + 4) * sizeof(uint64_t));
+        ok = space != NULL;
+        if (not ok)
+            break;
+        uint64_t * const d = space;
+        uint64_t * const q = d + len;
+        uint64_t * const t = q + len + 1;
+        uint64_t * const scratch = t + len + 1;
+        size_t dlen;
+        const unsigned int k = mp_perfect_power(d, &dlen, n, len, scratch);
+        if (k != 0)
+          {
+          /* common enough to be worth checking for, and slow for rho or ECM,
+            which would keep finding the same prime */
+            mp_mont_dispose(&m);
+            ok = factorize_mp_cofactor(f, rest, d, dlen, power * k, work);
+            break;
+          } /*if*/
+        ok = mp_find_factor(&m, d, &dlen, work);
+        if (not ok)
+            break;
+        if (dlen == 0)
+          {
+            ok = mp_factorization_add(rest, n, len, power);
+            break;
+          } /*if*/
+        mp_mont_dispose(&m); /* no longer needed, so free it before recursing */
+        memcpy(scratch, n, len * sizeof(uint64_t));
+        memset(q, 0, len * sizeof(uint64_t));
+        mp_divexact(q, scratch, len, d, dlen);
+        size_t qlen = mp_normalize(q, len - dlen + 1);
+        unsigned int times = 1;
+        for (;;)
+          {
+          /* divide out all other powers of d, so they don’t have to be
+            found all over again */
+            if (mp_cmp(q, qlen, d, dlen) < 0)
+                break;
+            memcpy(scratch, q, qlen * sizeof(uint64_t));
+            memset(t, 0, qlen * sizeof(uint64_t));
+            mp_divexact(t, scratch, qlen, d, dlen);
+            const size_t tlen = mp_normalize(t, qlen - dlen + 1);
+            mp_mul(scratch, t, tlen, d, dlen);
+            if (mp_cmp(scratch, mp_normalize(scratch, tlen + dlen), q, qlen) != 0)
+                break;
+            memcpy(q, t, tlen * sizeof(uint64_t));
+            qlen = tlen;
+            ++times;
+          } /*for*/
+        ok =
+                factorize_mp_cofactor(f, rest, d, dlen, power * times, work)
+            and
+                (
+                    qlen == 1 and q[0] == 1
+                or
+                    factorize_mp_cofactor(f, rest, q, qlen, power, work)
+                );
+      }
+    while (false);
+    free(space);
+    mp_mont_dispose(&m);
+    return
+        ok;
+  } /*factorize_mp_cofactor*/
+
+static bool factorize_mp
+  (
+    struct mp_factorization * f,
+    struct mp_factorization * rest, /* may be NULL if work is */
+    uint64_t * n, /* destroyed */
+    size_t len, /* n must be normalized, and at least 2**64 */
+    struct work_limit * work
+  )
+  /* fills in f with the prime factors of n, as far as work allows, putting
+    any unfactorized parts into rest. Returns false if out of memory. */
+  {
+    bool ok = true;
+    do /*once*/
+      {
+        const unsigned int twos = mp_ctz(n, len);
+        if (twos != 0)
+          {
+            len = mp_shr(n, len, twos);
+            const uint64_t two = 2;
+            ok = mp_factorization_add(f, &two, 1, twos);
+            if (not ok)
+                break;
+          } /*if*/
+        for (unsigned int i = 0;;)
+          {
+            if (i == NR_TRIAL_PRIMES)
+                break;
+            const uint64_t p = trial_primes[i].prime;
+            if (len == 1 and n[0] / p < p)
+                break; /* what’s left is 1 or prime */
+            unsigned int power = 0;
+            for (;;)
+              {
+                if (mp_divrem_1(NULL, n, len, p) != 0)
+                    break;
+                mp_divrem_1(n, n, len, p);
+                len = mp_normalize(n, len);
+                ++power;
+              } /*for*/
+            if (power != 0)
+              {
+                ok = mp_factorization_add(f, &p, 1, power);
+                if (not ok)
+                    break;
+              } /*if*/
+            ++i;
+          } /*for*/
+        if (not ok)
+            break;
+        if (len == 1)
+          {
+            if (n[0] > 1)
+              {
+                struct factorization g = {.nr_factors = 0};
+                factorize_remainder(&g, n[0]);
+                ok = mp_factorization_add_all(f, &g, 1);
+              } /*if*/
+          }
+        else
+            ok = factorize_mp_cofactor(f, rest, n, len, 1, work);
+      }
+    while (false);
+    return
+        ok;
+  } /*factorize_mp*/
+
+/*
+    Incremental factorization
+
+    The same methods as above, but reorganized so that each prime power
+    is handed back as soon as it is found, and the work can be abandoned
+    at any point. The small primes come out of trial division in
+    ascending order; whatever is left over is kept as a stack of pieces,
+    each raised to some power, whose product is the part of n not yet
+    accounted for. A piece is split (by rho, ECM or SIQS, as for
+    factorize_mp_cofactor) only when it reaches the top of the stack
+    without being prime, and the smaller part is pushed last, so small
+    factors tend to come out first. Since different pieces can still
+    share a prime, every prime found is divided out of all the others
+    before its total power is returned.
+*/
+
+struct ifact_piece
+  {
+    uint64_t * limbs;
+    size_t len;
+    unsigned int power;
+  };
+
+struct ifactorizer
+  {
+    uint64_t * n; /* cofactor remaining for trial division */
+    size_t len; /* 0 once trial division is finished */
+    bool twos_done;
+    unsigned int next_trial; /* index into trial_primes */
+    struct ifact_piece * pieces; /* remaining pieces, top of stack last */
+    size_t nr_pieces, allocated;
+  };
+
+static void ifactorizer_dispose
+  (
+    struct ifactorizer * it
+  )
+  {
+    free(it->n);
+    it->n = NULL;
+    it->len = 0;
+    for (size_t i = 0;;)
+      {
+        if (i == it->nr_pieces)
+            break;
+        free(it->pieces[i].limbs);
+        ++i;
+      } /*for*/
+    free(it->pieces);
+    it->pieces = NULL;
+    it->nr_pieces = it->allocated = 0;
+  } /*ifactorizer_dispose*/
+
+static void ifactorizer_init
+  (
+    struct ifactorizer * it,
+    uint64_t * n, /* normalized, at least 2; ownership passes to it */
+    size_t len
+  )
+  {
+    it->n = n;
+    it->len = len;
+    it->twos_done = false;
+    it->next_trial = 0;
+    it->pieces = NULL;
+    it->nr_pieces = it->allocated = 0;
+  } /*ifactorizer_init*/
+
+static bool ifactorizer_push
+  (
+    struct ifactorizer * it,
+    uint64_t * limbs, /* ownership passes to it, even on failure */
+    size_t len,
+    unsigned int power
+  )
+  /* pushes limbs ** power onto the stack. Returns false if out of memory. */
+  {
+    bool ok = true;
+    if (it->nr_pieces == it->allocated)
+      {
+        const size_t new_allocated = it->allocated == 0 ? 8 : 2 * it->allocated;
+        struct ifact_piece * const new_pieces =
+            realloc(it->pieces, new_allocated * sizeof(struct ifact_piece));
+        if (new_pieces != NULL)
+          {
+            it->pieces = new_pieces;
+            it->allocated = new_allocated;
+          }
+        else
+            ok = false;
+      } /*if*/
+    if (ok)
+      {
+        it->pieces[it->nr_pieces].limbs = limbs;
+        it->pieces[it->nr_pieces].len = len;
+        it->pieces[it->nr_pieces].power = power;
+        ++it->nr_pieces;
+      }
+    else
+        free(limbs);
+    return
+        ok;
+  } /*ifactorizer_push*/
+
+static bool ifact_is_prime
+  (
+    const uint64_t * n,
+    size_t len,
+    bool * prime
+  )
+  /* decides whether n, which has no factors up to TRIAL_LIMIT, is prime.
+    Returns false if out of memory. */
+  {
+    bool ok = true;
+    if (len == 1)
+        *prime = is_prime_u64(n[0]);
+    else if (len == 2)
+        *prime = is_prime_u128((uint128_t)n[1] << 64 | n[0]);
+    else
+      {
+        struct mp_mont m = {.n = NULL};
+        ok = mp_mont_init(&m, n, len);
+        if (ok)
+            *prime = is_prime_mp(&m);
+        mp_mont_dispose(&m);
+      } /*if*/
+    return
+        ok;
+  } /*ifact_is_prime*/
+
+static bool ifact_split
+  (
+    struct ifactorizer * it,
+    struct ifact_piece piece /* composite, no factors up to TRIAL_LIMIT; ownership passes to it */
+  )
+  /* splits piece into two factors, pushing them onto the stack, the
+    smaller one last, or replaces it with its root if it is a perfect
+    power. Returns false if out of memory. */
+  {
+    bool ok = true;
+    struct mp_mont m = {.n = NULL};
+    uint64_t * d = NULL;
+    uint64_t * q = NULL;
+    uint64_t * scratch = NULL;
+    do /*once*/
+      {
+        const size_t len = piece.len;
+        d = malloc(len * sizeof(uint64_t));
+        q = malloc((len + 1) * sizeof(uint64_t));
+        scratch = malloc((5 * len + 3) * sizeof(uint64_t));
+        if (d == NULL or q == NULL or scratch == NULL)
+          {
+            ok = false;
+            break;
+          } /*if*/
+        size_t dlen, qlen;
+        if (len == 1)
+          {
+            for (uint64_t c = 1;;)
+              {
+                d[0] = rho_brent(piece.limbs[0], c);
+                if (d[0] != piece.limbs[0])
+                    break;
+                ++c;
+              } /*for*/
+            q[0] = piece.limbs[0] / d[0];
+            dlen = qlen = 1;
+          }
+        else
+          {
+            const unsigned int k = mp_perfect_power(d, &dlen, piece.limbs, len, scratch);
+            if (k != 0)
+              {
+                ok = ifactorizer_push(it, d, dlen, k * piece.power);
+                d = NULL; /* ownership has passed */
+                break;
+              } /*if*/
+            ok = mp_mont_init(&m, piece.limbs, len);
+            if (not ok)
+                break;
+            ok = mp_find_factor(&m, d, &dlen, NULL);
+            if (not ok)
+                break;
+            mp_mont_dispose(&m);
+            memset(q, 0, (len + 1) * sizeof(uint64_t));
+            mp_divexact(q, piece.limbs, len, d, dlen);
+            qlen = mp_normalize(q, len - dlen + 1);
+          } /*if*/
+        unsigned int times = 1;
+        for (;;)
+          {
+          /* divide out all other powers of d, as for factorize_mp_cofactor */
+            if (mp_cmp(q, qlen, d, dlen) < 0)
+                break;
+            uint64_t * const t = scratch + len + 1;
+            memcpy(scratch, q, qlen * sizeof(uint64_t));
+            memset(t, 0, qlen * sizeof(uint64_t));
+            mp_divexact(t, scratch, qlen, d, dlen);
+            const size_t tlen = mp_normalize(t, qlen - dlen + 1);
+            mp_mul(scratch, t, tlen, d, dlen);
+            if (mp_cmp(scratch, mp_normalize(scratch, tlen + dlen), q, qlen) != 0)
+                break;
+            memcpy(q, t, tlen * sizeof(uint64_t));
+            qlen = tlen;
+            ++times;
+          } /*for*/
+        if (qlen == 1 and q[0] == 1)
+          {
+            ok = ifactorizer_push(it, d, dlen, times * piece.power);
+            d = NULL; /* ownership has passed */
+            break;
+          } /*if*/
+        const bool d_smaller = mp_cmp(d, dlen, q, qlen) < 0;
+        ok = ifactorizer_push
+          (
+            it,
+            d_smaller ? q : d,
+            d_smaller ? qlen : dlen,
+            d_smaller ? piece.power : times * piece.power
+          );
+        if (ok)
+            ok = ifactorizer_push
+              (
+                it,
+                d_smaller ? d : q,
+                d_smaller ? dlen : qlen,
+                d_smaller ? times * piece.power : piece.power
+              );
+        else
+            free(d_smaller ? d : q);
+        d = q = NULL; /* ownership has passed */
+      }
+    while (false);
+    free(d);
+    free(q);
+    free(scratch);
+    mp_mont_dispose(&m);
+    free(piece.limbs);
+    return
+        ok;
+  } /*ifact_split*/
+
+static bool ifact_divide_out
+  (
+    struct ifactorizer * it,
+    const uint64_t * p,
+    size_t plen,
+    unsigned int * power
+  )
+  /* removes all occurrences of prime p from the pieces on the stack,
+    adding the resulting powers of p to *power. Returns false if out
+    of memory. */
+  {
+    bool ok = true;
+    uint64_t * work = NULL;
+    for (size_t i = 0;;)
+      {
+        if (i == it->nr_pieces)
+            break;
+        struct ifact_piece * const y = &it->pieces[i];
+        for (;;)
+          {
+            bool divides;
+            if (y->len < plen)
+                divides = false;
+            else if (plen == 1)
+                divides = mp_divrem_1(NULL, y->limbs, y->len, p[0]) == 0;
+            else
+              {
+              /* p is prime, so gcd is either p or 1 */
+                uint64_t * const new_work = realloc(work, (2 * y->len + plen + 1) * sizeof(uint64_t));
+                if (new_work == NULL)
+                  {
+                    ok = false;
+                    break;
+                  } /*if*/
+                work = new_work;
+                uint64_t * const a = work;
+                uint64_t * const b = work + y->len;
+                memcpy(a, y->limbs, y->len * sizeof(uint64_t));
+                memcpy(b, p, plen * sizeof(uint64_t));
+                const size_t glen = mp_gcd(b, a, y->len, b, plen);
+                divides = mp_cmp(b, glen, p, plen) == 0;
+              } /*if*/
+            if (not divides)
+                break;
+            *power += y->power;
+            if (plen == 1)
+                mp_divrem_1(y->limbs, y->limbs, y->len, p[0]);
+            else
+              {
+                uint64_t * const q = work + y->len + plen;
+                memcpy(work, y->limbs, y->len * sizeof(uint64_t));
+                memset(q, 0, (y->len - plen + 1) * sizeof(uint64_t));
+                mp_divexact(q, work, y->len, p, plen);
+                memcpy(y->limbs, q, (y->len - plen + 1) * sizeof(uint64_t));
+              } /*if*/
+            y->len = mp_normalize(y->limbs, y->len);
+          } /*for*/
+        if (not ok)
+            break;
+        if (y->len == 1 and y->limbs[0] == 1)
+          {
+          /* nothing left of this piece */
+            free(y->limbs);
+            memmove(y, y + 1, (it->nr_pieces - i - 1) * sizeof(struct ifact_piece));
+            --it->nr_pieces;
+          }
+        else
+            ++i;
+      } /*for*/
+    free(work);
+    return
+        ok;
+  } /*ifact_divide_out*/
+
+static bool ifactorizer_next
+  (
+    struct ifactorizer * it,
+    struct ifact_piece * result /* newly allocated limbs, len 0 if no more */
+  )
+  /* finds the next prime factor of n and its power. Returns false if out
+    of memory. */
+  {
+    bool ok = true;
+    result->limbs = NULL;
+    result->len = 0;
+    do /*once*/
+      {
+        if (not it->twos_done)
+          {
+            it->twos_done = true;
+            const unsigned int twos = mp_ctz(it->n, it->len);
+            if (twos != 0)
+              {
+                it->len = mp_shr(it->n, it->len, twos);
+                result->limbs = malloc(sizeof(uint64_t));
+                if (result->limbs == NULL)
+                  {
+                    ok = false;
+                    break;
+                  } /*if*/
+                result->limbs[0] = 2;
+                result->len = 1;
+                result->power = twos;
+                break;
+              } /*if*/
+          } /*if*/
+        for (;;)
+          {
+            if (it->len == 0)
+                break;
+            if (it->len == 1 and it->n[0] == 1)
+              {
+                it->len = 0; /* all done */
+                break;
+              } /*if*/
+            if (it->next_trial == NR_TRIAL_PRIMES)
+              {
+              /* pass on what is left to the splitting stage */
+                ok = ifactorizer_push(it, it->n, it->len, 1);
+                it->n = NULL;
+                it->len = 0;
+                break;
+              } /*if*/
+            const uint64_t p = trial_primes[it->next_trial].prime;
+            if (it->len == 1 and it->n[0] / p < p)
+              {
+              /* what’s left is prime */
+                result->limbs = it->n;
+                result->len = 1;
+                result->power = 1;
+                it->n = NULL;
+                it->len = 0;
+                break;
+              } /*if*/
+            ++it->next_trial;
+            unsigned int power = 0;
+            for (;;)
+              {
+                if (mp_divrem_1(NULL, it->n, it->len, p) != 0)
+                    break;
+                mp_divrem_1(it->n, it->n, it->len, p);
+                it->len = mp_normalize(it->n, it->len);
+                ++power;
+              } /*for*/
+            if (power != 0)
+              {
+                result->limbs = malloc(sizeof(uint64_t));
+                if (result->limbs == NULL)
+                  {
+                    ok = false;
+                    break;
+                  } /*if*/
+                result->limbs[0] = p;
+                result->len = 1;
+                result->power = power;
+                break;
+              } /*if*/
+          } /*for*/
+        if (not ok or result->len != 0)
+            break;
+        for (;;)
+          {
+            if (it->nr_pieces == 0)
+                break;
+            const struct ifact_piece top = it->pieces[--it->nr_pieces];
+            bool prime;
+            ok = ifact_is_prime(top.limbs, top.len, &prime);
+            if (not ok)
+              {
+                free(top.limbs);
+                break;
+              } /*if*/
+            if (prime)
+              {
+                *result = top;
+                ok = ifact_divide_out(it, result->limbs, result->len, &result->power);
+                break;
+              } /*if*/
+            ok = ifact_split(it, top);
+            if (not ok)
+                break;
+          } /*for*/
+      }
+    while (false);
+    if (not ok)
+      {
+        free(result->limbs);
+        result->limbs = NULL;
+        result->len = 0;
+      } /*if*/
+    return
+        ok;
+  } /*ifactorizer_next*/
+
+/*
+    Smooth factorization
+
+    Finds just the prime factors up to a given bound, leaving whatever
+    is left over as an unfactorized cofactor, by trial division with the
+    same multiply-by-inverse test as usual, stopping as soon as the next
+    prime squared exceeds the cofactor, since it must then be 1 or
+    prime. For bounds beyond SMOOTH_TRIAL_MAX, trying every prime would
+    take longer than factorizing a 64-bit cofactor completely with rho,
+    so that is done instead, and the factors sorted out into those above
+    and below the bound. Integers beyond 64 bits are completely
+    factorized in the same way once what is left of them is less than
+    the bound squared; until then, unless it turns out to be prime,
+    trial division carries on with primes from the sieve, charging the
+    work done to a work_limit, so it can be timed out or interrupted
+    like any other multiple-precision factorization.
+*/
+
+#define SMOOTH_TRIAL_MAX ((uint64_t)1 << 16)
+  /* biggest prime tried on 64-bit cofactors */
+
+struct smooth_primes
+  /* the primes to trial-divide by for a given bound */
+  {
+    uint64_t bound;
+    const struct trial_prime * primes; /* odd primes up to min(bound, SMOOTH_TRIAL_MAX) */
+    size_t nr_primes;
+    struct trial_prime * allocated; /* if primes is not just part of trial_primes */
+  };
+
+static void smooth_primes_dispose
+  (
+    struct smooth_primes * sp
+  )
+  {
+    free(sp->allocated);
+    sp->allocated = NULL;
+  } /*smooth_primes_dispose*/
+
+static bool smooth_primes_init
+  (
+    struct smooth_primes * sp,
+    uint64_t bound
+  )
+  /* sets up the primes for factorizing with the given bound. Returns false
+    if out of memory; in any case, the caller must dispose of it with
+    smooth_primes_dispose. */
+  {
+    bool ok = false;
+    uint32_t * base_primes = NULL;
+    sp->bound = bound;
+    sp->allocated = NULL;
+    sp->nr_primes = 0;
+    do /*once*/
+      {
+        if (bound <= TRIAL_LIMIT)
+          {
+            sp->primes = trial_primes;
+            for (;;)
+              {
+                if (sp->nr_primes == NR_TRIAL_PRIMES or trial_primes[sp->nr_primes].prime > bound)
+                    break;
+                ++sp->nr_primes;
+              } /*for*/
+            ok = true;
+            break;
+          } /*if*/
+        const uint64_t limit = bound < SMOOTH_TRIAL_MAX ? bound : SMOOTH_TRIAL_MAX;
+        size_t nr_base_primes;
+        if (not sieve_base_primes(limit * limit, &base_primes, &nr_base_primes))
+            break;
+        sp->allocated = malloc((nr_base_primes + 2) * sizeof(struct trial_prime));
+        if (sp->allocated == NULL)
+            break;
+        for (size_t i = 0;;)
+          {
+            if (i == nr_base_primes + 2)
+                break;
+            const uint64_t p = i < 2 ? wheel_primes[i + 1] : base_primes[i - 2];
+            if (p > limit)
+                break; /* √(limit * limit) might have been rounded up */
+            trial_prime_init(&sp->allocated[i], p);
+            ++sp->nr_primes;
+            ++i;
+          } /*for*/
+        sp->primes = sp->allocated;
+        ok = true;
+      }
+    while (false);
+    free(base_primes);
+    return
+        ok;
+  } /*smooth_primes_init*/
+
+static uint64_t smooth_finish
+  (
+    struct factorization * f,
+    uint64_t n, /* no factors below the first prime to be tried */
+    const struct smooth_primes * sp,
+    size_t from /* index in sp->primes of first prime to try */
+  )
+  /* adds the prime factors of n up to sp->bound to f, and returns the
+    product of the rest. */
+  {
+    const struct trial_prime * t = sp->primes + from;
+    bool prime = false; /* n is known to be 1 or prime */
+    for (;;)
+      {
+        if (t == sp->primes + sp->nr_primes)
+            break;
+        if (t->prime * t->prime > n)
+          {
+            prime = true;
+            break;
+          } /*if*/
+        trial_divide(f, &n, t);
+        ++t;
+      } /*for*/
+    if (not prime and n > 1 and sp->bound > SMOOTH_TRIAL_MAX)
+      {
+      /* no factors up to SMOOTH_TRIAL_MAX, but might be some further up */
+        struct factorization g = {.nr_factors = 0};
+        factorize_cofactor(&g, n);
+        n = 1;
+        for (unsigned int i = 0;;)
+          {
+            if (i == g.nr_factors)
+                break;
+            if (g.factors[i].prime <= sp->bound)
+                factorization_add(f, g.factors[i].prime, g.factors[i].power);
+            else
+              {
+                for (unsigned int j = 0;;)
+                  {
+                    if (j == g.factors[i].power)
+                        break;
+                    n *= g.factors[i].prime;
+                    ++j;
+                  } /*for*/
+              } /*if*/
+            ++i;
+          } /*for*/
+      }
+    else if (prime and n > 1 and n <= sp->bound)
+      {
+        factorization_add(f, n, 1);
+        n = 1;
+      } /*if*/
+    return
+        n;
+  } /*smooth_finish*/
+
+static uint64_t factorize_smooth_u64
+  (
+    struct factorization * f,
+    uint64_t n, /* must be nonzero */
+    const struct smooth_primes * sp
+  )
+  /* fills in f with the prime factors of n up to sp->bound, and returns
+    the product of the rest. */
+  {
+    f->nr_factors = 0;
+    if (sp->bound >= 2)
+        n = remove_twos(f, n);
+    return
+        smooth_finish(f, n, sp, 0);
+  } /*factorize_smooth_u64*/
+
+static unsigned int mp_remove_factor
+  (
+    uint64_t * n,
+    size_t * len, /* n must be normalized; updated */
+    uint64_t * q, /* scratch, at least *len limbs */
+    uint64_t p
+  )
+  /* divides all factors p out of n, returning how many there were. */
+  {
+    unsigned int power = 0;
+    for (;;)
+      {
+        if (mp_divrem_1(q, n, *len, p) != 0)
+            break;
+        *len = mp_normalize(q, *len);
+        memcpy(n, q, *len * sizeof(uint64_t));
+        ++power;
+      } /*for*/
+    return
+        power;
+  } /*mp_remove_factor*/
+
+#define SMOOTH_CHARGE_INTERVAL 256
+  /* nr of sieve primes tried between charges to the work limit */
+
+static bool factorize_smooth_mp
+  (
+    struct mp_factorization * f,
+    struct mp_factorization * above,
+    struct mp_factorization * rest, /* may be NULL if work is */
+    uint64_t * n, /* destroyed */
+    size_t len, /* n must be normalized, and at least 2**64 */
+    const struct smooth_primes * sp,
+    struct work_limit * work
+  )
+  /* fills in f with the prime factors of n up to sp->bound, and above with
+    the rest, as far as work allows, putting any part that could not be
+    finished into rest. The entries put in above are not necessarily prime,
+    but have no prime factors up to the bound. Returns false if out of
+    memory. */
+  {
+    bool ok = true;
+    struct prime_iter it = {.base_primes = NULL, .sieve = NULL};
+    struct mp_mont m = {.n = NULL};
+    struct mp_factorization g = MP_FACTORIZATION_INIT;
+    uint64_t * q = NULL;
+    do /*once*/
+      {
+        q = malloc(len * sizeof(uint64_t));
+        ok = q != NULL;
+        if (not ok)
+            break;
+        if (sp->bound >= 2)
+          {
+            const unsigned int twos = mp_ctz(n, len);
+            if (twos != 0)
+              {
+                len = mp_shr(n, len, twos);
+                const uint64_t two = 2;
+                ok = mp_factorization_add(f, &two, 1, twos);
+                if (not ok)
+                    break;
+              } /*if*/
+          } /*if*/
+        size_t i = 0;
+        for (;;)
+          {
+            if (i == sp->nr_primes or len == 1)
+                break;
+            const uint64_t p = sp->primes[i].prime;
+            const unsigned int power = mp_remove_factor(n, &len, q, p);
+            if (power != 0)
+              {
+                ok = mp_factorization_add(f, &p, 1, power);
+                if (not ok)
+                    break;
+              } /*if*/
+            ++i;
+          } /*for*/
+        if (not ok)
+            break;
+        if (len == 1)
+          {
+          /* no factors up to the last prime tried, so smooth_finish can carry on */
+            struct factorization h = {.nr_factors = 0};
+            const uint64_t cofactor = smooth_finish(&h, n[0], sp, i);
+            ok =
+                    mp_factorization_add_all(f, &h, 1)
+                and
+                    (cofactor == 1 or mp_factorization_add(above, &cofactor, 1, 1));
+            break;
+          } /*if*/
+        if (sp->bound <= SMOOTH_TRIAL_MAX)
+          {
+          /* every prime up to the bound has been tried */
+            ok = mp_factorization_add(above, n, len, 1);
+            break;
+          } /*if*/
+        const uint128_t bound_squared = (uint128_t)sp->bound * sp->bound;
+        uint64_t searched = SMOOTH_TRIAL_MAX; /* end of range of primes covered so far */
+        bool changed = true; /* cofactor not tested for primality since last factor found */
+        unsigned int nr_tried = 0; /* primes tried since work was last charged */
+        for (;;)
+          {
+            if (len == 1 or len == 2 and ((uint128_t)n[1] << 64 | n[0]) < bound_squared)
+              {
+              /* At most one prime factor of what is left can now exceed the
+                bound, so rather than trial-dividing all the way up to the
+                bound, factorize it completely and sort out the factors, as
+                smooth_finish does. (This also covers the next prime squared
+                exceeding the cofactor, which cannot happen before now.) */
+                ok = factorize_mp_cofactor(&g, rest, n, len, 1, work);
+                if (not ok)
+                    break;
+                for (size_t j = 0;;)
+                  {
+                    if (j == g.nr_factors)
+                        break;
+                    const struct mp_factor * const e = g.factors + j;
+                    ok = mp_factorization_add
+                      (
+                        e->len == 1 and e->limbs[0] <= sp->bound ? f : above,
+                        e->limbs, e->len, e->power
+                      );
+                    if (not ok)
+                        break;
+                    ++j;
+                  } /*for*/
+                break;
+              } /*if*/
+            if (changed)
+              {
+                bool prime;
+                if (len == 2)
+                    prime = is_prime_u128((uint128_t)n[1] << 64 | n[0]);
+                else
+                  {
+                    ok = mp_mont_init(&m, n, len);
+                    if (not ok)
+                        break;
+                    prime = is_prime_mp(&m);
+                    mp_mont_dispose(&m);
+                  } /*if*/
+                if (prime)
+                  {
+                    ok = mp_factorization_add(above, n, len, 1);
+                    break;
+                  } /*if*/
+                changed = false;
+              } /*if*/
+            if (nr_tried == SMOOTH_CHARGE_INTERVAL)
+              {
+                if (work_charge(work, nr_tried))
+                  {
+                    ok = mp_factorization_add(rest, n, len, 1);
+                    break;
+                  } /*if*/
+                nr_tried = 0;
+              } /*if*/
+          /* carry on with primes from the sieve, in windows doubling in
+            size, so only the base primes for the current window need be
+            found */
+            const uint64_t p = it.sieve != NULL ? prime_iter_next(&it) : 0;
+            if (p == 0)
+              {
+                prime_iter_dispose(&it);
+                if (searched == sp->bound)
+                  {
+                    ok = mp_factorization_add(above, n, len, 1);
+                    break;
+                  } /*if*/
+                const uint64_t start = searched + 1;
+                searched = sp->bound - searched <= searched ? sp->bound : 2 * searched;
+                ok = prime_iter_init(&it, start, searched);
+                if (not ok)
+                    break;
+                continue;
+              } /*if*/
+            const unsigned int power = mp_remove_factor(n, &len, q, p);
+            if (power != 0)
+              {
+                ok = mp_factorization_add(f, &p, 1, power);
+                if (not ok)
+                    break;
+                changed = true;
+              } /*if*/
+            ++nr_tried;
+          } /*for*/
+      }
+    while (false);
+    mp_factorization_dispose(&g);
+    mp_mont_dispose(&m);
+    prime_iter_dispose(&it);
+    free(q);
+    return
+        ok;
+  } /*factorize_smooth_mp*/
+
+struct smooth_job
+  /* a batch of values for factorize_smooth_many, shared between worker
+    threads in the same way as for factorize_many */
+  {
+    const uint64_t * values;
+    struct factorization * results;
+    uint64_t * cofactors;
+    uint8_t * statuses; /* enum factorize_status values */
+    const struct chunk_plan * plan;
+    const struct smooth_primes * sp;
+    atomic_size_t next_chunk; /* index of next unclaimed chunk */
+  };
+
+static void * smooth_worker
+  (
+    void * arg
+  )
+  {
+    struct smooth_job * const job = arg;
+    for (;;)
+      {
+        const size_t chunk = atomic_fetch_add(&job->next_chunk, 1);
+        if (chunk >= job->plan->nr_chunks)
+            break;
+        const size_t start = chunk_plan_start(job->plan, chunk);
+        const size_t end = chunk_plan_start(job->plan, chunk + 1);
+        for (size_t i = start;;)
+          {
+            if (i == end)
+                break;
+            if (job->values[i] > 1)
+              {
+                job->cofactors[i] = factorize_smooth_u64(&job->results[i], job->values[i], job->sp);
+                job->statuses[i] = factorization_status(&job->results[i]);
+              }
+            else
+              {
+                job->results[i].nr_factors = 0;
+                job->cofactors[i] = 0;
+                job->statuses[i] = FACTORIZE_TOO_SMALL;
+              } /*if*/
+            ++i;
+          } /*for*/
+      } /*for*/
+    return
+        NULL;
+  } /*smooth_worker*/
+
+/*
+    Subquadratic multiplication and division
+
+    Multiplying big numbers is done by Karatsuba’s method, which replaces
+    a product of two n-limb numbers by three products of n/2 limbs, and
+    beyond that, with number-theoretic transforms (NTTs): the limbs of
+    each number are taken as the coefficients of a polynomial, the
+    polynomials are multiplied by convolution modulo three primes just
+    below 2**63, and the coefficients of the product are recovered from
+    their three residues by the Chinese remainder theorem, which is
+    enough to hold sums of up to 2**40 products of two limbs. The
+    transforms for the three primes are independent of each other, and
+    so can be done on separate threads.
+
+    Division is by Barrett’s method, multiplying by a precomputed
+    reciprocal of the divisor. The reciprocal itself comes from Newton
+    iteration, starting from the reciprocal of the top half of the
+    divisor, which doubles the nr of correct limbs at each step, so it
+    costs only a small multiple of the time for one multiplication.
+*/
+
+#define KARATSUBA_THRESHOLD 32 /* limbs below which schoolbook multiplication is faster */
+#define NTT_THRESHOLD 8192 /* limbs from which NTTs are faster than Karatsuba */
+#define NTT_NR_PRIMES 3
+#define NTT_MAX_LOG 40 /* 2**NTT_MAX_LOG divides p - 1 for each prime */
+
+static const struct
+  {
+    uint64_t p; /* c·2**NTT_MAX_LOG + 1 */
+    uint64_t g; /* generator of the multiplicative group */
+  } ntt_primes[NTT_NR_PRIMES] =
+    {
+        {0x7ffffe0000000001, 7},
+        {0x7fffef0000000001, 5},
+        {0x7fffe90000000001, 7},
+    };
+
+static uint64_t mp_shl
+  (
+    uint64_t * r, /* may be the same as a */
+    const uint64_t * a,
+    size_t len,
+    unsigned int shift /* less than 64 */
+  )
+  /* r = a << shift, all of len limbs; returns the bits shifted out. */
+  {
+    uint64_t out = 0;
+    for (size_t i = 0;;)
+      {
+        if (i == len)
+            break;
+        const uint64_t limb = a[i];
+        r[i] = limb << shift | out;
+        out = shift != 0 ? limb >> (64 - shift) : 0;
+        ++i;
+      } /*for*/
+    return
+        out;
+  } /*mp_shl*/
+
+static void mp_add_into
+  (
+    uint64_t * r,
+    size_t rlen,
+    const uint64_t * a,
+    size_t alen /* no more than rlen */
+  )
+  /* r += a, where the sum is known to fit in rlen limbs. */
+  {
+    uint64_t carry = mp_add_n(r, r, a, alen);
+    for (size_t i = alen;;)
+      {
+        if (carry == 0 or i == rlen)
+            break;
+        carry = ++r[i] == 0;
+        ++i;
+      } /*for*/
+  } /*mp_add_into*/
+
+static void mp_negate
+  (
+    uint64_t * a,
+    size_t len
+  )
+  /* a = B**len - a, which is the two’s-complement negation of a. */
+  {
+    uint64_t carry = 1;
+    for (size_t i = 0;;)
+      {
+        if (i == len)
+            break;
+        a[i] = ~a[i] + carry;
+        carry = carry != 0 and a[i] == 0;
+        ++i;
+      } /*for*/
+  } /*mp_negate*/
+
+static bool mp_absdiff
+  (
+    uint64_t * r, /* room for alen limbs */
+    const uint64_t * a,
+    size_t alen,
+    const uint64_t * b,
+    size_t blen /* no more than alen */
+  )
+  /* r = |a - b|, returning true if a < b. */
+  {
+    uint64_t borrow = mp_sub_n(r, a, b, blen);
+    for (size_t i = blen;;)
+      {
+        if (i == alen)
+            break;
+        r[i] = a[i] - borrow;
+        borrow = a[i] < borrow;
+        ++i;
+      } /*for*/
+    if (borrow != 0)
+        mp_negate(r, alen);
+    return
+        borrow != 0;
+  } /*mp_absdiff*/
+
+static size_t karatsuba_scratch
+  (
+    size_t n
+  )
+  /* nr of limbs of scratch space mp_mul_karatsuba needs for n-limb operands. */
+  {
+    size_t result = 0;
+    if (n >= KARATSUBA_THRESHOLD)
+      {
+        const size_t hi = n - n / 2;
+        const size_t inner = karatsuba_scratch(hi);
+        result = 4 * hi + (inner > 2 * hi + 1 ? inner : 2 * hi + 1);
+      } /*if*/
+    return
+        result;
+  } /*karatsuba_scratch*/
+
+static void mp_mul_karatsuba
+  (
+    uint64_t * r, /* room for 2·n limbs; not overlapping anything else */
+    const uint64_t * a,
+    const uint64_t * b,
+    size_t n,
+    uint64_t * scratch /* room for karatsuba_scratch(n) limbs */
+  )
+  /* r = a·b, where a and b are both of n limbs. Splitting each into a
+    low half of lo limbs and a high half of hi limbs, the middle product
+    a0·b1 + a1·b0 is worked out as a0·b0 + a1·b1 - (a1 - a0)·(b1 - b0),
+    so all three products are of numbers of at most hi limbs. */
+  {
+    if (n < KARATSUBA_THRESHOLD)
+        mp_mul(r, a, n, b, n);
+    else
+      {
+        const size_t lo = n / 2, hi = n - lo;
+        uint64_t * const da = scratch;
+        uint64_t * const db = scratch + hi;
+        uint64_t * const d = scratch + 2 * hi;
+        uint64_t * const rest = scratch + 4 * hi;
+        const bool negative =
+            mp_absdiff(da, a + lo, hi, a, lo) != mp_absdiff(db, b + lo, hi, b, lo);
+        mp_mul_karatsuba(r, a, b, lo, rest); /* low product */
+        mp_mul_karatsuba(r + 2 * lo, a + lo, b + lo, hi, rest); /* high product */
+        mp_mul_karatsuba(d, da, db, hi, rest);
+      /* middle product goes in rest, now free */
+        memcpy(rest, r + 2 * lo, 2 * hi * sizeof(uint64_t));
+        rest[2 * hi] = 0;
+        mp_add_into(rest, 2 * hi + 1, r, 2 * lo);
+        if (negative)
+            mp_add_into(rest, 2 * hi + 1, d, 2 * hi);
+        else
+            mp_sub(rest, 2 * hi + 1, d, 2 * hi);
+        mp_add_into(r + lo, 2 * n - lo, rest, 2 * hi + 1);
+      } /*if*/
+  } /*mp_mul_karatsuba*/
+
+struct ntt_job
+  /* a multiplication by NTTs, shared between threads each doing one
+    or more of the primes */
+  {
+    const uint64_t * a, * b; /* b is NULL for squaring */
+    size_t alen, blen;
+    unsigned int log_size; /* of the transforms */
+    uint64_t * residues[NTT_NR_PRIMES]; /* convolution modulo each prime */
+    atomic_uint next; /* index of next prime to be done */
+    atomic_bool failed; /* out of memory */
+  };
+
+static inline uint64_t ntt_sub
+  (
+    uint64_t a,
+    uint64_t b,
+    uint64_t p
+  )
+  {
+    return
+        a >= b ? a - b : a - b + p;
+  } /*ntt_sub*/
+
+static void ntt_load
+  (
+    uint64_t * x, /* room for size elements */
+    const uint64_t * a,
+    size_t len, /* no more than size */
+    size_t size,
+    uint64_t p
+  )
+  /* reduces the limbs of a modulo p, padding with zeroes to the transform size. */
+  {
+    for (size_t i = 0;;)
+      {
+        if (i == len)
+            break;
+        uint64_t limb = a[i]; /* less than 3·p */
+        if (limb >= p)
+            limb -= p;
+        if (limb >= p)
+            limb -= p;
+        x[i] = limb;
+        ++i;
+      } /*for*/
+    memset(x + len, 0, (size - len) * sizeof(uint64_t));
+  } /*ntt_load*/
+
+static void ntt_forward
+  (
+    const struct mont64 * m,
+    uint64_t * x,
+    const uint64_t * w,
+    size_t size
+  )
+  /* transforms x in place, by decimation in frequency, leaving the
+    result in bit-reversed order. w[h + j] is the jth power of the
+    primitive (2·h)th root of unity, in Montgomery form, for each
+    power of 2 h less than size. */
+  {
+    for (size_t h = size / 2;;)
+      {
+        if (h == 0)
+            break;
+        for (size_t s = 0;;)
+          {
+            if (s == size)
+                break;
+            for (size_t j = 0;;)
+              {
+                if (j == h)
+                    break;
+                const uint64_t u = x[s + j], v = x[s + j + h];
+                x[s + j] = mont64_add(m, u, v);
+                x[s + j + h] = mont64_mul(m, ntt_sub(u, v, m->n), w[h + j]);
+                ++j;
+              } /*for*/
+            s += 2 * h;
+          } /*for*/
+        h /= 2;
+      } /*for*/
+  } /*ntt_forward*/
+
+static void ntt_inverse
+  (
+    const struct mont64 * m,
+    uint64_t * x,
+    const uint64_t * w,
+    size_t size
+  )
+  /* undoes ntt_forward, by decimation in time, taking its input in
+    bit-reversed order, except that the result is multiplied by size.
+    The negative powers of the roots of unity come from the same table,
+    since w**-j = -w**(h - j) when w**h = -1. */
+  {
+    for (size_t h = 1;;)
+      {
+        if (h == size)
+            break;
+        for (size_t s = 0;;)
+          {
+            if (s == size)
+                break;
+            const uint64_t u0 = x[s], v0 = x[s + h];
+            x[s] = mont64_add(m, u0, v0);
+            x[s + h] = ntt_sub(u0, v0, m->n);
+            for (size_t j = 1;;)
+              {
+                if (j == h)
+                    break;
+                const uint64_t u = x[s + j];
+                const uint64_t v = mont64_mul(m, x[s + j + h], m->n - w[2 * h - j]);
+                x[s + j] = mont64_add(m, u, v);
+                x[s + j + h] = ntt_sub(u, v, m->n);
+                ++j;
+              } /*for*/
+            s += 2 * h;
+          } /*for*/
+        h *= 2;
+      } /*for*/
+  } /*ntt_inverse*/
+
+static bool ntt_convolve
+  (
+    struct ntt_job * job,
+    unsigned int i /* which prime */
+  )
+  /* computes the convolution of the limbs of job->a and job->b modulo
+    the ith prime. Returns false if out of memory. */
+  {
+    bool ok = false;
+    uint64_t * w = NULL;
+    uint64_t * y = NULL;
+    do /*once*/
+      {
+        const size_t size = (size_t)1 << job->log_size;
+        const uint64_t p = ntt_primes[i].p;
+        struct mont64 m;
+        mont64_init(&m, p);
+        job->residues[i] = malloc(size * sizeof(uint64_t));
+        w = malloc(size * sizeof(uint64_t));
+        if (job->b != NULL)
+            y = malloc(size * sizeof(uint64_t));
+        if (job->residues[i] == NULL or w == NULL or job->b != NULL and y == NULL)
+            break;
+      /* table of roots of unity: fill in the top row, then each row below
+        is every second element of the one above */
+        const uint64_t root = mont64_pow(&m, mont64_to(&m, ntt_primes[i].g), (p - 1) >> job->log_size);
+        w[size / 2] = m.one;
+        for (size_t j = 1;;)
+          {
+            if (j == size / 2)
+                break;
+            w[size / 2 + j] = mont64_mul(&m, w[size / 2 + j - 1], root);
+            ++j;
+          } /*for*/
+        for (size_t h = size / 4;;)
+          {
+            if (h == 0)
+                break;
+            for (size_t j = 0;;)
+              {
+                if (j == h)
+                    break;
+                w[h + j] = w[2 * h + 2 * j];
+                ++j;
+              } /*for*/
+            h /= 2;
+          } /*for*/
+        uint64_t * const x = job->residues[i];
+        ntt_load(x, job->a, job->alen, size, p);
+        ntt_forward(&m, x, w, size);
+        if (y != NULL)
+          {
+            ntt_load(y, job->b, job->blen, size, p);
+            ntt_forward(&m, y, w, size);
+          } /*if*/
+        for (size_t j = 0;;)
+          {
+            if (j == size)
+                break;
+            x[j] = mont64_mul(&m, x[j], y != NULL ? y[j] : x[j]);
+            ++j;
+          } /*for*/
+        ntt_inverse(&m, x, w, size);
+      /* pointwise products each left a factor of 1/R, and the inverse
+        transform a factor of size: multiply by R/size, in Montgomery form */
+        const uint64_t scale = mont64_to(&m, mont64_to(&m, p - ((p - 1) >> job->log_size)));
+        for (size_t j = 0;;)
+          {
+            if (j == size)
+                break;
+            x[j] = mont64_mul(&m, x[j], scale);
+            ++j;
+          } /*for*/
+        ok = true;
+      }
+    while (false);
+    free(w);
+    free(y);
+    return
+        ok;
+  } /*ntt_convolve*/
+
+static void * ntt_worker
+  (
+    void * arg
+  )
+  {
+    struct ntt_job * const job = arg;
+    for (;;)
+      {
+        const unsigned int i = atomic_fetch_add(&job->next, 1);
+        if (i >= NTT_NR_PRIMES)
+            break;
+        if (not ntt_convolve(job, i))
+            atomic_store(&job->failed, true);
+      } /*for*/
+    return
+        NULL;
+  } /*ntt_worker*/
+
+static bool mp_mul_ntt
+  (
+    uint64_t * r, /* room for alen + blen limbs; not the same as a or b */
+    const uint64_t * a,
+    size_t alen,
+    const uint64_t * b, /* may be the same as a */
+    size_t blen,
+    unsigned int nr_threads
+  )
+  /* r = a·b, by NTTs done on up to nr_threads threads. Returns false if
+    out of memory. */
+  {
+    struct ntt_job job =
+        {
+            .a = a,
+            .b = b == a and blen == alen ? NULL : b,
+            .alen = alen,
+            .blen = blen,
+            .log_size = 0,
+            .residues = {NULL},
+        };
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, false);
+    for (;;)
+      {
+        if ((size_t)1 << job.log_size >= alen + blen)
+            break;
+        ++job.log_size;
+      } /*for*/
+    run_workers(ntt_worker, &job, nr_threads < NTT_NR_PRIMES ? nr_threads : NTT_NR_PRIMES);
+    const bool ok = not atomic_load(&job.failed);
+    if (ok)
+      {
+      /* Garner’s algorithm: x = r0 + p0·(t1 + p1·t2), where t1 and t2
+        come from the residues modulo p1 and p2 */
+        const uint64_t p0 = ntt_primes[0].p, p1 = ntt_primes[1].p, p2 = ntt_primes[2].p;
+        struct mont64 m1, m2;
+        mont64_init(&m1, p1);
+        mont64_init(&m2, p2);
+        const uint64_t inv01 = mont64_to(&m1, (uint64_t)invmod_u128(p0 % p1, p1));
+        const uint64_t inv02 = mont64_to(&m2, (uint64_t)invmod_u128(p0 % p2, p2));
+        const uint64_t inv12 = mont64_to(&m2, (uint64_t)invmod_u128(p1 % p2, p2));
+        const uint128_t p01 = (uint128_t)p0 * p1;
+        uint64_t c0 = 0, c1 = 0; /* carry into next limb */
+        for (size_t i = 0;;)
+          {
+            if (i == alen + blen)
+                break;
+            const uint64_t r0 = job.residues[0][i];
+          /* p0 > p1 > p2 > p0 / 2 */
+            const uint64_t t1 = mont64_mul(&m1, ntt_sub(job.residues[1][i], r0 >= p1 ? r0 - p1 : r0, p1), inv01);
+            const uint64_t t2 =
+                mont64_mul
+                  (
+                    &m2,
+                    ntt_sub
+                      (
+                        mont64_mul(&m2, ntt_sub(job.residues[2][i], r0 >= p2 ? r0 - p2 : r0, p2), inv02),
+                        t1 >= p2 ? t1 - p2 : t1,
+                        p2
+                      ),
+                    inv12
+                  );
+          /* add r0 + p0·t1 + p0·p1·t2 to carry */
+            const uint128_t lo = (uint128_t)p0 * t1 + r0; /* < 2**126 */
+            const uint128_t top_lo = (uint128_t)(uint64_t)p01 * t2;
+            const uint128_t top_hi = (uint128_t)(uint64_t)(p01 >> 64) * t2;
+            uint128_t sum = (uint128_t)c0 + (uint64_t)lo + (uint64_t)top_lo;
+            r[i] = (uint64_t)sum;
+            sum = (sum >> 64) + c1 + (uint64_t)(lo >> 64) + (uint64_t)(top_lo >> 64) + (uint64_t)top_hi;
+            c0 = (uint64_t)sum;
+            c1 = (uint64_t)(sum >> 64) + (uint64_t)(top_hi >> 64);
+            ++i;
+          } /*for*/
+      } /*if*/
+    for (unsigned int i = 0;;)
+      {
+        if (i == NTT_NR_PRIMES)
+            break;
+        free(job.residues[i]);
+        ++i;
+      } /*for*/
+    return
+        ok;
+  } /*mp_mul_ntt*/
+
+static bool mp_mul_fast
+  (
+    uint64_t * r, /* room for alen + blen limbs; not the same as a or b */
+    const uint64_t * a,
+    size_t alen,
+    const uint64_t * b, /* may be the same as a, for squaring */
+    size_t blen,
+    unsigned int nr_threads /* for NTTs */
+  )
+  /* r = a·b, by whichever method is fastest for the sizes involved.
+    Returns false if out of memory. */
+  {
+    bool ok = false;
+    uint64_t * scratch = NULL;
+    do /*once*/
+      {
+        if (alen < blen)
+          {
+            const uint64_t * const t = a;
+            const size_t tlen = alen;
+            a = b;
+            alen = blen;
+            b = t;
+            blen = tlen;
+          } /*if*/
+        if (blen < KARATSUBA_THRESHOLD)
+          {
+            mp_mul(r, a, alen, b, blen);
+            ok = true;
+            break;
+          } /*if*/
+        if (blen >= NTT_THRESHOLD)
+          {
+            ok = mp_mul_ntt(r, a, alen, b, blen, nr_threads);
+            break;
+          } /*if*/
+      /* Karatsuba on successive pieces of a the same size as b, with
+        any shorter piece left over done recursively */
+        const size_t nr_scratch = karatsuba_scratch(blen);
+        scratch = malloc((nr_scratch + 2 * blen) * sizeof(uint64_t));
+        if (scratch == NULL)
+            break;
+        uint64_t * const product = scratch + nr_scratch;
+        memset(r, 0, (alen + blen) * sizeof(uint64_t));
+        ok = true;
+        for (size_t i = 0;;)
+          {
+            if (i == alen)
+                break;
+            const size_t len = alen - i < blen ? alen - i : blen;
+            if (len == blen)
+                mp_mul_karatsuba(product, a + i, b, blen, scratch);
+            else
+                ok = mp_mul_fast(product, a + i, len, b, blen, nr_threads);
+            if (not ok)
+                break;
+            mp_add_into(r + i, alen + blen - i, product, len + blen);
+            i += len;
+          } /*for*/
+      }
+    while (false);
+    free(scratch);
+    return
+        ok;
+  } /*mp_mul_fast*/
+
+static bool mp_reciprocal
+  (
+    uint64_t * inv, /* room for n + 1 limbs */
+    const uint64_t * d, /* top bit must be set */
+    size_t n,
+    unsigned int nr_threads
+  )
+  /* inv = floor((B**(2·n) - 1) / d), where B = 2**64. Newton’s iteration
+    x' = x + x·(B**(2·n) - d·x) / B**(2·n) takes the reciprocal xh of
+    the top h limbs of d, correct to about h limbs, to one correct to
+    about 2·h limbs, and the few units of error left over are corrected
+    by adding or subtracting d from the remainder. Returns false if out
+    of memory. */
+  {
+    bool ok = false;
+    uint64_t * xh = NULL;
+    uint64_t * prod = NULL;
+    uint64_t * corr = NULL;
+    do /*once*/
+      {
+        if (n == 1)
+          {
+            const uint128_t q = ~(uint128_t)0 / d[0];
+            inv[0] = (uint64_t)q;
+            inv[1] = (uint64_t)(q >> 64);
+            ok = true;
+            break;
+          } /*if*/
+        const size_t h = n - n / 2;
+        xh = malloc((h + 1) * sizeof(uint64_t));
+        prod = malloc((2 * n + 2) * sizeof(uint64_t));
+        corr = malloc((n + 2 * h + 2) * sizeof(uint64_t));
+        if (xh == NULL or prod == NULL or corr == NULL)
+            break;
+        if (not mp_reciprocal(xh, d + n - h, h, nr_threads))
+            break;
+      /* x = xh·B**(n - h), so B**(2·n) - d·x = B**(n - h)·(B**(n + h) - d·xh),
+        and the magnitude e of the latter is at most 2·B**n */
+        if (not mp_mul_fast(prod, d, n, xh, h + 1, nr_threads))
+            break;
+        const uint64_t one = 1;
+        const bool too_big = prod[n + h] != 0;
+        if (too_big)
+            prod[n + h] = 0; /* e = d·xh - B**(n + h) */
+        else
+            mp_negate(prod, n + h); /* e = B**(n + h) - d·xh */
+        const size_t elen = mp_normalize(prod, n + h);
+      /* correction to x is x·e / B**(2·n) = xh·e / B**(2·h) */
+        memset(inv, 0, (n + 1) * sizeof(uint64_t));
+        memcpy(inv + n - h, xh, (h + 1) * sizeof(uint64_t));
+        if (h + 1 + elen > 2 * h)
+          {
+            if (not mp_mul_fast(corr, xh, h + 1, prod, elen, nr_threads))
+                break;
+            const size_t clen = mp_normalize(corr + 2 * h, h + 1 + elen - 2 * h);
+            if (too_big)
+                mp_sub(inv, n + 1, corr + 2 * h, clen);
+            else
+                mp_add_into(inv, n + 1, corr + 2 * h, clen);
+          } /*if*/
+      /* fix up the last few units */
+        if (not mp_mul_fast(prod, d, n, inv, n + 1, nr_threads))
+            break;
+        for (;;)
+          {
+            if (prod[2 * n] == 0)
+                break;
+            mp_sub(inv, n + 1, &one, 1);
+            mp_sub(prod, 2 * n + 1, d, n);
+          } /*for*/
+        for (size_t i = 0;;)
+          {
+            if (i == 2 * n)
+                break;
+            prod[i] = ~prod[i]; /* B**(2·n) - 1 - d·x */
+            ++i;
+          } /*for*/
+        for (;;)
+          {
+            if (mp_cmp(prod, mp_normalize(prod, 2 * n), d, n) < 0)
+                break;
+            mp_add_into(inv, n + 1, &one, 1);
+            mp_sub(prod, 2 * n, d, n);
+          } /*for*/
+        ok = true;
+      }
+    while (false);
+    free(xh);
+    free(prod);
+    free(corr);
+    return
+        ok;
+  } /*mp_reciprocal*/
+
+/*
+    Batch GCD
+
+    Finds, for each of a set of positive integers, its gcd with the
+    product of all the others, by Bernstein’s method. A product tree is
+    built with the integers as its leaves, each node above being the
+    product of its two children, up to the product P of all of them at
+    the root. A remainder tree then works back down, so that each leaf
+    x ends up with P mod x**2, which is x times the product m of all
+    the others modulo x; the gcd of that with x is the answer.
+
+    Rather than taking a remainder at every node, which would need a
+    reciprocal of every node, this is the scaled remainder tree: each
+    node v is given the fraction t = P / v**2 mod 1, in fixed point, to
+    a precision a little more than that of v**2. At the root, t is just
+    1/P; the fraction at a child c is that at its parent, times the
+    square of the other child, mod 1, so it is one multiplication per
+    node, and only one reciprocal is needed. At a leaf x, t·x, rounded
+    to the nearest integer, is m mod x. Each truncation loses less than
+    one unit in the last place, and each multiplication scales the
+    accumulated error by no more than the precision increases, so the
+    GCD_GUARD_LIMBS of extra precision are plenty to keep that rounding
+    correct.
+
+    All the threads work on each level of a tree in turn, claiming one
+    node at a time; near the top, where there are fewer nodes than
+    threads, the spare threads go into the NTTs instead. The whole
+    product tree, plus the fractions for two levels at a time, is laid
+    out in one array sized in advance from the sizes of the leaves; if
+    that is more than a given limit, it is mapped from an unlinked
+    temporary file instead of being allocated, so the kernel can write
+    it out as needed rather than running out of memory and swap.
+*/
+
+#define BATCH_GCD_MEMORY_LIMIT ((size_t)1 << 30)
+  /* default nr of bytes of tree storage beyond which it goes in a temporary file */
+#define GCD_GUARD_LIMBS 2
+  /* extra precision of fractions in the remainder tree */
+
+struct big_buffer
+  /* storage for a potentially huge array */
+  {
+    void * mem;
+    size_t size;
+    bool mapped; /* from a temporary file, rather than allocated */
+  };
+
+static bool big_buffer_alloc
+  (
+    struct big_buffer * buf,
+    size_t size,
+    size_t memory_limit
+  )
+  /* allocates size bytes, from an unlinked temporary file in $TMPDIR
+    (or /tmp) if more than memory_limit. Returns false, with errno set,
+    if this cannot be done; in any case, the caller must dispose of buf
+    with big_buffer_dispose. */
+  {
+    char * path = NULL;
+    int fd = -1;
+    int err = ENOMEM;
+    buf->mem = NULL;
+    buf->size = size;
+    buf->mapped = size > memory_limit;
+    do /*once*/
+      {
+        if (not buf->mapped)
+          {
+            buf->mem = malloc(size);
+            break;
+          } /*if*/
+        const char * dir = getenv("TMPDIR");
+        if (dir == NULL or dir[0] == 0)
+            dir = "/tmp";
+        path = malloc(strlen(dir) + 32);
+        if (path == NULL)
+            break;
+        sprintf(path, "%s/discipline-XXXXXX", dir);
+        fd = mkstemp(path);
+        if (fd < 0)
+          {
+            err = errno;
+            break;
+          } /*if*/
+        unlink(path);
+        err = posix_fallocate(fd, 0, size); /* rather than SIGBUS when disk fills up */
+        if (err != 0)
+            break;
+        void * const mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED)
+          {
+            err = errno;
+            break;
+          } /*if*/
+        buf->mem = mem;
+      }
+    while (false);
+    close_fd(fd);
+    free(path);
+    errno = err;
+    return
+        buf->mem != NULL;
+  } /*big_buffer_alloc*/
+
+static void big_buffer_dispose
+  (
+    struct big_buffer * buf
+  )
+  {
+    if (buf->mem != NULL)
+      {
+        if (buf->mapped)
+            munmap(buf->mem, buf->size);
+        else
+            free(buf->mem);
+        buf->mem = NULL;
+      } /*if*/
+  } /*big_buffer_dispose*/
+
+enum gcd_phase
+  {
+    GCD_PRODUCT, /* multiplying pairs of nodes at the level below */
+    GCD_REMAINDER, /* reducing the remainders at the level above */
+    GCD_LEAF, /* finishing off at the leaves */
+  };
+
+struct gcd_job
+  /* a batch GCD, shared between threads working on one level at a time */
+  {
+    uint64_t * limbs; /* all the tree storage */
+    unsigned int nr_levels; /* level 0 is the leaves, nr_levels - 1 the root */
+    size_t level_start[65]; /* index of first node at each level, and one past the root */
+    size_t * offset; /* of each node’s limbs, with an extra entry for the end */
+    size_t * len; /* normalized length of each node */
+    uint64_t * frac[2]; /* remainder-tree fractions for alternate levels */
+    size_t * frac_len[2]; /* normalized lengths of fractions */
+    enum gcd_phase phase;
+    unsigned int level; /* being worked on */
+    unsigned int inner_threads; /* for NTTs within each node */
+    atomic_size_t next; /* index within level of next node to be claimed */
+    atomic_bool failed; /* out of memory */
+  };
+
+static inline size_t gcd_precision
+  (
+    const struct gcd_job * job,
+    size_t node
+  )
+  /* nr of fractional limbs in the remainder-tree fraction for the node,
+    enough that the fraction could hold P mod node**2 exactly. */
+  {
+    return
+        2 * job->len[node] + GCD_GUARD_LIMBS;
+  } /*gcd_precision*/
+
+static inline uint64_t * gcd_frac
+  (
+    const struct gcd_job * job,
+    unsigned int level,
+    size_t i /* index within level */
+  )
+  /* where the fraction for the ith node at the level goes, with room for
+    as many limbs as gcd_precision could need. */
+  {
+    const size_t node = job->level_start[level] + i;
+    return
+            job->frac[level % 2]
+        +
+            2 * (job->offset[node] - job->offset[job->level_start[level]])
+        +
+            GCD_GUARD_LIMBS * i;
+  } /*gcd_frac*/
+
+static bool gcd_product
+  (
+    struct gcd_job * job,
+    size_t i /* index within current level */
+  )
+  /* multiplies together the children of the ith node. Returns false if
+    out of memory. */
+  {
+    bool ok = true;
+    const unsigned int level = job->level;
+    const size_t node = job->level_start[level] + i;
+    const size_t child = job->level_start[level - 1] + 2 * i;
+    uint64_t * const dest = job->limbs + job->offset[node];
+    if (child + 1 == job->level_start[level])
+      {
+      /* odd one out */
+        memcpy(dest, job->limbs + job->offset[child], job->len[child] * sizeof(uint64_t));
+        job->len[node] = job->len[child];
+      }
+    else
+      {
+        ok = mp_mul_fast
+          (
+            dest,
+            job->limbs + job->offset[child], job->len[child],
+            job->limbs + job->offset[child + 1], job->len[child + 1],
+            job->inner_threads
+          );
+        job->len[node] = mp_normalize(dest, job->len[child] + job->len[child + 1]);
+      } /*if*/
+    return
+        ok;
+  } /*gcd_product*/
+
+static bool gcd_root
+  (
+    struct gcd_job * job,
+    unsigned int nr_threads
+  )
+  /* sets the fraction at the root to 1/P. Returns false if out of memory. */
+  {
+    bool ok = false;
+    uint64_t * d = NULL;
+    uint64_t * inv = NULL;
+    const unsigned int top = job->nr_levels - 1;
+    const size_t root = job->level_start[top];
+    const uint64_t * const p = job->limbs + job->offset[root];
+    const size_t n = job->len[root];
+    uint64_t * const t = gcd_frac(job, top, 0);
+    do /*once*/
+      {
+        if (n == 1 and p[0] == 1)
+          {
+          /* all the leaves are 1, and 1/1 mod 1 = 0 */
+            job->frac_len[top % 2][0] = 0;
+            ok = true;
+            break;
+          } /*if*/
+      /* reciprocal of P·2**shift·B**GCD_GUARD_LIMBS, which has its top bit
+        set, is B**(2·n + GCD_GUARD_LIMBS) / (P·2**shift); shifting that
+        back up gives 1/P to 2·n + GCD_GUARD_LIMBS limbs, less than 2**shift
+        units out */
+        const unsigned int shift = __builtin_clzll(p[n - 1]);
+        const size_t dlen = n + GCD_GUARD_LIMBS;
+        d = malloc(dlen * sizeof(uint64_t));
+        inv = malloc((dlen + 2) * sizeof(uint64_t));
+        if (d == NULL or inv == NULL)
+            break;
+        memset(d, 0, GCD_GUARD_LIMBS * sizeof(uint64_t));
+        mp_shl(d + GCD_GUARD_LIMBS, p, n, shift);
+        if (not mp_reciprocal(inv, d, dlen, nr_threads))
+            break;
+        inv[dlen + 1] = mp_shl(inv, inv, dlen + 1, shift);
+        const size_t tlen = mp_normalize(inv, dlen + 2); /* < B**(2·n + GCD_GUARD_LIMBS) / 2 */
+        memcpy(t, inv, tlen * sizeof(uint64_t));
+        job->frac_len[top % 2][0] = tlen;
+        ok = true;
+      }
+    while (false);
+    free(d);
+    free(inv);
+    return
+        ok;
+  } /*gcd_root*/
+
+static bool gcd_remainder
+  (
+    struct gcd_job * job,
+    size_t i /* index within current level */
+  )
+  /* computes the fraction for the ith node from that at its parent, by
+    multiplying by the square of its sibling. Returns false if out of memory. */
+  {
+    bool ok = false;
+    uint64_t * square = NULL;
+    uint64_t * prod = NULL;
+    const unsigned int level = job->level;
+    const size_t nr_nodes = job->level_start[level + 1] - job->level_start[level];
+    const size_t parent = job->level_start[level + 1] + i / 2;
+    const uint64_t * const pt = gcd_frac(job, level + 1, i / 2);
+    const size_t ptlen = job->frac_len[(level + 1) % 2][i / 2];
+    uint64_t * const t = gcd_frac(job, level, i);
+    do /*once*/
+      {
+        if ((i ^ 1) >= nr_nodes or ptlen == 0)
+          {
+          /* only child, with the same value as its parent, or nothing to multiply */
+            memcpy(t, pt, ptlen * sizeof(uint64_t));
+            job->frac_len[level % 2][i] = ptlen;
+            ok = true;
+            break;
+          } /*if*/
+        const size_t sibling = job->level_start[level] + (i ^ 1);
+        const uint64_t * const s = job->limbs + job->offset[sibling];
+        const size_t slen = job->len[sibling];
+        square = malloc(2 * slen * sizeof(uint64_t));
+        prod = malloc((ptlen + 2 * slen) * sizeof(uint64_t));
+        if (square == NULL or prod == NULL)
+            break;
+        if (not mp_mul_fast(square, s, slen, s, slen, job->inner_threads))
+            break;
+        const size_t sqlen = mp_normalize(square, 2 * slen);
+        if (not mp_mul_fast(prod, pt, ptlen, square, sqlen, job->inner_threads))
+            break;
+      /* keep the fractional part, to the precision wanted for this node */
+        const size_t prec = gcd_precision(job, parent);
+        const size_t newprec = gcd_precision(job, job->level_start[level] + i);
+        const size_t plen = ptlen + sqlen < prec ? ptlen + sqlen : prec;
+        const size_t start = prec - newprec;
+        const size_t tlen = plen > start ? mp_normalize(prod + start, plen - start) : 0;
+        memcpy(t, prod + start, tlen * sizeof(uint64_t));
+        job->frac_len[level % 2][i] = tlen;
+        ok = true;
+      }
+    while (false);
+    free(square);
+    free(prod);
+    return
+        ok;
+  } /*gcd_remainder*/
+
+static bool gcd_leaf
+  (
+    struct gcd_job * job,
+    size_t i
+  )
+  /* replaces the fraction P / x**2 mod 1 at the ith leaf x with gcd(m, x),
+    where m is the product of all the other leaves. Returns false if out
+    of memory. */
+  {
+    bool ok = false;
+    uint64_t * prod = NULL;
+    do /*once*/
+      {
+        const uint64_t * const x = job->limbs + job->offset[i];
+        const size_t xlen = job->len[i];
+        uint64_t * const t = gcd_frac(job, 0, i);
+        const size_t tlen = job->frac_len[0][i];
+        const size_t prec = gcd_precision(job, i);
+        prod = malloc((prec + 3 * xlen + 2) * sizeof(uint64_t));
+        if (prod == NULL)
+            break;
+        uint64_t * const q = prod + prec + xlen + 1; /* room for xlen + 1 limbs */
+        uint64_t * const xodd = q + xlen + 1; /* room for xlen limbs */
+      /* m mod x = t·x, rounded to the nearest integer, mod x */
+        memset(prod, 0, (prec + xlen + 1) * sizeof(uint64_t));
+        if (tlen != 0)
+          {
+            if (not mp_mul_fast(prod, t, tlen, x, xlen, job->inner_threads))
+                break;
+          } /*if*/
+        const uint64_t half = (uint64_t)1 << 63;
+        mp_add_into(prod + prec - 1, xlen + 2, &half, 1);
+        size_t qlen = mp_normalize(prod + prec, xlen + 1);
+        memcpy(q, prod + prec, (xlen + 1) * sizeof(uint64_t));
+        if (mp_cmp(q, qlen, x, xlen) == 0)
+            qlen = 0;
+      /* x may be even, but mp_gcd wants it odd */
+        const unsigned int twos = mp_ctz(x, xlen);
+        memcpy(xodd, x, xlen * sizeof(uint64_t));
+        const size_t oddlen = mp_shr(xodd, xlen, twos);
+        if (qlen == 0)
+          {
+          /* x divides the product of the others */
+            memcpy(t, x, xlen * sizeof(uint64_t));
+            job->frac_len[0][i] = xlen;
+          }
+        else
+          {
+            const unsigned int qtwos = mp_ctz(q, qlen);
+            const unsigned int shift = qtwos < twos ? qtwos : twos;
+            size_t glen = mp_gcd(t + shift / 64, q, qlen, xodd, oddlen);
+            memset(t, 0, shift / 64 * sizeof(uint64_t));
+            glen += shift / 64;
+            const uint64_t out = mp_shl(t, t, glen, shift % 64);
+            if (out != 0)
+                t[glen++] = out;
+            job->frac_len[0][i] = glen;
+          } /*if*/
+        ok = true;
+      }
+    while (false);
+    free(prod);
+    return
+        ok;
+  } /*gcd_leaf*/
+
+static void * gcd_worker
+  (
+    void * arg
+  )
+  {
+    struct gcd_job * const job = arg;
+    const size_t nr_nodes = job->level_start[job->level + 1] - job->level_start[job->level];
+    for (;;)
+      {
+        const size_t i = atomic_fetch_add(&job->next, 1);
+        if (i >= nr_nodes or atomic_load(&job->failed))
+            break;
+        bool ok = false;
+        switch (job->phase)
+          {
+        case GCD_PRODUCT:
+            ok = gcd_product(job, i);
+        break;
+        case GCD_REMAINDER:
+            ok = gcd_remainder(job, i);
+        break;
+        case GCD_LEAF:
+            ok = gcd_leaf(job, i);
+        break;
+          } /*switch*/
+        if (not ok)
+            atomic_store(&job->failed, true);
+      } /*for*/
+    return
+        NULL;
+  } /*gcd_worker*/
+
+static void gcd_run_level
+  (
+    struct gcd_job * job,
+    enum gcd_phase phase,
+    unsigned int level,
+    unsigned int nr_threads
+  )
+  /* does the specified phase to every node at the specified level. */
+  {
+    const size_t nr_nodes = job->level_start[level + 1] - job->level_start[level];
+    job->phase = phase;
+    job->level = level;
+    job->inner_threads = nr_threads > nr_nodes ? nr_threads / nr_nodes : 1;
+    atomic_store(&job->next, 0);
+    run_workers(gcd_worker, job, threads_for(nr_nodes, 1, nr_threads));
+  } /*gcd_run_level*/
+
+static bool run_batch_gcd
+  (
+    struct gcd_job * job,
+    unsigned int nr_threads
+  )
+  /* computes the batch GCD, given the leaves and the layout of the
+    storage. The answer for each leaf is left in place of its fraction.
+    Must be called without the GIL. Returns false if out of memory. */
+  {
+    atomic_init(&job->failed, false);
+    for (unsigned int level = 1;;)
+      {
+        if (level == job->nr_levels or atomic_load(&job->failed))
+            break;
+        gcd_run_level(job, GCD_PRODUCT, level, nr_threads);
+        ++level;
+      } /*for*/
+    if (not atomic_load(&job->failed) and not gcd_root(job, nr_threads))
+        atomic_store(&job->failed, true);
+    for (unsigned int level = job->nr_levels - 1;;)
+      {
+        if (level == 0 or atomic_load(&job->failed))
+            break;
+        --level;
+        gcd_run_level(job, GCD_REMAINDER, level, nr_threads);
+      } /*for*/
+    if (not atomic_load(&job->failed))
+        gcd_run_level(job, GCD_LEAF, 0, nr_threads);
+    return
+        not atomic_load(&job->failed);
+  } /*run_batch_gcd*/
+
+/*
+    Factorization type
+
+    A compact, immutable alternative to the tuple of pairs: the primes and
+    their powers are stored inline in a single variable-size object, as two
+    consecutive arrays of uint64. The (prime, power) pairs are only turned
+    into Python objects if they are accessed as a sequence; the arrays can
+    also be read directly through the buffer protocol, as a 2 × «n» array
+    with the primes in the first row and powers in the second.
+*/
+
+typedef struct
+  {
+    PyObject_VAR_HEAD /* ob_size is nr of distinct prime factors */
+    Py_ssize_t shape[2], strides[2]; /* for buffer export */
+    uint64_t data[]; /* ob_size primes followed by ob_size powers */
+  } FactorizationObject;
+
+static inline uint64_t * Factorization_primes
+  (
+    FactorizationObject * self
+  )
+  {
+    return
+        self->data;
+  } /*Factorization_primes*/
+
+static inline uint64_t * Factorization_powers
+  (
+    FactorizationObject * self
+  )
+  {
+    return
+        self->data + Py_SIZE(self);
+  } /*Factorization_powers*/
+
+static PyObject * factorization_to_object
+  (
+    struct module_state * state,
+    const struct factorization * f
+  )
+  /* returns a new Factorization object representing f. */
+  {
+    FactorizationObject * result =
+        PyObject_NewVar(FactorizationObject, state->Factorization_type, f->nr_factors);
+    if (result != NULL)
+      {
+        for (unsigned int i = 0;;)
+          {
+            if (i == f->nr_factors)
+                break;
+            Factorization_primes(result)[i] = f->factors[i].prime;
+            Factorization_powers(result)[i] = f->factors[i].power;
+            ++i;
+          } /*for*/
+        result->shape[0] = 2;
+        result->shape[1] = f->nr_factors;
+        result->strides[0] = f->nr_factors * sizeof(uint64_t);
+        result->strides[1] = sizeof(uint64_t);
+      } /*if*/
+    return
+        (PyObject *)result;
+  } /*factorization_to_object*/
+
+static void Factorization_dealloc
+  (
+    PyObject * self
+  )
+  {
+    PyTypeObject * const type = Py_TYPE(self);
+    PyObject_Del(self);
+    Py_DECREF(type); /* instances of heap types own a reference to it */
+  } /*Factorization_dealloc*/
+
+static Py_ssize_t Factorization_length
+  (
+    PyObject * self
+  )
+  {
+    return
+        Py_SIZE(self);
+  } /*Factorization_length*/
+
+static PyObject * Factorization_item
+  (
+    PyObject * self,
+    Py_ssize_t i
+  )
+  {
+    FactorizationObject * const fself = (FactorizationObject *)self;
+    PyObject * result = NULL;
+    if (i >= 0 and i < Py_SIZE(self))
+        result = Py_BuildValue
+          (
+            "(KK)",
+            (unsigned long long)Factorization_primes(fself)[i],
+            (unsigned long long)Factorization_powers(fself)[i]
+          );
+    else
+        PyErr_SetString(PyExc_IndexError, "Factorization index out of range");
+    return
+        result;
+  } /*Factorization_item*/
+
+static int Factorization_getbuffer
+  (
+    PyObject * self,
+    Py_buffer * view,
+    int flags
+  )
+  {
+    FactorizationObject * const fself = (FactorizationObject *)self;
+    int result = -1;
+    do /*once*/
+      {
+        if ((flags & PyBUF_WRITABLE) != 0)
+          {
+            PyErr_SetString(PyExc_BufferError, "Factorization objects are read-only");
+            break;
+          } /*if*/
+        view->obj = self;
+        Py_INCREF(self);
+        view->buf = fself->data;
+        view->len = 2 * Py_SIZE(self) * sizeof(uint64_t);
+        view->readonly = 1;
+        view->itemsize = sizeof(uint64_t);
+        view->format = (flags & PyBUF_FORMAT) != 0 ? "Q" : NULL;
+        view->ndim = 2;
+        view->shape = (flags & PyBUF_ND) == PyBUF_ND ? fself->shape : NULL;
+        view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? fself->strides : NULL;
+        view->suboffsets = NULL;
+        view->internal = NULL;
+        if (view->shape == NULL)
+          /* caller just wants the bytes */
+            view->ndim = 1;
+      /* all done */
+        result = 0;
+      }
+    while (false);
+    return
+        result;
+  } /*Factorization_getbuffer*/
+
+static PyObject * Factorization_value
+  (
+    PyObject * self,
+    PyObject * unused
+  )
+  /* the number that was factorized. Cannot overflow, because it came from
+    a uint64 in the first place. */
+  {
+    FactorizationObject * const fself = (FactorizationObject *)self;
+    uint64_t value = 1;
+    for (Py_ssize_t i = 0;;)
+      {
+        if (i == Py_SIZE(self))
+            break;
+        for (uint64_t j = 0;;)
+          {
+            if (j == Factorization_powers(fself)[i])
+                break;
+            value *= Factorization_primes(fself)[i];
+            ++j;
+          } /*for*/
+        ++i;
+      } /*for*/
+    return
+        PyLong_FromUnsignedLongLong(value);
+  } /*Factorization_value*/
+
+static PyObject * Factorization_divisor_count
+  (
+    PyObject * self,
+    PyObject * unused
+  )
+  {
+    FactorizationObject * const fself = (FactorizationObject *)self;
+    uint64_t count = 1;
+    for (Py_ssize_t i = 0;;)
+      {
+        if (i == Py_SIZE(self))
+            break;
+        count *= Factorization_powers(fself)[i] + 1;
+        ++i;
+      } /*for*/
+    return
+        PyLong_FromUnsignedLongLong(count);
+  } /*Factorization_divisor_count*/
+
+static PyObject * Factorization_as_dict
+  (
+    PyObject * self,
+    PyObject * unused
+  )
+  {
+    FactorizationObject * const fself = (FactorizationObject *)self;
+    PyObject * result = NULL;
+    PyObject * tempresult = NULL;
+    do /*once*/
+      {
+        tempresult = PyDict_New();
+        if (tempresult == NULL)
+            break;
+        for (Py_ssize_t i = 0;;)
+          {
+            if (i == Py_SIZE(self))
+                break;
+            PyObject * key = NULL;
+            PyObject * value = NULL;
+            do /*once*/
+              {
+                key = PyLong_FromUnsignedLongLong(Factorization_primes(fself)[i]);
+                if (key == NULL)
+                    break;
+                value = PyLong_FromUnsignedLongLong(Factorization_powers(fself)[i]);
+                if (value == NULL)
+                    break;
+                if (PyDict_SetItem(tempresult, key, value) < 0)
+                    break;
+              }
+            while (false);
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+            if (PyErr_Occurred())
+                break;
+            ++i;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+      /* all done */
+        result = tempresult;
+        tempresult = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    Py_XDECREF(tempresult);
+    return
+        result;
+  } /*Factorization_as_dict*/
+
+static PyObject * Factorization_repr
+  (
+    PyObject * self
+  )
+  {
+    PyObject * result = NULL;
+    PyObject * items = NULL;
+    do /*once*/
+      {
+        items = PySequence_Tuple(self);
+        if (items == NULL)
+            break;
+        result = PyUnicode_FromFormat("Factorization(%R)", items);
+      }
+    while (false);
+    Py_XDECREF(items);
+    return
+        result;
+  } /*Factorization_repr*/
+
+static PyObject * Factorization_richcompare
+  (
+    PyObject * self,
+    PyObject * other,
+    int op
+  )
+  /* Factorizations compare equal if they have the same primes and powers. */
+  {
+    PyObject * result;
+    if
+      (
+            Py_IS_TYPE(other, Py_TYPE(self))
+        and
+            (op == Py_EQ or op == Py_NE)
+      )
+      {
+        const bool equal =
+                Py_SIZE(self) == Py_SIZE(other)
+            and
+                memcmp
+                  (
+                    ((FactorizationObject *)self)->data,
+                    ((FactorizationObject *)other)->data,
+                    2 * Py_SIZE(self) * sizeof(uint64_t)
+                  )
+                ==
+                    0;
+        result = equal == (op == Py_EQ) ? Py_True : Py_False;
+      }
+    else
+        result = Py_NotImplemented;
+    Py_INCREF(result);
+    return
+        result;
+  } /*Factorization_richcompare*/
+
+static Py_hash_t Factorization_hash
+  (
+    PyObject * self
+  )
+  /* consistent with Factorization_richcompare: depends only on the primes
+    and powers, so equal Factorizations can serve as the same dict key. */
+  {
+    const FactorizationObject * const fself = (const FactorizationObject *)self;
+    uint64_t hash = Py_SIZE(self);
+    for (Py_ssize_t i = 0;;)
+      {
+        if (i == 2 * Py_SIZE(self))
+            break;
+        hash = siqs_mix(hash ^ fself->data[i]);
+        ++i;
+      } /*for*/
+    if ((Py_hash_t)hash == -1)
+      /* reserved for errors */
+        hash = -2;
+    return
+        (Py_hash_t)hash;
+  } /*Factorization_hash*/
+
+static PyMethodDef Factorization_methods[] =
+  {
+    {"value", Factorization_value, METH_NOARGS,
+        "value()\n\n"
+        "returns the integer that was factorized."
+    },
+    {"divisor_count", Factorization_divisor_count, METH_NOARGS,
+        "divisor_count()\n\n"
+        "returns the number of distinct divisors of the integer that was"
+        " factorized, including 1 and itself."
+    },
+    {"as_dict", Factorization_as_dict, METH_NOARGS,
+        "as_dict()\n\n"
+        "returns a dict mapping each prime factor to its power."
+    },
+    END_STRUCT_LIST
+  };
+
+static PyType_Slot Factorization_slots[] =
+  {
+    {Py_tp_doc,
+        (void *)
+        "the result of factorize(«n», compact = True): a read-only sequence of"
+        " («prime», «power») pairs, which also exports its primes and powers"
+        " through the buffer protocol as a 2 × «len» array of unsigned 64-bit"
+        " integers. Factorizations with the same primes and powers compare equal"
+        " and hash the same; they are not ordered."
+    },
+    {Py_tp_dealloc, Factorization_dealloc},
+    {Py_tp_repr, Factorization_repr},
+    {Py_tp_richcompare, Factorization_richcompare},
+    {Py_tp_hash, Factorization_hash},
+    {Py_sq_length, Factorization_length},
+    {Py_sq_item, Factorization_item},
+    {Py_bf_getbuffer, Factorization_getbuffer},
+    {Py_tp_methods, Factorization_methods},
+    END_STRUCT_LIST
+  };
+
+static PyType_Spec Factorization_spec =
+  {
+    .name = "discipline.Factorization",
+    .basicsize = offsetof(FactorizationObject, data),
+    .itemsize = 2 * sizeof(uint64_t),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, /* only made internally */
+    .slots = Factorization_slots,
+  };
+
+/*
+    Prime iterator type
+
+    What primes() returns when not given a buffer to fill: it just
+    sieves the next segment whenever it runs out of primes from the
+    last one, so arbitrarily long ranges take only bounded memory.
+*/
+
+typedef struct
+  {
+    PyObject_HEAD
+    struct prime_iter it; /* sieve is NULL if range is empty or exhausted */
+  } PrimeIteratorObject;
+
+static PyObject * prime_iterator_new
+  (
+    struct module_state * state,
+    uint64_t lo,
+    uint64_t last,
+    bool empty /* if true, lo and last are ignored */
+  )
+  /* returns a new PrimeIterator object for the primes in [lo, last]. */
+  {
+    PyObject * result = NULL;
+    PrimeIteratorObject * self = NULL;
+    do /*once*/
+      {
+        self = PyObject_New(PrimeIteratorObject, state->PrimeIterator_type);
+        if (self == NULL)
+            break;
+        self->it.base_primes = NULL;
+        self->it.sieve = NULL;
+        if (not empty)
+          {
+            bool ok;
+            Py_BEGIN_ALLOW_THREADS
+            ok = prime_iter_init(&self->it, lo, last);
+            Py_END_ALLOW_THREADS
+            if (not ok)
+              {
+                PyErr_NoMemory();
+                break;
+              } /*if*/
+          } /*if*/
+      /* all done */
+        result = (PyObject *)self;
+        self = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    Py_XDECREF(self);
+    return
+        result;
+  } /*prime_iterator_new*/
+
+static void PrimeIterator_dealloc
+  (
+    PyObject * self
+  )
+  {
+    PyTypeObject * const type = Py_TYPE(self);
+    prime_iter_dispose(&((PrimeIteratorObject *)self)->it);
+    PyObject_Del(self);
+    Py_DECREF(type);
+  } /*PrimeIterator_dealloc*/
+
+static PyObject * PrimeIterator_next
+  (
+    PyObject * self
+  )
+  /* returns the next prime, or NULL without an exception set if there
+    are no more. */
+  {
+    PrimeIteratorObject * const pself = (PrimeIteratorObject *)self;
+    PyObject * result = NULL;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (pself->it.sieve != NULL)
+      {
+        const uint64_t p = prime_iter_next(&pself->it);
+        if (p != 0)
+            result = PyLong_FromUnsignedLongLong(p);
+        else
+            prime_iter_dispose(&pself->it); /* won’t be needing it any more */
+      } /*if*/
+    Py_END_CRITICAL_SECTION();
+    return
+        result;
+  } /*PrimeIterator_next*/
+
+static PyType_Slot PrimeIterator_slots[] =
+  {
+    {Py_tp_doc,
+        (void *)
+        "the result of primes(«lo», «hi»): an iterator over the primes in"
+        " that range, in ascending order, found by sieving one segment at a time."
+    },
+    {Py_tp_dealloc, PrimeIterator_dealloc},
+    {Py_tp_iter, PyObject_SelfIter},
+    {Py_tp_iternext, PrimeIterator_next},
+    END_STRUCT_LIST
+  };
+
+static PyType_Spec PrimeIterator_spec =
+  {
+    .name = "discipline.PrimeIterator",
+    .basicsize = sizeof(PrimeIteratorObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, /* only made internally */
+    .slots = PrimeIterator_slots,
+  };
+
+/*
+    Factorization range iterator type
+
+    What factorize_range() returns when not given arrays to fill: it
+    factorizes the next segment of the window whenever it runs out of
+    results from the last one, so arbitrarily big windows take only
+    bounded memory.
+*/
+
+typedef struct
+  {
+    PyObject_HEAD
+    struct range_primes rp;
+    struct range_segment * seg; /* NULL once finished */
+    size_t pos; /* index in seg of next value to return */
+    uint64_t next_start; /* first value of next segment, if more */
+    uint64_t last; /* of window */
+    bool more; /* there are more segments to come after seg */
+    bool compact; /* return Factorization objects instead of tuples */
+    bool busy; /* a segment is being filled without the GIL */
+  } FactorRangeIteratorObject;
+
+static PyObject * factorization_to_tuple
+  (
+    const struct factorization * f
+  ); /* forward */
+
+static PyObject * factor_range_iterator_new
+  (
+    struct module_state * state,
+    uint64_t lo,
+    uint64_t last,
+    bool empty, /* if true, lo and last are ignored */
+    bool compact
+  )
+  /* returns a new FactorRangeIterator object for the values in [lo, last]. */
+  {
+    PyObject * result = NULL;
+    FactorRangeIteratorObject * self = NULL;
+    do /*once*/
+      {
+        self = PyObject_New(FactorRangeIteratorObject, state->FactorRangeIterator_type);
+        if (self == NULL)
+            break;
+        self->rp.primes = NULL;
+        self->seg = NULL;
+        self->pos = 0;
+        self->next_start = lo;
+        self->last = last;
+        self->more = not empty;
+        self->compact = compact;
+        self->busy = false;
+        if (not empty)
+          {
+            bool ok;
+            Py_BEGIN_ALLOW_THREADS
+            ok = range_primes_init(&self->rp, lo, last);
+            if (ok)
+              {
+                self->seg = range_segment_new();
+                ok = self->seg != NULL;
+              } /*if*/
+            Py_END_ALLOW_THREADS
+            if (not ok)
+              {
+                PyErr_NoMemory();
+                break;
+              } /*if*/
+          } /*if*/
+      /* all done */
+        result = (PyObject *)self;
+        self = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    Py_XDECREF(self);
+    return
+        result;
+  } /*factor_range_iterator_new*/
+
+static void FactorRangeIterator_dealloc
+  (
+    PyObject * self
+  )
+  {
+    PyTypeObject * const type = Py_TYPE(self);
+    FactorRangeIteratorObject * const rself = (FactorRangeIteratorObject *)self;
+    range_segment_dispose(rself->seg);
+    range_primes_dispose(&rself->rp);
+    PyObject_Del(self);
+    Py_DECREF(type);
+  } /*FactorRangeIterator_dealloc*/
+
+static PyObject * FactorRangeIterator_next
+  (
+    PyObject * self
+  )
+  /* returns the next («n», «factors») pair, or NULL without an exception
+    set if there are no more. */
+  {
+    FactorRangeIteratorObject * const rself = (FactorRangeIteratorObject *)self;
+    PyObject * result = NULL;
+    PyObject * factors = NULL;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    do /*once*/
+      {
+        if (rself->seg == NULL)
+            break;
+        if (rself->busy)
+          {
+            PyErr_SetString(PyExc_ValueError, "FactorRangeIterator already executing");
+            break;
+          } /*if*/
+        if (rself->pos == rself->seg->nr_values)
+          {
+            if (not rself->more)
+              {
+              /* won’t be needing these any more */
+                range_segment_dispose(rself->seg);
+                rself->seg = NULL;
+                range_primes_dispose(&rself->rp);
+                break;
+              } /*if*/
+            const uint64_t start = rself->next_start;
+            const size_t nr_values =
+                rself->last - start < FACTOR_RANGE_SEGMENT ?
+                    rself->last - start + 1
+                :
+                    FACTOR_RANGE_SEGMENT;
+            bool ok;
+            rself->busy = true;
+            Py_BEGIN_ALLOW_THREADS
+            ok = range_segment_fill(rself->seg, &rself->rp, start, nr_values);
+            Py_END_ALLOW_THREADS
+            rself->busy = false;
+            if (not ok)
+              {
+                rself->seg->nr_values = 0;
+                PyErr_NoMemory();
+                break;
+              } /*if*/
+            rself->more = rself->last - start >= FACTOR_RANGE_SEGMENT;
+            if (rself->more)
+                rself->next_start = start + FACTOR_RANGE_SEGMENT;
+            rself->pos = 0;
+          } /*if*/
+        const size_t i = rself->pos;
+        if (rself->seg->statuses[i] == FACTORIZE_OK)
+          {
+            struct factorization f;
+            range_segment_get(rself->seg, i, &f);
+            factors =
+                rself->compact ?
+                    factorization_to_object(type_module_state(Py_TYPE(self)), &f)
+                :
+                    factorization_to_tuple(&f);
+            if (factors == NULL)
+                break;
+          }
+        else
+          {
+            factors = Py_None;
+            Py_INCREF(factors);
+          } /*if*/
+        result = Py_BuildValue("(KO)", (unsigned long long)(rself->seg->start + i), factors);
+        if (result == NULL)
+            break;
+        ++rself->pos;
+      }
+    while (false);
+    Py_END_CRITICAL_SECTION();
+    Py_XDECREF(factors);
+    return
+        result;
+  } /*FactorRangeIterator_next*/
+
+static PyType_Slot FactorRangeIterator_slots[] =
+  {
+    {Py_tp_doc,
+        (void *)
+        "the result of factorize_range(«lo», «hi»): an iterator over («n», «factors»)"
+        " pairs for each «n» in that range, in ascending order, factorized one"
+        " segment at a time."
+    },
+    {Py_tp_dealloc, FactorRangeIterator_dealloc},
+    {Py_tp_iter, PyObject_SelfIter},
+    {Py_tp_iternext, FactorRangeIterator_next},
+    END_STRUCT_LIST
+  };
+
+static PyType_Spec FactorRangeIterator_spec =
+  {
+    .name = "discipline.FactorRangeIterator",
+    .basicsize = sizeof(FactorRangeIteratorObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, /* only made internally */
+    .slots = FactorRangeIterator_slots,
+  };
+
+/*
+    Factor iterator type
+
+    What ifactorize() returns: it does just enough of the factorization
+    on each call to find the next prime power, so the caller can stop as
+    soon as it has what it needs.
+*/
+
+typedef struct
+  {
+    PyObject_HEAD
+    struct ifactorizer it;
+    bool busy; /* a call is in progress without the GIL */
+    bool finished; /* no more factors, or unluckiness has been reported */
+  } FactorIteratorObject;
+
+
+static void set_factorize_error
+  (
+    enum factorize_status status
+  ); /* forward */
+static PyObject * mp_to_long
+  (
+    const uint64_t * limbs,
+    size_t len
+  ); /* forward */
+
+static void FactorIterator_dealloc
+  (
+    PyObject * self
+  )
+  {
+    PyTypeObject * const type = Py_TYPE(self);
+    ifactorizer_dispose(&((FactorIteratorObject *)self)->it);
+    PyObject_Del(self);
+    Py_DECREF(type);
+  } /*FactorIterator_dealloc*/
+
+static PyObject * FactorIterator_next
+  (
+    PyObject * self
+  )
+  /* returns the next («prime», «power») pair, or NULL without an exception
+    set if there are no more. */
+  {
+    FactorIteratorObject * const fself = (FactorIteratorObject *)self;
+    PyObject * result = NULL;
+    struct ifact_piece factor = {.limbs = NULL};
+    Py_BEGIN_CRITICAL_SECTION(self);
+    do /*once*/
+      {
+        if (fself->finished)
+            break;
+        if (fself->busy)
+          {
+            PyErr_SetString(PyExc_ValueError, "FactorIterator already executing");
+            break;
+          } /*if*/
+        bool ok;
+        if (fself->it.len == 0)
+          {
+          /* past trial division, so could take a long time */
+            fself->busy = true;
+            Py_BEGIN_ALLOW_THREADS
+            ok = ifactorizer_next(&fself->it, &factor);
+            Py_END_ALLOW_THREADS
+            fself->busy = false;
+          }
+        else
+            ok = ifactorizer_next(&fself->it, &factor);
+        if (not ok)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        if (factor.len == 0)
+          {
+            fself->finished = true;
+            ifactorizer_dispose(&fself->it); /* won’t be needing it any more */
+            break;
+          } /*if*/
+        if (factor.len == 1 and factor.limbs[0] == 5 or factor.power == 5)
+          {
+          /* same as factorize() would do */
+            fself->finished = true;
+            ifactorizer_dispose(&fself->it);
+            set_factorize_error
+              (
+                factor.len == 1 and factor.limbs[0] == 5 ?
+                    FACTORIZE_UNLUCKY_FACTOR
+                :
+                    FACTORIZE_UNLUCKY_POWER
+              );
+            break;
+          } /*if*/
+        PyObject * const prime = mp_to_long(factor.limbs, factor.len);
+        if (prime == NULL)
+            break;
+        result = Py_BuildValue("(NI)", prime, factor.power);
+      }
+    while (false);
+    Py_END_CRITICAL_SECTION();
+    free(factor.limbs);
+    return
+        result;
+  } /*FactorIterator_next*/
+
+static PyType_Slot FactorIterator_slots[] =
+  {
+    {Py_tp_doc,
+        (void *)
+        "the result of ifactorize(«n»): an iterator over («prime», «power») pairs"
+        " for the prime factors of «n», each found only when asked for."
+    },
+    {Py_tp_dealloc, FactorIterator_dealloc},
+    {Py_tp_iter, PyObject_SelfIter},
+    {Py_tp_iternext, FactorIterator_next},
+    END_STRUCT_LIST
+  };
+
+static PyType_Spec FactorIterator_spec =
+  {
+    .name = "discipline.FactorIterator",
+    .basicsize = sizeof(FactorIteratorObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, /* only made internally */
+    .slots = FactorIterator_slots,
+  };
+
+/*
+    Asynchronous factorization
+
+    factorize_async() hands each request to the thread pool as a task,
+    which puts it on a done list when finished. Only a task finding the
+    done list empty writes to the eventfd that the asyncio event loop is
+    watching; the loop’s callback reads the eventfd before taking the
+    whole list, so any nr of completions arriving meanwhile cost just the
+    one wakeup. The tasks only ever see plain C data; turning results
+    into Python objects and completing the futures is left to the
+    callback, which runs with the GIL. Each interpreter’s module has its
+    own channel holding the done list and eventfd, and a request that
+    finishes after its module has gone is just abandoned.
+*/
+
+struct async_channel
+  /* where the finished requests for one interpreter go */
+  {
+    pthread_mutex_t lock;
+    struct async_request * done; /* finished, most recent first */
+    int efd; /* eventfd */
+    unsigned int generation; /* value of async_fork_generation when made */
+    atomic_uint refs; /* one for the module, one for each request in flight */
+    bool closed; /* module and its interpreter have gone */
+  };
+
+static atomic_uint async_fork_generation; /* incremented in child after fork() */
+
+struct async_request
+  {
+    struct async_request * next;
+    struct async_channel * channel; /* has a reference for this request */
+    PyObject * future; /* only touched with the GIL */
+    struct spf_table * table;
+    uint64_t n; /* if len is 0 */
+    uint64_t * limbs; /* otherwise n is this, normalized, at least 2**64 */
+    size_t len;
+  /* results: */
+    struct factorization f; /* if len is 0 */
+    struct mp_factorization mf; /* otherwise */
+    struct mp_factorization rest; /* left unfactorized if pool was shut down */
+    enum factorize_status status; /* if len is 0 */
+    bool ok; /* false if out of memory */
+  };
+
+static void async_channel_release
+  (
+    struct async_channel * channel
+  )
+  /* drops a reference to channel, disposing of it when no longer in use.
+    Noop if channel is NULL. */
+  {
+    if (channel != NULL and atomic_fetch_sub(&channel->refs, 1) == 1)
+      {
+        close(channel->efd);
+        pthread_mutex_destroy(&channel->lock);
+        free(channel);
+      } /*if*/
+  } /*async_channel_release*/
+
+static struct async_channel * async_channel_new(void)
+  /* returns a new channel with one reference, or NULL with a Python
+    exception set. */
+  {
+    struct async_channel * result = NULL;
+    struct async_channel * channel = NULL;
+    do /*once*/
+      {
+        channel = malloc(sizeof(struct async_channel));
+        if (channel == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        channel->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (channel->efd < 0)
+          {
+            PyErr_SetFromErrno(PyExc_OSError);
+            break;
+          } /*if*/
+        pthread_mutex_init(&channel->lock, NULL);
+        channel->done = NULL;
+        channel->generation = atomic_load(&async_fork_generation);
+        atomic_init(&channel->refs, 1);
+        channel->closed = false;
+      /* all done */
+        result = channel;
+        channel = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    free(channel);
+    return
+        result;
+  } /*async_channel_new*/
+
+static void async_request_abandon
+  (
+    struct async_request * req
+  )
+  /* frees up everything req owns except its future, for when the
+    interpreter that made that has gone. Noop if req is NULL. */
+  {
+    if (req != NULL)
+      {
+        async_channel_release(req->channel);
+        spf_table_release(req->table);
+        mp_factorization_dispose(&req->mf);
+        mp_factorization_dispose(&req->rest);
+        free(req->limbs);
+        free(req);
+      } /*if*/
+  } /*async_request_abandon*/
+
+static void async_request_dispose
+  (
+    struct async_request * req
+  )
+  /* frees up req and everything it owns. Must be called with the GIL held. */
+  {
+    if (req != NULL)
+      {
+        Py_XDECREF(req->future);
+        async_request_abandon(req);
+      } /*if*/
+  } /*async_request_dispose*/
+
+static void * async_run
+  (
+    void * arg
+  )
+  /* pool task for running a request. */
+  {
+    struct async_request * const req = arg;
+    struct async_channel * const channel = req->channel;
+    if (req->len == 0)
+      {
+        req->status = factorize_one(&req->f, req->n, req->table);
+        req->ok = true;
+      }
+    else
+        req->ok = factorize_mp(&req->mf, &req->rest, req->limbs, req->len, &pool.cancel);
+    pthread_mutex_lock(&channel->lock);
+    const bool closed = channel->closed;
+    if (not closed)
+      {
+        const bool was_empty = channel->done == NULL;
+        req->next = channel->done;
+        channel->done = req;
+        if (was_empty)
+            eventfd_write(channel->efd, 1);
+              /* before unlocking, since channel may be gone afterwards */
+      } /*if*/
+    pthread_mutex_unlock(&channel->lock);
+    if (closed)
+        async_request_abandon(req); /* leaking its future, which can no longer be touched */
+    return
+        NULL;
+  } /*async_run*/
+
+static bool async_submit
+  (
+    struct async_request * req /* ownership passes to the pool if successful */
+  )
+  /* returns false if out of memory. */
+  {
+    return
+        pool_task_new(async_run, req, NULL) != NULL;
+  } /*async_submit*/
+
+static struct async_request * async_take_done
+  (
+    struct async_channel * channel
+  )
+  /* returns all the finished requests, oldest first, after resetting
+    the eventfd. */
+  {
+    eventfd_t count;
+    eventfd_read(channel->efd, &count); /* EAGAIN just means a spurious wakeup */
+    pthread_mutex_lock(&channel->lock);
+    struct async_request * done = channel->done;
+    channel->done = NULL;
+    pthread_mutex_unlock(&channel->lock);
+    struct async_request * result = NULL;
+    for (;;)
+      {
+        if (done == NULL)
+            break;
+        struct async_request * const req = done;
+        done = req->next;
+        req->next = result;
+        result = req;
+      } /*for*/
+    return
+        result;
+  } /*async_take_done*/
+
+static void async_channel_close
+  (
+    struct async_channel * channel
+  )
+  /* for when the module goes away: disposes of any finished requests, and
+    makes sure any still in flight just get abandoned. Must be called
+    with the GIL held. Noop if channel is NULL. */
+  {
+    if (channel != NULL)
+      {
+        pthread_mutex_lock(&channel->lock);
+        channel->closed = true;
+        struct async_request * done = channel->done;
+        channel->done = NULL;
+        pthread_mutex_unlock(&channel->lock);
+        for (;;)
+          {
+            if (done == NULL)
+                break;
+            struct async_request * const req = done;
+            done = req->next;
+            async_request_dispose(req);
+          } /*for*/
+        async_channel_release(channel);
+      } /*if*/
+  } /*async_channel_close*/
+
+static void async_after_fork(void)
+  /* marks every channel as belonging to the parent after fork(). Its
+    requests in flight will never finish in the child, and its eventfd
+    is still shared with the parent, so the child must not use it. */
+  {
+    atomic_fetch_add(&async_fork_generation, 1);
+  } /*async_after_fork*/
+
+/*
+    Methods
+*/
+
+static PyObject * discipline_makedict
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    PyObject * tempresult = NULL;
+    br_PyObject * items;
+    const br_char * msg = NULL;
+    const PyTypeObject * const ExceptMe_type = get_module_state(self)->ExceptMe_type;
+    do /*once*/
+      {
+        const bool parsed_ok = PyArg_ParseTuple(args, "Os", &items, &msg);
+        if (not parsed_ok)
+            break;
+        fprintf(stdout, "makedict says: “%s”\n", msg);
+        if (not PyTuple_Check(items))
+          {
+            PyErr_SetString(PyExc_TypeError, "expecting a tuple");
+            break;
+          } /*if*/
+        const ssize_t nr_items = PyTuple_Size(items);
+        if (PyErr_Occurred())
+            break;
+      /* No critical sections needed here, even without the GIL: items and
+        the 2-tuples in it cannot change, and no other thread can see
+        tempresult until it is returned. */
+        tempresult = PyDict_New();
+        if (tempresult == NULL)
+            break;
+        for (ssize_t i = 0;;)
+          {
+            if (i == nr_items)
+                break;
+            br_PyObject * const item = PyTuple_GetItem(items, i);
+            if (item == NULL)
+                break;
+            if (not PyTuple_Check(item) or PyTuple_Size(item) != 2)
+              {
+                PyErr_SetString(PyExc_TypeError, "expecting a 2-tuple");
+                break;
+              } /*if*/
+            br_PyObject * const first = PyTuple_GetItem(item, 0);
+            if (first == NULL)
+                break;
+            br_PyObject * const second = PyTuple_GetItem(item, 1);
+            if (second == NULL)
+                break;
+            if (first == (PyObject *)ExceptMe_type or second == (PyObject *)ExceptMe_type)
+              {
+                PyErr_SetString(PyExc_ValueError, "ExceptMe object found");
+                break;
+              } /*if*/
+            if (PyDict_SetItem(tempresult, first, second) < 0)
+                break;
+            ++i;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+      /* all done */
+        result = tempresult;
+        tempresult = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    Py_XDECREF(tempresult);
+    return
+        result;
+  } /*discipline_makedict*/
+
+static void set_factorize_error
+  (
+    enum factorize_status status
+  )
+  /* raises the exception corresponding to an unsuccessful status. */
+  {
+    switch (status)
+      {
+    case FACTORIZE_TOO_SMALL:
+        PyErr_SetString(PyExc_ValueError, "cannot factorize one or zero");
+    break;
+    case FACTORIZE_UNLUCKY_FACTOR:
+        PyErr_SetString(PyExc_ValueError, "Aiee! Unlucky factor 5 found!");
+    break;
+    case FACTORIZE_UNLUCKY_POWER:
+        PyErr_SetString(PyExc_ValueError, "Aiee! Unlucky power 5 found!");
+    break;
+    default:
+        PyErr_SetString(PyExc_SystemError, "unexpected factorize status");
+    break;
+      } /*switch*/
+  } /*set_factorize_error*/
+
+static PyObject * factorization_to_tuple
+  (
+    const struct factorization * f
+  )
+  /* returns a tuple of («prime», «power») pairs representing f. The result
+    is allocated once at its final size, since f already says how big it
+    has to be. */
+  {
+    PyObject * result = NULL;
+    PyObject * tempresult = NULL;
+    do /*once*/
+      {
+        tempresult = PyTuple_New(f->nr_factors);
+        if (tempresult == NULL)
+            break;
+        for (unsigned int i = 0;;)
+          {
+            if (i == f->nr_factors)
+                break;
+            PyObject * factorelt = NULL;
+            PyObject * factorobj = NULL;
+            PyObject * powerobj = NULL;
+            do /*once*/
+              {
+                factorelt = PyTuple_New(2);
+                if (factorelt == NULL)
+                    break;
+                factorobj = PyLong_FromUnsignedLongLong(f->factors[i].prime);
+                if (factorobj == NULL)
+                    break;
+                powerobj = PyLong_FromUnsignedLong(f->factors[i].power);
+                if (powerobj == NULL)
+                    break;
+                PyTuple_SET_ITEM(factorelt, 0, factorobj);
+                PyTuple_SET_ITEM(factorelt, 1, powerobj);
+                factorobj = powerobj = NULL; /* ownership has passed to factorelt */
+              /* all done */
+                PyTuple_SET_ITEM(tempresult, i, factorelt);
+                factorelt = NULL; /* ownership has passed to tempresult */
+              }
+            while (false);
+            Py_XDECREF(factorobj);
+            Py_XDECREF(powerobj);
+            Py_XDECREF(factorelt);
+            if (PyErr_Occurred())
+                break;
+            ++i;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+      /* all done */
+        result = tempresult;
+        tempresult = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    Py_XDECREF(tempresult);
+    return
+        result;
+  } /*factorization_to_tuple*/
+
+static enum factorize_status mp_factorization_status
+  (
+    const struct mp_factorization * f
+  )
+  /* checks f for unluckiness, as for factorization_status. */
+  {
+    enum factorize_status result = FACTORIZE_OK;
+    for (size_t i = 0;;)
+      {
+        if (i == f->nr_factors)
+            break;
+        if (f->factors[i].len == 1 and f->factors[i].limbs[0] == 5)
+          {
+            result = FACTORIZE_UNLUCKY_FACTOR;
+            break;
+          } /*if*/
+        if (f->factors[i].power == 5)
+          {
+            result = FACTORIZE_UNLUCKY_POWER;
+            break;
+          } /*if*/
+        ++i;
+      } /*for*/
+    return
+        result;
+  } /*mp_factorization_status*/
+
+static bool get_mp
+  (
+    PyObject * obj,
+    uint64_t ** limbs,
+    size_t * len
+  )
+  /* converts obj, which must be a nonnegative Python int, to a newly
+    allocated limb array, which the caller must free regardless of errors.
+    Returns false, with an exception set, if it cannot. */
+  {
+    unsigned char * bytes = NULL;
+    *limbs = NULL;
+    do /*once*/
+      {
+        const size_t nr_bits = _PyLong_NumBits(obj);
+        if (PyErr_Occurred())
+            break;
+        *len = nr_bits / 64 + 1;
+        bytes = malloc(*len * sizeof(uint64_t));
+        *limbs = malloc(*len * sizeof(uint64_t));
+        if (bytes == NULL or *limbs == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        if
+          (
+            _PyLong_AsByteArray
+              (
+                (PyLongObject *)obj, bytes, *len * sizeof(uint64_t),
+                /*little_endian =*/ true, /*is_signed =*/ false
+#if PY_VERSION_HEX >= 0x030d0000
+                , /*with_exceptions =*/ true
+#endif
+              )
+            <
+                0
+          )
+            break; /* e.g. OverflowError for negative numbers */
+        for (size_t i = 0;;)
+          {
+            if (i == *len)
+                break;
+            uint64_t limb = 0;
+            for (unsigned int j = sizeof(uint64_t);;)
+              {
+                if (j == 0)
+                    break;
+                --j;
+                limb = limb << 8 | bytes[i * sizeof(uint64_t) + j];
+              } /*for*/
+            (*limbs)[i] = limb;
+            ++i;
+          } /*for*/
+        *len = mp_normalize(*limbs, *len);
+      }
+    while (false);
+    free(bytes);
+    return
+        not PyErr_Occurred();
+  } /*get_mp*/
+
+static PyObject * mp_to_long
+  (
+    const uint64_t * limbs,
+    size_t len
+  )
+  /* converts a multiple-precision number to a Python int. */
+  {
+    PyObject * result = NULL;
+    unsigned char * bytes = NULL;
+    do /*once*/
+      {
+        if (len <= 1)
+          {
+            result = PyLong_FromUnsignedLongLong(len != 0 ? limbs[0] : 0);
+            break;
+          } /*if*/
+        bytes = malloc(len * sizeof(uint64_t));
+        if (bytes == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        for (size_t i = 0;;)
+          {
+            if (i == len * sizeof(uint64_t))
+                break;
+            bytes[i] = limbs[i / sizeof(uint64_t)] >> i % sizeof(uint64_t) * 8;
+            ++i;
+          } /*for*/
+        result = _PyLong_FromByteArray(bytes, len * sizeof(uint64_t), /*little_endian =*/ true, /*is_signed =*/ false);
+      }
+    while (false);
+    free(bytes);
+    return
+        result;
+  } /*mp_to_long*/
+
+static PyObject * mp_factorization_to_tuple
+  (
+    const struct mp_factorization * f
+  )
+  /* returns a tuple of («prime», «power») pairs representing f. */
+  {
+    PyObject * result = NULL;
+    PyObject * tempresult = NULL;
+    do /*once*/
+      {
+        tempresult = PyTuple_New(f->nr_factors);
+        if (tempresult == NULL)
+            break;
+        for (size_t i = 0;;)
+          {
+            if (i == f->nr_factors)
+                break;
+            PyObject * factorelt = NULL;
+            PyObject * factorobj = NULL;
+            PyObject * powerobj = NULL;
+            do /*once*/
+              {
+                factorelt = PyTuple_New(2);
+                if (factorelt == NULL)
+                    break;
+                factorobj = mp_to_long(f->factors[i].limbs, f->factors[i].len);
+                if (factorobj == NULL)
+                    break;
+                powerobj = PyLong_FromUnsignedLong(f->factors[i].power);
+                if (powerobj == NULL)
+                    break;
+                PyTuple_SET_ITEM(factorelt, 0, factorobj);
+                PyTuple_SET_ITEM(factorelt, 1, powerobj);
+                factorobj = powerobj = NULL; /* ownership has passed to factorelt */
+              /* all done */
+                PyTuple_SET_ITEM(tempresult, i, factorelt);
+                factorelt = NULL; /* ownership has passed to tempresult */
+              }
+            while (false);
+            Py_XDECREF(factorobj);
+            Py_XDECREF(powerobj);
+            Py_XDECREF(factorelt);
+            if (PyErr_Occurred())
+                break;
+            ++i;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+      /* all done */
+        result = tempresult;
+        tempresult = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    Py_XDECREF(tempresult);
+    return
+        result;
+  } /*mp_factorization_to_tuple*/
+
+static PyObject * mp_factorization_product
+  (
+    const struct mp_factorization * f
+  )
+  /* returns the product of the prime powers in f. */
+  {
+    PyObject * result = NULL;
+    PyObject * tempresult = NULL;
+    do /*once*/
+      {
+        tempresult = PyLong_FromLong(1);
+        if (tempresult == NULL)
+            break;
+        for (size_t i = 0;;)
+          {
+            if (i == f->nr_factors)
+                break;
+            PyObject * factorobj = NULL;
+            PyObject * powerobj = NULL;
+            PyObject * term = NULL;
+            do /*once*/
+              {
+                factorobj = mp_to_long(f->factors[i].limbs, f->factors[i].len);
+                if (factorobj == NULL)
+                    break;
+                powerobj = PyLong_FromUnsignedLong(f->factors[i].power);
+                if (powerobj == NULL)
+                    break;
+                term = PyNumber_Power(factorobj, powerobj, Py_None);
+                if (term == NULL)
+                    break;
+                PyObject * const product = PyNumber_Multiply(tempresult, term);
+                if (product == NULL)
+                    break;
+                Py_DECREF(tempresult);
+                tempresult = product;
+              }
+            while (false);
+            Py_XDECREF(factorobj);
+            Py_XDECREF(powerobj);
+            Py_XDECREF(term);
+            if (PyErr_Occurred())
+                break;
+            ++i;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+      /* all done */
+        result = tempresult;
+        tempresult = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    Py_XDECREF(tempresult);
+    return
+        result;
+  } /*mp_factorization_product*/
+
+static PyObject * factors_and_cofactor
+  (
+    PyObject * factors, /* reference is stolen */
+    PyObject * cofactor /* reference is stolen */
+  )
+  /* returns the pair (factors, cofactor) for a partial factorization. */
+  {
+    PyObject * result = NULL;
+    if (factors != NULL and cofactor != NULL)
+        result = PyTuple_Pack(2, factors, cofactor);
+    Py_XDECREF(factors);
+    Py_XDECREF(cofactor);
+    return
+        result;
+  } /*factors_and_cofactor*/
+
+static bool get_work_limits
+  (
+    PyObject * deadlineobj, /* or Py_None */
+    PyObject * max_workobj, /* or Py_None */
+    double * deadline, /* left unchanged if none */
+    uint64_t * max_work /* left unchanged if none */
+  )
+  /* converts the deadline and max_work arguments to factorize() and
+    factorize_smooth(). Returns false, with a Python exception set, if
+    they are no good. */
+  {
+    bool ok = false;
+    do /*once*/
+      {
+        if (deadlineobj != Py_None)
+          {
+            *deadline = PyFloat_AsDouble(deadlineobj);
+            if (PyErr_Occurred())
+                break;
+            if (not isfinite(*deadline))
+              {
+                PyErr_SetString(PyExc_ValueError, "deadline must be finite");
+                break;
+              } /*if*/
+            if (*deadline == 0)
+                *deadline = -1; /* long passed, but 0 would mean none */
+          } /*if*/
+        if (max_workobj != Py_None)
+          {
+            *max_work = PyLong_AsUnsignedLongLong(max_workobj);
+            if
+              (
+                    PyErr_Occurred()
+                and
+                    PyLong_Check(max_workobj)
+                and
+                    PyErr_ExceptionMatches(PyExc_OverflowError)
+              )
+              {
+                PyErr_Clear();
+                *max_work = 0; /* report as for zero */
+              } /*if*/
+            if (PyErr_Occurred())
+                break;
+            if (*max_work == 0)
+              {
+                PyErr_SetString(PyExc_ValueError, "max_work must be in [1, 2**64 - 1]");
+                break;
+              } /*if*/
+          } /*if*/
+        ok = true;
+      }
+    while (false);
+    return
+        ok;
+  } /*get_work_limits*/
+
+static PyObject * factorize_mp_object
+  (
+    PyObject * nobj,
+    double deadline, /* or 0 for none */
+    uint64_t max_work, /* or 0 for none */
+    bool partial /* whether to return a pair («factors», «cofactor») */
+  )
+  /* factorize() for integers too big for a uint64. */
+  {
+    PyObject * result = NULL;
+    uint64_t * n = NULL;
+    struct mp_factorization f = MP_FACTORIZATION_INIT;
+    struct mp_factorization rest = MP_FACTORIZATION_INIT;
+    do /*once*/
+      {
+        size_t len = 0;
+        bool ok;
+        if (not get_mp(nobj, &n, &len))
+            break;
+      /* could take a long time, so let other threads run meanwhile, but
+        still keep an eye out for signals */
+        struct work_limit limit;
+        work_limit_init(&limit, deadline, max_work);
+        limit.tstate = PyEval_SaveThread();
+        ok = factorize_mp(&f, &rest, n, len, &limit);
+        PyEval_RestoreThread(limit.tstate);
+        if (atomic_load(&limit.stop) == WORK_INTERRUPTED)
+            break; /* exception already set */
+        if (not ok)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        const enum factorize_status status = mp_factorization_status(&f);
+        if (status != FACTORIZE_OK)
+          {
+            set_factorize_error(status);
+            break;
+          } /*if*/
+        if (partial)
+            result = factors_and_cofactor(mp_factorization_to_tuple(&f), mp_factorization_product(&rest));
+        else
+            result = mp_factorization_to_tuple(&f);
+      }
+    while (false);
+    mp_factorization_dispose(&f);
+    mp_factorization_dispose(&rest);
+    free(n);
+    return
+        result;
+  } /*factorize_mp_object*/
+
+static PyObject * discipline_factorize
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    static const char * const keywords[] = {"", "compact", "deadline", "max_work", NULL};
+    PyObject * result = NULL;
+    uint64_t n;
+    int compact = false;
+    bool partial;
+    do /*once*/
+      {
+          {
+            br_PyObject * nobj;
+            br_PyObject * deadlineobj = Py_None;
+            br_PyObject * max_workobj = Py_None;
+            double deadline = 0;
+            uint64_t max_work = 0;
+          /* Note that “K” specifier for PyArg_ParseTuple does not do overflow checking */
+            if
+              (
+                not PyArg_ParseTupleAndKeywords
+                  (
+                    args, kwargs, "O|$pOO", (char **)keywords,
+                    &nobj, &compact, &deadlineobj, &max_workobj
+                  )
+              )
+                break;
+            if (not get_work_limits(deadlineobj, max_workobj, &deadline, &max_work))
+                break;
+            partial = deadlineobj != Py_None or max_workobj != Py_None;
+            n = PyLong_AsUnsignedLongLong(nobj);
+            if (PyErr_Occurred())
+              {
+                if (PyLong_Check(nobj) and PyErr_ExceptionMatches(PyExc_OverflowError))
+                  {
+                  /* too big (or negative, which factorize_mp_object will complain about) */
+                    PyErr_Clear();
+                    if (compact and _PyLong_Sign(nobj) > 0)
+                      /* Factorization objects can only hold 64-bit primes */
+                        PyErr_SetString(PyExc_ValueError, "compact result only available for n below 2**64");
+                    else
+                        result = factorize_mp_object(nobj, deadline, max_work, partial);
+                  } /*if*/
+                break;
+              } /*if*/
+          }
+        struct factorization f; /* collects the factors without any Python objects */
+        enum factorize_status status;
+      /* from here on, all shared state (the cache, the table) is plain C
+        data with its own locking, so concurrent calls are fine without
+        the GIL too */
+        struct spf_table * const table = spf_table_borrow(n);
+        if (n > (uint64_t)TRIAL_LIMIT * TRIAL_LIMIT and table == NULL)
+          {
+          /* might need primality testing and rho, so let other threads run meanwhile */
+            Py_BEGIN_ALLOW_THREADS
+            status = factorize_one(&f, n, table);
+            Py_END_ALLOW_THREADS
+          }
+        else
+            status = factorize_one(&f, n, table);
+        spf_table_unborrow(table); /* before anything that might call back into Python */
+        if (status != FACTORIZE_OK)
+          {
+            set_factorize_error(status);
+            break;
+          } /*if*/
+        result =
+            compact ?
+                factorization_to_object(get_module_state(self), &f)
+            :
+                factorization_to_tuple(&f);
+        if (partial)
+            result = factors_and_cofactor(result, PyLong_FromLong(1)); /* always finished */
+      }
+    while (false);
+    return
+        result;
+  } /*discipline_factorize*/
+
+static void async_complete
+  (
+    struct async_request * req
+  )
+  /* completes the future for a finished request, unless it has been
+    cancelled. Leaves no exception set. */
+  {
+    PyObject * value = NULL;
+    PyObject * done = NULL;
+    PyObject * outcome = NULL;
+    do /*once*/
+      {
+        done = PyObject_CallMethod(req->future, "done", NULL);
+        if (done == NULL or PyObject_IsTrue(done))
+            break; /* cancelled, most likely */
+        if (not req->ok)
+            PyErr_NoMemory();
+        else if (req->rest.nr_factors != 0)
+            PyErr_SetString(PyExc_RuntimeError, "factorization abandoned at shutdown");
+        else if (req->len == 0)
+          {
+            if (req->status != FACTORIZE_OK)
+                set_factorize_error(req->status);
+            else
+                value = factorization_to_tuple(&req->f);
+          }
+        else
+          {
+            const enum factorize_status status = mp_factorization_status(&req->mf);
+            if (status != FACTORIZE_OK)
+                set_factorize_error(status);
+            else
+                value = mp_factorization_to_tuple(&req->mf);
+          } /*if*/
+        if (value != NULL)
+            outcome = PyObject_CallMethod(req->future, "set_result", "(O)", value);
+        else
+          {
+            PyObject * type, * exc, * traceback;
+            PyErr_Fetch(&type, &exc, &traceback);
+            PyErr_NormalizeException(&type, &exc, &traceback);
+            outcome = PyObject_CallMethod(req->future, "set_exception", "(O)", exc);
+            Py_XDECREF(type);
+            Py_XDECREF(exc);
+            Py_XDECREF(traceback);
+          } /*if*/
+      }
+    while (false);
+    PyErr_Clear(); /* e.g. if the loop has since been closed, nothing more I can do */
+    Py_XDECREF(value);
+    Py_XDECREF(done);
+    Py_XDECREF(outcome);
+  } /*async_complete*/
+
+static PyObject * async_ready
+  (
+    PyObject * self,
+    PyObject * unused
+  )
+  /* called by the event loop when the module’s async channel’s eventfd
+    becomes readable. */
+  {
+    struct module_state * const state = get_module_state(self);
+    struct async_request * done;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    done = state->async != NULL ? async_take_done(state->async) : NULL;
+    Py_END_CRITICAL_SECTION();
+    for (;;)
+      {
+        if (done == NULL)
+            break;
+        struct async_request * const req = done;
+        done = req->next;
+        async_complete(req);
+        async_request_dispose(req);
+      } /*for*/
+    Py_INCREF(Py_None);
+    return
+        Py_None;
+  } /*async_ready*/
+
+static PyMethodDef async_ready_def =
+    {"_async_ready", async_ready, METH_NOARGS, "delivers finished factorize_async() results."};
+
+static bool async_bind
+  (
+    PyObject * modu,
+    PyObject * loop
+  )
+  /* makes sure the pool is running, and the module has an async channel
+    with its eventfd registered with loop. The eventfd can only be
+    registered with one loop at a time; it moves to a new one if the
+    previous one is no longer running. Returns false, with a Python
+    exception set, on failure. Must be called in a critical section on
+    modu, since other threads can be calling factorize_async() too. */
+  {
+    bool ok = false;
+    struct module_state * const state = get_module_state(modu);
+    PyObject * running = NULL;
+    PyObject * outcome = NULL;
+    do /*once*/
+      {
+        if
+          (
+                state->async != NULL
+            and
+                state->async->generation != atomic_load(&async_fork_generation)
+          )
+          {
+          /* inherited from parent across fork(), can’t use it; any requests
+            left in it are lost */
+            close(state->async->efd);
+            state->async = NULL;
+            Py_CLEAR(state->async_loop);
+          } /*if*/
+        if (state->async != NULL and loop == state->async_loop)
+          {
+            ok = true;
+            break;
+          } /*if*/
+        if (not pool_start())
+          {
+            PyErr_SetString(PyExc_RuntimeError, "cannot start factorize_async threads");
+            break;
+          } /*if*/
+        if (state->async == NULL)
+          {
+            state->async = async_channel_new();
+            if (state->async == NULL)
+                break;
+          } /*if*/
+        if (state->async_callback == NULL)
+          {
+            state->async_callback = PyCFunction_New(&async_ready_def, modu);
+            if (state->async_callback == NULL)
+                break;
+          } /*if*/
+        if (state->async_loop != NULL)
+          {
+            running = PyObject_CallMethod(state->async_loop, "is_running", NULL);
+            if (running == NULL)
+                break;
+            if (PyObject_IsTrue(running))
+              {
+                PyErr_SetString
+                  (
+                    PyExc_RuntimeError,
+                    "factorize_async is in use by another running event loop"
+                  );
+                break;
+              } /*if*/
+            outcome = PyObject_CallMethod(state->async_loop, "remove_reader", "i", state->async->efd);
+            PyErr_Clear(); /* don’t care if it’s already closed */
+            Py_CLEAR(outcome);
+            Py_CLEAR(state->async_loop);
+          } /*if*/
+        outcome =
+            PyObject_CallMethod(loop, "add_reader", "iO", state->async->efd, state->async_callback);
+        if (outcome == NULL)
+            break;
+        Py_INCREF(loop);
+        state->async_loop = loop;
+        ok = true;
+      }
+    while (false);
+    Py_XDECREF(running);
+    Py_XDECREF(outcome);
+    return
+        ok;
+  } /*async_bind*/
+
+static PyObject * discipline_factorize_async
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    PyObject * asyncio = NULL;
+    PyObject * loop = NULL;
+    struct async_request * req = NULL;
+    do /*once*/
+      {
+        br_PyObject * nobj;
+        if (not PyArg_ParseTuple(args, "O", &nobj))
+            break;
+        req = malloc(sizeof(struct async_request));
+        if (req == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        req->channel = NULL;
+        req->future = NULL;
+        req->table = NULL;
+        req->limbs = NULL;
+        req->len = 0;
+        req->mf = (struct mp_factorization)MP_FACTORIZATION_INIT;
+        req->rest = (struct mp_factorization)MP_FACTORIZATION_INIT;
+        req->n = PyLong_AsUnsignedLongLong(nobj);
+        if (PyErr_Occurred())
+          {
+            if (not PyLong_Check(nobj) or not PyErr_ExceptionMatches(PyExc_OverflowError))
+                break;
+          /* too big (or negative, which get_mp will complain about) */
+            PyErr_Clear();
+            if (not get_mp(nobj, &req->limbs, &req->len))
+                break;
+          }
+        else
+            req->table = spf_table_acquire(req->n);
+        asyncio = PyImport_ImportModule("asyncio");
+        if (asyncio == NULL)
+            break;
+        loop = PyObject_CallMethod(asyncio, "get_running_loop", NULL);
+        if (loop == NULL)
+            break;
+        bool bound;
+        Py_BEGIN_CRITICAL_SECTION(self);
+        bound = async_bind(self, loop);
+        if (bound)
+          {
+            req->channel = get_module_state(self)->async;
+            atomic_fetch_add(&req->channel->refs, 1);
+          } /*if*/
+        Py_END_CRITICAL_SECTION();
+        if (not bound)
+            break;
+        req->future = PyObject_CallMethod(loop, "create_future", NULL);
+        if (req->future == NULL)
+            break;
+        if (not async_submit(req))
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        Py_INCREF(req->future);
+        result = req->future;
+        req = NULL; /* ownership has passed */
+      }
+    while (false);
+    async_request_dispose(req);
+    Py_XDECREF(loop);
+    Py_XDECREF(asyncio);
+    return
+        result;
+  } /*discipline_factorize_async*/
+
+static PyObject * discipline_ifactorize
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    uint64_t * n = NULL;
+    do /*once*/
+      {
+        br_PyObject * nobj;
+        if (not PyArg_ParseTuple(args, "O!", &PyLong_Type, &nobj))
+            break;
+        size_t len = 0;
+        if (not get_mp(nobj, &n, &len))
+            break;
+        if (len == 0 or len == 1 and n[0] < 2)
+          {
+            set_factorize_error(FACTORIZE_TOO_SMALL);
+            break;
+          } /*if*/
+        FactorIteratorObject * const iter =
+            PyObject_New(FactorIteratorObject, get_module_state(self)->FactorIterator_type);
+        if (iter == NULL)
+            break;
+        ifactorizer_init(&iter->it, n, len);
+        n = NULL; /* ownership has passed */
+        iter->busy = false;
+        iter->finished = false;
+        result = (PyObject *)iter;
+      }
+    while (false);
+    free(n);
+    return
+        result;
+  } /*discipline_ifactorize*/
+
+static bool is_uint64_format
+  (
+    const char * format
+  )
+  /* is format a struct-module format code for a native-order unsigned 64-bit integer? */
+  {
+    if (format == NULL)
+        format = "B"; /* as per buffer protocol */
+    if (*format == '@' or *format == '=')
+        ++format;
+    return
+            strcmp(format, "Q") == 0
+        or
+            strcmp(format, "L") == 0 and sizeof(unsigned long) == sizeof(uint64_t);
+  } /*is_uint64_format*/
+
+static bool is_uint8_format
+  (
+    const char * format
+  )
+  /* is format a struct-module format code for an unsigned byte? */
+  {
+    if (format == NULL)
+        format = "B"; /* as per buffer protocol */
+    if (*format == '@' or *format == '=')
+        ++format;
+    return
+        strcmp(format, "B") == 0;
+  } /*is_uint8_format*/
+
+static bool is_int8_format
+  (
+    const char * format
+  )
+  /* is format a struct-module format code for a signed byte? */
+  {
+    if (format == NULL)
+        return
+            false; /* default is unsigned */
+    if (*format == '@' or *format == '=')
+        ++format;
+    return
+        strcmp(format, "b") == 0;
+  } /*is_int8_format*/
+
+static void get_output_buffer
+  (
+    PyObject * obj,
+    Py_buffer * view,
+    bool wide, /* uint64 if true, else uint8 */
+    const char * what
+  )
+  /* gets a writable contiguous buffer of the appropriate element type from
+    obj, which must later be released with PyBuffer_Release regardless of
+    errors. */
+  {
+    do /*once*/
+      {
+        if (PyObject_GetBuffer(obj, view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+            break;
+        if
+          (
+            wide ?
+                view->itemsize != sizeof(uint64_t) or not is_uint64_format(view->format)
+            :
+                view->itemsize != sizeof(uint8_t) or not is_uint8_format(view->format)
+          )
+          {
+            PyErr_Format
+              (
+                PyExc_TypeError,
+                "%s buffer must contain unsigned %s integers",
+                what,
+                wide ? "64-bit" : "8-bit"
+              );
+            break;
+          } /*if*/
+      }
+    while (false);
+  } /*get_output_buffer*/
+
+struct batch_input
+  /* the values to be factorized by a batch call */
+  {
+    const uint64_t * values;
+    size_t nr_values;
+    Py_buffer view; /* if values come from a buffer */
+    uint64_t * converted; /* if values come from a sequence */
+  };
+#define BATCH_INPUT_INIT {.values = NULL, .view = {.obj = NULL}, .converted = NULL}
+
+static void get_batch_input
+  (
+    PyObject * obj,
+    struct batch_input * input
+  )
+  /* fills in input from obj, which may either be a buffer of uint64
+    values or an iterable of Python ints. Caller must dispose of input
+    with release_batch_input, regardless of errors. */
+  {
+    PyObject * seq = NULL;
+    do /*once*/
+      {
+        if (PyObject_CheckBuffer(obj))
+          {
+            if (PyObject_GetBuffer(obj, &input->view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+                break;
+            if (input->view.itemsize != sizeof(uint64_t) or not is_uint64_format(input->view.format))
+              {
+                PyErr_SetString(PyExc_TypeError, "buffer must contain unsigned 64-bit integers");
+                break;
+              } /*if*/
+            input->values = input->view.buf;
+            input->nr_values = input->view.len / sizeof(uint64_t);
+          }
+        else
+          {
+            seq = sequence_fast(obj, "expecting a buffer or an iterable of ints");
+            if (seq == NULL)
+                break;
+            const Py_ssize_t nr_items = PySequence_Fast_GET_SIZE(seq);
+            input->converted = malloc(nr_items * sizeof(uint64_t) + 1); /* avoid malloc(0) */
+            if (input->converted == NULL)
+              {
+                PyErr_NoMemory();
+                break;
+              } /*if*/
+            for (Py_ssize_t i = 0;;)
+              {
+                if (i == nr_items)
+                    break;
+                input->converted[i] = PyLong_AsUnsignedLongLong(PySequence_Fast_GET_ITEM(seq, i));
+                if (PyErr_Occurred())
+                    break;
+                ++i;
+              } /*for*/
+            if (PyErr_Occurred())
+                break;
+            input->values = input->converted;
+            input->nr_values = nr_items;
+          } /*if*/
+      }
+    while (false);
+    Py_XDECREF(seq);
+  } /*get_batch_input*/
+
+static uint64_t batch_min_value
+  (
+    const struct batch_input * input
+  )
+  /* for deciding whether the smallest-prime-factor table will be of any use. */
+  {
+    uint64_t result = UINT64_MAX;
+    for (size_t i = 0;;)
+      {
+        if (i == input->nr_values)
+            break;
+        if (input->values[i] < result)
+            result = input->values[i];
+        ++i;
+      } /*for*/
+    return
+        result;
+  } /*batch_min_value*/
+
+static void release_batch_input
+  (
+    struct batch_input * input
+  )
+  {
+    PyBuffer_Release(&input->view); /* noop if no buffer */
+    free(input->converted);
+    input->converted = NULL;
+    input->values = NULL;
+  } /*release_batch_input*/
+
+static PyObject * discipline_factorize_many
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    static const char * const keywords[] = {"", "threads", "compact", NULL};
+    const size_t block_size = 16384;
+      /* nr of values factorized between reacquisitions of the GIL, to
+        bound the memory taken by intermediate results */
+    PyObject * result = NULL;
+    PyObject * results = NULL;
+    PyObject * statuses = NULL;
+    struct batch_input input = BATCH_INPUT_INIT;
+    struct factorization * block = NULL;
+    struct spf_table * table = NULL;
+    do /*once*/
+      {
+        br_PyObject * valuesobj;
+        Py_ssize_t nr_threads = 0;
+        int compact = false;
+        if
+          (
+            not PyArg_ParseTupleAndKeywords
+              (
+                args, kwargs, "O|$np", (char **)keywords,
+                &valuesobj, &nr_threads, &compact
+              )
+          )
+            break;
+        if (nr_threads < 0)
+          {
+            PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+            break;
+          } /*if*/
+        if (nr_threads == 0)
+            nr_threads = default_nr_threads();
+        else if (nr_threads > MAX_BATCH_THREADS)
+            nr_threads = MAX_BATCH_THREADS;
+        get_batch_input(valuesobj, &input);
+        if (PyErr_Occurred())
+            break;
+        table = spf_table_acquire(batch_min_value(&input));
+        results = PyTuple_New(input.nr_values);
+        if (results == NULL)
+            break;
+        statuses = PyBytes_FromStringAndSize(NULL, input.nr_values);
+        if (statuses == NULL)
+            break;
+        block = malloc(block_size * sizeof(struct factorization));
+        if (block == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        uint8_t * const status_codes = (uint8_t *)PyBytes_AS_STRING(statuses);
+        for (size_t block_start = 0;;)
+          {
+            if (block_start == input.nr_values)
+                break;
+            const size_t block_len =
+                input.nr_values - block_start > block_size ?
+                    block_size
+                :
+                    input.nr_values - block_start;
+            Py_BEGIN_ALLOW_THREADS
+            run_batch
+              (
+                input.values + block_start,
+                block,
+                status_codes + block_start,
+                block_len,
+                table,
+                nr_threads
+              );
+            Py_END_ALLOW_THREADS
+            for (size_t i = 0;;)
+              {
+                if (i == block_len)
+                    break;
+                PyObject * elt;
+                if (status_codes[block_start + i] == FACTORIZE_OK)
+                  {
+                    elt =
+                        compact ?
+                            factorization_to_object(get_module_state(self), &block[i])
+                        :
+                            factorization_to_tuple(&block[i]);
+                    if (elt == NULL)
+                        break;
+                  }
+                else
+                  {
+                    elt = Py_None;
+                    Py_INCREF(elt);
+                  } /*if*/
+                PyTuple_SET_ITEM(results, block_start + i, elt);
+                ++i;
+              } /*for*/
+            if (PyErr_Occurred())
+                break;
+            block_start += block_len;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+        result = PyTuple_Pack(2, results, statuses);
+      }
+    while (false);
+    free(block);
+    spf_table_release(table);
+    release_batch_input(&input);
+    Py_XDECREF(results);
+    Py_XDECREF(statuses);
+    return
+        result;
+  } /*discipline_factorize_many*/
+
+static PyObject * smooth_result
+  (
+    PyObject * factors, /* reference is stolen */
+    PyObject * cofactor, /* reference is stolen */
+    PyObject * unfactored, /* reference is stolen; ignored if not partial */
+    bool partial
+  )
+  /* returns the pair («factors», «cofactor») from factorize_smooth(), or
+    if partial, the triple («factors», «cofactor», «unfactored»). */
+  {
+    PyObject * result = NULL;
+    if (factors != NULL and cofactor != NULL and (unfactored != NULL or not partial))
+        result =
+            partial ?
+                PyTuple_Pack(3, factors, cofactor, unfactored)
+            :
+                PyTuple_Pack(2, factors, cofactor);
+    Py_XDECREF(factors);
+    Py_XDECREF(cofactor);
+    Py_XDECREF(unfactored);
+    return
+        result;
+  } /*smooth_result*/
+
+static bool get_smooth_bound
+  (
+    PyObject * boundobj,
+    uint64_t * bound
+  )
+  /* converts the bound argument to factorize_smooth() and
+    factorize_smooth_many(). Returns false, with a Python exception set, if
+    it is out of range. */
+  {
+    *bound = PyLong_AsUnsignedLongLong(boundobj);
+    if (PyErr_Occurred() and PyErr_ExceptionMatches(PyExc_OverflowError))
+      {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_ValueError, "bound must be in [0, 2**64 - 1]");
+      } /*if*/
+    return
+        not PyErr_Occurred();
+  } /*get_smooth_bound*/
+
+static PyObject * discipline_factorize_smooth
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    static const char * const keywords[] = {"", "", "deadline", "max_work", NULL};
+    PyObject * result = NULL;
+    uint64_t * n = NULL;
+    struct smooth_primes sp = {.allocated = NULL};
+    struct mp_factorization mf = MP_FACTORIZATION_INIT;
+    struct mp_factorization above = MP_FACTORIZATION_INIT;
+    struct mp_factorization rest = MP_FACTORIZATION_INIT;
+    do /*once*/
+      {
+        br_PyObject * nobj;
+        br_PyObject * boundobj;
+        br_PyObject * deadlineobj = Py_None;
+        br_PyObject * max_workobj = Py_None;
+        double deadline = 0;
+        uint64_t max_work = 0;
+        if
+          (
+            not PyArg_ParseTupleAndKeywords
+              (
+                args, kwargs, "O!O!|$OO", (char **)keywords,
+                &PyLong_Type, &nobj, &PyLong_Type, &boundobj, &deadlineobj, &max_workobj
+              )
+          )
+            break;
+        uint64_t bound;
+        if (not get_smooth_bound(boundobj, &bound))
+            break;
+        if (not get_work_limits(deadlineobj, max_workobj, &deadline, &max_work))
+            break;
+        const bool partial = deadlineobj != Py_None or max_workobj != Py_None;
+        size_t len = 0;
+        if (not get_mp(nobj, &n, &len))
+            break;
+        if (len == 0 or len == 1 and n[0] < 2)
+          {
+            set_factorize_error(FACTORIZE_TOO_SMALL);
+            break;
+          } /*if*/
+        bool ok;
+        if (len == 1)
+          {
+            struct factorization f;
+            uint64_t cofactor;
+            if (n[0] > (uint64_t)TRIAL_LIMIT * TRIAL_LIMIT and bound > TRIAL_LIMIT)
+              {
+              /* might need sieving and rho, so let other threads run meanwhile */
+                Py_BEGIN_ALLOW_THREADS
+                ok = smooth_primes_init(&sp, bound);
+                if (ok)
+                    cofactor = factorize_smooth_u64(&f, n[0], &sp);
+                Py_END_ALLOW_THREADS
+              }
+            else
+              {
+                ok = smooth_primes_init(&sp, bound);
+                if (ok)
+                    cofactor = factorize_smooth_u64(&f, n[0], &sp);
+              } /*if*/
+            if (not ok)
+              {
+                PyErr_NoMemory();
+                break;
+              } /*if*/
+            const enum factorize_status status = factorization_status(&f);
+            if (status != FACTORIZE_OK)
+              {
+                set_factorize_error(status);
+                break;
+              } /*if*/
+            result = smooth_result
+              (
+                factorization_to_tuple(&f),
+                PyLong_FromUnsignedLongLong(cofactor),
+                partial ? PyLong_FromLong(1) : NULL, /* always finished */
+                partial
+              );
+            break;
+          } /*if*/
+      /* could take a long time, so let other threads run meanwhile, but
+        still keep an eye out for signals */
+        struct work_limit limit;
+        work_limit_init(&limit, deadline, max_work);
+        limit.tstate = PyEval_SaveThread();
+        ok =
+                smooth_primes_init(&sp, bound)
+            and
+                factorize_smooth_mp(&mf, &above, &rest, n, len, &sp, &limit);
+        PyEval_RestoreThread(limit.tstate);
+        if (atomic_load(&limit.stop) == WORK_INTERRUPTED)
+            break; /* exception already set */
+        if (not ok)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        const enum factorize_status status = mp_factorization_status(&mf);
+        if (status != FACTORIZE_OK)
+          {
+            set_factorize_error(status);
+            break;
+          } /*if*/
+        result = smooth_result
+          (
+            mp_factorization_to_tuple(&mf),
+            mp_factorization_product(&above),
+            partial ? mp_factorization_product(&rest) : NULL,
+            partial
+          );
+      }
+    while (false);
+    mp_factorization_dispose(&mf);
+    mp_factorization_dispose(&above);
+    mp_factorization_dispose(&rest);
+    smooth_primes_dispose(&sp);
+    free(n);
+    return
+        result;
+  } /*discipline_factorize_smooth*/
+
+static PyObject * discipline_factorize_smooth_many
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    static const char * const keywords[] = {"", "", "threads", NULL};
+    const size_t block_size = 16384;
+      /* nr of values factorized between reacquisitions of the GIL, to
+        bound the memory taken by intermediate results */
+    PyObject * result = NULL;
+    PyObject * results = NULL;
+    PyObject * statuses = NULL;
+    struct batch_input input = BATCH_INPUT_INIT;
+    struct factorization * block = NULL;
+    uint64_t * cofactors = NULL;
+    struct smooth_primes sp = {.allocated = NULL};
+    do /*once*/
+      {
+        br_PyObject * valuesobj;
+        br_PyObject * boundobj;
+        Py_ssize_t nr_threads = 0;
+        if
+          (
+            not PyArg_ParseTupleAndKeywords
+              (
+                args, kwargs, "OO!|$n", (char **)keywords,
+                &valuesobj, &PyLong_Type, &boundobj, &nr_threads
+              )
+          )
+            break;
+        uint64_t bound;
+        if (not get_smooth_bound(boundobj, &bound))
+            break;
+        if (nr_threads < 0)
+          {
+            PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+            break;
+          } /*if*/
+        if (nr_threads == 0)
+            nr_threads = default_nr_threads();
+        else if (nr_threads > MAX_BATCH_THREADS)
+            nr_threads = MAX_BATCH_THREADS;
+        get_batch_input(valuesobj, &input);
+        if (PyErr_Occurred())
+            break;
+        results = PyTuple_New(input.nr_values);
+        if (results == NULL)
+            break;
+        statuses = PyBytes_FromStringAndSize(NULL, input.nr_values);
+        if (statuses == NULL)
+            break;
+        block = malloc(block_size * sizeof(struct factorization));
+        cofactors = malloc(block_size * sizeof(uint64_t));
+        if (block == NULL or cofactors == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        bool ok;
+        Py_BEGIN_ALLOW_THREADS
+        ok = smooth_primes_init(&sp, bound);
+        Py_END_ALLOW_THREADS
+        if (not ok)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        uint8_t * const status_codes = (uint8_t *)PyBytes_AS_STRING(statuses);
+        for (size_t block_start = 0;;)
+          {
+            if (block_start == input.nr_values)
+                break;
+            const size_t block_len =
+                input.nr_values - block_start > block_size ?
+                    block_size
+                :
+                    input.nr_values - block_start;
+            struct chunk_plan plan;
+            struct smooth_job job =
+                {
+                    .values = input.values + block_start,
+                    .results = block,
+                    .cofactors = cofactors,
+                    .statuses = status_codes + block_start,
+                    .plan = &plan,
+                    .sp = &sp,
+                };
+            atomic_init(&job.next_chunk, 0);
+            Py_BEGIN_ALLOW_THREADS
+            chunk_plan_init(&plan, job.values, block_len, BATCH_MAX_CHUNK, nr_threads);
+            run_workers(smooth_worker, &job, threads_for(plan.nr_chunks, 1, nr_threads));
+            chunk_plan_dispose(&plan);
+            Py_END_ALLOW_THREADS
+            for (size_t i = 0;;)
+              {
+                if (i == block_len)
+                    break;
+                PyObject * elt;
+                if (status_codes[block_start + i] == FACTORIZE_OK)
+                  {
+                    elt =
+                        factors_and_cofactor
+                          (
+                            factorization_to_tuple(&block[i]),
+                            PyLong_FromUnsignedLongLong(cofactors[i])
+                          );
+                    if (elt == NULL)
+                        break;
+                  }
+                else
+                  {
+                    elt = Py_None;
+                    Py_INCREF(elt);
+                  } /*if*/
+                PyTuple_SET_ITEM(results, block_start + i, elt);
+                ++i;
+              } /*for*/
+            if (PyErr_Occurred())
+                break;
+            block_start += block_len;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+        result = PyTuple_Pack(2, results, statuses);
+      }
+    while (false);
+    smooth_primes_dispose(&sp);
+    free(block);
+    free(cofactors);
+    release_batch_input(&input);
+    Py_XDECREF(results);
+    Py_XDECREF(statuses);
+    return
+        result;
+  } /*discipline_factorize_smooth_many*/
+
+static PyObject * discipline_factorize_csr
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    static const char * const keywords[] =
+        {"", "offsets", "primes", "exponents", "statuses", "threads", NULL};
+    PyObject * result = NULL;
+    struct batch_input input = BATCH_INPUT_INIT;
+    Py_buffer offsets = {.obj = NULL};
+    Py_buffer primes = {.obj = NULL};
+    Py_buffer exponents = {.obj = NULL};
+    Py_buffer statuses = {.obj = NULL};
+    atomic_uint_fast64_t * chunk_ends = NULL;
+    struct chunk_plan plan = {.bounds = NULL};
+    struct spf_table * table = NULL;
+    do /*once*/
+      {
+        br_PyObject * valuesobj;
+        br_PyObject * offsetsobj = Py_None;
+        br_PyObject * primesobj = Py_None;
+        br_PyObject * exponentsobj = Py_None;
+        br_PyObject * statusesobj = Py_None;
+        Py_ssize_t nr_threads = 0;
+        if
+          (
+            not PyArg_ParseTupleAndKeywords
+              (
+                args, kwargs, "O|OOO$On", (char **)keywords,
+                &valuesobj, &offsetsobj, &primesobj, &exponentsobj,
+                &statusesobj, &nr_threads
+              )
+          )
+            break;
+        const bool counting = offsetsobj == Py_None;
+        if (counting != (primesobj == Py_None) or counting != (exponentsobj == Py_None))
+          {
+            PyErr_SetString
+              (
+                PyExc_TypeError,
+                "specify all or none of offsets, primes and exponents"
+              );
+            break;
+          } /*if*/
+        if (nr_threads < 0)
+          {
+            PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+            break;
+          } /*if*/
+        if (nr_threads == 0)
+            nr_threads = default_nr_threads();
+        else if (nr_threads > MAX_BATCH_THREADS)
+            nr_threads = MAX_BATCH_THREADS;
+        get_batch_input(valuesobj, &input);
+        if (PyErr_Occurred())
+            break;
+        if (not counting)
+          {
+            get_output_buffer(offsetsobj, &offsets, true, "offsets");
+            if (PyErr_Occurred())
+                break;
+            get_output_buffer(primesobj, &primes, true, "primes");
+            if (PyErr_Occurred())
+                break;
+            get_output_buffer(exponentsobj, &exponents, false, "exponents");
+            if (PyErr_Occurred())
+                break;
+            if ((size_t)offsets.len / sizeof(uint64_t) < input.nr_values + 1)
+              {
+                PyErr_Format
+                  (
+                    PyExc_ValueError,
+                    "offsets buffer needs room for %zu entries",
+                    input.nr_values + 1
+                  );
+                break;
+              } /*if*/
+          } /*if*/
+        if (statusesobj != Py_None)
+          {
+            get_output_buffer(statusesobj, &statuses, false, "statuses");
+            if (PyErr_Occurred())
+                break;
+            if ((size_t)statuses.len < input.nr_values)
+              {
+                PyErr_Format
+                  (
+                    PyExc_ValueError,
+                    "statuses buffer needs room for %zu entries",
+                    input.nr_values
+                  );
+                break;
+              } /*if*/
+          } /*if*/
+        table = spf_table_acquire(batch_min_value(&input));
+        struct csr_job job =
+            {
+                .values = input.values,
+                .nr_values = input.nr_values,
+                .offsets = counting ? NULL : offsets.buf,
+                .primes = counting ? NULL : primes.buf,
+                .exponents = counting ? NULL : exponents.buf,
+                .max_factors =
+                    counting ?
+                        0
+                    : primes.len / sizeof(uint64_t) < (size_t)exponents.len ?
+                        primes.len / sizeof(uint64_t)
+                    :
+                        exponents.len,
+                .statuses = statuses.buf,
+                .table = table,
+                .plan = &plan,
+            };
+        atomic_init(&job.next_chunk, 0);
+        atomic_init(&job.nr_factors, 0);
+        atomic_init(&job.first_failure, SIZE_MAX);
+        chunk_plan_init(&plan, input.values, input.nr_values, CSR_CHUNK, nr_threads);
+        chunk_ends = calloc(plan.nr_chunks + 1, sizeof(atomic_uint_fast64_t));
+        if (chunk_ends == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        job.chunk_ends = chunk_ends;
+        if (input.nr_values == 0 and not counting)
+            job.offsets[0] = 0;
+        Py_BEGIN_ALLOW_THREADS
+        run_workers(csr_worker, &job, threads_for(plan.nr_chunks, 1, nr_threads));
+        Py_END_ALLOW_THREADS
+        const size_t first_failure = atomic_load(&job.first_failure);
+        if (statuses.obj == NULL and first_failure != SIZE_MAX)
+          {
+          /* caller isn’t collecting statuses, so tell them the bad news the usual way */
+            struct factorization f;
+            set_factorize_error(factorize_one(&f, input.values[first_failure], table));
+            break;
+          } /*if*/
+        const uint64_t nr_factors =
+            counting ?
+                atomic_load(&job.nr_factors)
+            : plan.nr_chunks != 0 ?
+                atomic_load(&chunk_ends[plan.nr_chunks - 1]) - 1
+            :
+                0;
+        if (counting)
+            result = Py_BuildValue("(nK)", input.nr_values + 1, (unsigned long long)nr_factors);
+        else if (nr_factors > job.max_factors)
+          {
+            PyErr_Format
+              (
+                PyExc_ValueError,
+                "primes and exponents buffers need room for %llu entries",
+                (unsigned long long)nr_factors
+              );
+            break;
+          }
+        else
+            result = PyLong_FromUnsignedLongLong(nr_factors);
+      }
+    while (false);
+    free(chunk_ends);
+    chunk_plan_dispose(&plan);
+    spf_table_release(table);
+    PyBuffer_Release(&offsets);
+    PyBuffer_Release(&primes);
+    PyBuffer_Release(&exponents);
+    PyBuffer_Release(&statuses);
+    release_batch_input(&input);
+    return
+        result;
+  } /*discipline_factorize_csr*/
+
+static PyObject * discipline_set_spf_limit
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    do /*once*/
+      {
+        unsigned long long limit;
+        if (not PyArg_ParseTuple(args, "K", &limit))
+            break;
+        if (limit > SPF_MAX_LIMIT)
+          {
+            PyErr_Format(PyExc_ValueError, "limit must not exceed %llu", (unsigned long long)SPF_MAX_LIMIT);
+            break;
+          } /*if*/
+        pthread_mutex_lock(&spf_state.lock);
+        if (limit != spf_state.limit)
+          {
+            spf_table_retire(atomic_exchange(&spf_state.table, NULL));
+            spf_state.limit = limit;
+            if (spf_state.filename == NULL)
+                atomic_store(&spf_state.wanted_below, limit);
+            ++spf_state.generation;
+          } /*if*/
+        pthread_mutex_unlock(&spf_state.lock);
+      /* any batches still using the old table keep their own references to it */
+        spf_reclaim();
+      /* all done */
+        result = Py_None;
+        Py_INCREF(result);
+      }
+    while (false);
+    return
+        result;
+  } /*discipline_set_spf_limit*/
+
+static PyObject * discipline_spf_table_info
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    pthread_mutex_lock(&spf_state.lock);
+    const struct spf_table * const table = atomic_load(&spf_state.table);
+    PyObject * const result =
+        Py_BuildValue
+          (
+            "{sKsOsssnsdszsz}",
+            "limit", (unsigned long long)(table != NULL ? table->limit : spf_state.limit),
+            "built", table != NULL ? Py_True : Py_False,
+            "source",
+                table == NULL ?
+                    "none"
+                : table->mapped ?
+                    "file"
+                :
+                    "memory",
+            "size", table != NULL ? (Py_ssize_t)table->storage_size : (Py_ssize_t)0,
+            "load_time", table != NULL ? table->load_time : 0.0,
+            "file", spf_state.filename,
+            "file_error", spf_state.file_error
+          );
+    pthread_mutex_unlock(&spf_state.lock);
+    return
+        result;
+  } /*discipline_spf_table_info*/
+
+static PyObject * discipline_set_spf_table_file
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    PyObject * filename = NULL;
+    char * newname = NULL;
+    do /*once*/
+      {
+        br_PyObject * arg;
+        if (not PyArg_ParseTuple(args, "O", &arg))
+            break;
+        if (arg != Py_None)
+          {
+            if (not PyUnicode_FSConverter(arg, &filename))
+                break;
+            newname = strdup(PyBytes_AS_STRING(filename));
+            if (newname == NULL)
+              {
+                PyErr_NoMemory();
+                break;
+              } /*if*/
+          } /*if*/
+        pthread_mutex_lock(&spf_state.lock);
+        free(spf_state.filename);
+        spf_state.filename = newname;
+        newname = NULL; /* ownership has passed to spf_state */
+        free(spf_state.file_error);
+        spf_state.file_error = NULL;
+      /* next use of table will try the new file */
+        spf_table_retire(atomic_exchange(&spf_state.table, NULL));
+        atomic_store(&spf_state.wanted_below, spf_state.filename != NULL ? UINT64_MAX : spf_state.limit);
+        ++spf_state.generation;
+        pthread_mutex_unlock(&spf_state.lock);
+        spf_reclaim();
+      /* all done */
+        result = Py_None;
+        Py_INCREF(result);
+      }
+    while (false);
+    free(newname);
+    Py_XDECREF(filename);
+    return
+        result;
+  } /*discipline_set_spf_table_file*/
+
+static PyObject * discipline_spf_table_save
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    PyObject * filename = NULL;
+    char * tempname = NULL;
+    bool made_temp = false; /* tempname exists and needs cleaning up on failure */
+    struct spf_table * table = NULL;
+    int fd = -1;
+    do /*once*/
+      {
+        pthread_mutex_lock(&spf_state.lock);
+        unsigned long long limit = spf_state.limit;
+        pthread_mutex_unlock(&spf_state.lock);
+        if (not PyArg_ParseTuple(args, "O&|K", PyUnicode_FSConverter, &filename, &limit))
+            break;
+        if (limit > SPF_MAX_LIMIT)
+          {
+            PyErr_Format(PyExc_ValueError, "limit must not exceed %llu", (unsigned long long)SPF_MAX_LIMIT);
+            break;
+          } /*if*/
+      /* write to a temporary file first, then rename it into place, so that
+        any process mapping the file never sees a partly-written one. The
+        temporary name must be unique, since other threads or processes
+        could be saving to the same place at the same time. */
+        static const char tempsuffix[] = ".XXXXXX";
+        tempname = malloc(PyBytes_GET_SIZE(filename) + sizeof tempsuffix);
+        if (tempname == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        memcpy(tempname, PyBytes_AS_STRING(filename), PyBytes_GET_SIZE(filename));
+        memcpy(tempname + PyBytes_GET_SIZE(filename), tempsuffix, sizeof tempsuffix);
+        int err = 0;
+        Py_BEGIN_ALLOW_THREADS
+        do /*once*/
+          {
+            table = spf_table_build(limit);
+            if (table == NULL)
+              {
+                err = ENOMEM;
+                break;
+              } /*if*/
+            fd = mkostemp(tempname, O_CLOEXEC);
+            if (fd < 0)
+              {
+                err = errno;
+                break;
+              } /*if*/
+            made_temp = true;
+            if (fchmod(fd, 0644) != 0)
+              {
+              /* mkostemp makes it private, but the point is to share it */
+                err = errno;
+                break;
+              } /*if*/
+            for (size_t done = 0;;)
+              {
+                if (done == table->storage_size)
+                    break;
+                const ssize_t written =
+                    write(fd, (const uint8_t *)table->storage + done, table->storage_size - done);
+                if (written < 0)
+                  {
+                    err = errno;
+                    break;
+                  } /*if*/
+                done += written;
+              } /*for*/
+            if (err != 0)
+                break;
+            if (fsync(fd) != 0)
+              {
+                err = errno;
+                break;
+              } /*if*/
+          }
+        while (false);
+        Py_END_ALLOW_THREADS
+        if (err == ENOMEM and table == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        if (err != 0)
+          {
+            errno = err;
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, tempname);
+            break;
+          } /*if*/
+        if (close(fd) != 0)
+          {
+            fd = -1; /* gone anyway */
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, tempname);
+            break;
+          } /*if*/
+        fd = -1;
+        if (rename(tempname, PyBytes_AS_STRING(filename)) != 0)
+          {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(filename));
+            break;
+          } /*if*/
+        made_temp = false; /* successfully renamed, nothing to clean up */
+      /* all done */
+        result = Py_None;
+        Py_INCREF(result);
+      }
+    while (false);
+    close_fd(fd);
+    if (made_temp)
+        unlink(tempname); /* don’t leave partial file lying around */
+    spf_table_dispose(table);
+    free(tempname);
+    Py_XDECREF(filename);
+    return
+        result;
+  } /*discipline_spf_table_save*/
+
+static PyObject * discipline_set_cache_size
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    do /*once*/
+      {
+        unsigned long long maxsize;
+        if (not PyArg_ParseTuple(args, "K", &maxsize))
+            break;
+        if (maxsize > CACHE_MAX_SIZE)
+          {
+            PyErr_Format(PyExc_ValueError, "maxsize must not exceed %llu", (unsigned long long)CACHE_MAX_SIZE);
+            break;
+          } /*if*/
+        if (maxsize != atomic_load(&factor_cache.maxsize))
+          {
+            Py_BEGIN_ALLOW_THREADS /* in case batch workers are holding shard locks */
+            cache_reset(maxsize, true);
+            Py_END_ALLOW_THREADS
+          } /*if*/
+      /* all done */
+        result = Py_None;
+        Py_INCREF(result);
+      }
+    while (false);
+    return
+        result;
+  } /*discipline_set_cache_size*/
+
+static PyStructSequence_Field cache_info_fields[] =
+  {
+    {"hits", "nr of lookups that found their value in the cache"},
+    {"misses", "nr of lookups that didn’t"},
+    {"maxsize", "max nr of entries, 0 if the cache is disabled"},
+    {"currsize", "nr of entries currently in the cache"},
+    {NULL},
+  };
+
+static PyStructSequence_Desc cache_info_desc =
+  {
+    .name = "discipline.CacheInfo",
+    .doc = "statistics about the factorization cache, as returned by cache_info().",
+    .fields = cache_info_fields,
+    .n_in_sequence = 4,
+  };
+
+static PyObject * discipline_cache_info
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    uint64_t hits = 0, misses = 0;
+    size_t currsize = 0, maxsize;
+    Py_BEGIN_ALLOW_THREADS
+  /* keep out resets meanwhile, so the shards are all seen at the same size */
+    pthread_mutex_lock(&factor_cache.reset_lock);
+    maxsize = atomic_load(&factor_cache.maxsize);
+    for (unsigned int i = 0;;)
+      {
+        if (i == CACHE_SHARDS)
+            break;
+        struct cache_shard * const shard = &factor_cache.shards[i];
+        pthread_mutex_lock(&shard->lock);
+        hits += shard->hits;
+        misses += shard->misses;
+        currsize += shard->nr_slots;
+        pthread_mutex_unlock(&shard->lock);
+        ++i;
+      } /*for*/
+    pthread_mutex_unlock(&factor_cache.reset_lock);
+    Py_END_ALLOW_THREADS
+    PyObject * result = PyStructSequence_New(get_module_state(self)->CacheInfo_type);
+    if (result != NULL)
+      {
+        const uint64_t values[] = {hits, misses, maxsize, currsize};
+        for (unsigned int i = 0;;)
+          {
+            if (i == 4)
+                break;
+            PyObject * const value = PyLong_FromUnsignedLongLong(values[i]);
+            if (value == NULL)
+              {
+                Py_CLEAR(result);
+                break;
+              } /*if*/
+            PyStructSequence_SET_ITEM(result, i, value);
+            ++i;
+          } /*for*/
+      } /*if*/
+    return
+        result;
+  } /*discipline_cache_info*/
+
+static PyObject * discipline_cache_clear
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    Py_BEGIN_ALLOW_THREADS
+    cache_reset(CACHE_SAME_SIZE, false);
+    Py_END_ALLOW_THREADS
+    Py_INCREF(Py_None);
+    return
+        Py_None;
+  } /*discipline_cache_clear*/
+
+static PyObject * discipline_trial_kernels
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    PyObject * available = NULL;
+    do /*once*/
+      {
+        available = PyList_New(0);
+        if (available == NULL)
+            break;
+        for (const struct trial_kernel_entry * e = trial_kernels;;)
+          {
+            if (e->name == NULL)
+                break;
+            if (e->supported())
+              {
+                PyObject * const name = PyUnicode_FromString(e->name);
+                if (name == NULL)
+                    break;
+                const int status = PyList_Append(available, name);
+                Py_DECREF(name);
+                if (status < 0)
+                    break;
+              } /*if*/
+            ++e;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+        result = Py_BuildValue("(sN)", atomic_load(&trial_kernel)->name, PyList_AsTuple(available));
+      }
+    while (false);
+    Py_XDECREF(available);
+    return
+        result;
+  } /*discipline_trial_kernels*/
+
+static PyObject * discipline_set_trial_kernel
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    do /*once*/
+      {
+        const br_char * name;
+        if (not PyArg_ParseTuple(args, "s", &name))
+            break;
+        const struct trial_kernel_entry * e = trial_kernels;
+        for (;;)
+          {
+            if (e->name == NULL or strcmp(e->name, name) == 0)
+                break;
+            ++e;
+          } /*for*/
+        if (e->name == NULL or not e->supported())
+          {
+            PyErr_Format(PyExc_ValueError, "trial kernel \"%s\" not available", name);
+            break;
+          } /*if*/
+        atomic_store(&trial_kernel, e);
+      /* all done */
+        result = Py_None;
+        Py_INCREF(result);
+      }
+    while (false);
+    return
+        result;
+  } /*discipline_set_trial_kernel*/
+
+static bool get_uint128
+  (
+    PyObject * obj,
+    uint128_t * value
+  )
+  /* converts obj, which must be a nonnegative Python int less than 2**128.
+    Returns false, with an exception set, if it is not. */
+  {
+    PyObject * shift = NULL;
+    PyObject * hi = NULL;
+    do /*once*/
+      {
+        if (not PyLong_Check(obj))
+          {
+            PyErr_SetString(PyExc_TypeError, "expecting an int");
+            break;
+          } /*if*/
+        shift = PyLong_FromLong(64);
+        if (shift == NULL)
+            break;
+        hi = PyNumber_Rshift(obj, shift);
+        if (hi == NULL)
+            break;
+        const uint64_t hi64 = PyLong_AsUnsignedLongLong(hi);
+          /* raises OverflowError if obj is negative or too big */
+        if (PyErr_Occurred())
+            break;
+        *value = (uint128_t)hi64 << 64 | PyLong_AsUnsignedLongLongMask(obj);
+      }
+    while (false);
+    Py_XDECREF(hi);
+    Py_XDECREF(shift);
+    return
+        not PyErr_Occurred();
+  } /*get_uint128*/
+
+static PyObject * uint128_to_long
+  (
+    uint128_t value
+  )
+  {
+    PyObject * result = NULL;
+    PyObject * hi = NULL;
+    PyObject * shift = NULL;
+    PyObject * shifted = NULL;
+    PyObject * lo = NULL;
+    do /*once*/
+      {
+        if (value >> 64 == 0)
+          {
+            result = PyLong_FromUnsignedLongLong((uint64_t)value);
+            break;
+          } /*if*/
+        hi = PyLong_FromUnsignedLongLong((uint64_t)(value >> 64));
+        if (hi == NULL)
+            break;
+        shift = PyLong_FromLong(64);
+        if (shift == NULL)
+            break;
+        shifted = PyNumber_Lshift(hi, shift);
+        if (shifted == NULL)
+            break;
+        lo = PyLong_FromUnsignedLongLong((uint64_t)value);
+        if (lo == NULL)
+            break;
+        result = PyNumber_Or(shifted, lo);
+      }
+    while (false);
+    Py_XDECREF(hi);
+    Py_XDECREF(shift);
+    Py_XDECREF(shifted);
+    Py_XDECREF(lo);
+    return
+        result;
+  } /*uint128_to_long*/
+
+static bool get_modulus
+  (
+    PyObject * obj,
+    uint128_t * n
+  )
+  /* the modulus for powmod or invmod_many must be positive, and less than 2**128. */
+  {
+    bool ok = get_uint128(obj, n);
+    if (ok and *n == 0)
+      {
+        PyErr_SetString(PyExc_ValueError, "modulus must be positive");
+        ok = false;
+      } /*if*/
+    return
+        ok;
+  } /*get_modulus*/
+
+static bool get_residue
+  (
+    PyObject * obj,
+    PyObject * modulus,
+    uint128_t * value
+  )
+  /* reduces Python int obj, of any size or sign, modulo modulus. */
+  {
+    bool ok = false;
+    PyObject * reduced = NULL;
+    do /*once*/
+      {
+        if (not PyLong_Check(obj))
+          {
+            PyErr_SetString(PyExc_TypeError, "expecting an int");
+            break;
+          } /*if*/
+        reduced = PyNumber_Remainder(obj, modulus);
+        if (reduced == NULL)
+            break;
+        ok = get_uint128(reduced, value);
+      }
+    while (false);
+    Py_XDECREF(reduced);
+    return
+        ok;
+  } /*get_residue*/
+
+static PyObject * discipline_powmod
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    PyObject * negated = NULL;
+    do /*once*/
+      {
+        br_PyObject * baseobj, * exponentobj, * modulusobj;
+        uint128_t base, exponent, n;
+        if (not PyArg_ParseTuple(args, "OOO", &baseobj, &exponentobj, &modulusobj))
+            break;
+        if (not get_modulus(modulusobj, &n) or not get_residue(baseobj, modulusobj, &base))
+            break;
+        if (not PyLong_Check(exponentobj))
+          {
+            PyErr_SetString(PyExc_TypeError, "exponent must be an int");
+            break;
+          } /*if*/
+        int overflow;
+        const long long small_exponent = PyLong_AsLongLongAndOverflow(exponentobj, &overflow);
+        if (PyErr_Occurred())
+            break;
+        const bool invert = overflow < 0 or overflow == 0 and small_exponent < 0;
+        if (invert)
+          {
+            negated = PyNumber_Negative(exponentobj);
+            if (negated == NULL)
+                break;
+          } /*if*/
+        if (not get_uint128(invert ? negated : exponentobj, &exponent))
+            break;
+        if (invert and n != 1)
+          {
+            base = invmod_u128(base, n);
+            if (base == 0)
+              {
+                PyErr_SetString(PyExc_ValueError, "base is not invertible for the given modulus");
+                break;
+              } /*if*/
+          } /*if*/
+        result = uint128_to_long(powmod_u128(base, exponent, n));
+      }
+    while (false);
+    Py_XDECREF(negated);
+    return
+        result;
+  } /*discipline_powmod*/
+
+static PyObject * discipline_is_prime
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    do /*once*/
+      {
+        br_PyObject * nobj;
+        uint128_t n;
+        if (not PyArg_ParseTuple(args, "O", &nobj))
+            break;
+        if (not get_uint128(nobj, &n))
+            break;
+        result = PyBool_FromLong(is_prime_u128(n));
+      }
+    while (false);
+    return
+        result;
+  } /*discipline_is_prime*/
+
+static PyObject * discipline_invmod_many
+  (
+    PyObject * self,
+    PyObject * args
+  )
+  {
+    PyObject * result = NULL;
+    PyObject * tempresult = NULL;
+    PyObject * seq = NULL;
+    uint128_t * values = NULL;
+    do /*once*/
+      {
+        br_PyObject * valuesobj, * modulusobj;
+        uint128_t n;
+        if (not PyArg_ParseTuple(args, "OO", &valuesobj, &modulusobj))
+            break;
+        if (not get_modulus(modulusobj, &n))
+            break;
+        seq = sequence_fast(valuesobj, "expecting an iterable of ints");
+        if (seq == NULL)
+            break;
+        const Py_ssize_t nr_values = PySequence_Fast_GET_SIZE(seq);
+        values = malloc(2 * nr_values * sizeof(uint128_t) + 1);
+          /* second half is scratch area for inverse_many_u128; avoid malloc(0) */
+        if (values == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        for (Py_ssize_t i = 0;;)
+          {
+            if (i == nr_values)
+                break;
+            if (not get_residue(PySequence_Fast_GET_ITEM(seq, i), modulusobj, values + i))
+                break;
+            ++i;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+        if (not inverse_many_u128(values, values + nr_values, nr_values, n))
+          {
+            PyErr_SetString(PyExc_ValueError, "not every value is invertible for the given modulus");
+            break;
+          } /*if*/
+        tempresult = PyTuple_New(nr_values);
+        if (tempresult == NULL)
+            break;
+        for (Py_ssize_t i = 0;;)
+          {
+            if (i == nr_values)
+                break;
+            PyObject * const item = uint128_to_long(values[i]);
+            if (item == NULL)
+                break;
+            PyTuple_SET_ITEM(tempresult, i, item);
+            ++i;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+      /* all done */
+        result = tempresult;
+        tempresult = NULL; /* so I don’t dispose of it yet */
+      }
+    while (false);
+    free(values);
+    Py_XDECREF(seq);
+    Py_XDECREF(tempresult);
+    return
+        result;
+  } /*discipline_invmod_many*/
+
+static PyObject * discipline_batch_gcd
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    static const char * const keywords[] = {"", "threads", "memory_limit", NULL};
+    PyObject * result = NULL;
+    PyObject * tempresult = NULL;
+    PyObject * seq = NULL;
+    Py_buffer view = {.obj = NULL};
+    uint64_t ** converted = NULL; /* if values come from a sequence */
+    size_t nr_values = 0;
+    size_t * offset = NULL;
+    size_t * len = NULL;
+    size_t * frac_len = NULL;
+    struct big_buffer storage = {.mem = NULL};
+    do /*once*/
+      {
+        br_PyObject * valuesobj;
+        Py_ssize_t nr_threads = 0;
+        Py_ssize_t memory_limit = -1;
+        if
+          (
+            not PyArg_ParseTupleAndKeywords
+              (
+                args, kwargs, "O|$nn", (char **)keywords,
+                &valuesobj, &nr_threads, &memory_limit
+              )
+          )
+            break;
+        if (nr_threads < 0)
+          {
+            PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+            break;
+          } /*if*/
+        if (nr_threads == 0)
+            nr_threads = default_nr_threads();
+        else if (nr_threads > MAX_BATCH_THREADS)
+            nr_threads = MAX_BATCH_THREADS;
+        const uint64_t * words = NULL; /* if values come from a buffer */
+        if (PyObject_CheckBuffer(valuesobj))
+          {
+            if (PyObject_GetBuffer(valuesobj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+                break;
+            if (view.itemsize != sizeof(uint64_t) or not is_uint64_format(view.format))
+              {
+                PyErr_SetString(PyExc_TypeError, "buffer must contain unsigned 64-bit integers");
+                break;
+              } /*if*/
+            words = view.buf;
+            nr_values = view.len / sizeof(uint64_t);
+          }
+        else
+          {
+            seq = sequence_fast(valuesobj, "expecting a buffer or an iterable of ints");
+            if (seq == NULL)
+                break;
+            nr_values = PySequence_Fast_GET_SIZE(seq);
+            converted = calloc(nr_values + 1, sizeof(uint64_t *)); /* avoid calloc(0) */
+            if (converted == NULL)
+              {
+                PyErr_NoMemory();
+                break;
+              } /*if*/
+          } /*if*/
+        if (nr_values == 0)
+          {
+            result = PyTuple_New(0);
+            break;
+          } /*if*/
+      /* layout of tree levels, each half the size (rounded up) of the one below */
+        struct gcd_job job = {.nr_levels = 0};
+        job.level_start[0] = 0;
+        for (size_t nr_nodes = nr_values;;)
+          {
+            job.level_start[job.nr_levels + 1] = job.level_start[job.nr_levels] + nr_nodes;
+            ++job.nr_levels;
+            if (nr_nodes == 1)
+                break;
+            nr_nodes = (nr_nodes + 1) / 2;
+          } /*for*/
+        const size_t nr_nodes = job.level_start[job.nr_levels];
+        offset = malloc((nr_nodes + 1) * sizeof(size_t));
+        len = malloc(nr_nodes * sizeof(size_t));
+        frac_len = malloc(2 * nr_values * sizeof(size_t));
+        if (offset == NULL or len == NULL or frac_len == NULL)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        offset[0] = 0;
+        for (size_t i = 0;;)
+          {
+            if (i == nr_values)
+                break;
+            if (words != NULL)
+                len[i] = words[i] != 0;
+            else
+              {
+                br_PyObject * const item = PySequence_Fast_GET_ITEM(seq, i);
+                if (not PyLong_Check(item))
+                  {
+                    PyErr_SetString(PyExc_TypeError, "batch_gcd values must be ints");
+                    break;
+                  } /*if*/
+                if (not get_mp(item, &converted[i], &len[i]))
+                    break;
+              } /*if*/
+            if (len[i] == 0)
+              {
+                PyErr_SetString(PyExc_ValueError, "batch_gcd values must be positive");
+                break;
+              } /*if*/
+            offset[i + 1] = offset[i] + len[i];
+            ++i;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+      /* room for each node above is the sum of the sizes of its children */
+        size_t level_max = offset[nr_values];
+        for (unsigned int level = 1;;)
+          {
+            if (level == job.nr_levels)
+                break;
+            for (size_t node = job.level_start[level];;)
+              {
+                if (node == job.level_start[level + 1])
+                    break;
+                const size_t child = job.level_start[level - 1] + 2 * (node - job.level_start[level]);
+                const size_t end = child + 2 < job.level_start[level] ? child + 2 : job.level_start[level];
+                offset[node + 1] = offset[node] + offset[end] - offset[child];
+                ++node;
+              } /*for*/
+            const size_t level_size =
+                offset[job.level_start[level + 1]] - offset[job.level_start[level]];
+            if (level_size > level_max)
+                level_max = level_size;
+            ++level;
+          } /*for*/
+      /* plus fractions for two levels at a time */
+        const size_t frac_size = 2 * level_max + GCD_GUARD_LIMBS * nr_values;
+        if
+          (
+            not big_buffer_alloc
+              (
+                &storage,
+                (offset[nr_nodes] + 2 * frac_size) * sizeof(uint64_t),
+                memory_limit < 0 ? BATCH_GCD_MEMORY_LIMIT : memory_limit
+              )
+          )
+          {
+            if (storage.mapped)
+                PyErr_SetFromErrno(PyExc_OSError);
+            else
+                PyErr_NoMemory();
+            break;
+          } /*if*/
+        job.limbs = storage.mem;
+        for (size_t i = 0;;)
+          {
+            if (i == nr_values)
+                break;
+            if (words != NULL)
+                job.limbs[i] = words[i];
+            else
+              {
+                memcpy(job.limbs + offset[i], converted[i], len[i] * sizeof(uint64_t));
+                free(converted[i]);
+                converted[i] = NULL;
+              } /*if*/
+            ++i;
+          } /*for*/
+        job.offset = offset;
+        job.len = len;
+        job.frac[0] = job.limbs + offset[nr_nodes];
+        job.frac[1] = job.frac[0] + frac_size;
+        job.frac_len[0] = frac_len;
+        job.frac_len[1] = frac_len + nr_values;
+        bool ok;
+        Py_BEGIN_ALLOW_THREADS
+        ok = run_batch_gcd(&job, nr_threads);
+        Py_END_ALLOW_THREADS
+        if (not ok)
+          {
+            PyErr_NoMemory();
+            break;
+          } /*if*/
+        tempresult = PyTuple_New(nr_values);
+        if (tempresult == NULL)
+            break;
+        for (size_t i = 0;;)
+          {
+            if (i == nr_values)
+                break;
+            PyObject * const elt = mp_to_long(gcd_frac(&job, 0, i), frac_len[i]);
+            if (elt == NULL)
+                break;
+            PyTuple_SET_ITEM(tempresult, i, elt);
+            ++i;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
+        result = tempresult;
+        tempresult = NULL;
+      }
+    while (false);
+    if (converted != NULL)
+      {
+        for (size_t i = 0;;)
+          {
+            if (i == nr_values)
+                break;
+            free(converted[i]);
+            ++i;
+          } /*for*/
+        free(converted);
+      } /*if*/
+    big_buffer_dispose(&storage);
+    free(offset);
+    free(len);
+    free(frac_len);
+    PyBuffer_Release(&view); /* noop if no buffer */
+    Py_XDECREF(seq);
+    Py_XDECREF(tempresult);
+    return
+        result;
+  } /*discipline_batch_gcd*/
+
+static PyObject * discipline_primes
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    static const char * const keywords[] = {"", "", "", "threads", NULL};
+    PyObject * result = NULL;
+    Py_buffer view = {.obj = NULL};
+    do /*once*/
+      {
+        br_PyObject * loobj;
+        br_PyObject * hiobj;
+        br_PyObject * outobj = Py_None;
+        Py_ssize_t nr_threads = 0;
+        if
+          (
+            not PyArg_ParseTupleAndKeywords
+              (
+                args, kwargs, "OO|O$n", (char **)keywords,
+                &loobj, &hiobj, &outobj, &nr_threads
+              )
+          )
+            break;
+        uint128_t lo, hi;
+        if (not get_uint128(loobj, &lo) or not get_uint128(hiobj, &hi))
+            break;
+        if (lo > (uint128_t)1 << 64 or hi > (uint128_t)1 << 64)
+          {
+            PyErr_SetString(PyExc_ValueError, "primes range must lie within [0, 2**64]");
+            break;
+          } /*if*/
+        if (nr_threads < 0)
+          {
+            PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+            break;
+          } /*if*/
+        if (nr_threads == 0)
+            nr_threads = default_nr_threads();
+        else if (nr_threads > MAX_BATCH_THREADS)
+            nr_threads = MAX_BATCH_THREADS;
+        const bool empty = lo >= hi;
+        if (outobj == Py_None)
+          {
+            result = prime_iterator_new(get_module_state(self), lo, hi - 1, empty);
+            break;
+          } /*if*/
+        get_output_buffer(outobj, &view, true, "primes");
+        if (PyErr_Occurred())
+            break;
+        size_t count = 0;
+        if (not empty)
+          {
+            bool ok;
+            Py_BEGIN_ALLOW_THREADS
+            ok = run_primes(lo, hi - 1, view.buf, view.len / sizeof(uint64_t), nr_threads, &count);
+            Py_END_ALLOW_THREADS
+            if (not ok)
+              {
+                PyErr_NoMemory();
+                break;
+              } /*if*/
+          } /*if*/
+        result = PyLong_FromSize_t(count);
+      }
+    while (false);
+    PyBuffer_Release(&view); /* noop if no buffer */
+    return
+        result;
+  } /*discipline_primes*/
+
+static PyObject * discipline_factorize_range
   (
     PyObject * self,
-    PyObject * args
+    PyObject * args,
+    PyObject * kwargs
   )
   {
+    static const char * const keywords[] =
+        {"", "", "offsets", "primes", "exponents", "statuses", "threads", "compact", NULL};
     PyObject * result = NULL;
-    PyObject * tempresult = NULL;
-    br_PyObject * items;
-    const br_char * msg = NULL;
+    Py_buffer offsets = {.obj = NULL};
+    Py_buffer primes = {.obj = NULL};
+    Py_buffer exponents = {.obj = NULL};
+    Py_buffer statuses = {.obj = NULL};
+    struct range_primes rp = {.primes = NULL};
     do /*once*/
       {
-        const bool parsed_ok = PyArg_ParseTuple(args, "Os", &items, &msg);
-        if (not parsed_ok)
+        br_PyObject * loobj;
+        br_PyObject * hiobj;
+        br_PyObject * offsetsobj = Py_None;
+        br_PyObject * primesobj = Py_None;
+        br_PyObject * exponentsobj = Py_None;
+        br_PyObject * statusesobj = Py_None;
+        Py_ssize_t nr_threads = 0;
+        int compact = false;
+        if
+          (
+            not PyArg_ParseTupleAndKeywords
+              (
+                args, kwargs, "OO|OOO$Onp", (char **)keywords,
+                &loobj, &hiobj, &offsetsobj, &primesobj, &exponentsobj,
+                &statusesobj, &nr_threads, &compact
+              )
+          )
             break;
-        fprintf(stdout, "makedict says: “%s”\n", msg);
-        if (not PyTuple_Check(items))
+        uint128_t lo, hi;
+        if (not get_uint128(loobj, &lo) or not get_uint128(hiobj, &hi))
+            break;
+        if (lo > (uint128_t)1 << 64 or hi > (uint128_t)1 << 64)
           {
-            PyErr_SetString(PyExc_TypeError, "expecting a tuple");
+            PyErr_SetString(PyExc_ValueError, "factorize_range range must lie within [0, 2**64]");
             break;
           } /*if*/
-        const ssize_t nr_items = PyTuple_Size(items);
+        const bool streaming = offsetsobj == Py_None;
+        if (streaming != (primesobj == Py_None) or streaming != (exponentsobj == Py_None))
+          {
+            PyErr_SetString
+              (
+                PyExc_TypeError,
+                "specify all or none of offsets, primes and exponents"
+              );
+            break;
+          } /*if*/
+        if (nr_threads < 0)
+          {
+            PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+            break;
+          } /*if*/
+        if (nr_threads == 0)
+            nr_threads = default_nr_threads();
+        else if (nr_threads > MAX_BATCH_THREADS)
+            nr_threads = MAX_BATCH_THREADS;
+        const bool empty = lo >= hi;
+        if (streaming)
+          {
+            result = factor_range_iterator_new(get_module_state(self), lo, hi - 1, empty, compact);
+            break;
+          } /*if*/
+        get_output_buffer(offsetsobj, &offsets, true, "offsets");
         if (PyErr_Occurred())
             break;
-        tempresult = PyDict_New();
-        if (tempresult == NULL)
+        get_output_buffer(primesobj, &primes, true, "primes");
+        if (PyErr_Occurred())
             break;
-        for (ssize_t i = 0;;)
+        get_output_buffer(exponentsobj, &exponents, false, "exponents");
+        if (PyErr_Occurred())
+            break;
+        if (offsets.len == 0)
           {
-            if (i == nr_items)
-                break;
-            br_PyObject * const item = PyTuple_GetItem(items, i);
-            if (item == NULL)
-                break;
-            if (not PyTuple_Check(item) or PyTuple_Size(item) != 2)
-              {
-                PyErr_SetString(PyExc_TypeError, "expecting a 2-tuple");
-                break;
-              } /*if*/
-            br_PyObject * const first = PyTuple_GetItem(item, 0);
-            if (first == NULL)
-                break;
-            br_PyObject * const second = PyTuple_GetItem(item, 1);
-            if (second == NULL)
+            PyErr_SetString(PyExc_ValueError, "offsets buffer needs room for at least 1 entry");
+            break;
+          } /*if*/
+        size_t max_values = offsets.len / sizeof(uint64_t) - 1;
+        if (statusesobj != Py_None)
+          {
+            get_output_buffer(statusesobj, &statuses, false, "statuses");
+            if (PyErr_Occurred())
                 break;
-            if (first == (PyObject *)&ExceptMe_type or second == (PyObject *)&ExceptMe_type)
+            if ((size_t)statuses.len < max_values)
+                max_values = statuses.len;
+          } /*if*/
+        if (empty)
+            max_values = 0;
+        else if (hi - lo < max_values)
+            max_values = hi - lo;
+        struct range_job job =
+            {
+                .rp = &rp,
+                .lo = lo,
+                .last = lo + max_values - 1, /* no point going beyond what will fit */
+                .offsets = offsets.buf,
+                .primes = primes.buf,
+                .exponents = exponents.buf,
+                .statuses = statuses.buf,
+                .max_values = max_values,
+                .max_factors =
+                    primes.len / sizeof(uint64_t) < (size_t)exponents.len ?
+                        primes.len / sizeof(uint64_t)
+                    :
+                        exponents.len,
+                .nr_values_out = 0,
+                .nr_factors_out = 0,
+            };
+        atomic_init(&job.first_failure, SIZE_MAX);
+        if (max_values != 0)
+          {
+            bool ok;
+            Py_BEGIN_ALLOW_THREADS
+            ok =
+                    range_primes_init(&rp, job.lo, job.last)
+                and
+                    run_factorize_range(&job, nr_threads);
+            Py_END_ALLOW_THREADS
+            if (not ok)
               {
-                PyErr_SetString(PyExc_ValueError, "ExceptMe object found");
+                PyErr_NoMemory();
                 break;
               } /*if*/
-            if (PyDict_SetItem(tempresult, first, second) < 0)
-                break;
-            ++i;
-          } /*for*/
-        if (PyErr_Occurred())
+          }
+        else
+          {
+            job.offsets[0] = 0;
+          } /*if*/
+        const size_t first_failure = atomic_load(&job.first_failure);
+        if (statuses.obj == NULL and first_failure != SIZE_MAX)
+          {
+          /* caller isn’t collecting statuses, so tell them the bad news the usual way */
+            struct factorization f;
+            set_factorize_error(factorize_one(&f, lo + first_failure, NULL));
             break;
-      /* all done */
-        result = tempresult;
-        tempresult = NULL; /* so I don’t dispose of it yet */
+          } /*if*/
+        result = Py_BuildValue
+          (
+            "(nn)",
+            (Py_ssize_t)job.nr_values_out,
+            (Py_ssize_t)job.nr_factors_out
+          );
       }
     while (false);
-    Py_XDECREF(tempresult);
+    range_primes_dispose(&rp);
+    PyBuffer_Release(&offsets); /* noop if no buffer */
+    PyBuffer_Release(&primes);
+    PyBuffer_Release(&exponents);
+    PyBuffer_Release(&statuses);
     return
         result;
-  } /*discipline_makedict*/
+  } /*discipline_factorize_range*/
 
-static PyObject * discipline_factorize
+static PyObject * arith_range
   (
-    PyObject * self,
-    PyObject * args
+    PyObject * args,
+    PyObject * kwargs,
+    enum arith_function func,
+    const char * name /* of Python function, for error messages */
   )
+  /* common code for the arithmetic-function-table routines. */
   {
+    static const char * const keywords[] = {"", "", "", "threads", NULL};
     PyObject * result = NULL;
-    PyObject * tempresult = NULL;
-    uint64_t n;
-    ssize_t nr_allocated, nr_used;
-    const ssize_t allocation_step = 10;
-      /* something convenient to reduce nr of tuple resize operations */
+    Py_buffer view = {.obj = NULL};
+    struct range_primes rp = {.primes = NULL};
     do /*once*/
       {
+        br_PyObject * loobj;
+        br_PyObject * hiobj;
+        br_PyObject * outobj;
+        Py_ssize_t nr_threads = 0;
+        if
+          (
+            not PyArg_ParseTupleAndKeywords
+              (
+                args, kwargs, "OOO|$n", (char **)keywords,
+                &loobj, &hiobj, &outobj, &nr_threads
+              )
+          )
+            break;
+        uint128_t lo, hi;
+        if (not get_uint128(loobj, &lo) or not get_uint128(hiobj, &hi))
+            break;
+        if (lo > (uint128_t)1 << 64 or hi > (uint128_t)1 << 64)
           {
-            br_PyObject * nobj;
-          /* Note that “K” specifier for PyArg_ParseTuple does not do overflow checking */
-            if (not PyArg_ParseTuple(args, "O", &nobj))
-                break;
-            n = PyLong_AsUnsignedLongLong(nobj);
-            if (PyErr_Occurred())
-                break;
-          }
-        if (n < 2)
+            PyErr_Format(PyExc_ValueError, "%s range must lie within [0, 2**64]", name);
+            break;
+          } /*if*/
+        if (nr_threads < 0)
           {
-            PyErr_SetString(PyExc_ValueError, "cannot factorize one or zero");
+            PyErr_SetString(PyExc_ValueError, "threads must not be negative");
             break;
           } /*if*/
-        nr_allocated = allocation_step;
-        tempresult = PyTuple_New(nr_allocated);
-        if (tempresult == NULL)
+        if (nr_threads == 0)
+            nr_threads = default_nr_threads();
+        else if (nr_threads > MAX_BATCH_THREADS)
+            nr_threads = MAX_BATCH_THREADS;
+        size_t itemsize;
+        switch (func)
+          {
+        case ARITH_TOTIENT:
+        case ARITH_SIGMA:
+            get_output_buffer(outobj, &view, true, "out");
+            itemsize = sizeof(uint64_t);
+        break;
+        case ARITH_OMEGA:
+        case ARITH_BIGOMEGA:
+            get_output_buffer(outobj, &view, false, "out");
+            itemsize = sizeof(uint8_t);
+        break;
+        case ARITH_MOBIUS:
+            if
+              (
+                    PyObject_GetBuffer(outobj, &view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS | PyBUF_FORMAT)
+                ==
+                    0
+              and
+                (view.itemsize != sizeof(int8_t) or not is_int8_format(view.format))
+              )
+                PyErr_SetString(PyExc_TypeError, "out buffer must contain signed 8-bit integers");
+            itemsize = sizeof(int8_t);
+        break;
+          } /*switch*/
+        if (PyErr_Occurred())
             break;
-        nr_used = 0;
+        size_t nr_values = view.len / itemsize;
+        if (lo >= hi)
+            nr_values = 0;
+        else if (hi - lo < nr_values)
+            nr_values = hi - lo;
+        if (nr_values != 0)
           {
-            uint64_t step = 1;
-            for (uint64_t factor = 2;;)
+            struct arith_job job =
+                {
+                    .func = func,
+                    .itemsize = itemsize,
+                    .rp = &rp,
+                    .lo = lo,
+                    .last = lo + nr_values - 1,
+                    .out = view.buf,
+                };
+            bool ok;
+            Py_BEGIN_ALLOW_THREADS
+            ok =
+                    range_primes_init(&rp, job.lo, job.last)
+                and
+                    run_arith_range(&job, nr_threads);
+            Py_END_ALLOW_THREADS
+            if (not ok)
               {
-                if (factor > n)
-                    break;
-                if (n % factor == 0)
-                  {
-                    PyObject * factorelt = NULL;
-                    PyObject * factorobj = NULL;
-                    PyObject * powerobj = NULL;
-                    do /*once*/
-                      {
-                        factorelt = PyTuple_New(2);
-                        if (factorelt == NULL)
-                            break;
-                        uint64_t power = 1;
-                        n /= factor;
-                        while (n % factor == 0)
-                          {
-                            ++power;
-                            n /= factor;
-                          } /*while*/
-                        if (factor == 5)
-                          {
-                            PyErr_SetString(PyExc_ValueError, "Aiee! Unlucky factor 5 found!");
-                            break;
-                          } /*if*/
-                        if (power == 5)
-                          {
-                            PyErr_SetString(PyExc_ValueError, "Aiee! Unlucky power 5 found!");
-                            break;
-                          } /*if*/
-                        factorobj = PyLong_FromUnsignedLongLong(factor);
-                        if (factorobj == NULL)
-                            break;
-                        powerobj = PyLong_FromUnsignedLongLong(power);
-                        if (powerobj == NULL)
-                            break;
-                        PyTuple_SET_ITEM(factorelt, 0, factorobj);
-                        PyTuple_SET_ITEM(factorelt, 1, powerobj);
-                        factorobj = powerobj = NULL; /* ownership has passed to factorelt */
-                        if (nr_used == nr_allocated)
-                          {
-                          /* need more room in result tuple */
-                            nr_allocated += allocation_step;
-                            if (_PyTuple_Resize(&tempresult, nr_allocated) != 0)
-                                break;
-                          } /*if*/
-                      /* all done */
-                        PyTuple_SET_ITEM(tempresult, nr_used, factorelt);
-                        factorelt = NULL; /* ownership has passed to tempresult */
-                        ++nr_used;
-                      }
-                    while (false);
-                    Py_XDECREF(factorobj);
-                    Py_XDECREF(powerobj);
-                    Py_XDECREF(factorelt);
-                    if (PyErr_Occurred())
-                        break;
-                  } /*if*/
-                factor += step;
-                step = 2;
-              } /*for*/
-            if (PyErr_Occurred())
+                PyErr_NoMemory();
                 break;
-          }
-        if (_PyTuple_Resize(&tempresult, nr_used) != 0)
-            break;
-      /* all done */
-        result = tempresult;
-        tempresult = NULL; /* so I don’t dispose of it yet */
+              } /*if*/
+            const size_t overflow = atomic_load(&job.first_overflow);
+            if (overflow != SIZE_MAX)
+              {
+                PyErr_Format
+                  (
+                    PyExc_OverflowError,
+                    "%s result for %llu does not fit in 64 bits",
+                    name,
+                    (unsigned long long)(job.lo + overflow)
+                  );
+                break;
+              } /*if*/
+          } /*if*/
+        result = PyLong_FromSize_t(nr_values);
       }
     while (false);
-    Py_XDECREF(tempresult);
+    range_primes_dispose(&rp);
+    PyBuffer_Release(&view); /* noop if no buffer */
     return
         result;
-  } /*discipline_factorize*/
+  } /*arith_range*/
+
+static PyObject * discipline_totient_range
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    return
+        arith_range(args, kwargs, ARITH_TOTIENT, "totient_range");
+  } /*discipline_totient_range*/
+
+static PyObject * discipline_mobius_range
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    return
+        arith_range(args, kwargs, ARITH_MOBIUS, "mobius_range");
+  } /*discipline_mobius_range*/
+
+static PyObject * discipline_omega_range
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    return
+        arith_range(args, kwargs, ARITH_OMEGA, "omega_range");
+  } /*discipline_omega_range*/
+
+static PyObject * discipline_bigomega_range
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    return
+        arith_range(args, kwargs, ARITH_BIGOMEGA, "bigomega_range");
+  } /*discipline_bigomega_range*/
+
+static PyObject * discipline_sigma_range
+  (
+    PyObject * self,
+    PyObject * args,
+    PyObject * kwargs
+  )
+  {
+    return
+        arith_range(args, kwargs, ARITH_SIGMA, "sigma_range");
+  } /*discipline_sigma_range*/
 
 /*
     Top level
@@ -238,10 +14826,19 @@ static PyObject * discipline_factorize
   in a loop in the init routine (below). This reduces the repetitiveness of
   the init code, including the error recovery. */
 
-static PyTypeObject * types[] = /* all types defined in this module */
+struct type_entry
+  {
+    PyType_Spec * spec;
+    size_t offset; /* of where to keep the type in struct module_state */
+  };
+static const struct type_entry types[] = /* all types defined in this module */
   {
-    &ExceptMe_type,
-    END_PTR_LIST
+    {&ExceptMe_spec, offsetof(struct module_state, ExceptMe_type)},
+    {&Factorization_spec, offsetof(struct module_state, Factorization_type)},
+    {&PrimeIterator_spec, offsetof(struct module_state, PrimeIterator_type)},
+    {&FactorRangeIterator_spec, offsetof(struct module_state, FactorRangeIterator_type)},
+    {&FactorIterator_spec, offsetof(struct module_state, FactorIterator_type)},
+    END_STRUCT_LIST
   };
 
 struct string_constant_entry
@@ -257,6 +14854,21 @@ static const struct string_constant_entry string_constants[] =
     END_STRUCT_LIST
   };
 
+struct int_constant_entry
+    {
+        const char * name;
+        long value;
+    };
+static const struct int_constant_entry int_constants[] =
+  /* all integer constants defined in this module */
+  {
+    {"FACTORIZE_OK", FACTORIZE_OK},
+    {"FACTORIZE_TOO_SMALL", FACTORIZE_TOO_SMALL},
+    {"FACTORIZE_UNLUCKY_FACTOR", FACTORIZE_UNLUCKY_FACTOR},
+    {"FACTORIZE_UNLUCKY_POWER", FACTORIZE_UNLUCKY_POWER},
+    END_STRUCT_LIST
+  };
+
 static PyMethodDef discipline_methods[] =
   {
     {"makedict", discipline_makedict, METH_VARARGS,
@@ -265,41 +14877,298 @@ static PyMethodDef discipline_methods[] =
         " of (key, value) pairs. Raises a ValueError exception if"
         " any key or value is ExceptMe."
     },
-    {"factorize", discipline_factorize, METH_VARARGS,
-        "factorize(«n»)\n\n"
+    {"factorize", (PyCFunction)discipline_factorize, METH_VARARGS | METH_KEYWORDS,
+        "factorize(«n», compact = False, deadline = None, max_work = None)\n\n"
         "returns a tuple of integer pairs («i», «r») representing the"
         "prime factors of positive integer «n», where «i» is a prime"
         " number and «r» is the number of times «i» occurs as a factor"
-        " of «n». Raises a ValueError exception if any «i» or «r» equals 5."
+        " of «n». Raises a ValueError exception if any «i» or «r» equals 5.\n"
+        "«n» may be of any size; beyond 64 bits, factors are found with rho,"
+        " the elliptic curve method and the self-initialising quadratic sieve,"
+        " running without the GIL; the sieve uses all available CPUs.\n"
+        "If «compact» is true, the result is returned as a Factorization object"
+        " instead; this is only possible for «n» less than 2**64, and raises"
+        " ValueError otherwise.\n"
+        "If «deadline» (in the same terms as time.monotonic()) or «max_work» (in units"
+        " of roughly one multiplication modulo «n») is given, the work on «n» beyond"
+        " 64 bits stops once either is passed, and the result is instead a pair"
+        " («factors», «cofactor»), where «factors» is as above, but only for the"
+        " primes found so far, and «cofactor» is the product of the parts not"
+        " yet factorized (1 if finished), which might still share primes with"
+        " «factors». «deadline» must be finite, and «max_work» from 1 to 2**64 - 1;"
+        " ValueError is raised otherwise. Signal handlers get to run every so often"
+        " in any case, so KeyboardInterrupt can stop the factorization."
+    },
+    {"factorize_async", discipline_factorize_async, METH_VARARGS,
+        "factorize_async(«n»)\n\n"
+        "must be called from a coroutine: returns an awaitable asyncio future for"
+        " the result of factorize(«n»), for an int «n» of any size, which is worked"
+        " out by the module’s pool of native threads without the GIL."
+        " Completions are signalled to the running event loop through a single"
+        " eventfd, so many results can be delivered in one wakeup. Within each"
+        " interpreter, only one running event loop at a time can use it."
+    },
+    {"ifactorize", discipline_ifactorize, METH_VARARGS,
+        "ifactorize(«n»)\n\n"
+        "returns a FactorIterator yielding the same («prime», «power») pairs as"
+        " factorize(«n») would return, for an int «n» of any size, but one at a"
+        " time, doing only as much work as is needed to find each one, so the"
+        " caller can stop as soon as it has what it needs. Primes found by trial"
+        " division (those up to " STRINGIFY(TRIAL_LIMIT) ") come first, in ascending order; any larger"
+        " ones come in the order they are found, smaller ones usually first. Where"
+        " factorize() would raise an exception, the iterator raises it on reaching"
+        " the offending factor. Splitting large cofactors is done without the GIL."
+    },
+    {"factorize_smooth", (PyCFunction)discipline_factorize_smooth, METH_VARARGS | METH_KEYWORDS,
+        "factorize_smooth(«n», «bound», deadline = None, max_work = None)\n\n"
+        "partially factorizes an int «n» of any size, returning a pair"
+        " («factors», «cofactor»), where «factors» is a tuple of («prime», «power»)"
+        " pairs as factorize() would return, but only for the primes up to «bound»,"
+        " and «cofactor» is «n» divided by all of those, i.e. the product of the prime"
+        " factors greater than «bound». Much quicker than a full factorization when"
+        " «bound» is small, since it stops once the cofactor can have no more"
+        " factors up to «bound». Raises the same exceptions as factorize() for"
+        " any of the «factors», but not for the «cofactor». «bound» must be from 0"
+        " to 2**64 - 1; ValueError is raised otherwise.\n"
+        "If «deadline» or «max_work» is given, as for factorize(), the work on «n»"
+        " beyond 64 bits stops once either is passed, and the result is instead a"
+        " triple («factors», «cofactor», «unfactored»), where «unfactored» is the"
+        " product of the parts not yet searched (1 if finished), which might still"
+        " have factors up to «bound»; «cofactor» is then only the product of those"
+        " parts found to have none. Signal handlers get to run every so often in"
+        " any case, so KeyboardInterrupt can stop the search."
+    },
+    {"factorize_many", (PyCFunction)discipline_factorize_many, METH_VARARGS | METH_KEYWORDS,
+        "factorize_many(«values», threads = «nr_threads», compact = False)\n\n"
+        "factorizes every integer in «values», which may be an iterable of"
+        " ints or a buffer of unsigned 64-bit integers (e.g. array(\"Q\")),"
+        " using up to «nr_threads» native threads (default one per CPU)"
+        " running without the GIL. Returns a pair («results», «statuses»),"
+        " where «statuses» is a bytes object with a FACTORIZE_xxx code for"
+        " each value, and «results» is a tuple holding the same thing"
+        " factorize() would return for each successful value, or None where"
+        " the status is not FACTORIZE_OK. «compact» is as for factorize()."
+    },
+    {"factorize_smooth_many", (PyCFunction)discipline_factorize_smooth_many, METH_VARARGS | METH_KEYWORDS,
+        "factorize_smooth_many(«values», «bound», threads = «nr_threads»)\n\n"
+        "does factorize_smooth() with the given «bound» on every integer in «values»,"
+        " which may be an iterable of ints or a buffer of unsigned 64-bit integers,"
+        " in parallel as for factorize_many(). Returns a pair («results», «statuses»)"
+        " as for factorize_many(), except that each successful element of «results»"
+        " is the («factors», «cofactor») pair factorize_smooth() would return."
+    },
+    {"factorize_csr", (PyCFunction)discipline_factorize_csr, METH_VARARGS | METH_KEYWORDS,
+        "factorize_csr(«values»[, «offsets», «primes», «exponents»],"
+        " statuses = «statuses», threads = «nr_threads»)\n\n"
+        "factorizes every integer in «values» (as for factorize_many) into"
+        " caller-supplied writable buffers in compressed-sparse-row form:"
+        " the prime factors of «values»[i] are «primes»[«offsets»[i]:«offsets»[i + 1]],"
+        " with the corresponding powers at the same positions in «exponents»."
+        " «offsets» and «primes» must hold unsigned 64-bit integers, «exponents»"
+        " unsigned bytes. Returns the total nr of factors written.\n"
+        "If the three buffers are omitted, nothing is written, and the required"
+        " sizes are returned instead, as a pair («nr_offsets», «nr_factors»).\n"
+        "If the optional «statuses» byte buffer is supplied, it receives a FACTORIZE_xxx"
+        " code for each value, and unsuccessful values just get no factors;"
+        " otherwise the first unsuccessful value raises the usual ValueError."
+    },
+    {"set_spf_limit", discipline_set_spf_limit, METH_VARARGS,
+        "set_spf_limit(«limit»)\n\n"
+        "sets the size of the smallest-prime-factor table used to factorize"
+        " integers less than «limit» by table lookup; 0 disables the table."
+        " The table is built the next time it is needed, not immediately."
+    },
+    {"spf_table_info", discipline_spf_table_info, METH_NOARGS,
+        "spf_table_info()\n\n"
+        "returns a dict describing the smallest-prime-factor table: its «limit»,"
+        " whether it has been «built» (or loaded) yet, its «source» (\"memory\","
+        " \"file\" or \"none\"), its «size» in bytes, its «load_time» in seconds"
+        " (to build it, or to map it from the file), the «file» set by"
+        " set_spf_table_file(), if any, and «file_error», the reason why"
+        " that file could not be used, if it couldn’t."
+    },
+    {"set_spf_table_file", discipline_set_spf_table_file, METH_VARARGS,
+        "set_spf_table_file(«filename»)\n\n"
+        "specifies a file previously created by spf_table_save(), to be mapped"
+        " read-only the next time the smallest-prime-factor table is needed,"
+        " instead of building it in memory. If the file cannot be used, the"
+        " table is built in memory as usual. None goes back to always building"
+        " in memory."
+    },
+    {"spf_table_save", discipline_spf_table_save, METH_VARARGS,
+        "spf_table_save(«filename»[, «limit»])\n\n"
+        "builds a smallest-prime-factor table, covering integers less than"
+        " «limit» (defaults to the current limit), and saves it to the"
+        " specified file for later use with set_spf_table_file()."
+    },
+    {"set_cache_size", discipline_set_cache_size, METH_VARARGS,
+        "set_cache_size(«maxsize»)\n\n"
+        "sets the max nr of factorizations of 64-bit values remembered by the"
+        " factorization cache, which is used by factorize(), factorize_many() and"
+        " factorize_csr(), evicting entries not recently looked up to make room"
+        " for new ones; 0 (the default) disables it. Changing the size empties"
+        " the cache."
+    },
+    {"cache_info", discipline_cache_info, METH_NOARGS,
+        "cache_info()\n\n"
+        "returns a CacheInfo named tuple («hits», «misses», «maxsize», «currsize»)"
+        " describing the factorization cache, as for functools.lru_cache. Values"
+        " handled by the smallest-prime-factor table don’t go through the cache,"
+        " so aren’t counted."
+    },
+    {"cache_clear", discipline_cache_clear, METH_NOARGS,
+        "cache_clear()\n\n"
+        "empties the factorization cache and resets its statistics."
+    },
+    {"trial_kernels", discipline_trial_kernels, METH_NOARGS,
+        "trial_kernels()\n\n"
+        "returns a pair («current», «available»), being the name of the trial-division"
+        " kernel used by batch factorization, and a tuple of the names of all the"
+        " ones this CPU supports."
+    },
+    {"set_trial_kernel", discipline_set_trial_kernel, METH_VARARGS,
+        "set_trial_kernel(«name»)\n\n"
+        "selects the named trial-division kernel for batch factorization, instead"
+        " of the best one chosen at module load. Mainly useful for benchmarking."
+    },
+    {"powmod", discipline_powmod, METH_VARARGS,
+        "powmod(«base», «exponent», «modulus»)\n\n"
+        "returns the same as pow(«base», «exponent», «modulus»), for a positive"
+        " «modulus» and an «exponent» of magnitude less than 2**128, computed with"
+        " the same Montgomery-form arithmetic used for factorization. A negative"
+        " «exponent» requires «base» to be invertible modulo «modulus»."
+    },
+    {"is_prime", discipline_is_prime, METH_VARARGS,
+        "is_prime(«n»)\n\n"
+        "tests whether the nonnegative integer «n», which must be less than 2**128,"
+        " is prime. The answer is exact for «n» less than 2**64; beyond that, the"
+        " Baillie-PSW test is used, for which no counterexample is known."
+    },
+    {"invmod_many", discipline_invmod_many, METH_VARARGS,
+        "invmod_many(«values», «modulus»)\n\n"
+        "returns a tuple of the inverses modulo «modulus» (positive, less than"
+        " 2**128) of each of the ints in «values», computed together with only"
+        " one actual inversion. Raises ValueError if any of them is not invertible."
+    },
+    {"batch_gcd", (PyCFunction)discipline_batch_gcd, METH_VARARGS | METH_KEYWORDS,
+        "batch_gcd(«values», threads = «nr_threads», memory_limit = «nr_bytes»)\n\n"
+        "returns a tuple giving, for each of the positive integers in «values», its"
+        " gcd with the product of all the others, by way of a product tree and a"
+        " remainder tree, so any moduli sharing a prime factor show up as results"
+        " other than 1. «values» may be an iterable of ints of any size or a buffer"
+        " of unsigned 64-bit integers (e.g. array(\"Q\")). The work is done by up to"
+        " «nr_threads» native threads (default one per CPU) running without the GIL."
+        " If the trees need more than «nr_bytes» of storage (default 1GiB), they"
+        " are kept in a temporary file in $TMPDIR (or /tmp) mapped into memory."
+    },
+    {"primes", (PyCFunction)discipline_primes, METH_VARARGS | METH_KEYWORDS,
+        "primes(«lo», «hi»[, «out»], threads = «nr_threads»)\n\n"
+        "finds the primes «p» with «lo» <= «p» < «hi», where 0 <= «lo», «hi» <= 2**64,"
+        " by a segmented sieve of Eratosthenes. Without «out», returns a PrimeIterator"
+        " that yields them in ascending order, sieving as it goes (and finding the primes"
+        " to sieve with as it goes, too). Otherwise «out» must"
+        " be a writable buffer of unsigned 64-bit integers (e.g. array(\"Q\")), which is"
+        " filled with them in ascending order, stopping early if it is not big enough,"
+        " by up to «nr_threads» native threads (default one per CPU) running without"
+        " the GIL; the nr of primes written is returned."
+    },
+    {"factorize_range", (PyCFunction)discipline_factorize_range, METH_VARARGS | METH_KEYWORDS,
+        "factorize_range(«lo», «hi»[, «offsets», «primes», «exponents»],"
+        " statuses = «statuses», threads = «nr_threads», compact = False)\n\n"
+        "factorizes every integer «n» with «lo» <= «n» < «hi», where 0 <= «lo», «hi» <= 2**64,"
+        " by sieving the range a segment at a time with the primes up to 2**20,"
+        " which is much quicker than factorizing each value separately. Without"
+        " the buffers, returns a FactorRangeIterator yielding («n», «factors») pairs"
+        " in ascending order of «n», where «factors» is what factorize() would"
+        " return (as affected by «compact»), or None if it would have raised an"
+        " exception. Otherwise the factors are put into the buffers in the same"
+        " form as for factorize_csr, by up to «nr_threads» native threads (default"
+        " one per CPU) running without the GIL, stopping at the last value whose"
+        " factors will entirely fit. Returns («nr_values», «nr_factors»), the nrs of"
+        " values and factors written; continue from «lo» + «nr_values» to get the rest."
+        " If «statuses» is not given, an unsuccessful value raises the same exception"
+        " as factorize() would."
+    },
+    {"totient_range", (PyCFunction)discipline_totient_range, METH_VARARGS | METH_KEYWORDS,
+        "totient_range(«lo», «hi», «out», threads = «nr_threads»)\n\n"
+        "computes Euler’s totient φ(«n») for every «n» with «lo» <= «n» < «hi», where"
+        " 0 <= «lo», «hi» <= 2**64, from the factorizations found by sieving as for"
+        " factorize_range. «out» must be a writable buffer of unsigned 64-bit integers"
+        " (e.g. array(\"Q\")), which is filled with the values for «lo», «lo» + 1 and"
+        " so on, stopping early if it is not big enough, by up to «nr_threads» native"
+        " threads (default one per CPU) running without the GIL; the nr of values"
+        " written is returned. Zero gets 0."
+    },
+    {"mobius_range", (PyCFunction)discipline_mobius_range, METH_VARARGS | METH_KEYWORDS,
+        "mobius_range(«lo», «hi», «out», threads = «nr_threads»)\n\n"
+        "computes the Möbius function μ(«n») for every «n» with «lo» <= «n» < «hi»,"
+        " where 0 <= «lo», «hi» <= 2**64, from the factorizations found by sieving as"
+        " for factorize_range. «out» must be a writable buffer of signed 8-bit"
+        " integers (e.g. array(\"b\")), which is filled with the values for «lo», «lo»"
+        " + 1 and so on, stopping early if it is not big enough, by up to «nr_threads»"
+        " native threads (default one per CPU) running without the GIL; the nr of"
+        " values written is returned. Zero gets 0."
+    },
+    {"omega_range", (PyCFunction)discipline_omega_range, METH_VARARGS | METH_KEYWORDS,
+        "omega_range(«lo», «hi», «out», threads = «nr_threads»)\n\n"
+        "computes ω(«n»), the nr of distinct prime factors of «n», for every «n» with"
+        " «lo» <= «n» < «hi», where 0 <= «lo», «hi» <= 2**64, from the factorizations"
+        " found by sieving as for factorize_range. «out» must be a writable buffer of"
+        " unsigned 8-bit integers (e.g. bytearray), which is filled with the values"
+        " for «lo», «lo» + 1 and so on, stopping early if it is not big enough, by up"
+        " to «nr_threads» native threads (default one per CPU) running without the"
+        " GIL; the nr of values written is returned. Zero gets 0."
+    },
+    {"bigomega_range", (PyCFunction)discipline_bigomega_range, METH_VARARGS | METH_KEYWORDS,
+        "bigomega_range(«lo», «hi», «out», threads = «nr_threads»)\n\n"
+        "computes Ω(«n»), the nr of prime factors of «n» counted with multiplicity,"
+        " for every «n» with «lo» <= «n» < «hi», where 0 <= «lo», «hi» <= 2**64, from"
+        " the factorizations found by sieving as for factorize_range. «out» must be a"
+        " writable buffer of unsigned 8-bit integers (e.g. bytearray), which is filled"
+        " with the values for «lo», «lo» + 1 and so on, stopping early if it is not"
+        " big enough, by up to «nr_threads» native threads (default one per CPU)"
+        " running without the GIL; the nr of values written is returned. Zero gets 0."
+    },
+    {"sigma_range", (PyCFunction)discipline_sigma_range, METH_VARARGS | METH_KEYWORDS,
+        "sigma_range(«lo», «hi», «out», threads = «nr_threads»)\n\n"
+        "computes σ(«n»), the sum of the divisors of «n», for every «n» with «lo» <="
+        " «n» < «hi», where 0 <= «lo», «hi» <= 2**64, from the factorizations found by"
+        " sieving as for factorize_range. «out» must be a writable buffer of unsigned"
+        " 64-bit integers (e.g. array(\"Q\")), which is filled with the values for"
+        " «lo», «lo» + 1 and so on, stopping early if it is not big enough, by up to"
+        " «nr_threads» native threads (default one per CPU) running without the GIL;"
+        " the nr of values written is returned. Zero gets 0. Raises OverflowError if"
+        " some σ(«n») is 2**64 or more, which can only happen for «n» beyond about"
+        " 2**61."
     },
     END_STRUCT_LIST
   };
 
-static PyModuleDef discipline_module =
-  {
-    PyModuleDef_HEAD_INIT,
-    "discipline", /* module name */
-    "demonstration of structured discipline", /* docstring */
-    -1, /* size of per-interpreter state, -1 if entirely global */
-    discipline_methods,
-  };
-
-PyMODINIT_FUNC PyInit_discipline(void)
+static int discipline_exec
+  (
+    PyObject * modu
+  )
+  /* fills in a newly-created module object for the current interpreter. */
   {
-    PyObject * result = NULL;
-    PyObject * modu = NULL;
+    int result = -1;
+    struct module_state * const state = get_module_state(modu);
     do /*once*/
       {
-        modu = PyModule_Create(&discipline_module);
-        if (PyErr_Occurred())
+        state->CacheInfo_type = PyStructSequence_NewType(&cache_info_desc);
+        if (state->CacheInfo_type == NULL)
+            break;
+        if (PyModule_AddType(modu, state->CacheInfo_type) < 0)
             break;
-        for (PyTypeObject ** e = types;;)
+        for (const struct type_entry * e = types;;)
           {
-            if (*e == NULL)
+            if (e->spec == NULL)
                 break;
-            if (PyType_Ready(*e) < 0)
+            PyTypeObject * const type =
+                (PyTypeObject *)PyType_FromModuleAndSpec(modu, e->spec, NULL);
+            if (type == NULL)
                 break;
-            if (PyModule_AddObject(modu, (**e).tp_name, (PyObject *)*e) < 0)
+            *(PyTypeObject **)((char *)state + e->offset) = type; /* state owns this reference */
+            if (PyModule_AddType(modu, type) < 0)
                 break;
             ++e;
           } /*for*/
@@ -315,12 +15184,125 @@ PyMODINIT_FUNC PyInit_discipline(void)
           } /*for*/
         if (PyErr_Occurred())
             break;
+        for (const struct int_constant_entry *e = int_constants;;)
+          {
+            if (e->name == NULL)
+                break;
+            if (PyModule_AddIntConstant(modu, e->name, e->value) < 0)
+                break;
+            ++e;
+          } /*for*/
+        if (PyErr_Occurred())
+            break;
       /* all done */
-        result = modu;
-        modu = NULL; /* so I don’t dispose of it yet */
+        result = 0;
       }
     while (false);
-    Py_XDECREF(modu);
     return
         result;
+  } /*discipline_exec*/
+
+static int discipline_traverse
+  (
+    PyObject * modu,
+    visitproc visit,
+    void * arg
+  )
+  {
+    struct module_state * const state = get_module_state(modu);
+    Py_VISIT(state->CacheInfo_type);
+    for (const struct type_entry * e = types;;)
+      {
+        if (e->spec == NULL)
+            break;
+        Py_VISIT(*(PyTypeObject **)((char *)state + e->offset));
+        ++e;
+      } /*for*/
+    Py_VISIT(state->async_loop);
+    Py_VISIT(state->async_callback);
+    return
+        0;
+  } /*discipline_traverse*/
+
+static int discipline_clear
+  (
+    PyObject * modu
+  )
+  {
+    struct module_state * const state = get_module_state(modu);
+    Py_CLEAR(state->CacheInfo_type);
+    for (const struct type_entry * e = types;;)
+      {
+        if (e->spec == NULL)
+            break;
+        Py_CLEAR(*(PyTypeObject **)((char *)state + e->offset));
+        ++e;
+      } /*for*/
+    Py_CLEAR(state->async_loop);
+    Py_CLEAR(state->async_callback);
+    return
+        0;
+  } /*discipline_clear*/
+
+static void discipline_free
+  (
+    void * modu
+  )
+  {
+    discipline_clear(modu);
+    struct module_state * const state = get_module_state(modu);
+    async_channel_close(state->async);
+    state->async = NULL;
+  } /*discipline_free*/
+
+static pthread_once_t process_once = PTHREAD_ONCE_INIT;
+
+static void after_fork_child(void)
+  {
+    pool_after_fork();
+    async_after_fork();
+    spf_after_fork();
+  } /*after_fork_child*/
+
+static void process_init(void)
+  /* one-time setup of the state shared by all interpreters, done via
+    process_once when the module is first imported. The pool itself is
+    only started on first use. */
+  {
+    choose_trial_kernel();
+    cache_init();
+    pthread_atfork(NULL, NULL, after_fork_child);
+    Py_AtExit(pool_shutdown);
+  } /*process_init*/
+
+static PyModuleDef_Slot discipline_slots[] =
+  {
+    {Py_mod_exec, discipline_exec},
+#ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    END_STRUCT_LIST
+  };
+
+static PyModuleDef discipline_module =
+  {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "discipline",
+    .m_doc = "demonstration of structured discipline",
+    .m_size = sizeof(struct module_state), /* per-interpreter state */
+    .m_methods = discipline_methods,
+    .m_slots = discipline_slots,
+    .m_traverse = discipline_traverse,
+    .m_clear = discipline_clear,
+    .m_free = discipline_free,
+  };
+
+PyMODINIT_FUNC PyInit_discipline(void)
+  {
+    pthread_once(&process_once, process_init);
+    return
+        PyModuleDef_Init(&discipline_module);
   } /*PyInit_discipline*/
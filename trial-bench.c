@@ -0,0 +1,145 @@
+/*
+    trial-bench -- microbenchmark comparing two ways of doing the trial
+    division in discipline.c: the hardware remainder/divide instructions,
+    versus multiplying by the precomputed inverses in trial_primes.h.
+
+    Both versions run the same loop over the same pseudorandom inputs,
+    testing each one against every prime in the table (without the
+    square-root cutoff, so the amount of work is the same for every
+    input), and dividing out any factors found.
+
+    This code is licensed CC0
+    <https://creativecommons.org/publicdomain/zero/1.0/>; do with it
+    what you will.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <iso646.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trial_primes.h" /* generated by gen-trial-primes */
+
+#define NR_INPUTS 65536
+
+static double timestamp(void)
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return
+        now.tv_sec + now.tv_nsec / 1e9;
+  } /*timestamp*/
+
+static uint64_t trial_by_remainder
+  (
+    const uint64_t * inputs
+  )
+  /* returns a checksum of the cofactors left after trial division, so
+    the compiler cannot optimize the work away. */
+  {
+    uint64_t result = 0;
+    for (unsigned int i = 0;;)
+      {
+        if (i == NR_INPUTS)
+            break;
+        uint64_t n = inputs[i];
+        for (unsigned int j = 0;;)
+          {
+            if (j == NR_TRIAL_PRIMES)
+                break;
+            const uint64_t p = trial_primes[j].prime;
+            while (n % p == 0)
+                n /= p;
+            ++j;
+          } /*for*/
+        result += n;
+        ++i;
+      } /*for*/
+    return
+        result;
+  } /*trial_by_remainder*/
+
+static uint64_t trial_by_inverse
+  (
+    const uint64_t * inputs
+  )
+  /* same as trial_by_remainder, only using multiplications by inverses. */
+  {
+    uint64_t result = 0;
+    for (unsigned int i = 0;;)
+      {
+        if (i == NR_INPUTS)
+            break;
+        uint64_t n = inputs[i];
+        for (unsigned int j = 0;;)
+          {
+            if (j == NR_TRIAL_PRIMES)
+                break;
+            const struct trial_prime * const t = &trial_primes[j];
+            for (;;)
+              {
+                const uint64_t quotient = n * t->inverse;
+                if (quotient > t->bound)
+                    break;
+                n = quotient;
+              } /*for*/
+            ++j;
+          } /*for*/
+        result += n;
+        ++i;
+      } /*for*/
+    return
+        result;
+  } /*trial_by_inverse*/
+
+int main
+  (
+    int argc,
+    char ** argv
+  )
+  {
+    const unsigned int nr_rounds = argc > 1 ? atoi(argv[1]) : 20;
+    uint64_t * const inputs = malloc(NR_INPUTS * sizeof(uint64_t));
+    uint64_t state = 88172645463325252u;
+    for (unsigned int i = 0;;)
+      {
+        if (i == NR_INPUTS)
+            break;
+      /* xorshift64, with low bit forced on, since factors of 2 are not
+        done by trial division anyway */
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        inputs[i] = state | 1;
+        ++i;
+      } /*for*/
+    const double nr_tests = (double)NR_INPUTS * NR_TRIAL_PRIMES * nr_rounds;
+    uint64_t check_remainder = 0, check_inverse = 0;
+    double start = timestamp();
+    for (unsigned int i = 0;;)
+      {
+        if (i == nr_rounds)
+            break;
+        check_remainder += trial_by_remainder(inputs);
+        ++i;
+      } /*for*/
+    const double remainder_time = timestamp() - start;
+    start = timestamp();
+    for (unsigned int i = 0;;)
+      {
+        if (i == nr_rounds)
+            break;
+        check_inverse += trial_by_inverse(inputs);
+        ++i;
+      } /*for*/
+    const double inverse_time = timestamp() - start;
+    fprintf(stdout, "%d inputs × %d primes × %u rounds\n", NR_INPUTS, NR_TRIAL_PRIMES, nr_rounds);
+    fprintf(stdout, "remainder: %6.2f ns/test\n", remainder_time / nr_tests * 1e9);
+    fprintf(stdout, "inverse:   %6.2f ns/test\n", inverse_time / nr_tests * 1e9);
+    fprintf(stdout, "speedup:   %6.2fx\n", remainder_time / inverse_time);
+    free(inputs);
+    return
+        check_remainder == check_inverse ? 0 : 1;
+  } /*main*/